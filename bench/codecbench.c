@@ -0,0 +1,320 @@
+/*
+ *  Records analog data from a NI USB-6218 and send it to connected clients
+ *
+ *  Copyright (C)2011-2012, Johannes Weiß <weiss@tux4u.de>
+ *                        , Jonathan Dimond <jonny@dimond.de>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Measures encoding a block into a frame (what the daemon's encode stage
+ * does, daemon/frame.c) and decoding it again (what pm_read does,
+ * client/decode.c) for the block sizes in use: 1 to 8 channels of 1000 to
+ * 60000 samples. Prints one line per codec and size with the frame size and
+ * ns per sample and GB/s of sample data (8 bytes per sample) for both
+ * directions.
+ *
+ * Every codec is an entry in __codecs: to compare another encoder or wire
+ * format, add its encode and decode functions there. "raw" just copies the
+ * doubles behind a small header, which is the least any format costs.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <inttypes.h>
+#include <arpa/inet.h>
+
+#include "common.h"
+#include "frame.h"
+#include "client/decode.h"
+
+#define TIME_S 1000000000ULL
+/* a measurement runs at least that often */
+#define MIN_ROUNDS 5
+
+typedef struct {
+    const char *name;
+    /* upper bound of the frame size */
+    size_t (*max_size)(unsigned int num_channels,
+                       unsigned int points_per_channel);
+    /* encodes the channels channel_ids of a block, returns the length */
+    size_t (*encode)(uint8_t *buf,
+                     unsigned int num_channels,
+                     const unsigned int *channel_ids,
+                     unsigned int points_per_channel,
+                     uint64_t timestamp_nanos,
+                     double *analog_data,
+                     digival_t *digital_data);
+    /* decodes a frame into analog_data, one channel after the other,
+     * returns 0 or a negative errno */
+    int (*decode)(const uint8_t *frame,
+                  size_t len,
+                  size_t buffer_sizes,
+                  double *analog_data,
+                  unsigned int *samples_read,
+                  uint64_t *timestamp_nanos);
+} codec_t;
+
+static const unsigned int __num_channels[] = { 1, 2, 4, 8 };
+static const unsigned int __points[] = { 1000, 10000, 30000, 60000 };
+
+/*
+ * CODECS
+ */
+static size_t protobuf_encode(uint8_t *buf,
+                              unsigned int num_channels,
+                              const unsigned int *channel_ids,
+                              unsigned int points_per_channel,
+                              uint64_t timestamp_nanos,
+                              double *analog_data,
+                              digival_t *digital_data) {
+    return frame_encode(buf, num_channels, channel_ids, points_per_channel,
+                        timestamp_nanos, analog_data, digital_data, NULL);
+}
+
+static int protobuf_decode(const uint8_t *frame,
+                           size_t len,
+                           size_t buffer_sizes,
+                           double *analog_data,
+                           unsigned int *samples_read,
+                           uint64_t *timestamp_nanos) {
+    const size_t header = sizeof(MAGIC_DATA_SET) + sizeof(uint32_t);
+    uint32_t net_msg_len;
+    int err;
+
+    if(len < header || 0 != memcmp(frame, MAGIC_DATA_SET,
+                                   sizeof(MAGIC_DATA_SET))) {
+        return -EINVAL;
+    }
+    memcpy(&net_msg_len, frame + sizeof(MAGIC_DATA_SET), sizeof(uint32_t));
+    if(header + ntohl(net_msg_len) > len) {
+        return -EINVAL;
+    }
+
+    err = decode_dataset(frame + header, ntohl(net_msg_len), buffer_sizes,
+                         analog_data, NULL, samples_read, timestamp_nanos,
+                         NULL, NULL);
+    return 0 > err ? err : 0;
+}
+
+/* timestamp, channels and samples per channel, then the doubles */
+typedef struct {
+    uint64_t timestamp_nanos;
+    uint32_t num_channels;
+    uint32_t points_per_channel;
+} raw_header_t;
+
+static size_t raw_max_size(unsigned int num_channels,
+                           unsigned int points_per_channel) {
+    return sizeof(raw_header_t) +
+           (size_t)num_channels * points_per_channel * sizeof(double);
+}
+
+static size_t raw_encode(uint8_t *buf,
+                         unsigned int num_channels,
+                         const unsigned int *channel_ids,
+                         unsigned int points_per_channel,
+                         uint64_t timestamp_nanos,
+                         double *analog_data,
+                         digival_t *digital_data) {
+    const size_t channel_size = points_per_channel * sizeof(double);
+    raw_header_t header = { timestamp_nanos, num_channels,
+                            points_per_channel };
+
+    memcpy(buf, &header, sizeof(header));
+    for(unsigned int i = 0; i < num_channels; i++) {
+        memcpy(buf + sizeof(header) + i * channel_size,
+               analog_data + channel_ids[i] * points_per_channel,
+               channel_size);
+    }
+
+    return raw_max_size(num_channels, points_per_channel);
+}
+
+static int raw_decode(const uint8_t *frame,
+                      size_t len,
+                      size_t buffer_sizes,
+                      double *analog_data,
+                      unsigned int *samples_read,
+                      uint64_t *timestamp_nanos) {
+    raw_header_t header;
+    size_t samples;
+
+    if(len < sizeof(header)) {
+        return -EINVAL;
+    }
+    memcpy(&header, frame, sizeof(header));
+    samples = (size_t)header.num_channels * header.points_per_channel;
+    if(len < sizeof(header) + samples * sizeof(double)) {
+        return -EINVAL;
+    } else if(samples > buffer_sizes) {
+        return -ENOBUFS;
+    }
+
+    memcpy(analog_data, frame + sizeof(header), samples * sizeof(double));
+    *samples_read = header.points_per_channel;
+    *timestamp_nanos = header.timestamp_nanos;
+    return 0;
+}
+
+static const codec_t __codecs[] = {
+    { "protobuf-c", frame_max_size, protobuf_encode, protobuf_decode },
+    { "raw", raw_max_size, raw_encode, raw_decode },
+};
+
+/*
+ * MEASURING
+ */
+static uint64_t now_nanos(void) {
+    struct timespec ts;
+    int err = clock_gettime(CLOCK_MONOTONIC, &ts);
+    assert(0 == err);
+    return ((uint64_t)ts.tv_sec) * TIME_S + (uint64_t)ts.tv_nsec;
+}
+
+/* a noisy sine per channel, roughly what the shunts deliver */
+static void fill_block(double *analog_data,
+                       digival_t *digital_data,
+                       unsigned int num_channels,
+                       unsigned int points_per_channel) {
+    for(unsigned int ch = 0; ch < num_channels; ch++) {
+        for(unsigned int i = 0; i < points_per_channel; i++) {
+            analog_data[ch * points_per_channel + i] =
+                0.02 * sin(i / (50.0 + ch)) +
+                0.001 * (rand() / (double)RAND_MAX);
+            digital_data[ch * points_per_channel + i] = 0;
+        }
+    }
+}
+
+static void measure(const codec_t *codec,
+                    unsigned int num_channels,
+                    unsigned int points_per_channel,
+                    double min_seconds) {
+    const size_t samples = (size_t)num_channels * points_per_channel;
+    unsigned int channel_ids[8];
+    double *analog_data = malloc(samples * sizeof(double));
+    digival_t *digital_data = malloc(samples * sizeof(digival_t));
+    double *decoded = malloc(samples * sizeof(double));
+    uint8_t *frame = malloc(codec->max_size(num_channels,
+                                            points_per_channel));
+    unsigned int samples_read = 0;
+    uint64_t timestamp = 0;
+    uint64_t start, encode_nanos, decode_nanos;
+    unsigned int encode_rounds, decode_rounds;
+    size_t len = 0;
+    int err;
+    assert(NULL != analog_data && NULL != digital_data &&
+           NULL != decoded && NULL != frame);
+
+    for(unsigned int i = 0; i < num_channels; i++) {
+        channel_ids[i] = i;
+    }
+    fill_block(analog_data, digital_data, num_channels, points_per_channel);
+
+    start = now_nanos();
+    for(encode_rounds = 0;
+        encode_rounds < MIN_ROUNDS ||
+        now_nanos() - start < min_seconds * TIME_S;
+        encode_rounds++) {
+        len = codec->encode(frame, num_channels, channel_ids,
+                            points_per_channel, 1234567890, analog_data,
+                            digital_data);
+    }
+    encode_nanos = now_nanos() - start;
+
+    start = now_nanos();
+    for(decode_rounds = 0;
+        decode_rounds < MIN_ROUNDS ||
+        now_nanos() - start < min_seconds * TIME_S;
+        decode_rounds++) {
+        err = codec->decode(frame, len, samples, decoded, &samples_read,
+                            &timestamp);
+        assert(0 == err);
+    }
+    decode_nanos = now_nanos() - start;
+
+    /* what is measured has to be right */
+    assert(points_per_channel == samples_read);
+    assert(1234567890 == timestamp);
+    assert(0 == memcmp(analog_data, decoded, samples * sizeof(double)));
+
+    printf("%-12s %8u %8u %10zu %12.3f %8.3f %12.3f %8.3f\n",
+           codec->name, num_channels, points_per_channel, len,
+           encode_nanos / (double)encode_rounds / samples,
+           samples * sizeof(double) * (double)encode_rounds / encode_nanos,
+           decode_nanos / (double)decode_rounds / samples,
+           samples * sizeof(double) * (double)decode_rounds / decode_nanos);
+    fflush(stdout);
+
+    free(analog_data);
+    free(digital_data);
+    free(decoded);
+    free(frame);
+}
+
+int main(int argc, char **argv) {
+    const size_t num_codecs = sizeof(__codecs) / sizeof(*__codecs);
+    double min_seconds = 0.2;
+    bool selected;
+    int opt;
+
+    while((opt = getopt(argc, argv, "t:")) != -1) {
+        if('t' != opt || 0 >= (min_seconds = atof(optarg))) {
+            fprintf(stderr, "Usage: %s [-t SECONDS] [CODEC...]\n\n",
+                    argv[0]);
+            fprintf(stderr, "-t is the time spent per measurement at least "
+                            "(default 0.2)\n\nAvailable CODECs:\n");
+            for(size_t c = 0; c < num_codecs; c++) {
+                fprintf(stderr, "\t%s\n", __codecs[c].name);
+            }
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    printf("%-12s %8s %8s %10s %12s %8s %12s %8s\n", "codec", "channels",
+           "points", "frame", "enc_ns/smpl", "enc_GB/s", "dec_ns/smpl",
+           "dec_GB/s");
+
+    for(size_t c = 0; c < num_codecs; c++) {
+        selected = optind == argc;
+        for(int i = optind; i < argc; i++) {
+            selected |= 0 == strcmp(argv[i], __codecs[c].name);
+        }
+        if(!selected) {
+            continue;
+        }
+
+        for(size_t n = 0; n < sizeof(__num_channels) / sizeof(unsigned int);
+            n++) {
+            for(size_t p = 0; p < sizeof(__points) / sizeof(unsigned int);
+                p++) {
+                measure(&__codecs[c], __num_channels[n], __points[p],
+                        min_seconds);
+            }
+        }
+    }
+
+    return EXIT_SUCCESS;
+}
+/* vim: set fileencoding=utf8 : */
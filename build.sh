@@ -122,20 +122,67 @@ if [ "$#" -lt 1 -o "$1" = "client" ]; then
     echo
     echo "Building Utils"
     compile_c common/utils
+    compile_c common/mcast
+    compile_c common/selection
 
     echo
     echo "Building Client"
 
+    compile_c client/decode
+    compile_c client/shm_reader
+    compile_c client/unix_reader
+    compile_c client/mcast_reader
     compile_c client/libpmlab
+    compile_c client/channels
+    compile_c client/output
     compile_c client/pmlabclient
-    for f in gensrc/*.c; do
-        compile_c ${f%*.c}
-    done
+    compile_c client/pmlabbench
+    compile_c client/pmlabmark
+    compile_c client/pmlabrun
+    LIBPMLAB_OBJS="build/utils.o build/mcast.o build/selection.o"\
+"    build/decode.o build/shm_reader.o build/unix_reader.o"\
+"    build/mcast_reader.o build/libpmlab.o"
     echo "- Linking pmlabclient"
     if [ -f build/libpmlab ]; then
         rm build/libpmlab &> /dev/null || true
     fi
-    gcc $LDFLAGS -lprotobuf-c -o build/pmlabclient build/*.o
+    gcc $LDFLAGS -o build/pmlabclient $LIBPMLAB_OBJS build/channels.o \
+        build/output.o build/pmlabclient.o
+    echo "- Linking pmlabbench"
+    gcc $LDFLAGS -o build/pmlabbench $LIBPMLAB_OBJS build/pmlabbench.o
+    echo "- Linking pmlabmark"
+    gcc $LDFLAGS -o build/pmlabmark $LIBPMLAB_OBJS build/pmlabmark.o
+    echo "- Linking pmlabrun"
+    gcc $LDFLAGS -o build/pmlabrun $LIBPMLAB_OBJS build/channels.o \
+        build/pmlabrun.o -lm
+
+    if echo '#include <X11/Xlib.h>' | gcc $CFLAGS -x c -E - &> /dev/null; then
+        compile_c client/pmlabview
+        echo "- Linking pmlabview"
+        gcc $LDFLAGS -o build/pmlabview $LIBPMLAB_OBJS build/channels.o \
+            build/pmlabview.o -lX11 -lm
+    else
+        echo "- Skipping pmlabview (X11 headers not found)"
+    fi
+
+    # the library once more, position independent for the Python module
+    PY_INCLUDES="$(python3-config --includes 2> /dev/null || true)"
+    if [ -n "$PY_INCLUDES" ] && echo '#include <Python.h>' | \
+            gcc $PY_INCLUDES -x c -E - &> /dev/null; then
+        echo "- Building Python module pmlab"
+        PY_LDFLAGS="-shared"
+        if [ "$(uname -s)" = "Darwin" ]; then
+            PY_LDFLAGS="-bundle -undefined dynamic_lookup"
+        fi
+        gcc -std=gnu99 -Wall -Werror -pedantic -fPIC $PY_LDFLAGS $CFLAGS \
+            $PY_INCLUDES -Icommon -Iclient $LDFLAGS \
+            -o "build/pmlab$(python3-config --extension-suffix)" \
+            client/pmlabmodule.c client/libpmlab.c client/decode.c \
+            client/shm_reader.c client/unix_reader.c client/mcast_reader.c \
+            common/utils.c common/mcast.c common/selection.c -lpthread -lm
+    else
+        echo "- Skipping Python module pmlab (Python headers not found)"
+    fi
 fi
 
 if [ "$#" -lt 1 -o "$1" = "daemon" ]; then
@@ -145,11 +192,29 @@ if [ "$#" -lt 1 -o "$1" = "daemon" ]; then
     echo
     echo "Building Utils"
     compile_c common/utils
+    compile_c common/mcast
+    compile_c common/selection
 
     echo
     echo "Building Daemon"
     compile_c daemon/handler
     compile_c daemon/sync
+    compile_c daemon/stats
+    compile_c daemon/shm_ring
+    compile_c daemon/fd_block
+    compile_c daemon/mcast_pub
+    compile_c daemon/frame
+    compile_c daemon/uring
+    compile_c daemon/uring_sender
+    compile_c daemon/zerocopy
+    compile_c daemon/pipeline
+    compile_c daemon/daq_config
+    compile_c daemon/control
+    compile_c daemon/generator
+    compile_c daemon/rt
+    compile_c daemon/trigger
+    compile_c daemon/markers
+    compile_c daemon/energy
     for f in gensrc/*.c; do
         compile_c ${f%*.c}
     done
@@ -159,7 +224,15 @@ if [ "$#" -lt 1 -o "$1" = "daemon" ]; then
         rm build/daemon &> /dev/null || true
     fi
     gcc $LDFLAGS $NI_LDFLAGS -lprotobuf-c -lpthread -o build/daemon \
-        build/*.o .deps/pbl/src/libpbl.a
+        build/*.o .deps/pbl/src/libpbl.a -lm
+
+    echo
+    echo "Building Benchmarks"
+    compile_c client/decode
+    compile_c bench/codecbench
+    echo "- Linking codecbench"
+    gcc $LDFLAGS -lprotobuf-c -o build/codecbench build/codecbench.o \
+        build/frame.o build/decode.o build/measured-data.pb-c.o -lm
 fi
 
 
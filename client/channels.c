@@ -0,0 +1,105 @@
+/*
+ *  Reads and prints data from pm-lab-tools/daemon
+ *
+ *  Copyright (C)2011/12, Jonathan Dimond <jonny@dimond.de>
+ *                      & Johannes Weiß <uni@tux4u.de>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "channels.h"
+#include "libpmlab.h"
+#include "common/conf.h"
+
+/* the names of the lab's power measurement points */
+static const struct {
+    const char *name;
+    uint32_t channel;
+} pm_channels[] = {
+    { "pm2", PM2_DD },
+    { "pm3", PM3_DD },
+    { "pm4", PM4_DD },
+    { "pm5", PM5_CPU },
+    { "pm6", PM6_CPU },
+    { "pm7", PM7_CPU }
+};
+
+/* aiN or aiFIRST-LAST, returns false if name is neither */
+static bool parse_ai(const char *name, unsigned long *first,
+                     unsigned long *last) {
+    char *end;
+
+    if (0 != strncmp("ai", name, 2) || '0' > name[2] || '9' < name[2]) {
+        return false;
+    }
+    *first = *last = strtoul(name + 2, &end, 10);
+    if ('-' == *end && '0' <= end[1] && '9' >= end[1]) {
+        *last = strtoul(end + 1, &end, 10);
+    }
+    return '\0' == *end && *first <= *last && *last < MAX_CHANNELS;
+}
+
+unsigned int parse_channels(char *server,
+                            char *port,
+                            unsigned int argc,
+                            char **argv,
+                            uint32_t *chosen_channels) {
+    const unsigned int max_channels = MAX_CHANNELS;
+    const size_t num_pm = sizeof(pm_channels) / sizeof(*pm_channels);
+    unsigned int active_channels = 0;
+    unsigned long first, last;
+    pm_description_t *all;
+    bool known;
+
+    for(unsigned int i=0; i<argc && active_channels < max_channels; i++) {
+        known = false;
+        if (parse_ai(argv[i], &first, &last)) {
+            for (unsigned long c = first;
+                 c <= last && active_channels < max_channels; c++) {
+                chosen_channels[active_channels++] = c;
+            }
+            known = true;
+        } else if (0 == strcmp("all", argv[i])) {
+            all = malloc(sizeof(*all));
+            if (NULL != all && 0 == pm_query(server, port, all)) {
+                active_channels = all->num_channels;
+                for (unsigned int j=0; j<active_channels; j++) {
+                    chosen_channels[j] = j;
+                }
+                known = true;
+            }
+            free(all);
+            if (known) {
+                break;
+            }
+        }
+        for (size_t p = 0; !known && p < num_pm; p++) {
+            if (0 == strcmp(pm_channels[p].name, argv[i])) {
+                chosen_channels[active_channels++] = pm_channels[p].channel;
+                known = true;
+            }
+        }
+        if (!known) {
+            fprintf(stderr, "Wrong channel '%s', ignored...\n", argv[i]);
+        }
+    }
+    fprintf(stderr, "Setup %u channels.\n", active_channels);
+
+    return active_channels;
+}
+/* vim: set fileencoding=utf8 : */
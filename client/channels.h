@@ -0,0 +1,51 @@
+/*
+ *  Reads and prints data from pm-lab-tools/daemon
+ *
+ *  Copyright (C)2011/12, Jonathan Dimond <jonny@dimond.de>
+ *                      & Johannes Weiß <uni@tux4u.de>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CHANNELS_H
+#define CHANNELS_H
+
+#include <stdint.h>
+
+#include "common.h"
+
+/*
+ * Parses channel names (ai0, ai1, ..., ranges like ai8-15, pm2, ..., pm7 or
+ * all) given on the command line into channel ids. Unknown names are
+ * reported and ignored. For all, the daemon is asked how many channels it
+ * has.
+ *
+ * Parameters:
+ * server: The host of the daemon
+ * port: Its port
+ * argc: The number of names
+ * argv: The names
+ * chosen_channels: An array of MAX_CHANNELS for the channel ids
+ *
+ * Returns:
+ * The number of channels written to chosen_channels
+ */
+unsigned int parse_channels(char *server,
+                            char *port,
+                            unsigned int argc,
+                            char **argv,
+                            uint32_t *chosen_channels);
+
+#endif
+/* vim: set fileencoding=utf8 : */
@@ -0,0 +1,100 @@
+#!/usr/bin/env python
+#
+# Reads a file written by `pmlabclient -f columnar' (see client/output.h) and
+# prints one line per sample, "TIMESTAMP VALUE...", the values calibrated
+# using the description recorded in the file. Markers go to stderr,
+# "# marker ID LABEL at TIMESTAMP".
+#
+# Usage: columnar.py FILE
+#
+import sys, struct, array
+
+MAGIC = b"PMLABCOL"
+VERSIONS = (2, 3)
+RECORD_DESCRIPTION = 1
+RECORD_BLOCK = 2
+RECORD_MARKER = 3
+NAME_LEN = 32
+LABEL_LEN = 24
+
+def read_exactly(f, size):
+    data = f.read(size)
+    if len(data) != size:
+        raise EOFError()
+    return data
+
+def unpack(f, fmt):
+    return struct.unpack(fmt, read_exactly(f, struct.calcsize(fmt)))
+
+def string(raw):
+    return raw.split(b"\0")[0].decode("utf-8")
+
+def read_description(f, num_channels):
+    (version, generation, rate, block_size,
+     encoding, unit, range_min, range_max) = unpack(f, "<IQII16s8sdd")
+    channels = []
+    for _ in range(num_channels):
+        name, scale, offset = unpack(f, "<%dsdd" % NAME_LEN)
+        channels.append((string(name), scale, offset))
+    if string(encoding) != "float64":
+        raise ValueError("unknown encoding %s" % string(encoding))
+    return { "generation": generation, "sampling_rate": rate,
+             "block_size": block_size, "unit": string(unit),
+             "range": (range_min, range_max), "channels": channels }
+
+def read_blocks(f):
+    """yields (description, timestamp_nanos, [samples of every channel],
+    [(id, label, sample, timestamp_nanos) of the markers of the block])"""
+    if read_exactly(f, len(MAGIC)) != MAGIC:
+        raise ValueError("not a columnar file")
+    version, num_channels = unpack(f, "<II")
+    if version not in VERSIONS:
+        raise ValueError("unsupported version %d" % version)
+    unpack(f, "<%dI" % num_channels)
+    description = None
+    markers = []
+    while True:
+        try:
+            (record,) = unpack(f, "<I")
+        except EOFError:
+            return
+        if record == RECORD_DESCRIPTION:
+            description = read_description(f, num_channels)
+        elif record == RECORD_MARKER:
+            timestamp, marker_id, sample, label = unpack(f, "<QII%ds" %
+                                                         LABEL_LEN)
+            markers.append((marker_id, string(label), sample, timestamp))
+        elif record == RECORD_BLOCK and description is not None:
+            timestamp, samples = unpack(f, "<QI")
+            values = array.array("d")
+            values.frombytes(read_exactly(f, 8 * samples * num_channels))
+            if sys.byteorder != "little":
+                values.byteswap()
+            yield description, timestamp, [values[i*samples:(i+1)*samples]
+                                           for i in range(num_channels)], \
+                  markers
+            markers = []
+        else:
+            raise ValueError("unknown record %d" % record)
+
+def main():
+    if len(sys.argv) != 2:
+        sys.stderr.write("Usage: %s FILE\n" % sys.argv[0])
+        sys.exit(1)
+    with open(sys.argv[1], "rb") as f:
+        for description, timestamp, channels, markers in read_blocks(f):
+            for marker_id, label, _, marker_timestamp in markers:
+                sys.stderr.write("# marker %d %s at %f\n" %
+                                 (marker_id, label, marker_timestamp / 1e9))
+            calibration = description["channels"]
+            rate = float(description["sampling_rate"])
+            for i in range(len(channels[0]) if channels else 0):
+                values = [scale * c[i] + offset
+                          for c, (_, scale, offset) in zip(channels,
+                                                           calibration)]
+                sys.stdout.write("%f %s\n" % (timestamp / 1e9 + i / rate,
+                                              " ".join("%f" % v
+                                                       for v in values)))
+
+if __name__ == "__main__":
+    main()
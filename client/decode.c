@@ -0,0 +1,609 @@
+/*
+ *  Library to read data from pm-lab-tools/daemon
+ *
+ *  Copyright (C)2011/12, Jonathan Dimond <jonny@dimond.de>
+ *                      & Johannes Weiß <uni@tux4u.de>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+#include <stdbool.h>
+
+#include "decode.h"
+
+/* protobuf wire types */
+#define WT_VARINT 0
+#define WT_FIXED64 1
+#define WT_LENGTH_DELIMITED 2
+#define WT_FIXED32 5
+
+/* DataSet fields */
+#define DATA_SET_TIMESTAMP_NANOS 1
+#define DATA_SET_CHANNEL_DATA 2
+#define DATA_SET_MARKERS 3
+
+/* Marker fields */
+#define MARKER_ID 1
+#define MARKER_SAMPLE 2
+#define MARKER_LABEL 3
+
+/* MeasuredData fields */
+#define MEASURED_DATA_SHOT_ID 1
+#define MEASURED_DATA_SAMPLING_RATE 2
+#define MEASURED_DATA_CHANNEL_COUNT 3
+#define MEASURED_DATA_CHANNEL_NAMES 4
+#define MEASURED_DATA_PROTOCOL_VERSION 5
+#define MEASURED_DATA_ENCODING 6
+#define MEASURED_DATA_BLOCK_SIZE 7
+#define MEASURED_DATA_UNIT 8
+#define MEASURED_DATA_RANGE_MIN 9
+#define MEASURED_DATA_RANGE_MAX 10
+#define MEASURED_DATA_SCALE 11
+#define MEASURED_DATA_OFFSET 12
+#define MEASURED_DATA_GENERATION 13
+
+/* DataPoints fields */
+#define DATA_POINTS_ANALOG_DATA 1
+#define DATA_POINTS_DIGITAL_DATA 2
+
+typedef struct {
+    const uint8_t *pos;
+    const uint8_t *end;
+} cursor_t;
+
+static bool read_varint(cursor_t *c, uint64_t *value) {
+    uint64_t v = 0;
+
+    for(unsigned int shift = 0; shift < 64; shift += 7) {
+        if(c->pos >= c->end) {
+            return false;
+        }
+        v |= ((uint64_t)(*c->pos & 0x7f)) << shift;
+        if(0 == (*c->pos++ & 0x80)) {
+            *value = v;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static bool read_length_delimited(cursor_t *c, cursor_t *sub) {
+    uint64_t len;
+
+    if(!read_varint(c, &len) || len > (uint64_t)(c->end - c->pos)) {
+        return false;
+    }
+    sub->pos = c->pos;
+    sub->end = c->pos + len;
+    c->pos += len;
+
+    return true;
+}
+
+static bool skip_field(cursor_t *c, unsigned int wire_type) {
+    uint64_t dummy;
+    cursor_t sub;
+
+    switch(wire_type) {
+        case WT_VARINT:
+            return read_varint(c, &dummy);
+        case WT_FIXED64:
+            if(c->end - c->pos < 8) {
+                return false;
+            }
+            c->pos += 8;
+            return true;
+        case WT_LENGTH_DELIMITED:
+            return read_length_delimited(c, &sub);
+        case WT_FIXED32:
+            if(c->end - c->pos < 4) {
+                return false;
+            }
+            c->pos += 4;
+            return true;
+        default:
+            return false;
+    }
+}
+
+static bool read_string(cursor_t *c, unsigned int wire_type, cursor_t *sub) {
+    return WT_LENGTH_DELIMITED == wire_type && read_length_delimited(c, sub);
+}
+
+/* copies a string field, truncated to size - 1 characters */
+static void copy_string(char *dest, size_t size, const cursor_t *sub) {
+    size_t len = sub->end - sub->pos;
+
+    if(len >= size) {
+        len = size - 1;
+    }
+    memcpy(dest, sub->pos, len);
+    dest[len] = '\0';
+}
+
+/* copies little-endian doubles from the wire to the host */
+static void copy_doubles(double *dest, const uint8_t *src, size_t count) {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    memcpy(dest, src, count * sizeof(double));
+#else
+    for(size_t i = 0; i < count; i++) {
+        uint64_t bits = 0;
+        for(int b = 7; b >= 0; b--) {
+            bits = (bits << 8) | src[8*i + b];
+        }
+        memcpy(dest + i, &bits, sizeof(double));
+    }
+#endif
+}
+
+static int decode_datapoints(cursor_t *c,
+                             size_t space,
+                             double *analog_data,
+                             digival_t *digital_data,
+                             unsigned int *n_analog) {
+    size_t analog_count = 0;
+    size_t digital_count = 0;
+    uint64_t tag, value;
+    cursor_t sub;
+
+    while(c->pos < c->end) {
+        if(!read_varint(c, &tag)) {
+            return -EINVAL;
+        }
+
+        if(DATA_POINTS_ANALOG_DATA == (tag >> 3) &&
+           WT_LENGTH_DELIMITED == (tag & 7)) {
+            /* packed doubles, the common case */
+            size_t count;
+            if(!read_length_delimited(c, &sub) ||
+               0 != (sub.end - sub.pos) % sizeof(double)) {
+                return -EINVAL;
+            }
+            count = (sub.end - sub.pos) / sizeof(double);
+            if(analog_count + count > space) {
+                return -ENOBUFS;
+            }
+            if(NULL != analog_data) {
+                copy_doubles(analog_data + analog_count, sub.pos, count);
+            }
+            analog_count += count;
+        } else if(DATA_POINTS_ANALOG_DATA == (tag >> 3) &&
+                  WT_FIXED64 == (tag & 7)) {
+            /* unpacked double */
+            if(c->end - c->pos < 8) {
+                return -EINVAL;
+            }
+            if(analog_count + 1 > space) {
+                return -ENOBUFS;
+            }
+            if(NULL != analog_data) {
+                copy_doubles(analog_data + analog_count, c->pos, 1);
+            }
+            c->pos += 8;
+            analog_count++;
+        } else if(DATA_POINTS_DIGITAL_DATA == (tag >> 3) &&
+                  WT_LENGTH_DELIMITED == (tag & 7)) {
+            /* packed bools, one varint each */
+            if(!read_length_delimited(c, &sub)) {
+                return -EINVAL;
+            }
+            while(sub.pos < sub.end) {
+                if(!read_varint(&sub, &value)) {
+                    return -EINVAL;
+                }
+                if(digital_count >= space) {
+                    return -ENOBUFS;
+                }
+                if(NULL != digital_data) {
+                    digital_data[digital_count] = 0 != value;
+                }
+                digital_count++;
+            }
+        } else if(DATA_POINTS_DIGITAL_DATA == (tag >> 3) &&
+                  WT_VARINT == (tag & 7)) {
+            /* unpacked bool */
+            if(!read_varint(c, &value)) {
+                return -EINVAL;
+            }
+            if(digital_count >= space) {
+                return -ENOBUFS;
+            }
+            if(NULL != digital_data) {
+                digital_data[digital_count] = 0 != value;
+            }
+            digital_count++;
+        } else if(!skip_field(c, tag & 7)) {
+            return -EINVAL;
+        }
+    }
+
+    if(0 != digital_count && digital_count != analog_count) {
+        return -EINVAL;
+    }
+
+    *n_analog = analog_count;
+    return 0;
+}
+
+static bool decode_marker(cursor_t *c, pm_marker_t *marker) {
+    uint64_t tag, value;
+    cursor_t sub;
+
+    memset(marker, 0, sizeof(*marker));
+    while(c->pos < c->end) {
+        if(!read_varint(c, &tag)) {
+            return false;
+        }
+
+        if(MARKER_ID == (tag >> 3) && WT_VARINT == (tag & 7)) {
+            if(!read_varint(c, &value)) {
+                return false;
+            }
+            marker->id = value;
+        } else if(MARKER_SAMPLE == (tag >> 3) && WT_VARINT == (tag & 7)) {
+            if(!read_varint(c, &value)) {
+                return false;
+            }
+            marker->sample = value;
+        } else if(MARKER_LABEL == (tag >> 3)) {
+            if(!read_string(c, tag & 7, &sub)) {
+                return false;
+            }
+            copy_string(marker->label, sizeof(marker->label), &sub);
+        } else if(!skip_field(c, tag & 7)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+int decode_dataset(const uint8_t *msg,
+                   size_t msg_len,
+                   size_t buffer_sizes,
+                   double *analog_data,
+                   digival_t *digital_data,
+                   unsigned int *samples_read,
+                   uint64_t *timestamp_nanos,
+                   pm_marker_t *markers,
+                   unsigned int *num_markers) {
+    cursor_t c = { .pos = msg, .end = msg + msg_len };
+    cursor_t sub;
+    uint64_t tag, timestamp = 0;
+    size_t offset = 0;
+    unsigned int samples = 0;
+    unsigned int n_samples;
+    unsigned int n_markers = 0;
+    pm_marker_t dummy, *marker;
+    int channels = 0;
+    int err;
+
+    while(c.pos < c.end) {
+        if(!read_varint(&c, &tag)) {
+            return -EINVAL;
+        }
+
+        if(DATA_SET_TIMESTAMP_NANOS == (tag >> 3) && WT_VARINT == (tag & 7)) {
+            if(!read_varint(&c, &timestamp)) {
+                return -EINVAL;
+            }
+        } else if(DATA_SET_CHANNEL_DATA == (tag >> 3) &&
+                  WT_LENGTH_DELIMITED == (tag & 7)) {
+            if(!read_length_delimited(&c, &sub)) {
+                return -EINVAL;
+            }
+            err = decode_datapoints(&sub,
+                                    buffer_sizes - offset,
+                                    NULL == analog_data ?
+                                        NULL : analog_data + offset,
+                                    NULL == digital_data ?
+                                        NULL : digital_data + offset,
+                                    &n_samples);
+            if(0 != err) {
+                return err;
+            }
+            if(0 != channels && n_samples != samples) {
+                /* all channels carry the same number of samples */
+                return -EINVAL;
+            }
+            samples = n_samples;
+            offset += n_samples;
+            channels++;
+        } else if(DATA_SET_MARKERS == (tag >> 3) &&
+                  WT_LENGTH_DELIMITED == (tag & 7)) {
+            /* the daemon sends PM_MAX_MARKERS at most, more are ignored */
+            marker = NULL != markers && n_markers < PM_MAX_MARKERS ?
+                     &markers[n_markers] : &dummy;
+            if(!read_length_delimited(&c, &sub) ||
+               !decode_marker(&sub, marker)) {
+                return -EINVAL;
+            }
+            if(n_markers < PM_MAX_MARKERS) {
+                n_markers++;
+            }
+        } else if(!skip_field(&c, tag & 7)) {
+            return -EINVAL;
+        }
+    }
+
+    if(NULL != samples_read) {
+        *samples_read = samples;
+    }
+    if(NULL != timestamp_nanos) {
+        *timestamp_nanos = timestamp;
+    }
+    if(NULL != num_markers) {
+        *num_markers = n_markers;
+    }
+
+    return channels;
+}
+
+static bool read_double(cursor_t *c, unsigned int wire_type, double *value) {
+    if(WT_FIXED64 != wire_type || c->end - c->pos < 8) {
+        return false;
+    }
+    copy_doubles(value, c->pos, 1);
+    c->pos += 8;
+
+    return true;
+}
+
+/* reads a repeated double, packed or not, appends to values */
+static bool read_doubles(cursor_t *c,
+                         unsigned int wire_type,
+                         double *values,
+                         unsigned int *count) {
+    cursor_t sub;
+
+    if(WT_FIXED64 == wire_type) {
+        sub.pos = c->pos;
+        sub.end = c->pos + 8;
+        if(c->end - c->pos < 8) {
+            return false;
+        }
+        c->pos += 8;
+    } else if(WT_LENGTH_DELIMITED != wire_type ||
+              !read_length_delimited(c, &sub) ||
+              0 != (sub.end - sub.pos) % 8) {
+        return false;
+    }
+
+    while(sub.pos < sub.end) {
+        if(*count < PM_DESCRIPTION_MAX_CHANNELS) {
+            copy_doubles(values + *count, sub.pos, 1);
+        }
+        (*count)++;
+        sub.pos += 8;
+    }
+
+    return true;
+}
+
+static void init_description(pm_description_t *desc) {
+    memset(desc, 0, sizeof(*desc));
+    desc->protocol_version = 1;
+    strcpy(desc->encoding, SAMPLE_ENCODING);
+    strcpy(desc->unit, SAMPLE_UNIT);
+    for(unsigned int i = 0; i < PM_DESCRIPTION_MAX_CHANNELS; i++) {
+        desc->scale[i] = 1;
+    }
+}
+
+void decode_default_description(uint32_t sampling_rate,
+                                const uint32_t *channels,
+                                unsigned int num_channels,
+                                pm_description_t *desc) {
+    assert(num_channels <= PM_DESCRIPTION_MAX_CHANNELS);
+
+    init_description(desc);
+    desc->sampling_rate = sampling_rate;
+    desc->block_size = sampling_rate;
+    desc->num_channels = num_channels;
+    for(unsigned int i = 0; i < num_channels; i++) {
+        snprintf(desc->channel_names[i], PM_DESCRIPTION_NAME_LEN,
+                 "ai%u", channels[i]);
+    }
+}
+
+int decode_description(const uint8_t *msg,
+                       size_t msg_len,
+                       const uint32_t *channels,
+                       unsigned int num_channels,
+                       pm_description_t *desc) {
+    cursor_t c = { .pos = msg, .end = msg + msg_len };
+    cursor_t sub;
+    uint64_t tag, value = 0;
+    unsigned int wire_type;
+    unsigned int names = 0, scales = 0, offsets = 0;
+    double rate = 0;
+    bool ok;
+    pm_description_t *all;
+
+    init_description(desc);
+
+    while(c.pos < c.end) {
+        if(!read_varint(&c, &tag)) {
+            return -EINVAL;
+        }
+        wire_type = tag & 7;
+
+        switch(tag >> 3) {
+            case MEASURED_DATA_SAMPLING_RATE:
+                ok = read_double(&c, wire_type, &rate);
+                break;
+            case MEASURED_DATA_RANGE_MIN:
+                ok = read_double(&c, wire_type, &desc->range_min);
+                break;
+            case MEASURED_DATA_RANGE_MAX:
+                ok = read_double(&c, wire_type, &desc->range_max);
+                break;
+            case MEASURED_DATA_CHANNEL_COUNT:
+                ok = WT_VARINT == wire_type && read_varint(&c, &value);
+                desc->num_channels = value;
+                break;
+            case MEASURED_DATA_PROTOCOL_VERSION:
+                ok = WT_VARINT == wire_type && read_varint(&c, &value);
+                desc->protocol_version = value;
+                break;
+            case MEASURED_DATA_BLOCK_SIZE:
+                ok = WT_VARINT == wire_type && read_varint(&c, &value);
+                desc->block_size = value;
+                break;
+            case MEASURED_DATA_GENERATION:
+                ok = WT_VARINT == wire_type &&
+                     read_varint(&c, &desc->generation);
+                break;
+            case MEASURED_DATA_CHANNEL_NAMES:
+                ok = read_string(&c, wire_type, &sub);
+                if(ok && names < PM_DESCRIPTION_MAX_CHANNELS) {
+                    copy_string(desc->channel_names[names],
+                                PM_DESCRIPTION_NAME_LEN, &sub);
+                }
+                names++;
+                break;
+            case MEASURED_DATA_SHOT_ID:
+                ok = read_string(&c, wire_type, &sub);
+                if(ok) {
+                    copy_string(desc->shot_id, sizeof(desc->shot_id), &sub);
+                }
+                break;
+            case MEASURED_DATA_ENCODING:
+                ok = read_string(&c, wire_type, &sub);
+                if(ok) {
+                    copy_string(desc->encoding, sizeof(desc->encoding), &sub);
+                }
+                break;
+            case MEASURED_DATA_UNIT:
+                ok = read_string(&c, wire_type, &sub);
+                if(ok) {
+                    copy_string(desc->unit, sizeof(desc->unit), &sub);
+                }
+                break;
+            case MEASURED_DATA_SCALE:
+                ok = read_doubles(&c, wire_type, desc->scale, &scales);
+                break;
+            case MEASURED_DATA_OFFSET:
+                ok = read_doubles(&c, wire_type, desc->offset, &offsets);
+                break;
+            default:
+                ok = skip_field(&c, wire_type);
+        }
+        if(!ok) {
+            return -EINVAL;
+        }
+    }
+
+    if(!(rate >= 1 && rate <= UINT32_MAX) ||
+       desc->num_channels > PM_DESCRIPTION_MAX_CHANNELS) {
+        return -EINVAL;
+    }
+    desc->sampling_rate = (uint32_t)rate;
+
+    if(NULL == channels) {
+        return 0;
+    }
+
+    /* pick the requested channels */
+    all = malloc(sizeof(*all));
+    assert(NULL != all);
+    memcpy(all, desc, sizeof(*all));
+    desc->num_channels = num_channels;
+    for(unsigned int i = 0; i < num_channels; i++) {
+        if(channels[i] >= all->num_channels) {
+            free(all);
+            return -EINVAL;
+        }
+        memcpy(desc->channel_names[i], all->channel_names[channels[i]],
+               PM_DESCRIPTION_NAME_LEN);
+        desc->scale[i] = all->scale[channels[i]];
+        desc->offset[i] = all->offset[channels[i]];
+    }
+    free(all);
+
+    return 0;
+}
+
+int decode_slot(const pm_shm_slot_t *slot,
+                const uint32_t *channels,
+                unsigned int num_channels,
+                const double **channel_data,
+                const digival_t **digital_channel_data,
+                pm_view_t *view) {
+    const uint32_t points = slot->points_per_channel;
+    const digival_t *digital_data = PM_SHM_DIGITAL_DATA(slot);
+
+    for(unsigned int i = 0; i < num_channels; i++) {
+        if(channels[i] >= slot->num_channels) {
+            return -EINVAL;
+        }
+        channel_data[i] = slot->analog_data + channels[i] * points;
+        digital_channel_data[i] = digital_data + channels[i] * points;
+    }
+
+    view->num_markers = slot->num_markers < PM_MAX_MARKERS ?
+                        slot->num_markers : PM_MAX_MARKERS;
+    for(unsigned int i = 0; i < view->num_markers; i++) {
+        memset(&view->markers[i], 0, sizeof(view->markers[i]));
+        view->markers[i].id = slot->markers[i].id;
+        view->markers[i].sample = slot->markers[i].sample;
+        memcpy(view->markers[i].label, slot->markers[i].label,
+               MARKER_LABEL_LEN);
+    }
+
+    view->timestamp_nanos = slot->timestamp_nanos;
+    view->samples_read = points;
+    view->sampling_rate = slot->sampling_rate;
+    view->channel_data = channel_data;
+    view->digital_channel_data = digital_channel_data;
+
+    return 0;
+}
+
+void decode_view(const pm_view_t *view,
+                 unsigned int num_channels,
+                 size_t buffer_sizes,
+                 double *analog_data,
+                 digival_t *digital_data,
+                 pm_marker_t *markers,
+                 unsigned int *num_markers) {
+    const unsigned int points = view->samples_read;
+
+    assert(buffer_sizes >= points * num_channels);
+    for(unsigned int i = 0; i < num_channels; i++) {
+        if(NULL != analog_data) {
+            memcpy(analog_data + i * points, view->channel_data[i],
+                   points * sizeof(double));
+        }
+        if(NULL != digital_data) {
+            memcpy(digital_data + i * points, view->digital_channel_data[i],
+                   points * sizeof(digival_t));
+        }
+    }
+
+    if(NULL != markers) {
+        memcpy(markers, view->markers,
+               view->num_markers * sizeof(pm_marker_t));
+    }
+    if(NULL != num_markers) {
+        *num_markers = view->num_markers;
+    }
+}
+/* vim: set fileencoding=utf8 : */
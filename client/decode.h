@@ -0,0 +1,124 @@
+/*
+ *  Library to read data from pm-lab-tools/daemon
+ *
+ *  Copyright (C)2011/12, Jonathan Dimond <jonny@dimond.de>
+ *                      & Johannes Weiß <uni@tux4u.de>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef DECODE_H
+#define DECODE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "common.h"
+#include "shm_layout.h"
+#include "libpmlab.h"
+
+/*
+ * Decodes a serialized DataSet message (see protos/measured-data.proto)
+ * directly into the provided buffers without allocating any memory. The
+ * channels are stored one after the other, just as pm_read does.
+ *
+ * Parameters:
+ * msg: The serialized DataSet
+ * msg_len: The length of msg in bytes
+ * buffer_sizes: The sizes of the buffers analog_data and digital_data
+ * analog_data: A buffer for the analog data (may be NULL)
+ * digital_data: A buffer for the digital data (may be NULL)
+ * samples_read: Where the number of samples per channel will be written to
+ * timestamp_nanos: Where the timestamp of the first sample will be written to
+ * markers: A buffer for PM_MAX_MARKERS markers, their timestamp_nanos is
+ *          left 0 (may be NULL)
+ * num_markers: Where the number of markers will be written to (may be NULL)
+ *
+ * Returns:
+ * the number of channels decoded on success
+ * -EINVAL if the message is malformed
+ * -ENOBUFS if the buffers are not large enough
+ */
+int decode_dataset(const uint8_t *msg,
+                   size_t msg_len,
+                   size_t buffer_sizes,
+                   double *analog_data,
+                   digival_t *digital_data,
+                   unsigned int *samples_read,
+                   uint64_t *timestamp_nanos,
+                   pm_marker_t *markers,
+                   unsigned int *num_markers);
+
+/*
+ * Decodes a serialized MeasuredData message, which describes the blocks
+ * that follow.
+ *
+ * Parameters:
+ * msg: The serialized MeasuredData
+ * msg_len: The length of msg in bytes
+ * channels: The channels to describe as indices into the channels of the
+ *           message (NULL to describe all of them)
+ * num_channels: The size of the channels array
+ * desc: Where the description will be written to
+ *
+ * Returns:
+ * 0 on success
+ * -EINVAL if the message is malformed or lacks one of the channels
+ */
+int decode_description(const uint8_t *msg,
+                       size_t msg_len,
+                       const uint32_t *channels,
+                       unsigned int num_channels,
+                       pm_description_t *desc);
+
+/*
+ * Fills desc with what is known without a MeasuredData message: the
+ * sampling rate and the channels, named after their ids.
+ */
+void decode_default_description(uint32_t sampling_rate,
+                                const uint32_t *channels,
+                                unsigned int num_channels,
+                                pm_description_t *desc);
+
+/*
+ * Points view at the channels of a block in shared memory or a memfd and
+ * copies its markers, their timestamp_nanos left 0. channel_data and
+ * digital_channel_data have room for num_channels pointers each and the
+ * view keeps pointing to them.
+ *
+ * Returns:
+ * 0 on success
+ * -EINVAL if the block lacks one of the channels
+ */
+int decode_slot(const pm_shm_slot_t *slot,
+                const uint32_t *channels,
+                unsigned int num_channels,
+                const double **channel_data,
+                const digival_t **digital_channel_data,
+                pm_view_t *view);
+
+/*
+ * Copies the block view points to into the buffers just as decode_dataset
+ * does (all of them may be NULL).
+ */
+void decode_view(const pm_view_t *view,
+                 unsigned int num_channels,
+                 size_t buffer_sizes,
+                 double *analog_data,
+                 digival_t *digital_data,
+                 pm_marker_t *markers,
+                 unsigned int *num_markers);
+
+#endif
+/* vim: set fileencoding=utf8 : */
@@ -18,42 +18,369 @@
  *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
 #include <string.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <netinet/in.h>
 #include <arpa/inet.h>
 #include <unistd.h>
 #include <inttypes.h>
 #include <netdb.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <fcntl.h>
+#include <poll.h>
 
 #include <utils.h>
+#include <selection.h>
 
-#include "measured-data.pb-c.h"
-
+#include "decode.h"
+#include "shm_reader.h"
+#include "unix_reader.h"
+#include "mcast_reader.h"
 #include "libpmlab.h"
 
 #define PM_HANDLE_MAGIC_NUMBER 0xC001BABE
+#define PM_RECV_BUFFER_SIZE (4 * 1024 * 1024)
+#define PM_FRAME_HEADER_SIZE (sizeof(MAGIC_DATA_SET) + sizeof(uint32_t))
+#define PM_WELCOME_SIZE (sizeof(WELCOME_MSG) + PM_FRAME_HEADER_SIZE)
+#define PM_NANOS_PER_SECOND ((uint64_t)1000000000L)
+
+typedef enum {
+    PM_STATE_CONNECTING, /* waiting for the TCP connection */
+    PM_STATE_REQUEST,    /* sending the channel description */
+    PM_STATE_WELCOME,    /* waiting for welcome message and description */
+    PM_STATE_STREAMING,  /* receiving data sets */
+    PM_STATE_CLOSED
+} pm_state;
 
 typedef struct {
     int magic_number;
     int sockfd;
-    uint32_t sampling_rate;
+    pm_description_t description; /* of the block read last */
+    pm_state state;
+
+    /* addresses not yet tried while connecting */
+    struct addrinfo *addresses;
+    struct addrinfo *next_address;
+
+    /* channel description, unsent data is [request_start, request_end) */
+    uint8_t *request;
+    size_t request_start;
+    size_t request_end;
+
+    /* receive buffer, valid data is [recv_start, recv_end) */
+    uint8_t *recv_buffer;
+    size_t recv_buffer_size;
+    size_t recv_start;
+    size_t recv_end;
+
+    /* event driven API: callbacks and the buffers blocks are decoded into */
+    pm_callbacks_t callbacks;
+    void *user;
+    double *block_analog;
+    digival_t *block_digital;
+    size_t block_buffer_size;
+    bool have_next_timestamp;
+    uint64_t next_timestamp_nanos;
+
+    /* set if the blocks are read from the daemon's shared memory */
+    shm_reader_t *shm;
+    /* set if the blocks are passed as memfds over the unix domain socket */
+    unix_reader_t *unix_socket;
+    /* set if the blocks are reassembled from multicast datagrams */
+    mcast_reader_t *mcast;
+
+    /*
+     * a block pm_read_many got from a reader but didn't return as its
+     * description is a new one, the samples are in block_analog
+     */
+    bool have_held_block;
+    pm_block_t held_block;
+    size_t held_block_size;
 } pm_handle;
 
-void *pm_connect(char *server,
-                 char *port,
-                 uint32_t *channels,
-                 uint32_t num_channels) {
-    struct addrinfo hints = { 0 };
-    struct addrinfo *result = NULL, *rp = NULL;
+/*
+ * Receives as much data as fits into the receive buffer with a single recv.
+ * Returns the number of bytes received, 0 on EOF and -1 on error (errno is
+ * EAGAIN if non-blocking and no data is available).
+ */
+static ssize_t fill_recv_buffer(pm_handle *handle, bool block) {
+    ssize_t res;
+
+    if(handle->recv_start > 0 &&
+       handle->recv_buffer_size - handle->recv_end <
+       handle->recv_buffer_size / 4) {
+        /* move to front to make room for a large chunk */
+        memmove(handle->recv_buffer,
+                handle->recv_buffer + handle->recv_start,
+                handle->recv_end - handle->recv_start);
+        handle->recv_end -= handle->recv_start;
+        handle->recv_start = 0;
+    }
+
+    if(handle->recv_end == handle->recv_buffer_size) {
+        /* a single frame larger than the buffer */
+        handle->recv_buffer_size *= 2;
+        handle->recv_buffer = realloc(handle->recv_buffer,
+                                      handle->recv_buffer_size);
+        assert(NULL != handle->recv_buffer);
+    }
+
+    do {
+        res = recv(handle->sockfd,
+                   handle->recv_buffer + handle->recv_end,
+                   handle->recv_buffer_size - handle->recv_end,
+                   block ? 0 : MSG_DONTWAIT);
+    } while(res < 0 && EINTR == errno);
+
+    if(res > 0) {
+        handle->recv_end += res;
+    }
+
+    return res;
+}
+
+/* the markers arrived at samples of their block, on the block's clock */
+static void time_markers(pm_marker_t *markers,
+                         unsigned int num_markers,
+                         uint64_t timestamp_nanos,
+                         uint32_t sampling_rate) {
+    for(unsigned int i = 0; i < num_markers; i++) {
+        markers[i].timestamp_nanos =
+            timestamp_nanos +
+            PM_NANOS_PER_SECOND * (uint64_t)markers[i].sample /
+            sampling_rate;
+    }
+}
+
+/* true if the receive buffer starts with a MeasuredData frame */
+static bool description_next(pm_handle *handle) {
+    return handle->recv_end - handle->recv_start >= PM_FRAME_HEADER_SIZE &&
+           0 == strncmp(MAGIC_MEASURED_DATA,
+                        (const char *)handle->recv_buffer +
+                            handle->recv_start,
+                        sizeof(MAGIC_MEASURED_DATA));
+}
+
+/*
+ * Looks for a complete frame in the receive buffer and consumes it.
+ * Returns true if msg and msg_len point to a complete DataSet message.
+ * MeasuredData frames announcing a new configuration are consumed on the
+ * way and update the description.
+ */
+static bool next_frame(pm_handle *handle,
+                       const uint8_t **msg,
+                       uint32_t *msg_len) {
+    const uint8_t *frame;
+    size_t available;
+    uint32_t net_msg_len;
+    pm_description_t description;
+    bool is_config;
+
+    while(true) {
+        frame = handle->recv_buffer + handle->recv_start;
+        available = handle->recv_end - handle->recv_start;
+
+        if(available < PM_FRAME_HEADER_SIZE) {
+            return false;
+        }
+
+        is_config = 0 == strncmp(MAGIC_MEASURED_DATA,
+                                 (const char *)frame,
+                                 sizeof(MAGIC_MEASURED_DATA));
+        assert(is_config || 0 == strncmp(MAGIC_DATA_SET,
+                                         (const char *)frame,
+                                         sizeof(MAGIC_DATA_SET)));
+        memcpy(&net_msg_len, frame + sizeof(MAGIC_DATA_SET),
+               sizeof(uint32_t));
+
+        if(available < PM_FRAME_HEADER_SIZE + ntohl(net_msg_len)) {
+            return false;
+        }
+
+        *msg = frame + PM_FRAME_HEADER_SIZE;
+        *msg_len = ntohl(net_msg_len);
+        handle->recv_start += PM_FRAME_HEADER_SIZE + *msg_len;
+
+        if(!is_config) {
+            return true;
+        }
+        if(0 == decode_description(*msg, *msg_len, NULL, 0, &description)) {
+            handle->description = description;
+        }
+    }
+}
+
+/*
+ * Starts a non-blocking connect to the next address that accepts one.
+ * Returns -1 if no address is left.
+ */
+static int connect_next_address(pm_handle *handle) {
+    struct addrinfo *rp;
     int sockfd;
-    int err, i;
-    char welcome_msg[sizeof(WELCOME_MSG)];
-    uint32_t net_sampling_rate;
-    uint32_t net_nc = htonl(num_channels);
-    uint32_t *net_channels = alloca(sizeof(uint32_t)*num_channels);
+    int err;
+
+    while(NULL != (rp = handle->next_address)) {
+        handle->next_address = rp->ai_next;
+
+        sockfd = socket(rp->ai_family, rp->ai_socktype, rp->ai_protocol);
+        if(-1 == sockfd) {
+            continue;
+        }
+
+        err = fcntl(sockfd, F_SETFL, fcntl(sockfd, F_GETFL) | O_NONBLOCK);
+        assert(0 == err);
+
+        if(0 == connect(sockfd, rp->ai_addr, rp->ai_addrlen)) {
+            handle->sockfd = sockfd;
+            handle->state = PM_STATE_REQUEST;
+            return 0;
+        } else if(EINPROGRESS == errno) {
+            handle->sockfd = sockfd;
+            handle->state = PM_STATE_CONNECTING;
+            return 0;
+        }
+        close(sockfd);
+    }
+
+    handle->sockfd = -1;
+    handle->state = PM_STATE_CLOSED;
+    return -1;
+}
+
+/*
+ * Drives the connection up to the point where data sets arrive without
+ * ever blocking. Returns 1 once streaming, 0 if it has to wait for the
+ * socket and -1 if the connection failed.
+ */
+static int advance_connection(pm_handle *handle) {
+    struct pollfd poll_cfg;
+    int sock_err;
+    socklen_t sock_err_len = sizeof(sock_err);
+    ssize_t res;
+    uint32_t net_msg_len;
+    const uint8_t *welcome;
+    size_t available;
+
+    switch(handle->state) {
+        case PM_STATE_CONNECTING:
+            poll_cfg.fd = handle->sockfd;
+            poll_cfg.events = POLLOUT;
+            if(0 == poll(&poll_cfg, 1, 0)) {
+                return 0;
+            }
+            if(0 != getsockopt(handle->sockfd, SOL_SOCKET, SO_ERROR,
+                               &sock_err, &sock_err_len) || 0 != sock_err) {
+                close(handle->sockfd);
+                if(0 != connect_next_address(handle)) {
+                    return -1;
+                }
+                return advance_connection(handle);
+            }
+            handle->state = PM_STATE_REQUEST;
+            /* fall through */
+        case PM_STATE_REQUEST:
+            while(handle->request_start < handle->request_end) {
+                res = write(handle->sockfd,
+                            handle->request + handle->request_start,
+                            handle->request_end - handle->request_start);
+                if(res < 0 && EINTR == errno) {
+                    continue;
+                } else if(res < 0 && (EAGAIN == errno ||
+                                      EWOULDBLOCK == errno)) {
+                    return 0;
+                } else if(res < 0) {
+                    return -1;
+                }
+                handle->request_start += res;
+            }
+            freeaddrinfo(handle->addresses);
+            handle->addresses = NULL;
+            free(handle->request);
+            handle->request = NULL;
+            handle->state = PM_STATE_WELCOME;
+            /* fall through */
+        case PM_STATE_WELCOME:
+            /* the welcome message followed by a MeasuredData frame */
+            while(true) {
+                welcome = handle->recv_buffer + handle->recv_start;
+                available = handle->recv_end - handle->recv_start;
+                if(available >= PM_WELCOME_SIZE) {
+                    memcpy(&net_msg_len,
+                           welcome + PM_WELCOME_SIZE - sizeof(uint32_t),
+                           sizeof(uint32_t));
+                    if(available >= PM_WELCOME_SIZE + ntohl(net_msg_len)) {
+                        break;
+                    }
+                }
+                res = fill_recv_buffer(handle, false);
+                if(res < 0 && (EAGAIN == errno || EWOULDBLOCK == errno)) {
+                    return 0;
+                } else if(res <= 0) {
+                    return -1;
+                }
+            }
+            if(0 != strncmp(WELCOME_MSG, (const char *)welcome,
+                            sizeof(WELCOME_MSG)) ||
+               0 != strncmp(MAGIC_MEASURED_DATA,
+                            (const char *)welcome + sizeof(WELCOME_MSG),
+                            sizeof(MAGIC_MEASURED_DATA)) ||
+               0 != decode_description(welcome + PM_WELCOME_SIZE,
+                                       ntohl(net_msg_len),
+                                       NULL, 0,
+                                       &handle->description)) {
+                errno = EPROTO;
+                return -1;
+            }
+            handle->recv_start += PM_WELCOME_SIZE + ntohl(net_msg_len);
+            handle->state = PM_STATE_STREAMING;
+            /* fall through */
+        case PM_STATE_STREAMING:
+            return 1;
+        case PM_STATE_CLOSED:
+        default:
+            return -1;
+    }
+}
+
+static void free_handle(pm_handle *handle) {
+    if(NULL != handle->shm) {
+        shm_reader_detach(handle->shm);
+    }
+    if(NULL != handle->unix_socket) {
+        unix_reader_close(handle->unix_socket);
+    }
+    if(NULL != handle->mcast) {
+        mcast_reader_close(handle->mcast);
+    }
+    if(0 <= handle->sockfd) {
+        close(handle->sockfd);
+    }
+    if(NULL != handle->addresses) {
+        freeaddrinfo(handle->addresses);
+    }
+    free(handle->request);
+    free(handle->recv_buffer);
+    free(handle->block_analog);
+    free(handle->block_digital);
+    free(handle);
+}
+
+/*
+ * Resolves the server and prepares the channel description, doesn't connect.
+ */
+static pm_handle *create_handle(char *server,
+                                char *port,
+                                uint32_t *channels,
+                                uint32_t num_channels,
+                                const char *trigger) {
+    struct addrinfo hints = { 0 };
+    struct addrinfo *result = NULL;
+    int err;
     pm_handle *handle;
 
     if(NULL==server || NULL==port || NULL==channels) {
@@ -72,60 +399,366 @@ void *pm_connect(char *server,
         return NULL;
     }
 
-    for(rp = result; rp != NULL; rp = rp->ai_next) {
-        sockfd = socket(rp->ai_family, rp->ai_socktype,
-                        rp->ai_protocol);
-        if(-1 == sockfd) {
-            continue;
+    handle = (pm_handle *)calloc(1, sizeof(pm_handle));
+    assert(NULL != handle);
+    handle->magic_number = PM_HANDLE_MAGIC_NUMBER;
+    handle->sockfd = -1;
+    handle->addresses = result;
+    handle->next_address = result;
+
+    /* hello, the channels as ranges and the trigger in network endianess */
+    handle->request = malloc(SELECTION_REQUEST_MAX_SIZE(num_channels));
+    assert(NULL != handle->request);
+    handle->request_end = selection_request(handle->request, channels,
+                                            num_channels, trigger);
+
+    handle->recv_buffer = malloc(PM_RECV_BUFFER_SIZE);
+    assert(NULL != handle->recv_buffer);
+    handle->recv_buffer_size = PM_RECV_BUFFER_SIZE;
+
+    return handle;
+}
+
+void *pm_connect_async(char *server,
+                       char *port,
+                       uint32_t *channels,
+                       uint32_t num_channels) {
+    pm_handle *handle = create_handle(server, port, channels, num_channels,
+                                      NULL);
+
+    if(NULL == handle) {
+        return NULL;
+    }
+
+    if(0 != connect_next_address(handle)) {
+        free_handle(handle);
+        return NULL;
+    }
+
+    return handle;
+}
+
+/*
+ * LOCAL TRANSPORTS
+ */
+static bool is_loopback(const struct sockaddr *addr) {
+    if(AF_INET == addr->sa_family) {
+        const struct sockaddr_in *in = (const struct sockaddr_in *)addr;
+        return 127 == (ntohl(in->sin_addr.s_addr) >> 24);
+    } else if(AF_INET6 == addr->sa_family) {
+        const struct sockaddr_in6 *in6 = (const struct sockaddr_in6 *)addr;
+        return IN6_IS_ADDR_LOOPBACK(&in6->sin6_addr);
+    }
+    return false;
+}
+
+/*
+ * Attaches to the shared memory of a daemon on this host or, if that's not
+ * possible, connects to its unix domain socket.
+ * Returns 0 on success, -1 if the blocks have to be read from TCP.
+ */
+static int connect_local(pm_handle *handle,
+                         char *port,
+                         uint32_t *channels,
+                         uint32_t num_channels) {
+    if(NULL != getenv("PMLAB_NO_SHM") ||
+       !is_loopback(handle->addresses->ai_addr)) {
+        return -1;
+    }
+
+    handle->shm = shm_reader_attach(port, channels, num_channels);
+    if(NULL != handle->shm) {
+        handle->description = *shm_reader_describe(handle->shm);
+    } else {
+        handle->unix_socket = unix_reader_connect(port, channels, num_channels);
+        if(NULL == handle->unix_socket) {
+            return -1;
         }
+        handle->description = *unix_reader_describe(handle->unix_socket);
+    }
 
-        if(-1 != connect(sockfd, rp->ai_addr, rp->ai_addrlen)) {
-            break;
+    freeaddrinfo(handle->addresses);
+    handle->addresses = NULL;
+    free(handle->request);
+    handle->request = NULL;
+    free(handle->recv_buffer);
+    handle->recv_buffer = NULL;
+
+    handle->state = PM_STATE_STREAMING;
+    return 0;
+}
+
+static bool is_local(pm_handle *handle) {
+    return NULL != handle->shm || NULL != handle->unix_socket;
+}
+
+/* true if the blocks don't come as DataSet frames over TCP */
+static bool has_reader(pm_handle *handle) {
+    return is_local(handle) || NULL != handle->mcast;
+}
+
+/* the description of the block the reader read last */
+static const pm_description_t *reader_description(pm_handle *handle) {
+    if(NULL != handle->shm) {
+        return shm_reader_describe(handle->shm);
+    } else if(NULL != handle->mcast) {
+        return mcast_reader_describe(handle->mcast);
+    }
+    return unix_reader_describe(handle->unix_socket);
+}
+
+/* reads the next block just like decode_dataset, any buffer may be NULL */
+static int reader_read(pm_handle *handle,
+                       size_t buffer_sizes,
+                       double *analog_data,
+                       digival_t *digital_data,
+                       unsigned int *samples_read,
+                       uint64_t *timestamp_nanos,
+                       pm_marker_t *markers,
+                       unsigned int *num_markers,
+                       bool block) {
+    int ret;
+
+    if(NULL != handle->shm) {
+        return shm_reader_read(handle->shm, buffer_sizes, analog_data,
+                               digital_data, samples_read, timestamp_nanos,
+                               markers, num_markers, block);
+    } else if(NULL == handle->mcast) {
+        return unix_reader_read(handle->unix_socket, buffer_sizes,
+                                analog_data, digital_data, samples_read,
+                                timestamp_nanos, markers, num_markers, block);
+    }
+
+    ret = mcast_reader_read(handle->mcast, buffer_sizes, analog_data,
+                            samples_read, timestamp_nanos, block);
+    if(ret > 0) {
+        /* the datagrams carry neither, the daemon reads no digital inputs */
+        if(NULL != digital_data) {
+            memset(digital_data, 0, ret / sizeof(double) * sizeof(digival_t));
         }
-        close(sockfd);
+        if(NULL != num_markers) {
+            *num_markers = 0;
+        }
+    }
+    return ret;
+}
+
+/* keeps a block read by pm_read_many for the next read */
+static void hold_block(pm_handle *handle, const pm_block_t *block, int size) {
+    const size_t count = size / sizeof(double);
+
+    if(count > handle->block_buffer_size) {
+        handle->block_buffer_size = count;
+        free(handle->block_analog);
+        free(handle->block_digital);
+        handle->block_analog = malloc(count * sizeof(double));
+        assert(NULL != handle->block_analog);
+        handle->block_digital = malloc(count * sizeof(digival_t));
+        assert(NULL != handle->block_digital);
+    }
+    memcpy(handle->block_analog, block->analog_data, size);
+    if(NULL != block->digital_data) {
+        memcpy(handle->block_digital, block->digital_data,
+               count * sizeof(digival_t));
+    } else {
+        /* not read, the daemon reads no digital inputs anyway */
+        memset(handle->block_digital, 0, count * sizeof(digival_t));
+    }
+    handle->held_block = *block;
+    handle->held_block_size = size;
+    handle->have_held_block = true;
+}
+
+/* returns the held block, the reader hasn't read anything since */
+static int take_held_block(pm_handle *handle,
+                           size_t buffer_sizes,
+                           double *analog_data,
+                           digival_t *digital_data,
+                           unsigned int *samples_read,
+                           uint64_t *timestamp_nanos,
+                           pm_marker_t *markers,
+                           unsigned int *num_markers) {
+    const pm_block_t *held = &handle->held_block;
+    const size_t count = handle->held_block_size / sizeof(double);
+
+    assert(buffer_sizes >= count);
+    if(NULL != analog_data) {
+        memcpy(analog_data, handle->block_analog, handle->held_block_size);
     }
+    if(NULL != digital_data) {
+        memcpy(digital_data, handle->block_digital,
+               count * sizeof(digival_t));
+    }
+    if(NULL != markers) {
+        memcpy(markers, held->markers,
+               held->num_markers * sizeof(pm_marker_t));
+    }
+    if(NULL != num_markers) {
+        *num_markers = held->num_markers;
+    }
+    if(NULL != samples_read) {
+        *samples_read = held->samples_read;
+    }
+    if(NULL != timestamp_nanos) {
+        *timestamp_nanos = held->timestamp_nanos;
+    }
+    handle->have_held_block = false;
+    handle->description = *reader_description(handle);
 
-    if(NULL == rp) {
+    return handle->held_block_size;
+}
+
+/*
+ * Connects over TCP and waits for the handshake to complete. Frees the
+ * handle and returns NULL if that fails.
+ */
+static pm_handle *connect_tcp(pm_handle *handle) {
+    struct pollfd poll_cfg;
+    int err;
+
+    if(0 != connect_next_address(handle)) {
+        free_handle(handle);
         return NULL;
     }
 
-    freeaddrinfo(result);
+    while(0 == (err = advance_connection(handle))) {
+        poll_cfg.fd = handle->sockfd;
+        poll_cfg.events = pm_poll_events(handle);
+        poll(&poll_cfg, 1, -1);
+    }
 
-    /* convert integers to network endianess */
-    net_nc = htonl(num_channels);
-    for(i = 0; i < num_channels; i++) {
-        net_channels[i] = htonl(channels[i]);
+    if(err < 0) {
+        free_handle(handle);
+        return NULL;
     }
 
-    /* send channel description */
-    err = full_write(sockfd, (char *)&net_nc, sizeof(num_channels));
-    assert(sizeof(num_channels) == err);
-    err = full_write(sockfd,
-                     (char *)net_channels,
-                     num_channels*sizeof(uint32_t));
+    /* pm_read blocks */
+    err = fcntl(handle->sockfd,
+                F_SETFL,
+                fcntl(handle->sockfd, F_GETFL) & ~O_NONBLOCK);
+    assert(0 == err);
 
-    err = full_read(sockfd, welcome_msg, sizeof(WELCOME_MSG));
-    if(sizeof(WELCOME_MSG) != err) {
+    return handle;
+}
+
+void *pm_connect(char *server,
+                 char *port,
+                 uint32_t *channels,
+                 uint32_t num_channels) {
+    pm_handle *handle = create_handle(server, port, channels, num_channels,
+                                      NULL);
+
+    if(NULL == handle) {
+        return NULL;
+    }
+
+    if(0 == connect_local(handle, port, channels, num_channels)) {
+        return handle;
+    }
+
+    return connect_tcp(handle);
+}
+
+void *pm_connect_trigger(char *server,
+                         char *port,
+                         uint32_t *channels,
+                         uint32_t num_channels,
+                         const char *trigger) {
+    pm_handle *handle;
+
+    if(NULL == trigger || '\0' == trigger[0] ||
+       strlen(trigger) > MAX_TRIGGER_LEN) {
         return NULL;
     }
-    assert(0 == strncmp(WELCOME_MSG, welcome_msg, sizeof(WELCOME_MSG)));
 
-    err = full_read(sockfd, (char *)&net_sampling_rate, sizeof(uint32_t));
-    if(sizeof(uint32_t) != err) {
+    handle = create_handle(server, port, channels, num_channels, trigger);
+    if(NULL == handle) {
         return NULL;
     }
 
-    /* Only create structure once connection is established */
-    handle = (pm_handle *)malloc(sizeof(pm_handle));
+    return connect_tcp(handle);
+}
+
+int pm_query(char *server, char *port, pm_description_t *description) {
+    struct pollfd poll_cfg;
+    uint32_t no_channels;
+    int err, ret = -1;
+    /* a request without channels, always over TCP */
+    pm_handle *handle = create_handle(server, port, &no_channels, 0, NULL);
+
+    if(NULL == handle) {
+        return -1;
+    }
+
+    if(0 != connect_next_address(handle)) {
+        free_handle(handle);
+        return -1;
+    }
+
+    while(0 == (err = advance_connection(handle))) {
+        poll_cfg.fd = handle->sockfd;
+        poll_cfg.events = pm_poll_events(handle);
+        poll(&poll_cfg, 1, -1);
+    }
+
+    /* daemons before protocol version 3 describe no channels */
+    if(0 < err && 0 < handle->description.num_channels) {
+        *description = handle->description;
+        ret = 0;
+    }
+    free_handle(handle);
+
+    return ret;
+}
+
+void *pm_connect_multicast(char *server,
+                           char *group,
+                           uint32_t *channels,
+                           uint32_t num_channels) {
+    pm_handle *handle;
+
+    if(NULL == server || NULL == group || NULL == channels) {
+        return NULL;
+    }
+
+    handle = (pm_handle *)calloc(1, sizeof(pm_handle));
+    assert(NULL != handle);
     handle->magic_number = PM_HANDLE_MAGIC_NUMBER;
-    handle->sockfd = sockfd;
-    handle->sampling_rate = ntohl(net_sampling_rate);
+    handle->sockfd = -1;
+
+    handle->mcast = mcast_reader_open(server, group, channels, num_channels);
+    if(NULL == handle->mcast) {
+        free_handle(handle);
+        return NULL;
+    }
+    handle->description = *mcast_reader_describe(handle->mcast);
+    handle->state = PM_STATE_STREAMING;
 
     return handle;
 }
 
+void pm_multicast_losses(void *h,
+                         uint64_t *lost_datagrams,
+                         uint64_t *lost_samples) {
+    pm_handle *handle = (pm_handle *)h;
+    assert(PM_HANDLE_MAGIC_NUMBER == handle->magic_number);
+
+    *lost_datagrams = 0;
+    *lost_samples = 0;
+    if(NULL != handle->mcast) {
+        mcast_reader_losses(handle->mcast, lost_datagrams, lost_samples);
+    }
+}
+
 uint32_t pm_samplingrate(void *h) {
-    return ((pm_handle *)h)->sampling_rate;
+    return ((pm_handle *)h)->description.sampling_rate;
+}
+
+const pm_description_t *pm_describe(void *h) {
+    pm_handle *handle = (pm_handle *)h;
+    assert(PM_HANDLE_MAGIC_NUMBER == handle->magic_number);
+
+    return &handle->description;
 }
 
 int pm_read(void *h,
@@ -136,90 +769,397 @@ int pm_read(void *h,
             uint64_t *ret_timestamp_nanos) {
     int err;
     pm_handle *handle;
-    char magic_data_buffer[sizeof(MAGIC_DATA_SET)];
-    uint32_t msg_len, net_msg_len;
-    void *msg_buffer;
-    int i;
-    unsigned int offset;
-    DataSet *msg_ds;
-    ssize_t ret = 0;
-    unsigned int samples_read;
+    const uint8_t *msg;
+    uint32_t msg_len;
+    ssize_t res;
 
     handle = (pm_handle *)h;
     assert(PM_HANDLE_MAGIC_NUMBER == handle->magic_number);
 
-    err = full_read(handle->sockfd, magic_data_buffer, sizeof(MAGIC_DATA_SET));
-    if(0 == err) {
-        return 0;
+    if(has_reader(handle) && handle->have_held_block) {
+        return take_held_block(handle,
+                               buffer_sizes,
+                               analog_data,
+                               digital_data,
+                               ret_samples_read,
+                               ret_timestamp_nanos,
+                               NULL,
+                               NULL);
+    } else if(has_reader(handle)) {
+        err = reader_read(handle,
+                          buffer_sizes,
+                          analog_data,
+                          digital_data,
+                          ret_samples_read,
+                          ret_timestamp_nanos,
+                          NULL,
+                          NULL,
+                          true);
+        if(err > 0) {
+            handle->description = *reader_description(handle);
+        }
+        return err;
     }
-    assert(sizeof(MAGIC_DATA_SET)==err);
-    ret += err;
-    assert(0==strncmp(MAGIC_DATA_SET,magic_data_buffer,sizeof(MAGIC_DATA_SET)));
 
-    err = full_read(handle->sockfd, (char *)&net_msg_len, sizeof(uint32_t));
-    if(0 == err) {
-        return 0;
+    while(!next_frame(handle, &msg, &msg_len)) {
+        res = fill_recv_buffer(handle, true);
+        if(res <= 0) {
+            return res;
+        }
     }
-    assert(sizeof(uint32_t)==err);
-    ret += err;
-    msg_len = ntohl(net_msg_len);
 
-    msg_buffer = malloc(msg_len);
-    err = full_read(handle->sockfd, msg_buffer, msg_len);
-    if(0 == err) {
-        return 0;
+    err = decode_dataset(msg,
+                         msg_len,
+                         buffer_sizes,
+                         analog_data,
+                         digital_data,
+                         ret_samples_read,
+                         ret_timestamp_nanos,
+                         NULL,
+                         NULL);
+    assert(-ENOBUFS != err);
+    if(0 > err) {
+        return err;
     }
-    assert(msg_len==err);
-    ret += err;
 
-    msg_ds = data_set__unpack(NULL, msg_len, msg_buffer);
-    free(msg_buffer);
+    return PM_FRAME_HEADER_SIZE + msg_len;
+}
+
+int pm_read_many(void *h,
+                 size_t buffer_sizes,
+                 pm_block_t *blocks,
+                 unsigned int max_blocks) {
+    int err;
+    pm_handle *handle;
+    const uint8_t *msg;
+    uint32_t msg_len;
+    unsigned int num_blocks = 0;
+    ssize_t res;
+
+    handle = (pm_handle *)h;
+    assert(PM_HANDLE_MAGIC_NUMBER == handle->magic_number);
+
+    while(has_reader(handle) && num_blocks < max_blocks) {
+        pm_block_t *b = &blocks[num_blocks];
+        const pm_description_t *description;
 
-    offset = 0;
-    samples_read = 0;
-    for(i = 0; i < msg_ds->n_channel_data; i++) {
-        DataPoints *points = msg_ds->channel_data[i];
-        unsigned int n_samples = points->n_analog_data;
+        if(handle->have_held_block) {
+            take_held_block(handle,
+                            buffer_sizes,
+                            b->analog_data,
+                            b->digital_data,
+                            &b->samples_read,
+                            &b->timestamp_nanos,
+                            b->markers,
+                            &b->num_markers);
+        } else {
+            err = reader_read(handle,
+                              buffer_sizes,
+                              b->analog_data,
+                              b->digital_data,
+                              &b->samples_read,
+                              &b->timestamp_nanos,
+                              b->markers,
+                              &b->num_markers,
+                              0 == num_blocks);
+            if(-EAGAIN == err) {
+                break;
+            } else if(err <= 0) {
+                return 0 == num_blocks ? err : num_blocks;
+            }
 
-        assert(n_samples == points->n_analog_data);
-        assert(n_samples == points->n_digital_data);
-        assert(buffer_sizes >= offset+n_samples);
+            description = reader_description(handle);
+            if(num_blocks > 0 &&
+               description->generation != blocks[0].generation) {
+                /* returned by the next call, with its description */
+                hold_block(handle, b, err);
+                break;
+            }
+            handle->description = *description;
+        }
+        b->sampling_rate = handle->description.sampling_rate;
+        b->generation = handle->description.generation;
+        time_markers(b->markers, b->num_markers, b->timestamp_nanos,
+                     b->sampling_rate);
+        num_blocks++;
+    }
 
-        if(NULL != analog_data) {
-            memcpy(analog_data + offset,
-                   points->analog_data,
-                   n_samples * sizeof(double));
+    while(!has_reader(handle) && num_blocks < max_blocks) {
+        if(num_blocks > 0 && description_next(handle)) {
+            /* the blocks returned share one description */
+            break;
         }
-        if(NULL != digital_data) {
-            memcpy(digital_data + offset,
-                   points->digital_data,
-                   n_samples * sizeof(digival_t));
+        if(!next_frame(handle, &msg, &msg_len)) {
+            /* block for the first frame only, then take what's there */
+            res = fill_recv_buffer(handle, 0 == num_blocks);
+            if(res > 0) {
+                continue;
+            } else if(0 == num_blocks) {
+                return res;
+            } else {
+                break;
+            }
         }
-        offset += n_samples;
-        assert (0 == samples_read || n_samples == samples_read);
-        samples_read = n_samples;
+
+        err = decode_dataset(msg,
+                             msg_len,
+                             buffer_sizes,
+                             blocks[num_blocks].analog_data,
+                             blocks[num_blocks].digital_data,
+                             &blocks[num_blocks].samples_read,
+                             &blocks[num_blocks].timestamp_nanos,
+                             blocks[num_blocks].markers,
+                             &blocks[num_blocks].num_markers);
+        assert(-ENOBUFS != err);
+        if(0 > err) {
+            return err;
+        }
+        blocks[num_blocks].sampling_rate = handle->description.sampling_rate;
+        blocks[num_blocks].generation = handle->description.generation;
+        time_markers(blocks[num_blocks].markers,
+                     blocks[num_blocks].num_markers,
+                     blocks[num_blocks].timestamp_nanos,
+                     blocks[num_blocks].sampling_rate);
+        num_blocks++;
     }
 
-    if(NULL != ret_timestamp_nanos) {
-        *ret_timestamp_nanos = msg_ds->timestamp_nanos;
+    return num_blocks;
+}
+
+bool pm_is_local(void *h) {
+    pm_handle *handle = (pm_handle *)h;
+    assert(PM_HANDLE_MAGIC_NUMBER == handle->magic_number);
+
+    return is_local(handle);
+}
+
+int pm_read_view(void *h, pm_view_t *view) {
+    pm_handle *handle = (pm_handle *)h;
+    int ret;
+    assert(PM_HANDLE_MAGIC_NUMBER == handle->magic_number);
+
+    if(NULL != handle->shm) {
+        ret = shm_reader_view(handle->shm, view, true);
+    } else if(NULL != handle->unix_socket) {
+        ret = unix_reader_view(handle->unix_socket, view, true);
+    } else {
+        return -ENOTSUP;
     }
-    if(NULL != ret_samples_read) {
-        *ret_samples_read = samples_read;
+    if(1 == ret) {
+        handle->description = *reader_description(handle);
+        time_markers(view->markers, view->num_markers, view->timestamp_nanos,
+                     view->sampling_rate);
     }
+    return ret;
+}
 
-    data_set__free_unpacked(msg_ds, NULL);
+bool pm_view_valid(void *h, const pm_view_t *view) {
+    pm_handle *handle = (pm_handle *)h;
+    assert(PM_HANDLE_MAGIC_NUMBER == handle->magic_number);
+    assert(is_local(handle));
 
-    return ret;
+    if(NULL != handle->shm) {
+        return shm_reader_valid(handle->shm, view);
+    }
+    /* sealed, nobody can overwrite it */
+    return true;
 }
 
-void pm_close(void *h) {
+/*
+ * EVENT DRIVEN API
+ */
+int pm_fd(void *h) {
+    pm_handle *handle = (pm_handle *)h;
+    assert(PM_HANDLE_MAGIC_NUMBER == handle->magic_number);
+
+    return handle->sockfd;
+}
+
+short pm_poll_events(void *h) {
+    pm_handle *handle = (pm_handle *)h;
+    assert(PM_HANDLE_MAGIC_NUMBER == handle->magic_number);
+
+    switch(handle->state) {
+        case PM_STATE_CONNECTING:
+        case PM_STATE_REQUEST:
+            return POLLOUT;
+        default:
+            return POLLIN;
+    }
+}
+
+void pm_set_callbacks(void *h,
+                      const pm_callbacks_t *callbacks,
+                      void *user) {
+    pm_handle *handle = (pm_handle *)h;
+    assert(PM_HANDLE_MAGIC_NUMBER == handle->magic_number);
+
+    handle->callbacks = *callbacks;
+    handle->user = user;
+}
+
+static void disconnect(pm_handle *handle, int error) {
+    handle->state = PM_STATE_CLOSED;
+    if(NULL != handle->callbacks.on_disconnect) {
+        handle->callbacks.on_disconnect(handle->user, error);
+    }
+}
+
+static int deliver_block(pm_handle *handle,
+                         const uint8_t *msg,
+                         uint32_t msg_len) {
+    pm_block_t block;
+    int err;
+
+    /* a double takes 8 bytes on the wire, so this is always large enough */
+    if(msg_len / sizeof(double) > handle->block_buffer_size) {
+        handle->block_buffer_size = msg_len / sizeof(double);
+        free(handle->block_analog);
+        free(handle->block_digital);
+        handle->block_analog = malloc(handle->block_buffer_size *
+                                      sizeof(double));
+        assert(NULL != handle->block_analog);
+        handle->block_digital = malloc(handle->block_buffer_size *
+                                       sizeof(digival_t));
+        assert(NULL != handle->block_digital);
+    }
+
+    block.analog_data = handle->block_analog;
+    block.digital_data = handle->block_digital;
+    err = decode_dataset(msg,
+                         msg_len,
+                         handle->block_buffer_size,
+                         block.analog_data,
+                         block.digital_data,
+                         &block.samples_read,
+                         &block.timestamp_nanos,
+                         block.markers,
+                         &block.num_markers);
+    if(err < 0) {
+        return err;
+    }
+    block.sampling_rate = handle->description.sampling_rate;
+    block.generation = handle->description.generation;
+    time_markers(block.markers, block.num_markers, block.timestamp_nanos,
+                 block.sampling_rate);
+
+    if(handle->have_next_timestamp &&
+       block.timestamp_nanos != handle->next_timestamp_nanos &&
+       NULL != handle->callbacks.on_gap) {
+        handle->callbacks.on_gap(handle->user,
+                                 handle->next_timestamp_nanos,
+                                 block.timestamp_nanos);
+    }
+    handle->have_next_timestamp = true;
+    handle->next_timestamp_nanos = block.timestamp_nanos +
+                                   PM_NANOS_PER_SECOND *
+                                   block.samples_read /
+                                   handle->description.sampling_rate;
+
+    if(NULL != handle->callbacks.on_block) {
+        handle->callbacks.on_block(handle->user, &block);
+    }
+
+    return 0;
+}
+
+int pm_process(void *h) {
+    pm_handle *handle = (pm_handle *)h;
+    const uint8_t *msg;
+    uint32_t msg_len;
+    int delivered = 0;
     int err;
+    ssize_t res;
+
+    assert(PM_HANDLE_MAGIC_NUMBER == handle->magic_number);
+
+    if(PM_STATE_CLOSED == handle->state) {
+        return -1;
+    }
+
+    err = advance_connection(handle);
+    if(err < 0) {
+        disconnect(handle, 0 != errno ? errno : ECONNREFUSED);
+        return -1;
+    } else if(0 == err) {
+        return 0;
+    }
+
+    /* one large recv per call keeps several handles in one loop fair */
+    res = fill_recv_buffer(handle, false);
+    if(0 == res) {
+        disconnect(handle, 0);
+        return -1;
+    } else if(res < 0 && EAGAIN != errno && EWOULDBLOCK != errno) {
+        disconnect(handle, errno);
+        return -1;
+    }
+
+    while(next_frame(handle, &msg, &msg_len)) {
+        err = deliver_block(handle, msg, msg_len);
+        if(err < 0) {
+            disconnect(handle, -err);
+            return -1;
+        }
+        delivered++;
+    }
+
+    return delivered;
+}
+
+void pm_close(void *h) {
     pm_handle *handle = (pm_handle *)h;
 
     assert(PM_HANDLE_MAGIC_NUMBER == handle->magic_number);
 
-    err = close(handle->sockfd);
-    assert(0 == err);
-    free(handle);
+    free_handle(handle);
+}
+
+int pm_marker_open(const char *server) {
+    struct addrinfo hints;
+    struct addrinfo *result;
+    char port[8];
+    int sockfd, err;
+
+    memset(&hints, 0, sizeof(struct addrinfo));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_DGRAM;
+
+    snprintf(port, sizeof(port), "%d", MARKER_PORT);
+    err = getaddrinfo(server, port, &hints, &result);
+    if(0 != err) {
+        return -1;
+    }
+
+    sockfd = socket(result->ai_family, result->ai_socktype,
+                    result->ai_protocol);
+    /* no handshake, connect only fixes the destination */
+    if(0 <= sockfd &&
+       0 != connect(sockfd, result->ai_addr, result->ai_addrlen)) {
+        close(sockfd);
+        sockfd = -1;
+    }
+    freeaddrinfo(result);
+
+    return sockfd;
+}
+
+int pm_mark(int marker_fd, uint32_t id, const char *label) {
+    uint8_t record[MARKER_RECORD_SIZE] = { 0 };
+    uint32_t net_magic = htonl(MARKER_MAGIC);
+    uint32_t net_id = htonl(id);
+
+    memcpy(record, &net_magic, sizeof(uint32_t));
+    memcpy(record + sizeof(uint32_t), &net_id, sizeof(uint32_t));
+    if(NULL != label) {
+        /* the record is NUL padded, not terminated, the daemon adds it */
+        memcpy(record + 2 * sizeof(uint32_t), label,
+               strnlen(label, MARKER_LABEL_LEN));
+    }
+
+    if(MARKER_RECORD_SIZE != send(marker_fd, record, sizeof(record), 0)) {
+        return -1;
+    }
+    return 0;
 }
 /* vim: set fileencoding=utf8 : */
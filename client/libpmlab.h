@@ -22,14 +22,104 @@
 #define PMLABCLIENT
 
 #include <time.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
 
 #include "common.h"
 
+#define PM_DESCRIPTION_MAX_CHANNELS MAX_CHANNELS
+#define PM_DESCRIPTION_NAME_LEN 32
+/* buffers of that many samples hold every block, whatever the channels */
+#define PM_MAX_BLOCK_SAMPLES MAX_BLOCK_SAMPLES
+/* markers a block carries at most */
+#define PM_MAX_MARKERS MAX_BLOCK_MARKERS
+
+/*
+ * Describes the stream of a handle as returned by pm_describe, everything
+ * needed to interpret the samples without knowing how the daemon was
+ * configured. channel_names, scale and offset hold num_channels entries in
+ * the order the channels were requested, a sample s of channel i is
+ * scale[i] * s + offset[i] in unit. generation changes whenever the daemon
+ * is reconfigured. protocol_version is 1 if only the sampling rate is known.
+ * shot_id names the capture of a trigger (pm_connect_trigger) the block
+ * belongs to, it is empty for a stream.
+ */
+typedef struct {
+    uint32_t protocol_version;
+    char shot_id[MAX_SHOT_ID_LEN];
+    uint64_t generation;
+    uint32_t sampling_rate;
+    uint32_t block_size;     /* samples per channel and block */
+    char encoding[16];       /* of the samples on the wire, e.g. "float64" */
+    char unit[8];
+    double range_min;        /* input range of the DAQ task */
+    double range_max;
+    unsigned int num_channels;
+    char channel_names[PM_DESCRIPTION_MAX_CHANNELS][PM_DESCRIPTION_NAME_LEN];
+    double scale[PM_DESCRIPTION_MAX_CHANNELS];
+    double offset[PM_DESCRIPTION_MAX_CHANNELS];
+} pm_description_t;
+
+/*
+ * A marker sent by the program under test (pm_mark): it arrived while sample
+ * of its block was read, timestamp_nanos is the time of that sample.
+ */
+typedef struct {
+    uint32_t id;
+    char label[MARKER_LABEL_LEN + 1];
+    unsigned int sample;
+    uint64_t timestamp_nanos;
+} pm_marker_t;
+
+/*
+ * One block of data as returned by pm_read_many. analog_data and digital_data
+ * have to be provided by the caller (digital_data may be NULL), samples_read
+ * and timestamp_nanos are filled in just like pm_read does, sampling_rate is
+ * the rate the block was read with and generation the one of its
+ * description. markers are the num_markers markers that arrived while the
+ * block was read, multicast handles don't receive them.
+ */
+typedef struct {
+    double *analog_data;
+    digival_t *digital_data;
+    unsigned int samples_read;
+    uint64_t timestamp_nanos;
+    uint32_t sampling_rate;
+    uint64_t generation;
+    unsigned int num_markers;
+    pm_marker_t markers[PM_MAX_MARKERS];
+} pm_block_t;
+
+/*
+ * A block in the daemon's shared memory as returned by pm_read_view.
+ * channel_data[i] points to the samples_read samples of the i-th requested
+ * channel, digital_channel_data[i] to its digital samples. The markers are
+ * those of pm_block_t. seq and opaque_slot are used by pm_view_valid only.
+ */
+typedef struct {
+    uint64_t timestamp_nanos;
+    unsigned int samples_read;
+    uint32_t sampling_rate;
+    uint64_t generation;
+    const double *const *channel_data;
+    const digival_t *const *digital_channel_data;
+    unsigned int num_markers;
+    pm_marker_t markers[PM_MAX_MARKERS];
+    uint64_t seq;
+    const void *opaque_slot;
+} pm_view_t;
+
 /*
  * Connects to the PM Lab server and starts listening for data. The data can be
  * read with pm_read. Once all data has been read, pm_close should be called
  * to ensure a correct cleanup
  *
+ * If the server runs on this host, the blocks are read from the daemon's
+ * shared memory or, if that's not available, passed as memfds over its unix
+ * domain socket instead of the TCP connection (set the environment variable
+ * PMLAB_NO_SHM to prevent that).
+ *
  * Parameters:
  * server: The PM Lab server to connect to
  * port: The port number to use
@@ -45,10 +135,72 @@ void *pm_connect(char *server,
                  unsigned int num_channels);
 
 /*
- * Returns the sampling rate used by the server in Hertz.
+ * Like pm_connect but the daemon only sends the signal around the events
+ * trigger describes (see daemon/trigger.h), e.g.
+ * "edge,ch=0,thr=0.1,pre=0.01,post=0.05": every block read is a capture of
+ * the channels, from pre seconds before a hit to post seconds after it,
+ * and pm_describe tells its shot_id and length (block_size). Always uses
+ * TCP.
+ *
+ * Returns:
+ * A handle if the daemon accepted the trigger, NULL else
+ */
+void *pm_connect_trigger(char *server,
+                         char *port,
+                         unsigned int *channels,
+                         unsigned int num_channels,
+                         const char *trigger);
+
+/*
+ * Asks the daemon for the description of all of its channels without
+ * reading any, e.g. to pass channels 0 to description->num_channels - 1 to
+ * pm_connect.
+ *
+ * Returns:
+ * 0 on success, -1 if the daemon couldn't be asked
+ */
+int pm_query(char *server, char *port, pm_description_t *description);
+
+/*
+ * Like pm_connect but receives the blocks from the multicast group the daemon
+ * publishes to (daemon -m GROUP), which scales to many clients reading the
+ * same channels. Datagrams lost on the way are requested from server again.
+ * Samples that still couldn't be recovered are NaN and whole blocks that
+ * couldn't be recovered are skipped, see pm_multicast_losses.
+ *
+ * Returns:
+ * A handle if the group could be joined and the daemon sent data, NULL else
+ */
+void *pm_connect_multicast(char *server,
+                           char *group,
+                           unsigned int *channels,
+                           unsigned int num_channels);
+
+/*
+ * Returns how many datagrams were lost on the network and how many samples
+ * couldn't be recovered by retransmission (both 0 without multicast).
+ */
+void pm_multicast_losses(void *handle,
+                         uint64_t *lost_datagrams,
+                         uint64_t *lost_samples);
+
+/*
+ * Returns the sampling rate used by the server in Hertz. The daemon can be
+ * reconfigured while clients are connected, then this is the rate of the
+ * block read last (pm_read_many and the callbacks also tell it per block).
  */
 uint32_t pm_samplingrate(void *handle);
 
+/*
+ * Returns the description of the block read last (or, before the first one,
+ * of the stream as announced in the handshake). It stays valid until the
+ * next read. The blocks returned by one pm_read_many call always share one
+ * description, the call returns early before a block with a new one.
+ * Multicast handles only learn the sampling rate, the channels are named
+ * after their ids.
+ */
+const pm_description_t *pm_describe(void *handle);
+
 /*
  * Reads as much data as availabe from the network and writes it to the
  * provided buffers. Crashes if buffers are not large enough
@@ -75,10 +227,142 @@ int pm_read(void *handle,
             unsigned int *samples_read,
             uint64_t *timestamp_nanos);
 
+/*
+ * Like pm_read but returns all blocks that are already available (up to
+ * max_blocks). Blocks until at least one block could be read, then receives
+ * large chunks without blocking and decodes as many complete blocks as
+ * possible, saving syscalls when catching up or reading many channels.
+ *
+ * Parameters:
+ * handle: The server handle
+ * buffer_sizes: The sizes of the buffers of every block
+ * blocks: An array of max_blocks blocks with their buffers set up
+ * max_blocks: The size of the blocks array
+ *
+ * Returns:
+ * 0 on EOF
+ * n | n > 0 when n blocks have successfully been read
+ * m | m < 0 on error
+ */
+int pm_read_many(void *handle,
+                 size_t buffer_sizes,
+                 pm_block_t *blocks,
+                 unsigned int max_blocks);
+
+/*
+ * Returns true if the handle reads from the daemon's shared memory or
+ * unix domain socket.
+ */
+bool pm_is_local(void *handle);
+
+/*
+ * Points view at the next block in the daemon's shared memory (or the memfd
+ * passed by the daemon) without copying anything. The daemon may overwrite
+ * shared memory at any time (after about 8 blocks), so check pm_view_valid
+ * after using the data and discard the results if it returns false. A view
+ * is only usable until the next pm_read_view call. Only works if
+ * pm_is_local.
+ *
+ * Returns:
+ * 0 on EOF
+ * 1 if view points to the next block
+ * m | m < 0 on error (-ENOTSUP if the handle doesn't read locally)
+ */
+int pm_read_view(void *handle, pm_view_t *view);
+
+/*
+ * Returns true if the block view points to has not been overwritten (yet).
+ */
+bool pm_view_valid(void *handle, const pm_view_t *view);
+
+/*
+ * EVENT DRIVEN API
+ *
+ * Instead of blocking in pm_read, a handle created by pm_connect_async can be
+ * driven from an event loop: poll pm_fd(handle) for pm_poll_events(handle)
+ * and call pm_process(handle) whenever the descriptor is ready. Every block
+ * received is handed to the registered callbacks, so one thread can watch
+ * several daemons or several channel sets. Don't use pm_read or
+ * pm_read_many on such a handle. It always uses TCP, even for a local
+ * server.
+ */
+typedef struct {
+    /* a block was received, the buffers are only valid during the call */
+    void (*on_block)(void *user, const pm_block_t *block);
+    /* the block starting at timestamp_nanos didn't start where the previous
+     * block ended (at expected_nanos), samples have been lost */
+    void (*on_gap)(void *user,
+                   uint64_t expected_nanos,
+                   uint64_t timestamp_nanos);
+    /* the connection is gone (error is 0 on regular EOF), call pm_close */
+    void (*on_disconnect)(void *user, int error);
+} pm_callbacks_t;
+
+/*
+ * Like pm_connect but returns immediately, the connection is established
+ * and the channels are requested by subsequent pm_process calls.
+ *
+ * Returns:
+ * A handle if the server name could be resolved, NULL else
+ */
+void *pm_connect_async(char *server,
+                       char *port,
+                       unsigned int *channels,
+                       unsigned int num_channels);
+
+/*
+ * Returns the file descriptor to poll for the handle. It may change while
+ * connecting, so ask again before every poll.
+ */
+int pm_fd(void *handle);
+
+/*
+ * Returns the poll events (POLLIN or POLLOUT) pm_process is waiting for.
+ */
+short pm_poll_events(void *handle);
+
+/*
+ * Registers the callbacks (any of them may be NULL) and a user pointer that
+ * is passed to them.
+ */
+void pm_set_callbacks(void *handle,
+                      const pm_callbacks_t *callbacks,
+                      void *user);
+
+/*
+ * Makes progress on the connection without blocking and calls the
+ * callbacks for every complete block received.
+ *
+ * Returns:
+ * n | n >= 0 the number of blocks delivered
+ * -1 if the connection is gone (on_disconnect has been called)
+ */
+int pm_process(void *handle);
+
 /*
  * Closes the connection to the server and frees all allocated data
  */
 void pm_close(void *handle);
 
+/*
+ * Opens a socket for sending markers to the daemon on server, e.g. from the
+ * program under test where the phases of a benchmark begin. Close it with
+ * close(2).
+ *
+ * Returns:
+ * The socket or -1 if server can't be resolved
+ */
+int pm_marker_open(const char *server);
+
+/*
+ * Sends a marker with id and label (MARKER_LABEL_LEN characters at most,
+ * longer ones are cut, may be NULL). The daemon tells the clients
+ * which sample it arrived at. Markers are datagrams, they may get lost.
+ *
+ * Returns:
+ * 0 on success, -1 on error
+ */
+int pm_mark(int marker_fd, uint32_t id, const char *label);
+
 #endif
 /* vim: set fileencoding=utf8 : */
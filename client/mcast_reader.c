@@ -0,0 +1,561 @@
+/*
+ *  Library to read data from pm-lab-tools/daemon
+ *
+ *  Copyright (C)2011/12, Jonathan Dimond <jonny@dimond.de>
+ *                      & Johannes Weiß <uni@tux4u.de>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <math.h>
+#include <poll.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <utils.h>
+
+#include "mcast.h"
+#include "decode.h"
+#include "mcast_reader.h"
+
+/* blocks being reassembled at the same time */
+#define MCAST_ASSEMBLY_BLOCKS 4
+#define MCAST_RECV_BUFFER (4 * 1024 * 1024)
+/* a block that got no datagram for that long is repaired */
+#define MCAST_POLL_MS 500
+/* a daemon that sent nothing for that long is considered gone */
+#define MCAST_TIMEOUT_MS 5000
+#define MCAST_RETRANS_TIMEOUT_S 1
+
+typedef struct {
+    bool active;
+    uint64_t block;
+    uint64_t timestamp_nanos;
+    uint32_t sampling_rate;
+    uint32_t points_per_channel;
+    uint32_t num_fragments;
+    uint32_t missing;
+    uint8_t *have;      /* num_channels * num_fragments flags */
+    size_t have_size;
+    double *data;       /* one channel after the other */
+    size_t data_size;
+} assembly_t;
+
+struct mcast_reader {
+    unsigned int num_channels;
+    uint32_t *channels;
+    struct pollfd *poll_cfg;  /* one socket per channel */
+    char *server;
+    int retrans_fd;
+    pm_description_t description; /* of the block read last */
+
+    bool started;
+    uint64_t next_block;      /* the block to deliver next */
+    bool *seen;               /* per channel: got a datagram */
+    uint64_t *latest_block;   /* per channel: newest block seen */
+    uint64_t *next_seq;       /* per channel: next datagram expected */
+    uint32_t points_per_channel; /* of the block seen last */
+
+    assembly_t assembly[MCAST_ASSEMBLY_BLOCKS];
+    uint64_t lost_datagrams;
+    uint64_t lost_samples;
+};
+
+/*
+ * REASSEMBLY
+ */
+static assembly_t *slot(mcast_reader_t *r, uint64_t block) {
+    return &r->assembly[block % MCAST_ASSEMBLY_BLOCKS];
+}
+
+static bool assembling(mcast_reader_t *r, uint64_t block) {
+    const assembly_t *a = slot(r, block);
+    return a->active && a->block == block;
+}
+
+static void init_assembly(mcast_reader_t *r,
+                          assembly_t *a,
+                          const mcast_header_t *header) {
+    const size_t have_size = r->num_channels *
+                             mcast_num_fragments(header->points_per_channel);
+    const size_t data_size = r->num_channels * header->points_per_channel;
+
+    if(have_size > a->have_size) {
+        free(a->have);
+        a->have = malloc(have_size);
+        assert(NULL != a->have);
+        a->have_size = have_size;
+    }
+    if(data_size > a->data_size) {
+        free(a->data);
+        a->data = malloc(data_size * sizeof(double));
+        assert(NULL != a->data);
+        a->data_size = data_size;
+    }
+
+    a->active = true;
+    a->block = header->block;
+    a->timestamp_nanos = header->timestamp_nanos;
+    a->sampling_rate = header->sampling_rate;
+    a->points_per_channel = header->points_per_channel;
+    r->points_per_channel = header->points_per_channel;
+    a->num_fragments = mcast_num_fragments(header->points_per_channel);
+    a->missing = have_size;
+    memset(a->have, 0, have_size);
+}
+
+static void handle_datagram(mcast_reader_t *r,
+                            unsigned int idx,
+                            const uint8_t *buf,
+                            size_t len,
+                            bool retransmitted) {
+    const uint8_t *samples;
+    mcast_header_t header;
+    assembly_t *a;
+    uint8_t *have;
+
+    samples = mcast_unpack(buf, len, &header);
+    if(NULL == samples || header.channel != r->channels[idx]) {
+        return;
+    }
+
+    if(!retransmitted) {
+        if(r->seen[idx] && header.seq > r->next_seq[idx]) {
+            r->lost_datagrams += header.seq - r->next_seq[idx];
+        }
+        if(!r->seen[idx] || header.seq >= r->next_seq[idx]) {
+            r->next_seq[idx] = header.seq + 1;
+        }
+        if(!r->seen[idx] || header.block > r->latest_block[idx]) {
+            r->latest_block[idx] = header.block;
+        }
+        r->seen[idx] = true;
+    }
+
+    if(!r->started) {
+        r->started = true;
+        r->next_block = header.block;
+        decode_default_description(header.sampling_rate,
+                                   r->channels,
+                                   r->num_channels,
+                                   &r->description);
+    }
+
+    if(header.block < r->next_block ||
+       header.block >= r->next_block + MCAST_ASSEMBLY_BLOCKS) {
+        /* too old or too far ahead, the latter will be retransmitted */
+        return;
+    }
+
+    a = slot(r, header.block);
+    if(!assembling(r, header.block)) {
+        init_assembly(r, a, &header);
+    } else if(header.points_per_channel != a->points_per_channel) {
+        return;
+    }
+
+    have = &a->have[idx * a->num_fragments + header.fragment];
+    if(*have) {
+        return;
+    }
+    mcast_get_samples(a->data + idx * a->points_per_channel +
+                      header.fragment * MCAST_SAMPLES_PER_DATAGRAM,
+                      samples,
+                      header.num_samples);
+    *have = 1;
+    a->missing--;
+}
+
+static void receive_datagrams(mcast_reader_t *r) {
+    uint8_t buf[MCAST_MAX_DATAGRAM];
+    ssize_t res;
+
+    for(unsigned int i = 0; i < r->num_channels; i++) {
+        if(0 == (r->poll_cfg[i].revents & POLLIN)) {
+            continue;
+        }
+        while(0 < (res = recv(r->poll_cfg[i].fd, buf, sizeof(buf),
+                              MSG_DONTWAIT))) {
+            handle_datagram(r, i, buf, res, false);
+        }
+    }
+}
+
+/*
+ * RETRANSMISSION
+ */
+static int connect_retrans(mcast_reader_t *r) {
+    struct addrinfo hints = { 0 };
+    struct addrinfo *result, *rp;
+    struct timeval timeout = { MCAST_RETRANS_TIMEOUT_S, 0 };
+    char port[16];
+    int fd = -1;
+
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    snprintf(port, sizeof(port), "%u", MCAST_RETRANS_PORT);
+    if(0 != getaddrinfo(r->server, port, &hints, &result)) {
+        return -1;
+    }
+
+    for(rp = result; NULL != rp; rp = rp->ai_next) {
+        fd = socket(rp->ai_family, rp->ai_socktype, rp->ai_protocol);
+        if(0 > fd) {
+            continue;
+        }
+        if(0 == connect(fd, rp->ai_addr, rp->ai_addrlen)) {
+            break;
+        }
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(result);
+
+    if(0 <= fd) {
+        /* never wait long for the daemon, the samples will just be NaN */
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    }
+    return fd;
+}
+
+static int request_fragments(mcast_reader_t *r,
+                             unsigned int idx,
+                             const mcast_request_t *request) {
+    uint8_t buf[MCAST_REQUEST_SIZE];
+    uint8_t datagram[MCAST_MAX_DATAGRAM];
+    uint32_t net_len, len;
+
+    mcast_pack_request(buf, request);
+    if(sizeof(buf) != full_write(r->retrans_fd, (char *)buf, sizeof(buf))) {
+        return -1;
+    }
+
+    while(true) {
+        if(sizeof(uint32_t) != full_read(r->retrans_fd,
+                                         (char *)&net_len,
+                                         sizeof(uint32_t))) {
+            return -1;
+        }
+        len = ntohl(net_len);
+        if(0 == len) {
+            return 0;
+        } else if(len > sizeof(datagram) ||
+                  len != full_read(r->retrans_fd, (char *)datagram, len)) {
+            return -1;
+        }
+        handle_datagram(r, idx, datagram, len, true);
+    }
+}
+
+/* asks the daemon for everything missing in the next block */
+static void repair(mcast_reader_t *r) {
+    const uint64_t block = r->next_block;
+    mcast_request_t request;
+
+    if(0 > r->retrans_fd) {
+        r->retrans_fd = connect_retrans(r);
+        if(0 > r->retrans_fd) {
+            return;
+        }
+    }
+
+    for(unsigned int i = 0; i < r->num_channels; i++) {
+        request.block = block;
+        request.channel = r->channels[i];
+        request.first_fragment = 0;
+        request.num_fragments = MCAST_ALL_FRAGMENTS;
+
+        if(assembling(r, block)) {
+            const assembly_t *a = slot(r, block);
+            const uint8_t *have = a->have + i * a->num_fragments;
+            uint32_t first = 0, last = a->num_fragments;
+
+            while(first < a->num_fragments && have[first]) {
+                first++;
+            }
+            while(last > first && have[last - 1]) {
+                last--;
+            }
+            if(first == last) {
+                continue;
+            }
+            request.first_fragment = first;
+            request.num_fragments = last - first;
+        }
+
+        if(0 != request_fragments(r, i, &request)) {
+            close(r->retrans_fd);
+            r->retrans_fd = -1;
+            return;
+        }
+    }
+}
+
+/*
+ * Repairs the next block if necessary. Returns false if it's lost entirely
+ * (and skips it).
+ */
+static bool finish_block(mcast_reader_t *r) {
+    assembly_t *a = slot(r, r->next_block);
+
+    if(!assembling(r, r->next_block) || a->missing > 0) {
+        repair(r);
+    }
+
+    if(!assembling(r, r->next_block)) {
+        /* not a single datagram, assume it was as large as the last one */
+        r->lost_samples += r->num_channels * r->points_per_channel;
+        r->next_block++;
+        return false;
+    }
+
+    for(unsigned int i = 0; 0 < a->missing && i < r->num_channels; i++) {
+        for(uint32_t f = 0; f < a->num_fragments; f++) {
+            const uint32_t first = f * MCAST_SAMPLES_PER_DATAGRAM;
+            uint32_t n = a->points_per_channel - first;
+
+            if(a->have[i * a->num_fragments + f]) {
+                continue;
+            }
+            if(n > MCAST_SAMPLES_PER_DATAGRAM) {
+                n = MCAST_SAMPLES_PER_DATAGRAM;
+            }
+            for(uint32_t s = 0; s < n; s++) {
+                a->data[i * a->points_per_channel + first + s] = NAN;
+            }
+            r->lost_samples += n;
+            a->missing--;
+        }
+    }
+
+    return true;
+}
+
+/* true if the next block is complete or won't get any more datagrams */
+static bool block_done(mcast_reader_t *r) {
+    bool all_past = true;
+
+    if(assembling(r, r->next_block) &&
+       0 == slot(r, r->next_block)->missing) {
+        return true;
+    }
+
+    for(unsigned int i = 0; i < r->num_channels; i++) {
+        if(!r->seen[i] || r->latest_block[i] <= r->next_block) {
+            all_past = false;
+        } else if(r->latest_block[i] >=
+                  r->next_block + MCAST_ASSEMBLY_BLOCKS - 1) {
+            /* running out of room for the blocks to come */
+            return true;
+        }
+    }
+
+    return all_past;
+}
+
+/*
+ * FUNCTIONALITY
+ */
+mcast_reader_t *mcast_reader_open(const char *server,
+                                  const char *group,
+                                  const uint32_t *channels,
+                                  unsigned int num_channels) {
+    struct sockaddr_in addr;
+    struct ip_mreq mreq;
+    int sock_opt;
+    int err, waited_ms;
+    mcast_reader_t *r = calloc(1, sizeof(*r));
+    assert(NULL != r);
+
+    r->num_channels = num_channels;
+    r->retrans_fd = -1;
+    r->server = strdup(server);
+    r->channels = malloc(num_channels * sizeof(uint32_t));
+    r->poll_cfg = calloc(num_channels, sizeof(struct pollfd));
+    r->seen = calloc(num_channels, sizeof(bool));
+    r->latest_block = calloc(num_channels, sizeof(uint64_t));
+    r->next_seq = calloc(num_channels, sizeof(uint64_t));
+    assert(NULL != r->server && NULL != r->channels &&
+           NULL != r->poll_cfg && NULL != r->seen &&
+           NULL != r->latest_block && NULL != r->next_seq);
+    memcpy(r->channels, channels, num_channels * sizeof(uint32_t));
+    for(unsigned int i = 0; i < num_channels; i++) {
+        r->poll_cfg[i].fd = -1;
+    }
+
+    memset(&mreq, 0, sizeof(mreq));
+    if(1 != inet_pton(AF_INET, group, &mreq.imr_multiaddr)) {
+        goto err;
+    }
+    mreq.imr_interface.s_addr = htonl(INADDR_ANY);
+
+    for(unsigned int i = 0; i < num_channels; i++) {
+        const int fd = socket(AF_INET, SOCK_DGRAM, 0);
+        if(0 > fd) {
+            goto err;
+        }
+        r->poll_cfg[i].fd = fd;
+        r->poll_cfg[i].events = POLLIN;
+
+        /* other clients on this host listen as well */
+        sock_opt = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &sock_opt, sizeof(sock_opt));
+        sock_opt = MCAST_RECV_BUFFER;
+        setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &sock_opt, sizeof(sock_opt));
+
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_ANY);
+        addr.sin_port = htons(MCAST_DATA_PORT + channels[i]);
+        if(0 != bind(fd, (struct sockaddr *)&addr, sizeof(addr)) ||
+           0 != setsockopt(fd, IPPROTO_IP, IP_ADD_MEMBERSHIP,
+                           &mreq, sizeof(mreq))) {
+            goto err;
+        }
+    }
+
+    /* the sampling rate comes with the first datagram */
+    for(waited_ms = 0; !r->started && waited_ms < MCAST_TIMEOUT_MS;
+        waited_ms += MCAST_POLL_MS) {
+        err = poll(r->poll_cfg, num_channels, MCAST_POLL_MS);
+        if(0 < err) {
+            receive_datagrams(r);
+        }
+    }
+    if(!r->started) {
+        goto err;
+    }
+
+    return r;
+
+err:
+    mcast_reader_close(r);
+    return NULL;
+}
+
+const pm_description_t *mcast_reader_describe(mcast_reader_t *r) {
+    return &r->description;
+}
+
+int mcast_reader_read(mcast_reader_t *r,
+                      size_t buffer_sizes,
+                      double *analog_data,
+                      unsigned int *samples_read,
+                      uint64_t *timestamp_nanos,
+                      bool block) {
+    unsigned int idle_ms = 0;
+    assembly_t *a;
+    int err;
+
+    while(true) {
+        if(block_done(r)) {
+            if(!finish_block(r)) {
+                continue;
+            }
+            break;
+        }
+
+        err = poll(r->poll_cfg, r->num_channels, block ? MCAST_POLL_MS : 0);
+        if(0 > err && EINTR == errno) {
+            continue;
+        } else if(0 > err) {
+            return -errno;
+        } else if(0 < err) {
+            idle_ms = 0;
+            receive_datagrams(r);
+            continue;
+        }
+
+        if(!block) {
+            return -EAGAIN;
+        }
+        if(assembling(r, r->next_block)) {
+            /* the rest of the block got lost, repair what we have */
+            if(finish_block(r)) {
+                break;
+            }
+            continue;
+        }
+        idle_ms += MCAST_POLL_MS;
+        if(idle_ms >= MCAST_TIMEOUT_MS) {
+            return 0;
+        }
+    }
+
+    a = slot(r, r->next_block);
+    assert(buffer_sizes >= r->num_channels * a->points_per_channel);
+    if(NULL != analog_data) {
+        memcpy(analog_data,
+               a->data,
+               r->num_channels * a->points_per_channel * sizeof(double));
+    }
+    if(NULL != samples_read) {
+        *samples_read = a->points_per_channel;
+    }
+    if(NULL != timestamp_nanos) {
+        *timestamp_nanos = a->timestamp_nanos;
+    }
+    if(a->sampling_rate != r->description.sampling_rate) {
+        r->description.sampling_rate = a->sampling_rate;
+        r->description.block_size = a->sampling_rate;
+        r->description.generation++;
+    }
+    a->active = false;
+    r->next_block++;
+
+    return r->num_channels * a->points_per_channel * sizeof(double);
+}
+
+void mcast_reader_losses(mcast_reader_t *r,
+                         uint64_t *lost_datagrams,
+                         uint64_t *lost_samples) {
+    *lost_datagrams = r->lost_datagrams;
+    *lost_samples = r->lost_samples;
+}
+
+void mcast_reader_close(mcast_reader_t *r) {
+    for(unsigned int i = 0; i < r->num_channels; i++) {
+        if(0 <= r->poll_cfg[i].fd) {
+            close(r->poll_cfg[i].fd);
+        }
+    }
+    if(0 <= r->retrans_fd) {
+        close(r->retrans_fd);
+    }
+    for(int i = 0; i < MCAST_ASSEMBLY_BLOCKS; i++) {
+        free(r->assembly[i].have);
+        free(r->assembly[i].data);
+    }
+    free(r->server);
+    free(r->channels);
+    free(r->poll_cfg);
+    free(r->seen);
+    free(r->latest_block);
+    free(r->next_seq);
+    free(r);
+}
+/* vim: set fileencoding=utf8 : */
@@ -0,0 +1,70 @@
+/*
+ *  Library to read data from pm-lab-tools/daemon
+ *
+ *  Copyright (C)2011/12, Jonathan Dimond <jonny@dimond.de>
+ *                      & Johannes Weiß <uni@tux4u.de>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MCAST_READER_H
+#define MCAST_READER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef struct mcast_reader mcast_reader_t;
+
+/*
+ * Joins the multicast group for the channels and waits for the first
+ * datagram. Lost datagrams are requested from server. Returns NULL if the
+ * group can't be joined or nothing arrives.
+ */
+mcast_reader_t *mcast_reader_open(const char *server,
+                                  const char *group,
+                                  const uint32_t *channels,
+                                  unsigned int num_channels);
+
+/*
+ * The description of the block read last. The datagrams only carry the
+ * sampling rate, the generation changes with it.
+ */
+const pm_description_t *mcast_reader_describe(mcast_reader_t *reader);
+
+/*
+ * Reassembles the next block just like pm_read. Samples that couldn't be
+ * recovered are NaN, blocks that couldn't be recovered at all are skipped
+ * (so the timestamps jump). Returns the number of bytes copied, 0 if the
+ * daemon has been silent for a while and -EAGAIN if block is false and the
+ * next block isn't complete yet.
+ */
+int mcast_reader_read(mcast_reader_t *reader,
+                      size_t buffer_sizes,
+                      double *analog_data,
+                      unsigned int *samples_read,
+                      uint64_t *timestamp_nanos,
+                      bool block);
+
+/*
+ * Datagrams lost on the network and samples that couldn't be retransmitted.
+ */
+void mcast_reader_losses(mcast_reader_t *reader,
+                         uint64_t *lost_datagrams,
+                         uint64_t *lost_samples);
+
+void mcast_reader_close(mcast_reader_t *reader);
+
+#endif
+/* vim: set fileencoding=utf8 : */
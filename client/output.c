@@ -0,0 +1,353 @@
+/*
+ *  Reads and prints data from pm-lab-tools/daemon
+ *
+ *  Copyright (C)2011/12, Jonathan Dimond <jonny@dimond.de>
+ *                      & Johannes Weiß <uni@tux4u.de>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <assert.h>
+#include <unistd.h>
+#include <math.h>
+
+#include <utils.h>
+
+#include "output.h"
+
+#define OUTPUT_BUFFER_SIZE (1024 * 1024)
+/* longest "%f" of a double plus separator */
+#define MAX_VALUE_LEN 330
+/* values at least this large are formatted by snprintf */
+#define FIXED_LIMIT 1e12
+
+struct output {
+    output_format_t format;
+    int fd;
+    FILE *file;
+    unsigned int num_channels;
+    bool failed;
+
+    char *buffer;
+    size_t buffer_used;
+};
+
+int output_parse_format(const char *name, output_format_t *format) {
+    if(0 == strcmp("text", name)) {
+        *format = OUTPUT_TEXT;
+    } else if(0 == strcmp("fast", name)) {
+        *format = OUTPUT_FAST_TEXT;
+    } else if(0 == strcmp("raw", name)) {
+        *format = OUTPUT_RAW;
+    } else if(0 == strcmp("columnar", name)) {
+        *format = OUTPUT_COLUMNAR;
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * BUFFER MANAGEMENT
+ */
+static void flush(output_t *out) {
+    ssize_t err;
+
+    if(0 == out->buffer_used || out->failed) {
+        out->buffer_used = 0;
+        return;
+    }
+
+    err = full_write(out->fd, out->buffer, out->buffer_used);
+    if(err != out->buffer_used) {
+        out->failed = true;
+    }
+    out->buffer_used = 0;
+}
+
+static char *reserve(output_t *out, size_t len) {
+    assert(len <= OUTPUT_BUFFER_SIZE);
+
+    if(OUTPUT_BUFFER_SIZE - out->buffer_used < len) {
+        flush(out);
+    }
+    return out->buffer + out->buffer_used;
+}
+
+static void put_le32(output_t *out, uint32_t value) {
+    unsigned char *p = (unsigned char *)reserve(out, sizeof(value));
+
+    for(int i = 0; i < sizeof(value); i++) {
+        p[i] = (value >> (8 * i)) & 0xff;
+    }
+    out->buffer_used += sizeof(value);
+}
+
+static void put_le64(output_t *out, uint64_t value) {
+    unsigned char *p = (unsigned char *)reserve(out, sizeof(value));
+
+    for(int i = 0; i < sizeof(value); i++) {
+        p[i] = (value >> (8 * i)) & 0xff;
+    }
+    out->buffer_used += sizeof(value);
+}
+
+static void put_double(output_t *out, double value) {
+    uint64_t bits;
+
+    memcpy(&bits, &value, sizeof(bits));
+    put_le64(out, bits);
+}
+
+/* writes s NUL padded to len bytes */
+static void put_string(output_t *out, const char *s, size_t len) {
+    char *p = reserve(out, len);
+
+    strncpy(p, s, len);
+    out->buffer_used += len;
+}
+
+/*
+ * FIXED-POINT TEXT
+ */
+
+/* formats value like printf("%f") does, returns the end of the string */
+static char *format_fixed6(char *p, double value) {
+    char digits[24];
+    int n = 0;
+    uint64_t scaled;
+    uint64_t integral;
+    uint32_t fraction;
+
+    if(!(value > -FIXED_LIMIT && value < FIXED_LIMIT)) {
+        /* large, infinite or NaN */
+        return p + snprintf(p, MAX_VALUE_LEN, "%f", value);
+    }
+
+    if(signbit(value)) {
+        *p++ = '-';
+        value = -value;
+    }
+
+    scaled = (uint64_t)(value * 1e6 + 0.5);
+    integral = scaled / 1000000;
+    fraction = scaled % 1000000;
+
+    do {
+        digits[n++] = '0' + integral % 10;
+        integral /= 10;
+    } while(integral > 0);
+    while(n > 0) {
+        *p++ = digits[--n];
+    }
+
+    *p++ = '.';
+    for(int i = 5; i >= 0; i--) {
+        p[i] = '0' + fraction % 10;
+        fraction /= 10;
+    }
+
+    return p + 6;
+}
+
+static void write_fast_text(output_t *out, const pm_block_t *block) {
+    const unsigned int samples = block->samples_read;
+
+    for(unsigned int i = 0; i < samples; i++) {
+        const double ts = (double)block->timestamp_nanos/1000000000L +
+                          (i/(double)block->sampling_rate);
+        char *start = reserve(out, (out->num_channels + 1) * MAX_VALUE_LEN);
+        char *p = format_fixed6(start, ts);
+
+        for(unsigned int j = 0; j < out->num_channels; j++) {
+            *p++ = ' ';
+            p = format_fixed6(p, block->analog_data[i + j*samples]);
+        }
+        *p++ = '\n';
+        out->buffer_used += p - start;
+    }
+}
+
+static void write_text(output_t *out, const pm_block_t *block) {
+    const unsigned int samples = block->samples_read;
+
+    for(unsigned int i = 0; i < samples; i++) {
+        const double ts = (double)block->timestamp_nanos/1000000000L +
+                          (i/(double)block->sampling_rate);
+        fprintf(out->file, "%f", ts);
+        for(unsigned int j = 0; j < out->num_channels; j++) {
+            fprintf(out->file, " %f", block->analog_data[i + j*samples]);
+        }
+        fprintf(out->file, "\n");
+    }
+    if(ferror(out->file)) {
+        out->failed = true;
+    }
+}
+
+/*
+ * BINARY
+ */
+static void write_raw(output_t *out, const pm_block_t *block) {
+    const unsigned int samples = block->samples_read;
+
+    for(unsigned int i = 0; i < samples; i++) {
+        put_double(out, (double)block->timestamp_nanos/1000000000L +
+                        (i/(double)block->sampling_rate));
+        for(unsigned int j = 0; j < out->num_channels; j++) {
+            put_double(out, block->analog_data[i + j*samples]);
+        }
+    }
+}
+
+static void write_columnar(output_t *out, const pm_block_t *block) {
+    const size_t values = block->samples_read * out->num_channels;
+    ssize_t err;
+
+    for(unsigned int i = 0; i < block->num_markers; i++) {
+        put_le32(out, OUTPUT_RECORD_MARKER);
+        put_le64(out, block->markers[i].timestamp_nanos);
+        put_le32(out, block->markers[i].id);
+        put_le32(out, block->markers[i].sample);
+        put_string(out, block->markers[i].label, MARKER_LABEL_LEN);
+    }
+
+    put_le32(out, OUTPUT_RECORD_BLOCK);
+    put_le64(out, block->timestamp_nanos);
+    put_le32(out, block->samples_read);
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    /* the channels already are in the file's layout, write them in one go */
+    flush(out);
+    if(!out->failed) {
+        err = full_write(out->fd,
+                         (const char *)block->analog_data,
+                         values * sizeof(double));
+        if(err != values * sizeof(double)) {
+            out->failed = true;
+        }
+    }
+#else
+    (void)err;
+    for(size_t i = 0; i < values; i++) {
+        put_double(out, block->analog_data[i]);
+    }
+#endif
+}
+
+/*
+ * FUNCTIONALITY
+ */
+output_t *output_open(output_format_t format,
+                      int fd,
+                      unsigned int num_channels,
+                      const uint32_t *channels) {
+    output_t *out = calloc(1, sizeof(*out));
+    assert(NULL != out);
+
+    out->format = format;
+    out->fd = fd;
+    out->num_channels = num_channels;
+
+    if(OUTPUT_TEXT == format) {
+        out->file = fdopen(dup(fd), "w");
+        assert(NULL != out->file);
+        return out;
+    }
+
+    out->buffer = calloc(1, OUTPUT_BUFFER_SIZE);
+    assert(NULL != out->buffer);
+
+    if(OUTPUT_COLUMNAR == format) {
+        memcpy(reserve(out, strlen(OUTPUT_COLUMNAR_MAGIC)),
+               OUTPUT_COLUMNAR_MAGIC,
+               strlen(OUTPUT_COLUMNAR_MAGIC));
+        out->buffer_used += strlen(OUTPUT_COLUMNAR_MAGIC);
+        put_le32(out, OUTPUT_COLUMNAR_VERSION);
+        put_le32(out, num_channels);
+        for(unsigned int i = 0; i < num_channels; i++) {
+            put_le32(out, channels[i]);
+        }
+    }
+
+    return out;
+}
+
+int output_describe(output_t *out, const pm_description_t *description) {
+    const pm_description_t *d = description;
+
+    if(OUTPUT_COLUMNAR != out->format) {
+        return out->failed ? -1 : 0;
+    }
+    assert(d->num_channels == out->num_channels);
+
+    put_le32(out, OUTPUT_RECORD_DESCRIPTION);
+    put_le32(out, d->protocol_version);
+    put_le64(out, d->generation);
+    put_le32(out, d->sampling_rate);
+    put_le32(out, d->block_size);
+    put_string(out, d->encoding, sizeof(d->encoding));
+    put_string(out, d->unit, sizeof(d->unit));
+    put_double(out, d->range_min);
+    put_double(out, d->range_max);
+    for(unsigned int i = 0; i < d->num_channels; i++) {
+        put_string(out, d->channel_names[i], PM_DESCRIPTION_NAME_LEN);
+        put_double(out, d->scale[i]);
+        put_double(out, d->offset[i]);
+    }
+
+    return out->failed ? -1 : 0;
+}
+
+int output_block(output_t *out, const pm_block_t *block) {
+    switch(out->format) {
+        case OUTPUT_TEXT:
+            write_text(out, block);
+            break;
+        case OUTPUT_FAST_TEXT:
+            write_fast_text(out, block);
+            break;
+        case OUTPUT_RAW:
+            write_raw(out, block);
+            break;
+        case OUTPUT_COLUMNAR:
+            write_columnar(out, block);
+            break;
+    }
+
+    return out->failed ? -1 : 0;
+}
+
+int output_close(output_t *out) {
+    int ret;
+
+    if(NULL != out->file) {
+        if(0 != fclose(out->file)) {
+            out->failed = true;
+        }
+    } else {
+        flush(out);
+    }
+    ret = out->failed ? -1 : 0;
+
+    free(out->buffer);
+    free(out);
+
+    return ret;
+}
+/* vim: set fileencoding=utf8 : */
@@ -0,0 +1,120 @@
+/*
+ *  Reads and prints data from pm-lab-tools/daemon
+ *
+ *  Copyright (C)2011/12, Jonathan Dimond <jonny@dimond.de>
+ *                      & Johannes Weiß <uni@tux4u.de>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include <stdint.h>
+
+#include "libpmlab.h"
+
+/*
+ * Output formats of pmlabclient:
+ *
+ * OUTPUT_TEXT: one line per sample, "TIMESTAMP VALUE..." formatted with
+ *              printf("%f")
+ * OUTPUT_FAST_TEXT: the same text, formatted by a fixed-point formatter into
+ *                   a large buffer
+ * OUTPUT_RAW: the same rows as little-endian float64, TIMESTAMP first, i.e.
+ *             num_channels+1 doubles per sample
+ * OUTPUT_COLUMNAR: a typed, little-endian file that needs no knowledge of
+ *                  the daemon's configuration to be read:
+ *                  header: "PMLABCOL", uint32 version (3),
+ *                          uint32 num_channels,
+ *                          uint32 channel id (num_channels times)
+ *                  then records, each starting with its uint32 type:
+ *                  OUTPUT_RECORD_DESCRIPTION (before the first block and
+ *                  whenever the daemon is reconfigured, see
+ *                  pm_description_t):
+ *                          uint32 protocol version, uint64 generation,
+ *                          uint32 sampling rate, uint32 block size,
+ *                          char encoding[16], char unit[8],
+ *                          float64 range_min, float64 range_max,
+ *                          then for every channel: char name[32],
+ *                          float64 scale, float64 offset
+ *                  OUTPUT_RECORD_MARKER (before the block it came
+ *                  with, see pm_marker_t):
+ *                          uint64 timestamp_nanos, uint32 id,
+ *                          uint32 sample in the block, char label[24]
+ *                  OUTPUT_RECORD_BLOCK: uint64 timestamp_nanos,
+ *                          uint32 samples per channel,
+ *                          float64 samples of the first channel, ...,
+ *                          float64 samples of the last channel
+ *                  Strings are NUL padded. client/columnar.py reads it,
+ *                  version 2 files lack the markers.
+ */
+typedef enum {
+    OUTPUT_TEXT,
+    OUTPUT_FAST_TEXT,
+    OUTPUT_RAW,
+    OUTPUT_COLUMNAR
+} output_format_t;
+
+#define OUTPUT_COLUMNAR_MAGIC "PMLABCOL"
+#define OUTPUT_COLUMNAR_VERSION 3
+#define OUTPUT_RECORD_DESCRIPTION 1
+#define OUTPUT_RECORD_BLOCK 2
+#define OUTPUT_RECORD_MARKER 3
+
+typedef struct output output_t;
+
+/*
+ * Parses a format name (text, fast, raw or columnar).
+ *
+ * Returns:
+ * 0 on success, -1 if the name is unknown
+ */
+int output_parse_format(const char *name, output_format_t *format);
+
+/*
+ * Starts writing the given format to fd, writes the header if any.
+ */
+output_t *output_open(output_format_t format,
+                      int fd,
+                      unsigned int num_channels,
+                      const uint32_t *channels);
+
+/*
+ * Records the description of the blocks that follow (columnar only, the
+ * other formats take the sampling rate from every block).
+ *
+ * Returns:
+ * 0 on success, -1 on write errors
+ */
+int output_describe(output_t *out, const pm_description_t *description);
+
+/*
+ * Writes one block as received by pm_read_many.
+ *
+ * Returns:
+ * 0 on success, -1 on write errors
+ */
+int output_block(output_t *out, const pm_block_t *block);
+
+/*
+ * Flushes all buffered output and frees out.
+ *
+ * Returns:
+ * 0 on success, -1 on write errors
+ */
+int output_close(output_t *out);
+
+#endif
+/* vim: set fileencoding=utf8 : */
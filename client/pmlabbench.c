@@ -0,0 +1,648 @@
+/*
+ *  Benchmarks pm-lab-tools/daemon with many clients
+ *
+ *  Copyright (C)2011/12, Jonathan Dimond <jonny@dimond.de>
+ *                      & Johannes Weiß <uni@tux4u.de>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Starts the daemon (built with `build.sh -n', so it sends test data) or
+ * uses a running one, forks CLIENTS processes reading different channel
+ * selections with libpmlab for SECONDS and writes the results as one JSON
+ * object:
+ *
+ *  - samples per second received by all clients together,
+ *  - per client: channels, transport, samples per second, lost blocks
+ *    (the blocks missing in the gaps between timestamps),
+ *    percentiles of the lag behind the sample clock (the arrival time of a
+ *    block minus its timestamp, relative to the block that arrived with the
+ *    least lag), CPU time and maximum RSS,
+ *  - the CPU time and maximum RSS of the daemon if it was started here,
+ *  - the daemon's counters (blocks, drops, pipeline) from its metrics port.
+ *
+ * Client i reads 1 + i % CHANNELS consecutive channels starting at 3 * i
+ * (modulo the channels the daemon has), so the clients mix selections the
+ * pipeline encodes for separately and shared ones.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <netdb.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <signal.h>
+#include <string.h>
+#include <assert.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+
+#include <utils.h>
+
+#include "libpmlab.h"
+#include "channels.h"
+
+/* buffers, have to be large enough to read from the network */
+#define BUFFER_SIZES  PM_MAX_BLOCK_SAMPLES
+/* channels per client at most by default */
+#define DEFAULT_CHANNELS 8
+/* lag samples per client at most, one per block */
+#define MAX_LAGS 4096
+/* the daemon's metrics and control ports (daemon/stats.h, control.h) */
+#define METRICS_PORT "12346"
+#define CONTROL_PORT "12347"
+/* time the daemon gets to accept connections */
+#define STARTUP_TIMEOUT_S 10
+#define METRICS_SIZE (256 * 1024)
+
+#define TIME_S 1000000000ULL
+
+typedef struct {
+    uint64_t samples;        /* of all channels */
+    uint64_t blocks;
+    uint64_t lost_blocks;    /* missing between the timestamps */
+    uint64_t nanos;          /* from the first to the last block */
+    uint64_t lag_p50;
+    uint64_t lag_p90;
+    uint64_t lag_p99;
+    uint64_t lag_max;
+    uint32_t sampling_rate;  /* of the last block */
+    bool local;
+    bool connected;
+    bool closed_early;       /* the daemon dropped us */
+} client_result_t;
+
+typedef struct {
+    pid_t pid;
+    int result_fd;
+    unsigned int num_channels;
+    uint32_t channels[MAX_CHANNELS];
+    client_result_t result;
+    struct rusage usage;
+} client_t;
+
+static double analog_data[BUFFER_SIZES];
+
+static uint64_t now_nanos(void) {
+    struct timespec ts;
+    int err = clock_gettime(CLOCK_MONOTONIC, &ts);
+    assert(0 == err);
+    return ((uint64_t)ts.tv_sec) * TIME_S + (uint64_t)ts.tv_nsec;
+}
+
+static int compare_u64(const void *a, const void *b) {
+    const uint64_t x = *(const uint64_t *)a;
+    const uint64_t y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+static double cpu_seconds(const struct rusage *usage) {
+    return usage->ru_utime.tv_sec + usage->ru_stime.tv_sec +
+           (usage->ru_utime.tv_usec + usage->ru_stime.tv_usec) / 1e6;
+}
+
+/*
+ * SOCKETS
+ */
+static int tcp_connect(const char *server, const char *port) {
+    struct addrinfo hints = { .ai_family = AF_UNSPEC,
+                              .ai_socktype = SOCK_STREAM };
+    struct addrinfo *res, *ai;
+    int fd = -1;
+
+    if (0 != getaddrinfo(server, port, &hints, &res)) {
+        return -1;
+    }
+    for (ai = res; NULL != ai; ai = ai->ai_next) {
+        fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (0 > fd) {
+            continue;
+        }
+        if (0 == connect(fd, ai->ai_addr, ai->ai_addrlen)) {
+            break;
+        }
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(res);
+
+    return fd;
+}
+
+/* sends one request and reads the answer until the server closes or the
+ * first line is complete (one_line) */
+static ssize_t request(const char *server, const char *port,
+                       const char *req, char *answer, size_t size,
+                       bool one_line) {
+    size_t len = 0;
+    ssize_t res;
+    int fd = tcp_connect(server, port);
+
+    if (0 > fd) {
+        return -1;
+    }
+    if ((ssize_t)strlen(req) != full_write(fd, req, strlen(req))) {
+        close(fd);
+        return -1;
+    }
+    while (len + 1 < size) {
+        res = read(fd, answer + len, size - len - 1);
+        if (0 > res && EINTR == errno) {
+            continue;
+        } else if (0 >= res) {
+            break;
+        }
+        len += res;
+        answer[len] = '\0';
+        if (one_line && NULL != strchr(answer, '\n')) {
+            break;
+        }
+    }
+    answer[len] = '\0';
+    close(fd);
+
+    return len;
+}
+
+/* the value of an unlabelled Prometheus sample or -1 */
+static double metric(const char *metrics, const char *name) {
+    const size_t len = strlen(name);
+    const char *cur = metrics;
+
+    while (NULL != cur && '\0' != *cur) {
+        if (0 == strncmp(cur, name, len) && ' ' == cur[len]) {
+            return atof(cur + len + 1);
+        }
+        cur = strchr(cur, '\n');
+        if (NULL != cur) {
+            cur++;
+        }
+    }
+    return -1;
+}
+
+/*
+ * DAEMON
+ */
+static pid_t start_daemon(const char *daemon,
+                          const char *port,
+                          const char *physical_channels) {
+    uint64_t deadline = now_nanos() + STARTUP_TIMEOUT_S * TIME_S;
+    int fd, devnull;
+    pid_t pid = fork();
+    assert(0 <= pid);
+
+    if (0 == pid) {
+        /* the daemon logs every block */
+        devnull = open("/dev/null", O_WRONLY);
+        if (0 <= devnull) {
+            dup2(devnull, STDOUT_FILENO);
+            close(devnull);
+        }
+        if (NULL != physical_channels) {
+            execl(daemon, daemon, "-c", physical_channels, (char *)NULL);
+        } else {
+            execl(daemon, daemon, (char *)NULL);
+        }
+        fprintf(stderr, "exec %s: %s\n", daemon, strerror(errno));
+        _exit(EXIT_FAILURE);
+    }
+
+    while (now_nanos() < deadline) {
+        fd = tcp_connect("localhost", port);
+        if (0 <= fd) {
+            /* not requesting any channels, the handler just goes away */
+            close(fd);
+            return pid;
+        }
+        if (0 != waitpid(pid, NULL, WNOHANG)) {
+            return -1;
+        }
+        usleep(100 * 1000);
+    }
+
+    kill(pid, SIGKILL);
+    waitpid(pid, NULL, 0);
+    return -1;
+}
+
+static void stop_daemon(pid_t pid, struct rusage *usage) {
+    int status;
+
+    kill(pid, SIGINT);
+    while (0 > wait4(pid, &status, 0, usage) && EINTR == errno) {
+        /* again */
+    }
+}
+
+/*
+ * CLIENTS
+ */
+static void run_client(char *server, char *port, client_t *c,
+                       unsigned int seconds, int result_fd) {
+    client_result_t *r = &c->result;
+    pm_block_t block;
+    uint64_t *lags = calloc(MAX_LAGS, sizeof(*lags));
+    unsigned int num_lags = 0;
+    uint64_t first_arrival = 0, last_arrival = 0, expected_ts = 0;
+    uint64_t arrival, lag, min_lag = UINT64_MAX;
+    uint64_t block_nanos = 0, gap;
+    void *pm_handle;
+    int n;
+    assert(NULL != lags);
+
+    memset(r, 0, sizeof(*r));
+    pm_handle = pm_connect(server, port, c->channels, c->num_channels);
+    if (NULL != pm_handle) {
+        r->connected = true;
+        r->local = pm_is_local(pm_handle);
+
+        block.analog_data = analog_data;
+        block.digital_data = NULL;
+
+        /* one block per call, blocks read together would share an arrival
+         * time and the later ones would look early */
+        while (0 == r->blocks ||
+               last_arrival - first_arrival < seconds * TIME_S) {
+            n = pm_read_many(pm_handle, BUFFER_SIZES, &block, 1);
+            if (0 >= n) {
+                r->closed_early = true;
+                break;
+            }
+
+            arrival = now_nanos();
+            if (0 == r->blocks) {
+                first_arrival = arrival;
+            }
+            last_arrival = arrival;
+
+            if (0 < r->blocks && block.timestamp_nanos > expected_ts) {
+                /* as many blocks as fit into the gap, one at least */
+                gap = (block.timestamp_nanos - expected_ts + block_nanos / 2) /
+                      block_nanos;
+                r->lost_blocks += 0 < gap ? gap : 1;
+            } else if (0 < r->blocks && block.timestamp_nanos != expected_ts) {
+                r->lost_blocks++;
+            }
+            /* the timestamp of the next block if none gets lost */
+            block_nanos = (uint64_t)block.samples_read * TIME_S /
+                          block.sampling_rate;
+            expected_ts = block.timestamp_nanos + block_nanos;
+            r->blocks++;
+            r->sampling_rate = block.sampling_rate;
+            r->samples += (uint64_t)block.samples_read * c->num_channels;
+
+            /* both clocks started at different times, only the difference
+             * to the best block counts */
+            lag = arrival - block.timestamp_nanos;
+            min_lag = lag < min_lag ? lag : min_lag;
+            if (num_lags < MAX_LAGS) {
+                lags[num_lags++] = lag;
+            }
+        }
+        pm_close(pm_handle);
+    }
+    r->nanos = last_arrival - first_arrival;
+
+    if (0 < num_lags) {
+        for (unsigned int i = 0; i < num_lags; i++) {
+            lags[i] -= min_lag;
+        }
+        qsort(lags, num_lags, sizeof(*lags), compare_u64);
+        r->lag_p50 = lags[(num_lags - 1) * 50 / 100];
+        r->lag_p90 = lags[(num_lags - 1) * 90 / 100];
+        r->lag_p99 = lags[(num_lags - 1) * 99 / 100];
+        r->lag_max = lags[num_lags - 1];
+    }
+    free(lags);
+
+    full_write(result_fd, (char *)r, sizeof(*r));
+}
+
+static void spawn_client(char *server, char *port, client_t *c,
+                         unsigned int seconds) {
+    int fds[2];
+    int err = pipe(fds);
+    assert(0 == err);
+
+    c->pid = fork();
+    assert(0 <= c->pid);
+    if (0 == c->pid) {
+        close(fds[0]);
+        run_client(server, port, c, seconds, fds[1]);
+        _exit(EXIT_SUCCESS);
+    }
+    close(fds[1]);
+    c->result_fd = fds[0];
+}
+
+static void collect_client(client_t *c) {
+    int status;
+
+    memset(&c->result, 0, sizeof(c->result));
+    if (sizeof(c->result) != full_read(c->result_fd, (char *)&c->result,
+                                       sizeof(c->result))) {
+        memset(&c->result, 0, sizeof(c->result));
+    }
+    close(c->result_fd);
+
+    while (0 > wait4(c->pid, &status, 0, &c->usage) && EINTR == errno) {
+        /* again */
+    }
+}
+
+/*
+ * OUTPUT
+ */
+static void print_results(FILE *out, const char *server, unsigned int rate,
+                          unsigned int daemon_channels,
+                          unsigned int seconds, client_t *clients,
+                          unsigned int num_clients, bool daemon_started,
+                          const struct rusage *daemon_usage,
+                          const char *metrics) {
+    static const char *counters[] = {
+        "pmlab_blocks_acquired_total",
+        "pmlab_drops_total",
+        "pmlab_bytes_sent_total",
+        "pmlab_frames_sent_total",
+        "pmlab_encode_seconds_total",
+        "pmlab_pipeline_workers",
+        "pmlab_pipeline_tasks_total",
+        "pmlab_pipeline_steals_total",
+        "pmlab_pipeline_inline_tasks_total",
+        "pmlab_pipeline_transform_seconds_total",
+        "pmlab_pipeline_encode_seconds_total",
+    };
+    double total_rate = 0, client_rate;
+    uint64_t lost = 0;
+    unsigned int dropped = 0;
+    client_t *c;
+
+    for (unsigned int i = 0; i < num_clients; i++) {
+        c = &clients[i];
+        if (0 < c->result.nanos) {
+            total_rate += c->result.samples * (double)TIME_S /
+                          c->result.nanos;
+        }
+        lost += c->result.lost_blocks;
+        dropped += c->result.closed_early ? 1 : 0;
+    }
+
+    fprintf(out, "{\"server\": \"%s\", \"rate\": %u, "
+                 "\"daemon_channels\": %u, \"seconds\": %u, "
+                 "\"num_clients\": %u,\n",
+            server, rate, daemon_channels, seconds, num_clients);
+    fprintf(out, " \"samples_per_second\": %.1f, \"lost_blocks\": %"PRIu64
+                 ", \"clients_dropped\": %u,\n", total_rate, lost, dropped);
+    if (daemon_started) {
+        fprintf(out, " \"daemon\": {\"cpu_seconds\": %.3f, "
+                     "\"max_rss_kb\": %ld},\n",
+                cpu_seconds(daemon_usage), daemon_usage->ru_maxrss);
+    }
+
+    fprintf(out, " \"metrics\": {");
+    for (unsigned int i = 0; i < sizeof(counters) / sizeof(*counters); i++) {
+        fprintf(out, "%s\"%s\": %.9g", 0 == i ? "" : ", ", counters[i],
+                NULL == metrics ? -1 : metric(metrics, counters[i]));
+    }
+    fprintf(out, "},\n");
+
+    fprintf(out, " \"clients\": [\n");
+    for (unsigned int i = 0; i < num_clients; i++) {
+        c = &clients[i];
+        client_rate = 0 < c->result.nanos ?
+                      c->result.samples * (double)TIME_S / c->result.nanos : 0;
+        fprintf(out, "  {\"id\": %u, \"channels\": [", i);
+        for (unsigned int ch = 0; ch < c->num_channels; ch++) {
+            fprintf(out, "%s%u", 0 == ch ? "" : ", ", c->channels[ch]);
+        }
+        fprintf(out, "], \"transport\": \"%s\", \"connected\": %s, "
+                     "\"closed_early\": %s,\n",
+                c->result.local ? "local" : "tcp",
+                c->result.connected ? "true" : "false",
+                c->result.closed_early ? "true" : "false");
+        fprintf(out, "   \"sampling_rate\": %u, \"blocks\": %"PRIu64", "
+                     "\"lost_blocks\": %"PRIu64", "
+                     "\"samples_per_second\": %.1f,\n",
+                c->result.sampling_rate, c->result.blocks,
+                c->result.lost_blocks, client_rate);
+        fprintf(out, "   \"lag_ms\": {\"p50\": %.3f, \"p90\": %.3f, "
+                     "\"p99\": %.3f, \"max\": %.3f},\n",
+                c->result.lag_p50 / 1e6, c->result.lag_p90 / 1e6,
+                c->result.lag_p99 / 1e6, c->result.lag_max / 1e6);
+        fprintf(out, "   \"cpu_seconds\": %.3f, \"max_rss_kb\": %ld}%s\n",
+                cpu_seconds(&c->usage), c->usage.ru_maxrss,
+                i + 1 < num_clients ? "," : "");
+    }
+    fprintf(out, " ]}\n");
+
+    fprintf(stderr, "%u client(s), %.0f samples/s, %"PRIu64" lost "
+                    "block(s), %u dropped\n",
+            num_clients, total_rate, lost, dropped);
+}
+
+static void usage(const char *progname) {
+    fprintf(stderr,
+            "pmlabbench, Copyright (C)2011-2012, "
+            "Jonathan Dimond <jonny@dimond.de>\n");
+    fprintf(stderr,
+            "                                  & "
+            "Johannes Weiß <uni@tux4u.de>\n");
+    fprintf(stderr,
+            "This program comes with ABSOLUTELY NO WARRANTY; "
+            "for details type `show w'.\n"
+            "This is free software, and you are welcome to redistribute it"
+            "\nunder certain conditions; type `show c' for details.\n\n");
+    fprintf(stderr, "Usage: %s [-d DAEMON] [-p PHYSICAL] [-r RATE] "
+                    "[-n CLIENTS] [-c CHANNELS] [-t SECONDS] [-T] "
+                    "[-o FILE] [SERVER PORT]\n\n", progname);
+    fprintf(stderr, "\t-d DAEMON\tdaemon binary to start if no SERVER is "
+                    "given (default build/daemon)\n");
+    fprintf(stderr, "\t-p PHYSICAL\tthe physical channels of the daemon "
+                    "started, e.g. Dev1/ai0:255\n");
+    fprintf(stderr, "\t-r RATE\t\treconfigure the local daemon to RATE "
+                    "samples/s per channel\n");
+    fprintf(stderr, "\t-n CLIENTS\tclient processes (default 4)\n");
+    fprintf(stderr, "\t-c CHANNELS\tchannels per client at most "
+                    "(default %d)\n", DEFAULT_CHANNELS);
+    fprintf(stderr, "\t-t SECONDS\tmeasuring time per client (default 10)\n");
+    fprintf(stderr, "\t-T\t\tuse TCP even if the daemon runs on this host\n");
+    fprintf(stderr, "\t-o FILE\t\twrite the JSON results to FILE "
+                    "(default stdout)\n");
+}
+
+int main(int argc, char **argv)
+{
+    char *daemon = "build/daemon";
+    char *server = "localhost";
+    char *port = "12345";
+    char *output = NULL;
+    char *physical_channels = NULL;
+    pm_description_t *description;
+    unsigned int daemon_channels;
+    unsigned int rate = 0;
+    unsigned int num_clients = 4;
+    unsigned int max_channels = DEFAULT_CHANNELS;
+    unsigned int seconds = 10;
+    bool start = true;
+    pid_t daemon_pid = -1;
+    struct rusage daemon_usage;
+    client_t *clients;
+    char command[64];
+    char reply[512];
+    char *metrics = NULL;
+    FILE *out = stdout;
+    char *progname = argv[0];
+    int opt;
+
+    while ((opt = getopt(argc, argv, "d:p:r:n:c:t:To:")) != -1) {
+        switch (opt) {
+            case 'd':
+                daemon = optarg;
+                break;
+            case 'p':
+                physical_channels = optarg;
+                break;
+            case 'r':
+                rate = atoi(optarg);
+                break;
+            case 'n':
+                num_clients = atoi(optarg);
+                break;
+            case 'c':
+                max_channels = atoi(optarg);
+                break;
+            case 't':
+                seconds = atoi(optarg);
+                break;
+            case 'T':
+                setenv("PMLAB_NO_SHM", "1", 1);
+                break;
+            case 'o':
+                output = optarg;
+                break;
+            default:
+                argc = 0;
+                break;
+        }
+    }
+    argc -= optind - 1;
+    argv += optind - 1;
+
+    if (3 == argc) {
+        server = argv[1];
+        port = argv[2];
+        start = false;
+    } else if (1 != argc) {
+        argc = 0;
+    }
+    if (0 == argc || 0 == num_clients || 0 == seconds ||
+        0 == max_channels || max_channels > MAX_CHANNELS) {
+        usage(progname);
+        exit(EXIT_FAILURE);
+    }
+
+    /* the results come through pipes, a dead client mustn't kill us */
+    signal(SIGPIPE, SIG_IGN);
+
+    if (start) {
+        daemon_pid = start_daemon(daemon, port, physical_channels);
+        if (0 > daemon_pid) {
+            fprintf(stderr, "Starting %s failed!\n", daemon);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if (0 < rate) {
+        snprintf(command, sizeof(command), "config rate=%u\n", rate);
+        if (0 >= request(server, CONTROL_PORT, command, reply, sizeof(reply),
+                         true) || 0 != strncmp(reply, "OK", 2)) {
+            fprintf(stderr, "Setting the rate failed: %s\n", reply);
+            if (0 < daemon_pid) {
+                stop_daemon(daemon_pid, &daemon_usage);
+            }
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    description = malloc(sizeof(*description));
+    assert(NULL != description);
+    if (0 != pm_query(server, port, description)) {
+        fprintf(stderr, "Asking the daemon for its channels failed!\n");
+        if (0 < daemon_pid) {
+            stop_daemon(daemon_pid, &daemon_usage);
+        }
+        exit(EXIT_FAILURE);
+    }
+    daemon_channels = description->num_channels;
+    free(description);
+    if (max_channels > daemon_channels) {
+        max_channels = daemon_channels;
+    }
+
+    clients = calloc(num_clients, sizeof(*clients));
+    assert(NULL != clients);
+    for (unsigned int i = 0; i < num_clients; i++) {
+        clients[i].num_channels = 1 + i % max_channels;
+        for (unsigned int ch = 0; ch < clients[i].num_channels; ch++) {
+            clients[i].channels[ch] = (3 * i + ch) % daemon_channels;
+        }
+        spawn_client(server, port, &clients[i], seconds);
+    }
+    for (unsigned int i = 0; i < num_clients; i++) {
+        collect_client(&clients[i]);
+    }
+
+    metrics = malloc(METRICS_SIZE);
+    assert(NULL != metrics);
+    if (0 >= request(server, METRICS_PORT,
+                     "GET /metrics HTTP/1.0\r\n\r\n",
+                     metrics, METRICS_SIZE, false)) {
+        free(metrics);
+        metrics = NULL;
+    }
+
+    if (0 < daemon_pid) {
+        stop_daemon(daemon_pid, &daemon_usage);
+    }
+
+    if (NULL != output) {
+        out = fopen(output, "w");
+        if (NULL == out) {
+            fprintf(stderr, "Opening %s failed: %s\n", output,
+                    strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+    }
+    print_results(out, server, rate, daemon_channels, seconds, clients,
+                  num_clients,
+                  0 < daemon_pid, &daemon_usage, metrics);
+    if (stdout != out) {
+        fclose(out);
+    }
+
+    free(metrics);
+    free(clients);
+    return EXIT_SUCCESS;
+}
+/* vim: set fileencoding=utf8 : */
@@ -25,13 +25,17 @@
 #include <signal.h>
 #include <string.h>
 #include <assert.h>
+#include <unistd.h>
 
 #include "libpmlab.h"
-#include "common/conf.h"
+#include "output.h"
+#include "channels.h"
 
 /* buffers, have to be large enough to read from the network */
-#define BUFFER_SIZES  (8 * 50000)
-static double analog_data[BUFFER_SIZES] = { 0 };
+#define BUFFER_SIZES  PM_MAX_BLOCK_SAMPLES
+/* blocks read per pm_read_many call at most */
+#define NUM_BLOCKS 4
+static double analog_data[NUM_BLOCKS][BUFFER_SIZES] = { { 0 } };
 
 static bool running = true;
 
@@ -40,82 +44,41 @@ static void sig_hnd() {
     running = false;
 }
 
-static unsigned int parse_channels(unsigned int argc,
-                                   char **argv,
-                                   unsigned int max_channels,
-                                   uint32_t *all_channels,
-                                   uint32_t *chosen_channels) {
-    unsigned int active_channels = 0;
-
-    for(unsigned int i=0; i<argc && active_channels <= max_channels; i++) {
-        if(0 ==strcmp("ai0", argv[i])) {
-            chosen_channels[active_channels++] = AI0;
-        } else if(0 == strcmp("ai1", argv[i])) {
-            chosen_channels[active_channels++] = AI1;
-        } else if(0 == strcmp("ai2", argv[i])) {
-            chosen_channels[active_channels++] = AI2;
-        } else if(0 == strcmp("ai3", argv[i])) {
-            chosen_channels[active_channels++] = AI3;
-        } else if(0 == strcmp("ai4", argv[i])) {
-            chosen_channels[active_channels++] = AI4;
-        } else if(0 == strcmp("ai5", argv[i])) {
-            chosen_channels[active_channels++] = AI5;
-        } else if(0 == strcmp("ai6", argv[i])) {
-            chosen_channels[active_channels++] = AI6;
-        } else if(0 == strcmp("ai7", argv[i])) {
-            chosen_channels[active_channels++] = AI7;
-        } else if(0 == strcmp("pm2", argv[i])) {
-            chosen_channels[active_channels++] = PM2_DD;
-        } else if(0 == strcmp("pm3", argv[i])) {
-            chosen_channels[active_channels++] = PM3_DD;
-        } else if(0 == strcmp("pm4", argv[i])) {
-            chosen_channels[active_channels++] = PM4_DD;
-        } else if(0 == strcmp("pm5", argv[i])) {
-            chosen_channels[active_channels++] = PM5_CPU;
-        } else if(0 == strcmp("pm6", argv[i])) {
-            chosen_channels[active_channels++] = PM6_CPU;
-        } else if(0 == strcmp("pm7", argv[i])) {
-            chosen_channels[active_channels++] = PM7_CPU;
-        } else if(0 == strcmp("all", argv[i])) {
-            active_channels = max_channels;
-            for (unsigned int j=0; j<max_channels; j++) {
-                chosen_channels[j] = all_channels[j];
-            }
-            break;
-        } else {
-            fprintf(stderr, "Wrong channel '%s', ignored...\n", argv[i]);
-        }
-    }
-    fprintf(stderr, "Setup %u channels.\n", active_channels);
-
-    return active_channels;
-}
-
 int main(int argc, char **argv)
 {
-    uint32_t all_channels[] = {
-        AI0,
-        AI1,
-        AI2,
-        AI3,
-        AI4,
-        AI5,
-        AI6,
-        AI7
-    };
     /* channels to listen to */
-    uint32_t chosen_channels[8] = { 0 };
-
-    assert(sizeof(chosen_channels) >= sizeof(all_channels));
-    unsigned int num_channels = sizeof(all_channels)/sizeof(uint32_t);
+    uint32_t chosen_channels[MAX_CHANNELS] = { 0 };
+    unsigned int num_channels;
 
     /* misc */
     void *pm_handle = NULL;
-    unsigned int sample_count;
-    uint64_t timestamp;
-    uint32_t sampling_rate;
+    pm_block_t blocks[NUM_BLOCKS];
+    bool described = false;
+    uint64_t generation = 0;
     char *server;
     char *port;
+    char *group = NULL;
+    char *trigger = NULL;
+    char shot_id[MAX_SHOT_ID_LEN] = "";
+    uint64_t lost_datagrams, lost_samples;
+    output_format_t format = OUTPUT_TEXT;
+    output_t *output;
+    char *progname = argv[0];
+    int opt;
+
+    while ((opt = getopt(argc, argv, "f:m:t:")) != -1) {
+        if ('m' == opt) {
+            group = optarg;
+        } else if ('t' == opt) {
+            trigger = optarg;
+        } else if ('f' != opt || 0 != output_parse_format(optarg, &format)) {
+            /* print usage */
+            argc = 0;
+            break;
+        }
+    }
+    argc -= optind - 1;
+    argv += optind - 1;
 
     if (argc <= 3) {
         fprintf(stderr,
@@ -129,8 +92,23 @@ int main(int argc, char **argv)
                 "for details type `show w'.\n"
                 "This is free software, and you are welcome to redistribute it"
                 "\nunder certain conditions; type `show c' for details.\n\n");
-        fprintf(stderr, "Usage: %s SERVER PORT CHANNEL...\n\n", argv[0]);
+        fprintf(stderr, "Usage: %s [-f FORMAT] [-m GROUP | -t TRIGGER] "
+                        "SERVER PORT CHANNEL...\n\n", progname);
+        fprintf(stderr, "-m receives the data from the multicast GROUP "
+                        "the daemon publishes to\n");
+        fprintf(stderr, "-t only receives the captures around the events of "
+                        "TRIGGER,\n   e.g. edge,ch=0,thr=0.1,pre=0.01,"
+                        "post=0.05 (see daemon/trigger.h)\n\n");
+        fprintf(stderr, "Available FORMATs:\n");
+        fprintf(stderr, "\ttext\t\tone line per sample (default)\n");
+        fprintf(stderr, "\tfast\t\tthe same text, using less CPU\n");
+        fprintf(stderr, "\traw\t\tthe same rows as little-endian doubles\n");
+        fprintf(stderr, "\tcolumnar\ttyped binary file, one column per "
+                        "channel and block\n\n");
         fprintf(stderr, "Available CHANNELs:\n");
+        fprintf(stderr, "\tai0 ... ai%d\n", MAX_CHANNELS - 1);
+        fprintf(stderr, "\taiFIRST-LAST\te.g. ai8-15\n");
+        fprintf(stderr, "\tall\t\tevery channel of the daemon\n");
         fprintf(stderr, "\tpm2\n");
         fprintf(stderr, "\tpm3\n");
         fprintf(stderr, "\tpm4\n");
@@ -142,55 +120,102 @@ int main(int argc, char **argv)
     server = argv[1];
     port = argv[2];
 
-    num_channels = parse_channels(argc-3,
-                                  argv+3,
-                                  num_channels,
-                                  all_channels,
+    num_channels = parse_channels(server, port, argc-3, argv+3,
                                   chosen_channels);
 
     signal(SIGINT, (void (*)(int))sig_hnd);
 
     /* connect to server */
-    pm_handle = pm_connect(server, port, chosen_channels, num_channels);
+    if (NULL != trigger) {
+        pm_handle = pm_connect_trigger(server,
+                                       port,
+                                       chosen_channels,
+                                       num_channels,
+                                       trigger);
+    } else if (NULL != group) {
+        pm_handle = pm_connect_multicast(server,
+                                         group,
+                                         chosen_channels,
+                                         num_channels);
+    } else {
+        pm_handle = pm_connect(server, port, chosen_channels, num_channels);
+    }
     if (NULL == pm_handle) {
         fprintf(stderr, "Server connect failed!\n");
         exit(EXIT_FAILURE);
     }
 
-    /* get sampling rate for channels */
-    sampling_rate = pm_samplingrate(pm_handle);
+    for (unsigned int b = 0; b < NUM_BLOCKS; b++) {
+        blocks[b].analog_data = analog_data[b];
+        blocks[b].digital_data = NULL;
+    }
+
+    output = output_open(format,
+                         STDOUT_FILENO,
+                         num_channels,
+                         chosen_channels);
 
     /* read forever */
     while (running) {
-        int i, j;
+        int b;
         /* read data from network */
-        int err = pm_read(pm_handle,
-                          BUFFER_SIZES,
-                          analog_data,
-                          NULL,
-                          &sample_count,
-                          &timestamp);
+        int err = pm_read_many(pm_handle,
+                               BUFFER_SIZES,
+                               blocks,
+                               NUM_BLOCKS);
         if (0 == err) {
+            output_close(output);
             pm_close(pm_handle);
             fprintf(stderr, "Server closed connection.\n");
             exit(EXIT_FAILURE);
         } else if (err < 0) {
+            output_close(output);
             pm_close(pm_handle);
             fprintf(stderr, "Error reading from network!");
             exit(EXIT_FAILURE);
         }
 
-        /* output data to stdout */
-        for (i = 0; i < sample_count; i++) {
-            const double ts = (double)timestamp/1000000000L +
-                              (i/(double)sampling_rate);
-            printf("%f", ts);
-            for (j = 0; j < num_channels; j++) {
-                printf(" %f", analog_data[i+j*sample_count]);
+        /* the blocks read share one description, record it if it's new */
+        if (!described || blocks[0].generation != generation) {
+            described = true;
+            generation = blocks[0].generation;
+            if (0 != output_describe(output, pm_describe(pm_handle))) {
+                fprintf(stderr, "Error writing output!\n");
+                break;
             }
-            j = ts;
-            printf("\n");
         }
+
+        /* a capture comes with a description of its own */
+        if (0 != strcmp(shot_id, pm_describe(pm_handle)->shot_id)) {
+            strcpy(shot_id, pm_describe(pm_handle)->shot_id);
+            fprintf(stderr, "Capture %s: %u samples per channel at "
+                            "%"PRIu64" ns\n",
+                    shot_id, blocks[0].samples_read,
+                    blocks[0].timestamp_nanos);
+        }
+
+        /* output data to stdout, the markers to stderr */
+        for (b = 0; b < err; b++) {
+            for (unsigned int m = 0; m < blocks[b].num_markers; m++) {
+                fprintf(stderr, "Marker %u %s at %"PRIu64" ns\n",
+                        blocks[b].markers[m].id, blocks[b].markers[m].label,
+                        blocks[b].markers[m].timestamp_nanos);
+            }
+            if (0 != output_block(output, &blocks[b])) {
+                fprintf(stderr, "Error writing output!\n");
+                running = false;
+                break;
+            }
+        }
+    }
+
+    output_close(output);
+
+    pm_multicast_losses(pm_handle, &lost_datagrams, &lost_samples);
+    if (lost_datagrams > 0 || lost_samples > 0) {
+        fprintf(stderr, "Lost %"PRIu64" datagrams, %"PRIu64" samples "
+                        "couldn't be recovered.\n",
+                lost_datagrams, lost_samples);
     }
 
     /* close connection to server */
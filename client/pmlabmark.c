@@ -0,0 +1,80 @@
+/*
+ *  Sends a marker to pm-lab-tools/daemon
+ *
+ *  Copyright (C)2011/12, Jonathan Dimond <jonny@dimond.de>
+ *                      & Johannes Weiß <uni@tux4u.de>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Marks the beginning of a phase of the program under test, e.g. from a
+ * benchmark script:
+ *
+ *   pmlabmark daq-host 1 warmup; ./warmup
+ *   pmlabmark daq-host 2 run; ./run
+ *
+ * The clients of the daemon receive the marker with the block read when it
+ * arrived (see pm_mark in libpmlab.h).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "libpmlab.h"
+
+int main(int argc, char **argv)
+{
+    char *end;
+    unsigned long id;
+    int fd;
+
+    if (argc < 3 || argc > 4) {
+        fprintf(stderr, "Usage: %s SERVER ID [LABEL]\n\n", argv[0]);
+        fprintf(stderr, "Sends a marker to UDP port %d of the daemon on "
+                        "SERVER,\nLABEL is %d characters at most\n",
+                MARKER_PORT, MARKER_LABEL_LEN);
+        exit(EXIT_FAILURE);
+    }
+
+    errno = 0;
+    id = strtoul(argv[2], &end, 10);
+    if (0 != errno || '\0' != *end || end == argv[2] || id > UINT32_MAX) {
+        fprintf(stderr, "invalid ID: %s\n", argv[2]);
+        exit(EXIT_FAILURE);
+    }
+    if (4 == argc && strlen(argv[3]) > MARKER_LABEL_LEN) {
+        fprintf(stderr, "LABEL too long: %s\n", argv[3]);
+        exit(EXIT_FAILURE);
+    }
+
+    fd = pm_marker_open(argv[1]);
+    if (0 > fd) {
+        fprintf(stderr, "can't resolve %s\n", argv[1]);
+        exit(EXIT_FAILURE);
+    }
+    if (0 != pm_mark(fd, (uint32_t)id, 4 == argc ? argv[3] : NULL)) {
+        perror("send");
+        close(fd);
+        exit(EXIT_FAILURE);
+    }
+    close(fd);
+
+    return EXIT_SUCCESS;
+}
+/* vim: set fileencoding=utf8 : */
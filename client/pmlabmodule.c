@@ -0,0 +1,484 @@
+/*
+ *  Python module reading data from pm-lab-tools/daemon
+ *
+ *  Copyright (C)2011/12, Jonathan Dimond <jonny@dimond.de>
+ *                      & Johannes Weiß <uni@tux4u.de>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * The Python module pmlab, libpmlab for Python 3:
+ *
+ *   import numpy, pmlab
+ *
+ *   with pmlab.Stream("localhost", 12345, [0, 1]) as stream:
+ *       for block in stream:
+ *           samples = numpy.asarray(block)
+ *
+ * A Block exports its samples through the buffer protocol as a writable
+ * channels x samples array of doubles, so NumPy (or memoryview) uses them
+ * without copying and the module doesn't depend on NumPy. pm_read_many
+ * decodes every block straight into a buffer of the stream's pool, which
+ * gets the buffer back once the block and every array using it are gone.
+ * The GIL is released while connecting and waiting for a block, so other
+ * threads keep running.
+ */
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+#include <structmember.h>
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "libpmlab.h"
+
+/* buffers a stream keeps for the blocks to come */
+#define POOL_SIZE 4
+
+typedef struct {
+    PyObject_HEAD
+    void *pm_handle;
+    unsigned int num_channels;
+    /* a thread waits in pm_read_many without the GIL */
+    bool reading;
+    double *pool[POOL_SIZE];
+    unsigned int pool_count;
+} StreamObject;
+
+typedef struct {
+    PyObject_HEAD
+    StreamObject *stream;           /* gets data back */
+    double *data;
+    Py_ssize_t shape[2];
+    Py_ssize_t strides[2];
+    unsigned long long timestamp_nanos;
+    unsigned int sampling_rate;
+    unsigned long long generation;
+    PyObject *markers;
+} BlockObject;
+
+static PyTypeObject StreamType;
+static PyTypeObject BlockType;
+
+/*
+ * BLOCK
+ */
+static void Block_dealloc(BlockObject *self) {
+    StreamObject *stream = self->stream;
+
+    if (stream->pool_count < POOL_SIZE) {
+        stream->pool[stream->pool_count++] = self->data;
+    } else {
+        free(self->data);
+    }
+    Py_DECREF(stream);
+    Py_XDECREF(self->markers);
+    Py_TYPE(self)->tp_free((PyObject *)self);
+}
+
+static int Block_getbuffer(BlockObject *self, Py_buffer *view, int flags) {
+    view->obj = (PyObject *)self;
+    Py_INCREF(self);
+    view->buf = self->data;
+    view->len = self->shape[0] * self->shape[1] * sizeof(double);
+    view->readonly = 0;
+    view->itemsize = sizeof(double);
+    view->format = 0 != (flags & PyBUF_FORMAT) ? "d" : NULL;
+    view->ndim = 2;
+    view->shape = 0 != (flags & PyBUF_ND) ? self->shape : NULL;
+    view->strides = PyBUF_STRIDES == (flags & PyBUF_STRIDES) ?
+                    self->strides : NULL;
+    view->suboffsets = NULL;
+    view->internal = NULL;
+    return 0;
+}
+
+static Py_ssize_t Block_length(BlockObject *self) {
+    return self->shape[0];
+}
+
+static PyObject *Block_get_samples(BlockObject *self, void *closure) {
+    return PyLong_FromSsize_t(self->shape[1]);
+}
+
+static PyObject *Block_get_shape(BlockObject *self, void *closure) {
+    return Py_BuildValue("(nn)", self->shape[0], self->shape[1]);
+}
+
+static PyBufferProcs Block_as_buffer = {
+    .bf_getbuffer = (getbufferproc)Block_getbuffer,
+};
+
+static PySequenceMethods Block_as_sequence = {
+    .sq_length = (lenfunc)Block_length,
+};
+
+static PyMemberDef Block_members[] = {
+    { "timestamp_nanos", T_ULONGLONG,
+      offsetof(BlockObject, timestamp_nanos), READONLY,
+      "time of the first sample in ns" },
+    { "sampling_rate", T_UINT, offsetof(BlockObject, sampling_rate),
+      READONLY, "the rate the block was read with in Hz" },
+    { "generation", T_ULONGLONG, offsetof(BlockObject, generation),
+      READONLY, "the configuration of the daemon, see Stream.describe" },
+    { "markers", T_OBJECT, offsetof(BlockObject, markers), READONLY,
+      "(id, label, sample, timestamp_nanos) of every marker" },
+    { NULL }
+};
+
+static PyGetSetDef Block_getset[] = {
+    { "samples", (getter)Block_get_samples, NULL,
+      "samples per channel", NULL },
+    { "shape", (getter)Block_get_shape, NULL,
+      "(channels, samples)", NULL },
+    { NULL }
+};
+
+static PyTypeObject BlockType = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "pmlab.Block",
+    .tp_basicsize = sizeof(BlockObject),
+    .tp_dealloc = (destructor)Block_dealloc,
+    .tp_as_sequence = &Block_as_sequence,
+    .tp_as_buffer = &Block_as_buffer,
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_doc = "The raw samples of a block, channels x samples doubles "
+              "through the buffer protocol, e.g. numpy.asarray(block).",
+    .tp_members = Block_members,
+    .tp_getset = Block_getset,
+};
+
+/*
+ * STREAM
+ */
+static int Stream_init(StreamObject *self, PyObject *args, PyObject *kwds) {
+    static char *kwlist[] = { "server", "port", "channels", NULL };
+    unsigned int channels[MAX_CHANNELS];
+    const char *server, *port;
+    PyObject *port_obj, *port_str, *seq;
+    Py_ssize_t num_channels;
+    unsigned long ch;
+    void *handle;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "sOO", kwlist, &server,
+                                     &port_obj, &seq)) {
+        return -1;
+    }
+    if (NULL != self->pm_handle) {
+        PyErr_SetString(PyExc_RuntimeError, "stream is connected already");
+        return -1;
+    }
+
+    seq = PySequence_Fast(seq, "channels must be a sequence of numbers");
+    if (NULL == seq) {
+        return -1;
+    }
+    num_channels = PySequence_Fast_GET_SIZE(seq);
+    if (0 == num_channels || MAX_CHANNELS < num_channels) {
+        Py_DECREF(seq);
+        PyErr_Format(PyExc_ValueError, "1 to %d channels", MAX_CHANNELS);
+        return -1;
+    }
+    for (Py_ssize_t i = 0; i < num_channels; i++) {
+        ch = PyLong_AsUnsignedLong(PySequence_Fast_GET_ITEM(seq, i));
+        if (PyErr_Occurred() || MAX_CHANNELS <= ch) {
+            Py_DECREF(seq);
+            PyErr_Clear();
+            PyErr_Format(PyExc_ValueError, "channels are 0 to %d",
+                         MAX_CHANNELS - 1);
+            return -1;
+        }
+        channels[i] = ch;
+    }
+    Py_DECREF(seq);
+
+    port_str = PyObject_Str(port_obj);
+    port = NULL == port_str ? NULL : PyUnicode_AsUTF8(port_str);
+    if (NULL == port) {
+        Py_XDECREF(port_str);
+        return -1;
+    }
+
+    Py_BEGIN_ALLOW_THREADS
+    handle = pm_connect((char *)server, (char *)port, channels,
+                        num_channels);
+    Py_END_ALLOW_THREADS
+
+    if (NULL == handle) {
+        PyErr_Format(PyExc_OSError, "can't connect to %s:%U", server,
+                     port_str);
+        Py_DECREF(port_str);
+        return -1;
+    }
+    Py_DECREF(port_str);
+
+    self->pm_handle = handle;
+    self->num_channels = num_channels;
+    return 0;
+}
+
+static bool Stream_check(StreamObject *self) {
+    if (NULL == self->pm_handle) {
+        PyErr_SetString(PyExc_ValueError, "stream is closed");
+        return false;
+    } else if (self->reading) {
+        PyErr_SetString(PyExc_RuntimeError,
+                        "another thread reads the stream");
+        return false;
+    }
+    return true;
+}
+
+static PyObject *Stream_close(StreamObject *self, PyObject *unused) {
+    if (NULL != self->pm_handle) {
+        if (!Stream_check(self)) {
+            return NULL;
+        }
+        pm_close(self->pm_handle);
+        self->pm_handle = NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+static void Stream_dealloc(StreamObject *self) {
+    /* a reading thread holds a reference, so nobody reads */
+    if (NULL != self->pm_handle) {
+        pm_close(self->pm_handle);
+    }
+    for (unsigned int i = 0; i < self->pool_count; i++) {
+        free(self->pool[i]);
+    }
+    Py_TYPE(self)->tp_free((PyObject *)self);
+}
+
+static PyObject *markers_list(const pm_block_t *block) {
+    PyObject *markers = PyList_New(block->num_markers);
+    PyObject *marker;
+
+    for (unsigned int i = 0; NULL != markers && i < block->num_markers; i++) {
+        marker = Py_BuildValue("(IsIK)", block->markers[i].id,
+                               block->markers[i].label,
+                               block->markers[i].sample,
+                               (unsigned long long)
+                               block->markers[i].timestamp_nanos);
+        if (NULL == marker) {
+            Py_CLEAR(markers);
+            break;
+        }
+        PyList_SET_ITEM(markers, i, marker);
+    }
+    return markers;
+}
+
+static PyObject *Stream_read(StreamObject *self, PyObject *unused) {
+    BlockObject *b;
+    pm_block_t block;
+    double *data;
+    int err;
+
+    if (!Stream_check(self)) {
+        return NULL;
+    }
+
+    if (0 < self->pool_count) {
+        data = self->pool[--self->pool_count];
+    } else {
+        data = malloc(PM_MAX_BLOCK_SAMPLES * sizeof(double));
+        if (NULL == data) {
+            return PyErr_NoMemory();
+        }
+    }
+    block.analog_data = data;
+    block.digital_data = NULL;
+
+    self->reading = true;
+    Py_BEGIN_ALLOW_THREADS
+    err = pm_read_many(self->pm_handle, PM_MAX_BLOCK_SAMPLES, &block, 1);
+    Py_END_ALLOW_THREADS
+    self->reading = false;
+
+    if (0 >= err) {
+        self->pool[self->pool_count++] = data;
+        if (0 == err) {
+            Py_RETURN_NONE;
+        }
+        PyErr_SetString(PyExc_OSError, "error reading from the daemon");
+        return NULL;
+    }
+
+    b = PyObject_New(BlockObject, &BlockType);
+    if (NULL == b) {
+        self->pool[self->pool_count++] = data;
+        return NULL;
+    }
+    Py_INCREF(self);
+    b->stream = self;
+    b->data = data;
+    b->shape[0] = self->num_channels;
+    b->shape[1] = block.samples_read;
+    b->strides[0] = block.samples_read * sizeof(double);
+    b->strides[1] = sizeof(double);
+    b->timestamp_nanos = block.timestamp_nanos;
+    b->sampling_rate = block.sampling_rate;
+    b->generation = block.generation;
+    b->markers = markers_list(&block);
+    if (NULL == b->markers) {
+        Py_DECREF(b);
+        return NULL;
+    }
+    return (PyObject *)b;
+}
+
+static PyObject *Stream_describe(StreamObject *self, PyObject *unused) {
+    const pm_description_t *d;
+    PyObject *channels, *channel;
+
+    if (!Stream_check(self)) {
+        return NULL;
+    }
+    d = pm_describe(self->pm_handle);
+
+    channels = PyList_New(d->num_channels);
+    for (unsigned int i = 0; NULL != channels && i < d->num_channels; i++) {
+        channel = Py_BuildValue("(sdd)", d->channel_names[i], d->scale[i],
+                                d->offset[i]);
+        if (NULL == channel) {
+            Py_CLEAR(channels);
+            break;
+        }
+        PyList_SET_ITEM(channels, i, channel);
+    }
+    if (NULL == channels) {
+        return NULL;
+    }
+
+    return Py_BuildValue("{sIsssKsIsIssss" "s(dd)sN}",
+                         "protocol_version", d->protocol_version,
+                         "shot_id", d->shot_id,
+                         "generation", (unsigned long long)d->generation,
+                         "sampling_rate", d->sampling_rate,
+                         "block_size", d->block_size,
+                         "encoding", d->encoding,
+                         "unit", d->unit,
+                         "range", d->range_min, d->range_max,
+                         "channels", channels);
+}
+
+static PyObject *Stream_iternext(StreamObject *self) {
+    PyObject *block = Stream_read(self, NULL);
+
+    if (Py_None == block) {
+        /* EOF ends the iteration */
+        Py_DECREF(block);
+        return NULL;
+    }
+    return block;
+}
+
+static PyObject *Stream_enter(StreamObject *self, PyObject *unused) {
+    Py_INCREF(self);
+    return (PyObject *)self;
+}
+
+static PyObject *Stream_exit(StreamObject *self, PyObject *args) {
+    return Stream_close(self, NULL);
+}
+
+static PyObject *Stream_get_sampling_rate(StreamObject *self,
+                                          void *closure) {
+    if (!Stream_check(self)) {
+        return NULL;
+    }
+    return PyLong_FromUnsignedLong(pm_samplingrate(self->pm_handle));
+}
+
+static PyMethodDef Stream_methods[] = {
+    { "read", (PyCFunction)Stream_read, METH_NOARGS,
+      "read() -> Block or None at the end of the stream\n\n"
+      "Waits for the next block without holding the GIL." },
+    { "describe", (PyCFunction)Stream_describe, METH_NOARGS,
+      "describe() -> dict\n\n"
+      "The description of the block read last (see pm_describe): "
+      "sampling_rate,\ngeneration, unit, range and (name, scale, offset) "
+      "of every channel,\nthe physical value of a sample s is "
+      "scale * s + offset." },
+    { "close", (PyCFunction)Stream_close, METH_NOARGS,
+      "Closes the connection." },
+    { "__enter__", (PyCFunction)Stream_enter, METH_NOARGS, NULL },
+    { "__exit__", (PyCFunction)Stream_exit, METH_VARARGS, NULL },
+    { NULL }
+};
+
+static PyGetSetDef Stream_getset[] = {
+    { "sampling_rate", (getter)Stream_get_sampling_rate, NULL,
+      "the sampling rate of the block read last in Hz", NULL },
+    { NULL }
+};
+
+static PyTypeObject StreamType = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "pmlab.Stream",
+    .tp_basicsize = sizeof(StreamObject),
+    .tp_dealloc = (destructor)Stream_dealloc,
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_doc = "Stream(server, port, channels)\n\n"
+              "Connects to the daemon and reads the channels (numbers, "
+              "e.g. [0, 3]),\nlocally from the shared memory if possible "
+              "(see pm_connect). Iterating\nyields a Block per block read.",
+    .tp_iter = PyObject_SelfIter,
+    .tp_iternext = (iternextfunc)Stream_iternext,
+    .tp_methods = Stream_methods,
+    .tp_getset = Stream_getset,
+    .tp_init = (initproc)Stream_init,
+    .tp_new = PyType_GenericNew,
+};
+
+/*
+ * MODULE
+ */
+static struct PyModuleDef pmlab_module = {
+    PyModuleDef_HEAD_INIT,
+    .m_name = "pmlab",
+    .m_doc = "Reads the samples of pm-lab-tools/daemon, see "
+             "client/libpmlab.h.",
+    .m_size = -1,
+};
+
+PyMODINIT_FUNC PyInit_pmlab(void) {
+    PyObject *module;
+
+    if (0 > PyType_Ready(&StreamType) || 0 > PyType_Ready(&BlockType)) {
+        return NULL;
+    }
+
+    module = PyModule_Create(&pmlab_module);
+    if (NULL == module) {
+        return NULL;
+    }
+
+    Py_INCREF(&StreamType);
+    Py_INCREF(&BlockType);
+    if (0 > PyModule_AddObject(module, "Stream", (PyObject *)&StreamType) ||
+        0 > PyModule_AddObject(module, "Block", (PyObject *)&BlockType) ||
+        0 > PyModule_AddIntConstant(module, "MAX_CHANNELS", MAX_CHANNELS)) {
+        Py_DECREF(module);
+        return NULL;
+    }
+    return module;
+}
+/* vim: set fileencoding=utf8 : */
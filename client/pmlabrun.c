@@ -0,0 +1,520 @@
+/*
+ *  Measures the energy of a command using pm-lab-tools/daemon
+ *
+ *  Copyright (C)2011/12, Jonathan Dimond <jonny@dimond.de>
+ *                      & Johannes Weiß <uni@tux4u.de>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Runs a command and reports the energy the channels measured while it ran,
+ * e.g.
+ *
+ *   pmlabrun -n 10 -p 12:10 daq-host 12345 pm5 pm6 -- make -j4
+ *
+ * The child sends a marker (pm_mark, its pid as id, "exec") right before it
+ * executes the command and pmlabrun sends another one ("exit") as soon as
+ * the command exited. The daemon places both at the samples read at the
+ * time, so the run is measured from sample to sample. The samples in
+ * between are integrated while they arrive (compensated, see
+ * add_compensated), nothing is stored. With -n the command runs several
+ * times and the mean and the 95% confidence interval of every value are
+ * printed as well.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include <utils.h>
+
+#include "libpmlab.h"
+#include "channels.h"
+
+/* blocks received after the command exited until its markers have to be
+ * there: the blocks the daemon queued for us and the one being read */
+#define MARKER_WAIT_BLOCKS 10
+
+typedef struct {
+    double joules;
+    double compensation;  /* of joules */
+    double peak;          /* watts */
+} energy_t;
+
+/* mean and variance over the runs, updated with every run (Welford) */
+typedef struct {
+    unsigned int n;
+    double mean;
+    double m2;
+} series_t;
+
+typedef struct {
+    void *pm_handle;
+    bool connected;
+    bool streaming;                 /* received a block */
+    unsigned int num_channels;
+    uint32_t channels[MAX_CHANNELS];
+    double power_factor;            /* watts per calibrated unit */
+
+    /* the current run */
+    pid_t pid;
+    int status;
+    bool exited;
+    bool started;                   /* the exec marker arrived */
+    bool ended;                     /* the exit marker arrived */
+    bool failed;                    /* samples or markers lost */
+    unsigned int blocks_after_exit;
+    uint64_t start_nanos;
+    uint64_t end_nanos;
+    /* the channels and their sum */
+    energy_t energy[MAX_CHANNELS + 1];
+
+    series_t seconds;
+    series_t joules[MAX_CHANNELS + 1];
+    series_t watts[MAX_CHANNELS + 1];
+} runner_t;
+
+/* written by the SIGCHLD handler, polled with the connection */
+static int sigchld_pipe[2];
+
+/* two-sided 95% quantiles of Student's t for 1 to 30 degrees of freedom */
+static const double T_95[] = {
+    12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+    2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+    2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042
+};
+
+static void sigchld_hnd(int signum) {
+    const int saved_errno = errno;
+    const char c = 0;
+
+    if(1 != write(sigchld_pipe[1], &c, 1)) {
+        /* the pipe is full, the loop wakes up anyway */
+    }
+    errno = saved_errno;
+}
+
+static void series_add(series_t *s, double value) {
+    const double delta = value - s->mean;
+
+    s->n++;
+    s->mean += delta / s->n;
+    s->m2 += delta * (value - s->mean);
+}
+
+/* half the width of the 95% confidence interval of the mean */
+static double series_ci(const series_t *s) {
+    const unsigned int df = s->n - 1;
+    const unsigned int num_t = sizeof(T_95) / sizeof(*T_95);
+
+    if(s->n < 2) {
+        return 0;
+    }
+    return (df <= num_t ? T_95[df - 1] : 1.960) *
+           sqrt(s->m2 / df / s->n);
+}
+
+/*
+ * MEASURING
+ */
+
+/* integrates the samples [from, to) of every channel into the run */
+static void integrate(runner_t *r,
+                      const pm_block_t *block,
+                      unsigned int from,
+                      unsigned int to) {
+    const pm_description_t *d = pm_describe(r->pm_handle);
+    const unsigned int n = r->num_channels;
+    double sum[MAX_CHANNELS + 1];
+    double compensation[MAX_CHANNELS + 1];
+    double power, total;
+
+    for(unsigned int i = 0; i <= n; i++) {
+        sum[i] = compensation[i] = 0;
+    }
+
+    for(unsigned int j = from; j < to; j++) {
+        total = 0;
+        for(unsigned int i = 0; i < n; i++) {
+            power = r->power_factor *
+                    (d->scale[i] * block->analog_data[i * block->samples_read
+                                                      + j] +
+                     d->offset[i]);
+            add_compensated(&sum[i], &compensation[i], power);
+            if(power > r->energy[i].peak) {
+                r->energy[i].peak = power;
+            }
+            total += power;
+        }
+        add_compensated(&sum[n], &compensation[n], total);
+        if(total > r->energy[n].peak) {
+            r->energy[n].peak = total;
+        }
+    }
+
+    /* the rate may change between blocks, so the joules are summed */
+    for(unsigned int i = 0; i <= n; i++) {
+        add_compensated(&r->energy[i].joules, &r->energy[i].compensation,
+                        (sum[i] + compensation[i]) / block->sampling_rate);
+    }
+}
+
+static void on_block(void *user, const pm_block_t *block) {
+    runner_t *r = (runner_t *)user;
+    const pm_marker_t *m;
+    unsigned int from = 0;
+
+    r->streaming = true;
+    if(0 == r->pid || r->ended || r->failed) {
+        return;
+    }
+
+    /* the markers come in the order they arrived */
+    for(unsigned int i = 0; i < block->num_markers; i++) {
+        m = &block->markers[i];
+        if((uint32_t)r->pid != m->id) {
+            continue;
+        }
+        if(!r->started && 0 == strcmp("exec", m->label)) {
+            r->started = true;
+            r->start_nanos = m->timestamp_nanos;
+            from = m->sample;
+        } else if(r->started && 0 == strcmp("exit", m->label)) {
+            integrate(r, block, from, m->sample);
+            r->ended = true;
+            r->end_nanos = m->timestamp_nanos;
+            return;
+        }
+    }
+
+    if(r->started) {
+        integrate(r, block, from, block->samples_read);
+    }
+    if(r->exited && ++r->blocks_after_exit > MARKER_WAIT_BLOCKS) {
+        fprintf(stderr, "The markers of the run got lost!\n");
+        r->failed = true;
+    }
+}
+
+static void on_gap(void *user, uint64_t expected_nanos, uint64_t ts_nanos) {
+    runner_t *r = (runner_t *)user;
+
+    fprintf(stderr, "Lost samples between %f and %f\n",
+            expected_nanos / 1e9, ts_nanos / 1e9);
+    if(r->started && !r->ended) {
+        r->failed = true;
+    }
+}
+
+static void on_disconnect(void *user, int error) {
+    runner_t *r = (runner_t *)user;
+
+    fprintf(stderr, "Server closed connection (%s).\n",
+            0 == error ? "EOF" : strerror(error));
+    r->connected = false;
+}
+
+/* waits for events, returns false if the connection is gone */
+static bool process(runner_t *r, int marker_fd) {
+    struct pollfd poll_cfg[2];
+    char drain[16];
+    int status;
+
+    poll_cfg[0].fd = pm_fd(r->pm_handle);
+    poll_cfg[0].events = pm_poll_events(r->pm_handle);
+    poll_cfg[0].revents = 0;
+    poll_cfg[1].fd = sigchld_pipe[0];
+    poll_cfg[1].events = POLLIN;
+    poll_cfg[1].revents = 0;
+
+    if(0 > poll(poll_cfg, 2, -1)) {
+        return EINTR == errno;
+    }
+
+    if(0 != poll_cfg[1].revents) {
+        while(0 < read(sigchld_pipe[0], drain, sizeof(drain))) {
+        }
+        if(0 != r->pid && !r->exited &&
+           r->pid == waitpid(r->pid, &status, WNOHANG)) {
+            /* first of all, the sooner the marker the closer the sample */
+            if(0 != pm_mark(marker_fd, (uint32_t)r->pid, "exit")) {
+                perror("send");
+            }
+            r->exited = true;
+            r->status = status;
+        }
+    }
+
+    if(0 != poll_cfg[0].revents) {
+        pm_process(r->pm_handle);
+    }
+    return r->connected;
+}
+
+static void start_run(runner_t *r, int marker_fd, char **command) {
+    r->exited = r->started = r->ended = r->failed = false;
+    r->blocks_after_exit = 0;
+    for(unsigned int i = 0; i <= r->num_channels; i++) {
+        r->energy[i].joules = 0;
+        r->energy[i].compensation = 0;
+        r->energy[i].peak = -INFINITY;
+    }
+
+    r->pid = fork();
+    if(0 > r->pid) {
+        perror("fork");
+        exit(EXIT_FAILURE);
+    } else if(0 == r->pid) {
+        pm_mark(marker_fd, (uint32_t)getpid(), "exec");
+        execvp(command[0], command);
+        fprintf(stderr, "%s: %s\n", command[0], strerror(errno));
+        _exit(127);
+    }
+}
+
+/*
+ * REPORTING
+ */
+static void print_status(int status) {
+    if(WIFEXITED(status)) {
+        fprintf(stderr, "exit status %d", WEXITSTATUS(status));
+    } else if(WIFSIGNALED(status)) {
+        fprintf(stderr, "killed by signal %d", WTERMSIG(status));
+    }
+}
+
+static void report_run(runner_t *r, unsigned int run, unsigned int runs) {
+    const double seconds = (r->end_nanos - r->start_nanos) / 1e9;
+    const unsigned int n = r->num_channels;
+    double joules, watts;
+    char name[16];
+
+    fprintf(stderr, "Run %u/%u: ", run, runs);
+    print_status(r->status);
+    if(r->failed) {
+        fprintf(stderr, ", not measured\n");
+        return;
+    }
+    fprintf(stderr, ", %.6f s\n", seconds);
+    series_add(&r->seconds, seconds);
+
+    for(unsigned int i = 0; i <= n; i++) {
+        if(i == n && 1 == n) {
+            break;
+        }
+        if(i < n) {
+            snprintf(name, sizeof(name), "ai%u", r->channels[i]);
+        } else {
+            snprintf(name, sizeof(name), "total");
+        }
+        joules = r->energy[i].joules + r->energy[i].compensation;
+        watts = 0 < seconds ? joules / seconds : 0;
+        fprintf(stderr, "  %-8s %14.6f J %12.6f W mean %12.6f W peak\n",
+                name, joules, watts,
+                isinf(r->energy[i].peak) ? 0 : r->energy[i].peak);
+        series_add(&r->joules[i], joules);
+        series_add(&r->watts[i], watts);
+    }
+}
+
+static void report_series(runner_t *r) {
+    const unsigned int n = r->num_channels;
+    char name[16];
+
+    fprintf(stderr, "%u runs measured, mean +- 95%% confidence interval:\n",
+            r->seconds.n);
+    fprintf(stderr, "  %-8s %14.6f s +- %.6f s\n", "time",
+            r->seconds.mean, series_ci(&r->seconds));
+    for(unsigned int i = 0; i <= n; i++) {
+        if(i == n && 1 == n) {
+            break;
+        }
+        if(i < n) {
+            snprintf(name, sizeof(name), "ai%u", r->channels[i]);
+        } else {
+            snprintf(name, sizeof(name), "total");
+        }
+        fprintf(stderr, "  %-8s %14.6f J +- %.6f J %12.6f W +- %.6f W\n",
+                name, r->joules[i].mean, series_ci(&r->joules[i]),
+                r->watts[i].mean, series_ci(&r->watts[i]));
+    }
+}
+
+static void usage(const char *progname) {
+    fprintf(stderr,
+            "pmlabrun, Copyright (C)2011-2012, "
+            "Jonathan Dimond <jonny@dimond.de>\n");
+    fprintf(stderr,
+            "                                & "
+            "Johannes Weiß <uni@tux4u.de>\n");
+    fprintf(stderr,
+            "This program comes with ABSOLUTELY NO WARRANTY; "
+            "for details type `show w'.\n"
+            "This is free software, and you are welcome to redistribute it"
+            "\nunder certain conditions; type `show c' for details.\n\n");
+    fprintf(stderr, "Usage: %s [-n RUNS] [-p VOLTAGE:RESISTANCE] "
+                    "SERVER PORT CHANNEL... -- COMMAND [ARG...]\n\n",
+            progname);
+    fprintf(stderr, "Runs COMMAND and prints the energy, mean and peak "
+                    "power of every CHANNEL\n(see pmlabclient) while it "
+                    "ran to stderr.\n\n");
+    fprintf(stderr, "\t-n RUNS\t\truns COMMAND RUNS times and prints the "
+                    "means with their\n\t\t\t95%% confidence intervals\n");
+    fprintf(stderr, "\t-p V:R\t\tthe channels measure a R mOhm shunt at V "
+                    "volts,\n\t\t\telse the calibrated values are watts\n");
+}
+
+/* V:R, the supply voltage and the shunt in mOhm, to watts per volt */
+static int parse_shunt(const char *spec, double *factor)
+{
+    double voltage, resistance;
+    char *end;
+
+    errno = 0;
+    voltage = strtod(spec, &end);
+    if(0 != errno || end == spec || ':' != *end ||
+       voltage <= 0 || !isfinite(voltage)) {
+        return -1;
+    }
+    spec = end + 1;
+    resistance = strtod(spec, &end);
+    if(0 != errno || end == spec || '\0' != *end ||
+       resistance <= 0 || !isfinite(resistance)) {
+        return -1;
+    }
+    *factor = voltage / (resistance / 1000.0);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    static runner_t r;
+    pm_callbacks_t callbacks = { on_block, on_gap, on_disconnect };
+    struct sigaction sa;
+    char *progname = argv[0];
+    char **command = NULL;
+    unsigned long runs = 1;
+    char *end;
+    int marker_fd;
+    int opt;
+
+    r.power_factor = 1;
+    while((opt = getopt(argc, argv, "+n:p:")) != -1) {
+        if('n' == opt) {
+            errno = 0;
+            runs = strtoul(optarg, &end, 10);
+            if(0 != errno || '\0' != *end || 0 == runs) {
+                usage(progname);
+                exit(EXIT_FAILURE);
+            }
+        } else if('p' != opt ||
+                  0 != parse_shunt(optarg, &r.power_factor)) {
+            usage(progname);
+            exit(EXIT_FAILURE);
+        }
+    }
+    argc -= optind - 1;
+    argv += optind - 1;
+
+    for(int i = 1; i < argc; i++) {
+        if(0 == strcmp("--", argv[i])) {
+            command = argv + i + 1;
+            argc = i;
+            break;
+        }
+    }
+    if(argc <= 3 || NULL == command || NULL == command[0]) {
+        usage(progname);
+        exit(EXIT_FAILURE);
+    }
+
+    r.num_channels = parse_channels(argv[1], argv[2], argc-3, argv+3,
+                                    r.channels);
+    if(0 == r.num_channels) {
+        exit(EXIT_FAILURE);
+    }
+
+    marker_fd = pm_marker_open(argv[1]);
+    if(0 > marker_fd) {
+        fprintf(stderr, "can't resolve %s\n", argv[1]);
+        exit(EXIT_FAILURE);
+    }
+
+    /* markers are only delivered on TCP, which the event API always uses */
+    r.pm_handle = pm_connect_async(argv[1], argv[2],
+                                   r.channels, r.num_channels);
+    if(NULL == r.pm_handle) {
+        fprintf(stderr, "Server connect failed!\n");
+        exit(EXIT_FAILURE);
+    }
+    r.connected = true;
+    pm_set_callbacks(r.pm_handle, &callbacks, &r);
+
+    if(0 != pipe(sigchld_pipe)) {
+        perror("pipe");
+        exit(EXIT_FAILURE);
+    }
+    fcntl(sigchld_pipe[0], F_SETFL, O_NONBLOCK);
+    fcntl(sigchld_pipe[1], F_SETFL, O_NONBLOCK);
+    fcntl(sigchld_pipe[0], F_SETFD, FD_CLOEXEC);
+    fcntl(sigchld_pipe[1], F_SETFD, FD_CLOEXEC);
+    fcntl(marker_fd, F_SETFD, FD_CLOEXEC);
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = sigchld_hnd;
+    sa.sa_flags = SA_NOCLDSTOP;
+    sigaction(SIGCHLD, &sa, NULL);
+
+    /* the exec marker has to arrive while we are subscribed */
+    while(!r.streaming && process(&r, marker_fd)) {
+    }
+
+    for(unsigned long run = 1; r.connected && run <= runs; run++) {
+        fcntl(pm_fd(r.pm_handle), F_SETFD, FD_CLOEXEC);
+        start_run(&r, marker_fd, command);
+        while((!r.exited || !(r.ended || r.failed)) &&
+              process(&r, marker_fd)) {
+        }
+        if(r.connected) {
+            report_run(&r, run, runs);
+        }
+    }
+    if(1 < runs && 0 < r.seconds.n) {
+        report_series(&r);
+    }
+
+    if(!r.connected && 0 != r.pid && !r.exited) {
+        waitpid(r.pid, &r.status, 0);
+    }
+    pm_close(r.pm_handle);
+    close(marker_fd);
+
+    if(!r.connected || r.seconds.n < runs) {
+        return EXIT_FAILURE;
+    }
+    return WIFEXITED(r.status) ? WEXITSTATUS(r.status) :
+                                 128 + WTERMSIG(r.status);
+}
+/* vim: set fileencoding=utf8 : */
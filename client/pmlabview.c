@@ -0,0 +1,586 @@
+/*
+ *  Plots data from pm-lab-tools/daemon in real time
+ *
+ *  Copyright (C)2011/12, Jonathan Dimond <jonny@dimond.de>
+ *                      & Johannes Weiß <uni@tux4u.de>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <signal.h>
+#include <assert.h>
+#include <unistd.h>
+#include <poll.h>
+#include <math.h>
+#include <sys/time.h>
+
+#include <X11/Xlib.h>
+#include <X11/Xutil.h>
+#include <X11/keysym.h>
+
+#include "libpmlab.h"
+#include "channels.h"
+
+#define WIDTH 640
+#define HEIGHT 480
+#define HEIGHT_USED ((int)(0.8 * HEIGHT))
+#define HEIGHT_OFFSET ((HEIGHT - HEIGHT_USED) / 2)
+#define FRAMES_PER_SECOND 60
+#define NUM_TICKS 4
+#define LABEL_LEN 64
+/* colors, used again from the ninth channel on */
+#define NUM_COLORS 8
+
+/* same colors as client/realtime.py */
+static const unsigned short channel_rgb[NUM_COLORS][3] = {
+    { 255, 0, 0 },    /* red */
+    { 0, 255, 0 },    /* green */
+    { 0, 0, 255 },    /* blue */
+    { 255, 0, 255 },  /* purple */
+    { 255, 128, 0 },  /* orange */
+    { 0, 255, 255 },  /* yellow */
+    { 0, 0, 0 },      /* black */
+    { 85, 58, 38 }    /* brown */
+};
+
+typedef struct {
+    void *pm_handle;
+    bool connected;
+    unsigned int num_channels;
+
+    /* volts are multiplied by this to get watts (1 to plot volts) */
+    double power_factor;
+    double window_seconds;
+    unsigned int quality;      /* pixels per column */
+    unsigned int num_columns;
+
+    /* min/max bucket per channel and column, a ring of num_columns columns,
+     * channel c of column i is at [c * num_columns + i] */
+    unsigned int samples_per_column;
+    double *col_min;
+    double *col_max;
+    double *col_time;
+    unsigned int head;         /* the next column to be written */
+    unsigned int filled;       /* valid columns */
+    unsigned int pending;      /* columns not yet drawn */
+
+    /* the column currently being accumulated */
+    double *acc_min;
+    double *acc_max;
+    unsigned int acc_count;
+    double acc_time;
+
+    double y_min;
+    double y_max;
+    bool have_range;
+    bool range_changed;
+
+    /* X11 */
+    Display *dpy;
+    Window win;
+    Pixmap ring;               /* one column per num_columns, never scrolled */
+    Pixmap back;               /* ring in order plus labels, then shown */
+    GC bg_gc;
+    GC fg_gc;
+    GC channel_gc[MAX_CHANNELS];
+    Atom wm_delete;
+    int mouse_x;
+    int mouse_y;
+    bool dirty;
+} viewer_t;
+
+static volatile bool running = true;
+
+static void sig_hnd() {
+    fprintf(stderr, "Ctrl+C caught, exiting...\n");
+    running = false;
+}
+
+static double now_seconds(void) {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+/*
+ * COLUMN BUCKETS
+ */
+static void init_columns(viewer_t *v) {
+    const size_t n = v->num_channels * v->num_columns;
+    const double rate = pm_samplingrate(v->pm_handle);
+
+    v->samples_per_column = v->window_seconds * rate / v->num_columns;
+    if(0 == v->samples_per_column) {
+        v->samples_per_column = 1;
+    }
+
+    v->col_min = calloc(n, sizeof(double));
+    v->col_max = calloc(n, sizeof(double));
+    v->col_time = calloc(v->num_columns, sizeof(double));
+    v->acc_min = calloc(v->num_channels, sizeof(double));
+    v->acc_max = calloc(v->num_channels, sizeof(double));
+    assert(NULL != v->col_min && NULL != v->col_max && NULL != v->col_time);
+    assert(NULL != v->acc_min && NULL != v->acc_max);
+}
+
+static void update_range(viewer_t *v, double lo, double hi) {
+    double margin;
+
+    if(v->have_range && lo >= v->y_min && hi <= v->y_max) {
+        return;
+    }
+
+    if(!v->have_range) {
+        v->y_min = lo;
+        v->y_max = hi;
+        v->have_range = true;
+    } else {
+        v->y_min = lo < v->y_min ? lo : v->y_min;
+        v->y_max = hi > v->y_max ? hi : v->y_max;
+    }
+
+    /* grow a bit more than necessary so we don't redraw all the time */
+    margin = 0.05 * (v->y_max - v->y_min);
+    if(0 == margin) {
+        margin = 0.001 * (0 != v->y_max ? fabs(v->y_max) : 1);
+    }
+    v->y_min -= margin;
+    v->y_max += margin;
+    v->range_changed = true;
+}
+
+static void commit_column(viewer_t *v) {
+    double lo = INFINITY;
+    double hi = -INFINITY;
+
+    /* power_factor is positive, so min and max stay what they are */
+    for(unsigned int c = 0; c < v->num_channels; c++) {
+        const size_t idx = c * v->num_columns + v->head;
+        v->col_min[idx] = v->acc_min[c] * v->power_factor;
+        v->col_max[idx] = v->acc_max[c] * v->power_factor;
+        lo = v->col_min[idx] < lo ? v->col_min[idx] : lo;
+        hi = v->col_max[idx] > hi ? v->col_max[idx] : hi;
+    }
+    v->col_time[v->head] = v->acc_time;
+    update_range(v, lo, hi);
+
+    v->head = (v->head + 1) % v->num_columns;
+    if(v->filled < v->num_columns) {
+        v->filled++;
+    }
+    if(v->pending < v->num_columns) {
+        v->pending++;
+    }
+    v->acc_count = 0;
+}
+
+static void on_block(void *user, const pm_block_t *block) {
+    viewer_t *v = (viewer_t *)user;
+    const unsigned int n = block->samples_read;
+    const double rate = pm_samplingrate(v->pm_handle);
+    unsigned int start = 0;
+
+    if(0 == v->samples_per_column) {
+        init_columns(v);
+    }
+
+    while(start < n) {
+        unsigned int take = v->samples_per_column - v->acc_count;
+        if(take > n - start) {
+            take = n - start;
+        }
+
+        if(0 == v->acc_count) {
+            v->acc_time = block->timestamp_nanos / 1e9 + start / rate;
+            for(unsigned int c = 0; c < v->num_channels; c++) {
+                v->acc_min[c] = block->analog_data[c * n + start];
+                v->acc_max[c] = v->acc_min[c];
+            }
+        }
+
+        /* plain min/max loops over one channel at a time vectorize well */
+        for(unsigned int c = 0; c < v->num_channels; c++) {
+            const double *data = block->analog_data + c * n + start;
+            double lo = v->acc_min[c];
+            double hi = v->acc_max[c];
+            for(unsigned int i = 0; i < take; i++) {
+                lo = data[i] < lo ? data[i] : lo;
+                hi = data[i] > hi ? data[i] : hi;
+            }
+            v->acc_min[c] = lo;
+            v->acc_max[c] = hi;
+        }
+
+        v->acc_count += take;
+        start += take;
+        if(v->acc_count == v->samples_per_column) {
+            commit_column(v);
+        }
+    }
+}
+
+static void on_gap(void *user, uint64_t expected_nanos, uint64_t ts_nanos) {
+    fprintf(stderr, "Lost samples between %f and %f\n",
+            expected_nanos / 1e9, ts_nanos / 1e9);
+}
+
+static void on_disconnect(void *user, int error) {
+    viewer_t *v = (viewer_t *)user;
+
+    fprintf(stderr, "Server closed connection (%s).\n",
+            0 == error ? "EOF" : strerror(error));
+    v->connected = false;
+}
+
+/*
+ * DRAWING
+ */
+static int value_to_y(const viewer_t *v, double value) {
+    return HEIGHT - HEIGHT_OFFSET -
+           (int)((value - v->y_min) / (v->y_max - v->y_min) * HEIGHT_USED);
+}
+
+static void draw_column(viewer_t *v, unsigned int col) {
+    const int x = col * v->quality;
+
+    XFillRectangle(v->dpy, v->ring, v->bg_gc, x, 0, v->quality, HEIGHT);
+    for(unsigned int c = 0; c < v->num_channels; c++) {
+        const size_t idx = c * v->num_columns + col;
+        const int y_top = value_to_y(v, v->col_max[idx]);
+        const int y_bottom = value_to_y(v, v->col_min[idx]);
+        XFillRectangle(v->dpy, v->ring, v->channel_gc[c],
+                       x, y_top, v->quality, y_bottom - y_top + 1);
+    }
+}
+
+static void draw_new_columns(viewer_t *v) {
+    if(v->range_changed) {
+        /* scale changed, everything has to be redrawn */
+        XFillRectangle(v->dpy, v->ring, v->bg_gc, 0, 0, WIDTH, HEIGHT);
+        for(unsigned int i = 0; i < v->filled; i++) {
+            draw_column(v, i);
+        }
+        v->range_changed = false;
+    } else {
+        for(unsigned int i = v->pending; i > 0; i--) {
+            draw_column(v, (v->head + v->num_columns - i) % v->num_columns);
+        }
+    }
+
+    if(0 != v->pending) {
+        v->dirty = true;
+    }
+    v->pending = 0;
+}
+
+static void draw_label(viewer_t *v, int x, int y, const char *label) {
+    XDrawString(v->dpy, v->back, v->fg_gc, x, y, label, strlen(label));
+}
+
+/* the column displayed at window position x */
+static unsigned int column_at(const viewer_t *v, int x) {
+    const unsigned int oldest = v->filled < v->num_columns ? 0 : v->head;
+    return (oldest + x / v->quality) % v->num_columns;
+}
+
+static void present(viewer_t *v) {
+    char label[LABEL_LEN];
+    const int split = v->head * v->quality;
+
+    /* bring the ring into chronological order, oldest column left */
+    if(v->filled < v->num_columns) {
+        XCopyArea(v->dpy, v->ring, v->back, v->fg_gc,
+                  0, 0, WIDTH, HEIGHT, 0, 0);
+    } else {
+        XCopyArea(v->dpy, v->ring, v->back, v->fg_gc,
+                  split, 0, WIDTH - split, HEIGHT, 0, 0);
+        XCopyArea(v->dpy, v->ring, v->back, v->fg_gc,
+                  0, 0, split, HEIGHT, WIDTH - split, 0);
+    }
+
+    if(v->have_range) {
+        const double values[3] = { v->y_max, (v->y_max + v->y_min) / 2,
+                                   v->y_min };
+        const int ys[3] = { HEIGHT_OFFSET, HEIGHT / 2,
+                            HEIGHT - HEIGHT_OFFSET };
+        for(int i = 0; i < 3; i++) {
+            XDrawLine(v->dpy, v->back, v->fg_gc,
+                      WIDTH - 5, ys[i], WIDTH, ys[i]);
+            snprintf(label, sizeof(label), "%f", values[i]);
+            draw_label(v, WIDTH - 7 - 6 * strlen(label), ys[i] + 4, label);
+        }
+    }
+
+    for(int i = 0; i < NUM_TICKS; i++) {
+        const int x = i * WIDTH / NUM_TICKS;
+        const unsigned int col = column_at(v, x);
+        if(x / v->quality >= v->filled) {
+            break;
+        }
+        XDrawLine(v->dpy, v->back, v->fg_gc, x, HEIGHT - 5, x, HEIGHT);
+        snprintf(label, sizeof(label), "%.2f", v->col_time[col]);
+        draw_label(v, x + 2, HEIGHT - 3, label);
+    }
+
+    if(v->have_range && v->mouse_x / v->quality < v->filled) {
+        const double my = (1.0 - (double)(v->mouse_y - HEIGHT_OFFSET) /
+                                 HEIGHT_USED) *
+                          (v->y_max - v->y_min) + v->y_min;
+        snprintf(label, sizeof(label), "(x=%f, y=%f)",
+                 v->col_time[column_at(v, v->mouse_x)], my);
+        draw_label(v, 2, 12, label);
+    }
+
+    XCopyArea(v->dpy, v->back, v->win, v->fg_gc, 0, 0, WIDTH, HEIGHT, 0, 0);
+    XFlush(v->dpy);
+    v->dirty = false;
+}
+
+static GC rgb_gc(viewer_t *v, unsigned short r, unsigned short g,
+                 unsigned short b) {
+    XColor color = { .red = r * 257, .green = g * 257, .blue = b * 257 };
+    GC gc = XCreateGC(v->dpy, v->win, 0, NULL);
+
+    XAllocColor(v->dpy, DefaultColormap(v->dpy, DefaultScreen(v->dpy)),
+                &color);
+    XSetForeground(v->dpy, gc, color.pixel);
+    return gc;
+}
+
+static int open_window(viewer_t *v) {
+    int depth;
+
+    v->dpy = XOpenDisplay(NULL);
+    if(NULL == v->dpy) {
+        return -1;
+    }
+    depth = DefaultDepth(v->dpy, DefaultScreen(v->dpy));
+
+    v->win = XCreateSimpleWindow(v->dpy, DefaultRootWindow(v->dpy),
+                                 0, 0, WIDTH, HEIGHT, 0,
+                                 BlackPixel(v->dpy, DefaultScreen(v->dpy)),
+                                 WhitePixel(v->dpy, DefaultScreen(v->dpy)));
+    XStoreName(v->dpy, v->win, "pmlabview");
+    XSelectInput(v->dpy, v->win,
+                 ExposureMask | PointerMotionMask | KeyPressMask);
+    v->wm_delete = XInternAtom(v->dpy, "WM_DELETE_WINDOW", False);
+    XSetWMProtocols(v->dpy, v->win, &v->wm_delete, 1);
+
+    v->ring = XCreatePixmap(v->dpy, v->win, WIDTH, HEIGHT, depth);
+    v->back = XCreatePixmap(v->dpy, v->win, WIDTH, HEIGHT, depth);
+    v->bg_gc = rgb_gc(v, 255, 255, 255);
+    v->fg_gc = rgb_gc(v, 0, 0, 0);
+    for(unsigned int c = 0; c < v->num_channels; c++) {
+        v->channel_gc[c] = rgb_gc(v, channel_rgb[c % NUM_COLORS][0],
+                                  channel_rgb[c % NUM_COLORS][1],
+                                  channel_rgb[c % NUM_COLORS][2]);
+    }
+    XFillRectangle(v->dpy, v->ring, v->bg_gc, 0, 0, WIDTH, HEIGHT);
+
+    XMapWindow(v->dpy, v->win);
+    XFlush(v->dpy);
+    return 0;
+}
+
+static void close_window(viewer_t *v) {
+    XFreeGC(v->dpy, v->bg_gc);
+    XFreeGC(v->dpy, v->fg_gc);
+    for(unsigned int c = 0; c < v->num_channels; c++) {
+        XFreeGC(v->dpy, v->channel_gc[c]);
+    }
+    XFreePixmap(v->dpy, v->ring);
+    XFreePixmap(v->dpy, v->back);
+    XDestroyWindow(v->dpy, v->win);
+    XCloseDisplay(v->dpy);
+}
+
+static void handle_x_events(viewer_t *v) {
+    XEvent ev;
+
+    while(XPending(v->dpy)) {
+        XNextEvent(v->dpy, &ev);
+        switch(ev.type) {
+            case Expose:
+                v->dirty = true;
+                break;
+            case MotionNotify:
+                v->mouse_x = ev.xmotion.x;
+                v->mouse_y = ev.xmotion.y;
+                v->dirty = true;
+                break;
+            case KeyPress:
+                if(XK_q == XLookupKeysym(&ev.xkey, 0) ||
+                   XK_Escape == XLookupKeysym(&ev.xkey, 0)) {
+                    running = false;
+                }
+                break;
+            case ClientMessage:
+                if((Atom)ev.xclient.data.l[0] == v->wm_delete) {
+                    running = false;
+                }
+                break;
+            default:
+                break;
+        }
+    }
+}
+
+static void usage(const char *progname) {
+    fprintf(stderr,
+            "pmlabview, Copyright (C)2011-2012, "
+            "Jonathan Dimond <jonny@dimond.de>\n");
+    fprintf(stderr,
+            "                                 & "
+            "Johannes Weiß <uni@tux4u.de>\n");
+    fprintf(stderr,
+            "This program comes with ABSOLUTELY NO WARRANTY; "
+            "for details type `show w'.\n"
+            "This is free software, and you are welcome to redistribute it"
+            "\nunder certain conditions; type `show c' for details.\n\n");
+    fprintf(stderr, "Usage: %s [-w SECONDS] [-q QUALITY] "
+                    "[-p VOLTAGE:RESISTANCE] SERVER PORT CHANNEL...\n\n",
+            progname);
+    fprintf(stderr, "\t-w SECONDS\ttime frame of the window (default 40)\n");
+    fprintf(stderr, "\t-q QUALITY\tpixels per column (default 1)\n");
+    fprintf(stderr, "\t-p V:R\t\tplot watts, V volts over a R mOhm shunt\n");
+    fprintf(stderr, "\nColors:\n");
+    fprintf(stderr, "\tchannel 1: red\n\tchannel 2: green\n"
+                    "\tchannel 3: blue\n\tchannel 4: purple\n"
+                    "\tchannel 5: orange\n\tchannel 6: yellow\n"
+                    "\tchannel 7: black\n\tchannel 8: brown\n"
+                    "\tchannel 9 on: the same again\n");
+}
+
+int main(int argc, char **argv)
+{
+    viewer_t v = { .window_seconds = 40, .quality = 1, .power_factor = 1 };
+    uint32_t chosen_channels[MAX_CHANNELS] = { 0 };
+    pm_callbacks_t callbacks = { on_block, on_gap, on_disconnect };
+    struct pollfd poll_cfg[2];
+    double next_frame, fps_start;
+    unsigned int frames = 0;
+    double voltage, resistance;
+    char *progname = argv[0];
+    int opt;
+
+    while ((opt = getopt(argc, argv, "w:q:p:")) != -1) {
+        switch (opt) {
+            case 'w':
+                v.window_seconds = atof(optarg);
+                break;
+            case 'q':
+                v.quality = atoi(optarg);
+                break;
+            case 'p':
+                if (2 != sscanf(optarg, "%lf:%lf", &voltage, &resistance) ||
+                    voltage <= 0 || resistance <= 0) {
+                    argc = 0;
+                    break;
+                }
+                v.power_factor = voltage / (resistance / 1000.0);
+                break;
+            default:
+                argc = 0;
+                break;
+        }
+    }
+    argc -= optind - 1;
+    argv += optind - 1;
+
+    if (argc <= 3 || v.window_seconds <= 0 ||
+        v.quality < 1 || v.quality > WIDTH) {
+        usage(progname);
+        exit(EXIT_FAILURE);
+    }
+
+    v.num_channels = parse_channels(argv[1], argv[2], argc-3, argv+3,
+                                    chosen_channels);
+    v.num_columns = WIDTH / v.quality;
+    if (0 == v.num_channels) {
+        exit(EXIT_FAILURE);
+    }
+
+    signal(SIGINT, (void (*)(int))sig_hnd);
+
+    v.pm_handle = pm_connect_async(argv[1], argv[2],
+                                   chosen_channels, v.num_channels);
+    if (NULL == v.pm_handle) {
+        fprintf(stderr, "Server connect failed!\n");
+        exit(EXIT_FAILURE);
+    }
+    v.connected = true;
+    pm_set_callbacks(v.pm_handle, &callbacks, &v);
+
+    if (0 != open_window(&v)) {
+        fprintf(stderr, "Can't open display!\n");
+        pm_close(v.pm_handle);
+        exit(EXIT_FAILURE);
+    }
+
+    next_frame = fps_start = now_seconds();
+    while (running && v.connected) {
+        double now = now_seconds();
+        int timeout = (int)((next_frame - now) * 1000);
+
+        poll_cfg[0].fd = pm_fd(v.pm_handle);
+        poll_cfg[0].events = pm_poll_events(v.pm_handle);
+        poll_cfg[0].revents = 0;
+        poll_cfg[1].fd = ConnectionNumber(v.dpy);
+        poll_cfg[1].events = POLLIN;
+        poll_cfg[1].revents = 0;
+
+        if (0 < poll(poll_cfg, 2, timeout < 0 ? 0 : timeout) &&
+            0 != poll_cfg[0].revents) {
+            pm_process(v.pm_handle);
+        }
+        handle_x_events(&v);
+
+        now = now_seconds();
+        if (now < next_frame) {
+            continue;
+        }
+        next_frame += 1.0 / FRAMES_PER_SECOND;
+        if (next_frame < now) {
+            /* we fell behind, don't try to catch up */
+            next_frame = now + 1.0 / FRAMES_PER_SECOND;
+        }
+
+        if (0 != v.samples_per_column) {
+            draw_new_columns(&v);
+        }
+        if (v.dirty) {
+            present(&v);
+            frames++;
+        }
+        if (now - fps_start > 1) {
+            fprintf(stderr, "FPS %f\n", frames / (now - fps_start));
+            frames = 0;
+            fps_start = now;
+        }
+    }
+
+    close_window(&v);
+    pm_close(v.pm_handle);
+    free(v.col_min);
+    free(v.col_max);
+    free(v.col_time);
+    free(v.acc_min);
+    free(v.acc_max);
+
+    return 0;
+}
+/* vim: set fileencoding=utf8 : */
@@ -0,0 +1,344 @@
+/*
+ *  Library to read data from pm-lab-tools/daemon
+ *
+ *  Copyright (C)2011/12, Jonathan Dimond <jonny@dimond.de>
+ *                      & Johannes Weiß <uni@tux4u.de>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <signal.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#ifndef __MACH__
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#endif
+
+#include "shm_layout.h"
+#include "decode.h"
+#include "shm_reader.h"
+
+#define SHM_NAME_LEN 64
+/* busy polls before sleeping while waiting for a block */
+#define SHM_SPINS 1000
+/* how long to sleep before checking whether the daemon is still alive */
+#define SHM_CHECK_NANOS 100000000L
+/* reads of a description being rewritten before giving up for now */
+#define SHM_DESCRIPTION_TRIES 1000
+
+struct shm_reader {
+    void *base;
+    size_t size;
+    const pm_shm_header_t *header;
+    unsigned int num_channels;
+    uint32_t *channels;
+    const double **channel_data;
+    const digival_t **digital_channel_data;
+    uint64_t next_block;
+    bool described;          /* by the daemon, not just the header */
+    pm_description_t description; /* of the block read last */
+};
+
+static const pm_shm_slot_t *reader_slot(shm_reader_t *reader,
+                                        uint64_t block) {
+    const pm_shm_header_t *h = reader->header;
+    return (const pm_shm_slot_t *)((const char *)reader->base +
+                                   sizeof(pm_shm_header_t) +
+                                   (block % h->num_slots) * h->slot_size);
+}
+
+static bool daemon_alive(const pm_shm_header_t *header) {
+    return !PM_SHM_LOAD(header->closed) &&
+           !(0 != kill((pid_t)header->daemon_pid, 0) && ESRCH == errno);
+}
+
+/*
+ * Sleeps until the futex word in the header no longer holds published (the
+ * daemon woke us) or timeout_nanos passed.
+ */
+static void wait_published(shm_reader_t *reader,
+                           uint32_t published,
+                           long timeout_nanos) {
+    const struct timespec timeout = { 0, timeout_nanos };
+#ifndef __MACH__
+    syscall(SYS_futex, &reader->header->published, FUTEX_WAIT, published,
+            &timeout, NULL, 0);
+#else
+    /* no futexes, poll */
+    nanosleep(&timeout, NULL);
+#endif
+}
+
+/*
+ * Decodes the description in the header, returns false if there is none or
+ * the daemon kept rewriting it (the next block retries then).
+ */
+static bool load_description(shm_reader_t *reader) {
+    const pm_shm_description_t *d = &reader->header->description;
+    uint8_t *message = malloc(PM_SHM_DESCRIPTION_SIZE);
+    unsigned int tries = 0;
+    uint64_t seq;
+    uint32_t len;
+    int err;
+    assert(NULL != message);
+
+    while(true) {
+        if(SHM_DESCRIPTION_TRIES == tries++) {
+            free(message);
+            reader->described = false;
+            return false;
+        }
+        seq = PM_SHM_LOAD(d->seq);
+        len = d->len;
+        if(0 != seq % 2 || len > PM_SHM_DESCRIPTION_SIZE) {
+            /* being rewritten, let the daemon finish */
+            sched_yield();
+            continue;
+        }
+        memcpy(message, d->message, len);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if(__atomic_load_n(&d->seq, __ATOMIC_RELAXED) == seq) {
+            break;
+        }
+    }
+
+    err = 0 == seq ? -EINVAL : decode_description(message,
+                                                  len,
+                                                  reader->channels,
+                                                  reader->num_channels,
+                                                  &reader->description);
+    free(message);
+    reader->described = 0 == err;
+
+    return reader->described;
+}
+
+shm_reader_t *shm_reader_attach(const char *port,
+                                const uint32_t *channels,
+                                unsigned int num_channels) {
+    char name[SHM_NAME_LEN];
+    struct stat st;
+    const pm_shm_header_t *h;
+    int fd, err;
+    shm_reader_t *reader;
+
+    snprintf(name, sizeof(name), PM_SHM_NAME_FORMAT, port);
+    fd = shm_open(name, O_RDONLY, 0);
+    if(0 > fd) {
+        return NULL;
+    }
+
+    err = fstat(fd, &st);
+    if(0 != err || st.st_size < sizeof(pm_shm_header_t)) {
+        close(fd);
+        return NULL;
+    }
+
+    reader = calloc(1, sizeof(*reader));
+    assert(NULL != reader);
+    reader->size = st.st_size;
+    reader->base = mmap(NULL, reader->size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if(MAP_FAILED == reader->base) {
+        free(reader);
+        return NULL;
+    }
+
+    h = reader->header = (const pm_shm_header_t *)reader->base;
+    if(PM_SHM_MAGIC != PM_SHM_LOAD(h->magic) ||
+       PM_SHM_VERSION != h->version ||
+       reader->size < sizeof(pm_shm_header_t) +
+                      h->num_slots * h->slot_size ||
+       !daemon_alive(h)) {
+        goto err;
+    }
+
+    for(unsigned int i = 0; i < num_channels; i++) {
+        if(channels[i] >= h->num_channels) {
+            goto err;
+        }
+    }
+
+    reader->num_channels = num_channels;
+    reader->channels = malloc(num_channels * sizeof(uint32_t));
+    reader->channel_data = malloc(num_channels * sizeof(double *));
+    reader->digital_channel_data = malloc(num_channels *
+                                          sizeof(digival_t *));
+    assert(NULL != reader->channels && NULL != reader->channel_data &&
+           NULL != reader->digital_channel_data);
+    memcpy(reader->channels, channels, num_channels * sizeof(uint32_t));
+
+    /* like a new TCP client, start with the next block */
+    reader->next_block = PM_SHM_LOAD(h->write_count);
+    if(!load_description(reader)) {
+        /* nothing published yet */
+        decode_default_description(PM_SHM_LOAD(h->sampling_rate),
+                                   channels,
+                                   num_channels,
+                                   &reader->description);
+    }
+
+    return reader;
+
+err:
+    munmap(reader->base, reader->size);
+    free(reader);
+    return NULL;
+}
+
+const pm_description_t *shm_reader_describe(shm_reader_t *reader) {
+    return &reader->description;
+}
+
+/* returns the number of published blocks once there is a new one */
+static int wait_block(shm_reader_t *reader, bool block, uint64_t *count) {
+    unsigned int spins = 0;
+    uint32_t published;
+
+    while(true) {
+        /* before write_count, so a block published in between wakes us */
+        published = PM_SHM_LOAD(reader->header->published);
+        *count = PM_SHM_LOAD(reader->header->write_count);
+        if(*count > reader->next_block) {
+            return 1;
+        }
+        if(!block) {
+            return -EAGAIN;
+        }
+        if(PM_SHM_LOAD(reader->header->closed)) {
+            return 0;
+        }
+        if(spins < SHM_SPINS) {
+            spins++;
+            continue;
+        }
+        wait_published(reader, published, SHM_CHECK_NANOS);
+        if(published == PM_SHM_LOAD(reader->header->published) &&
+           !daemon_alive(reader->header)) {
+            return 0;
+        }
+    }
+}
+
+int shm_reader_view(shm_reader_t *reader, pm_view_t *view, bool block) {
+    const pm_shm_slot_t *slot;
+    uint64_t count, seq;
+    int err;
+
+    while(true) {
+        err = wait_block(reader, block, &count);
+        if(1 != err) {
+            return err;
+        }
+
+        if(count - reader->next_block >= reader->header->num_slots) {
+            /* we fell behind and the block is gone, skip to the newest */
+            reader->next_block = count - 1;
+        }
+
+        slot = reader_slot(reader, reader->next_block);
+        seq = PM_SHM_LOAD(slot->seq);
+        if(0 != seq % 2 || slot->block != reader->next_block ||
+           slot->points_per_channel > reader->header->max_points_per_channel ||
+           slot->num_channels > reader->header->num_channels ||
+           0 != decode_slot(slot,
+                            reader->channels,
+                            reader->num_channels,
+                            reader->channel_data,
+                            reader->digital_channel_data,
+                            view)) {
+            /* overwritten while we looked at it, try the newest again */
+            reader->next_block = count - 1;
+            continue;
+        }
+
+        view->generation = slot->config_generation;
+        view->seq = seq;
+        view->opaque_slot = slot;
+
+        if(!shm_reader_valid(reader, view)) {
+            continue;
+        }
+        reader->next_block++;
+        if(!reader->described ||
+           view->generation != reader->description.generation) {
+            /* the daemon describes it before publishing the block */
+            load_description(reader);
+        }
+        reader->description.sampling_rate = view->sampling_rate;
+        return 1;
+    }
+}
+
+bool shm_reader_valid(shm_reader_t *reader, const pm_view_t *view) {
+    const pm_shm_slot_t *slot = (const pm_shm_slot_t *)view->opaque_slot;
+
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&slot->seq, __ATOMIC_RELAXED) == view->seq;
+}
+
+int shm_reader_read(shm_reader_t *reader,
+                    size_t buffer_sizes,
+                    double *analog_data,
+                    digival_t *digital_data,
+                    unsigned int *samples_read,
+                    uint64_t *timestamp_nanos,
+                    pm_marker_t *markers,
+                    unsigned int *num_markers,
+                    bool block) {
+    pm_view_t view;
+    int err;
+
+    do {
+        err = shm_reader_view(reader, &view, block);
+        if(1 != err) {
+            return err;
+        }
+
+        decode_view(&view, reader->num_channels, buffer_sizes, analog_data,
+                    digital_data, markers, num_markers);
+        /* if it was overwritten while copying we have lost it */
+    } while(!shm_reader_valid(reader, &view));
+
+    if(NULL != samples_read) {
+        *samples_read = view.samples_read;
+    }
+    if(NULL != timestamp_nanos) {
+        *timestamp_nanos = view.timestamp_nanos;
+    }
+
+    return view.samples_read * reader->num_channels * sizeof(double);
+}
+
+void shm_reader_detach(shm_reader_t *reader) {
+    munmap(reader->base, reader->size);
+    free(reader->channels);
+    free(reader->channel_data);
+    free(reader->digital_channel_data);
+    free(reader);
+}
+/* vim: set fileencoding=utf8 : */
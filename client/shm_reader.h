@@ -0,0 +1,72 @@
+/*
+ *  Library to read data from pm-lab-tools/daemon
+ *
+ *  Copyright (C)2011/12, Jonathan Dimond <jonny@dimond.de>
+ *                      & Johannes Weiß <uni@tux4u.de>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SHM_READER_H
+#define SHM_READER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "libpmlab.h"
+
+typedef struct shm_reader shm_reader_t;
+
+/*
+ * Attaches to the shared memory segment of the daemon listening on port.
+ * Returns NULL if there is none or it doesn't provide the channels.
+ */
+shm_reader_t *shm_reader_attach(const char *port,
+                                const uint32_t *channels,
+                                unsigned int num_channels);
+
+/* the description of the block read last */
+const pm_description_t *shm_reader_describe(shm_reader_t *reader);
+
+/*
+ * Points view at the next block without copying. Returns 1 on success, 0 if
+ * the daemon is gone and -EAGAIN if block is false and there is no new block.
+ */
+int shm_reader_view(shm_reader_t *reader, pm_view_t *view, bool block);
+
+/*
+ * Returns true if the block view points to hasn't been overwritten yet.
+ */
+bool shm_reader_valid(shm_reader_t *reader, const pm_view_t *view);
+
+/*
+ * Copies the next block just like decode_dataset. Returns the number of
+ * analog bytes copied, 0 if the daemon is gone and -EAGAIN if block is false
+ * and there is no new block.
+ */
+int shm_reader_read(shm_reader_t *reader,
+                    size_t buffer_sizes,
+                    double *analog_data,
+                    digival_t *digital_data,
+                    unsigned int *samples_read,
+                    uint64_t *timestamp_nanos,
+                    pm_marker_t *markers,
+                    unsigned int *num_markers,
+                    bool block);
+
+void shm_reader_detach(shm_reader_t *reader);
+
+#endif
+/* vim: set fileencoding=utf8 : */
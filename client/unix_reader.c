@@ -0,0 +1,348 @@
+/*
+ *  Library to read data from pm-lab-tools/daemon
+ *
+ *  Copyright (C)2011/12, Jonathan Dimond <jonny@dimond.de>
+ *                      & Johannes Weiß <uni@tux4u.de>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <arpa/inet.h>
+
+#include <utils.h>
+#include <selection.h>
+
+#include "common.h"
+#include "shm_layout.h"
+#include "decode.h"
+#include "unix_reader.h"
+
+#define PM_BLOCK_MSG_SIZE (sizeof(MAGIC_MEMFD_BLOCK) + sizeof(uint32_t))
+#define PM_DESCRIPTION_HEADER_SIZE (sizeof(MAGIC_MEASURED_DATA) + \
+                                    sizeof(uint32_t))
+
+struct unix_reader {
+    int sockfd;
+    pm_description_t description; /* of the block read last */
+    unsigned int num_channels;
+    uint32_t *channels;
+    const double **channel_data;
+    const digival_t **digital_channel_data;
+
+    /* the block mapped last */
+    void *map;
+    size_t map_size;
+};
+
+/*
+ * Reads a MeasuredData frame of which the first start_len bytes have been
+ * received already. Returns 0 on success, a negative errno value else.
+ */
+static int read_description(unix_reader_t *reader,
+                            const char *start,
+                            size_t start_len) {
+    char header[PM_DESCRIPTION_HEADER_SIZE];
+    uint32_t net_msg_len, msg_len;
+    uint8_t *msg;
+    ssize_t res;
+    int err;
+
+    assert(start_len <= sizeof(header));
+    if(0 < start_len) {
+        memcpy(header, start, start_len);
+    }
+    res = full_read(reader->sockfd, header + start_len,
+                    sizeof(header) - start_len);
+    if(sizeof(header) - start_len != res ||
+       0 != strncmp(MAGIC_MEASURED_DATA, header,
+                    sizeof(MAGIC_MEASURED_DATA))) {
+        return -EPROTO;
+    }
+    memcpy(&net_msg_len, header + sizeof(MAGIC_MEASURED_DATA),
+           sizeof(uint32_t));
+    msg_len = ntohl(net_msg_len);
+
+    msg = malloc(msg_len);
+    assert(NULL != msg);
+    res = full_read(reader->sockfd, (char *)msg, msg_len);
+    err = msg_len != res ? -EPROTO : decode_description(msg, msg_len,
+                                                        NULL, 0,
+                                                        &reader->description);
+    free(msg);
+
+    return err;
+}
+
+static int handshake(unix_reader_t *reader,
+                     const uint32_t *channels,
+                     unsigned int num_channels) {
+    char welcome[sizeof(WELCOME_MSG)];
+    uint8_t *request = malloc(SELECTION_REQUEST_MAX_SIZE(num_channels));
+    size_t len;
+    ssize_t res;
+    assert(NULL != request);
+
+    len = selection_request(request, channels, num_channels, NULL);
+    res = full_write(reader->sockfd, (char *)request, len);
+    free(request);
+    if(len != res) {
+        return -1;
+    }
+
+    res = full_read(reader->sockfd, welcome, sizeof(welcome));
+    if(sizeof(welcome) != res ||
+       0 != strncmp(WELCOME_MSG, welcome, sizeof(WELCOME_MSG))) {
+        return -1;
+    }
+
+    return 0 == read_description(reader, NULL, 0) ? 0 : -1;
+}
+
+unix_reader_t *unix_reader_connect(const char *port,
+                                   const uint32_t *channels,
+                                   unsigned int num_channels) {
+    struct sockaddr_un addr = { 0 };
+    unix_reader_t *reader;
+    int err;
+
+    reader = calloc(1, sizeof(*reader));
+    assert(NULL != reader);
+
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path, sizeof(addr.sun_path), PM_UNIX_PATH_FORMAT, port);
+
+    reader->sockfd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(0 > reader->sockfd) {
+        free(reader);
+        return NULL;
+    }
+
+    err = connect(reader->sockfd, (struct sockaddr *)&addr, sizeof(addr));
+    if(0 != err || 0 != handshake(reader, channels, num_channels)) {
+        close(reader->sockfd);
+        free(reader);
+        return NULL;
+    }
+
+    reader->num_channels = num_channels;
+    reader->channels = malloc(num_channels * sizeof(uint32_t));
+    reader->channel_data = malloc(num_channels * sizeof(double *));
+    reader->digital_channel_data = malloc(num_channels *
+                                          sizeof(digival_t *));
+    assert(NULL != reader->channels && NULL != reader->channel_data &&
+           NULL != reader->digital_channel_data);
+    memcpy(reader->channels, channels, num_channels * sizeof(uint32_t));
+
+    return reader;
+}
+
+const pm_description_t *unix_reader_describe(unix_reader_t *reader) {
+    return &reader->description;
+}
+
+static void unmap_block(unix_reader_t *reader) {
+    if(NULL != reader->map) {
+        munmap(reader->map, reader->map_size);
+        reader->map = NULL;
+    }
+}
+
+/*
+ * Receives the next block message and its memfd, returns 1 on success, 0 on
+ * EOF or a negative errno value. Takes in the descriptions sent before.
+ */
+static int receive_block_fd(unix_reader_t *reader,
+                            int *ret_block_fd,
+                            uint32_t *size,
+                            bool block) {
+    char msg[PM_BLOCK_MSG_SIZE];
+    char control[CMSG_SPACE(sizeof(int))];
+    struct iovec iov = { .iov_base = msg, .iov_len = sizeof(msg) };
+    struct msghdr hdr = { 0 };
+    struct cmsghdr *cmsg;
+    uint32_t net_size;
+    int block_fd = -1;
+    ssize_t res;
+
+again:
+    hdr.msg_iov = &iov;
+    hdr.msg_iovlen = 1;
+    hdr.msg_control = control;
+    hdr.msg_controllen = sizeof(control);
+
+    do {
+        res = recvmsg(reader->sockfd, &hdr,
+                      MSG_CMSG_CLOEXEC | (block ? 0 : MSG_DONTWAIT));
+    } while(0 > res && EINTR == errno);
+    if(0 > res) {
+        return (EAGAIN == errno || EWOULDBLOCK == errno) ? -EAGAIN : -errno;
+    } else if(0 == res) {
+        return 0;
+    }
+
+    for(cmsg = CMSG_FIRSTHDR(&hdr); NULL != cmsg;
+        cmsg = CMSG_NXTHDR(&hdr, cmsg)) {
+        if(SOL_SOCKET == cmsg->cmsg_level && SCM_RIGHTS == cmsg->cmsg_type) {
+            memcpy(&block_fd, CMSG_DATA(cmsg), sizeof(int));
+        }
+    }
+
+    if(0 > block_fd &&
+       0 == strncmp(MAGIC_MEASURED_DATA, msg,
+                    res < sizeof(MAGIC_MEASURED_DATA) ?
+                    res : sizeof(MAGIC_MEASURED_DATA))) {
+        /* reconfigured, the block read with it follows */
+        res = read_description(reader, msg, res);
+        if(0 > res) {
+            return res;
+        }
+        goto again;
+    }
+
+    /* the rest of the message without descriptors */
+    if(sizeof(msg) != res &&
+       sizeof(msg) - res != full_read(reader->sockfd,
+                                      msg + res,
+                                      sizeof(msg) - res)) {
+        res = -EPROTO;
+        goto err;
+    }
+
+    if(0 > block_fd ||
+       0 != strncmp(MAGIC_MEMFD_BLOCK, msg, sizeof(MAGIC_MEMFD_BLOCK))) {
+        res = -EPROTO;
+        goto err;
+    }
+
+    memcpy(&net_size, msg + sizeof(MAGIC_MEMFD_BLOCK), sizeof(uint32_t));
+    *size = ntohl(net_size);
+    *ret_block_fd = block_fd;
+    return 1;
+
+err:
+    if(0 <= block_fd) {
+        close(block_fd);
+    }
+    return res;
+}
+
+int unix_reader_view(unix_reader_t *reader, pm_view_t *view, bool block) {
+    const pm_shm_slot_t *slot;
+    uint32_t size = 0;
+    int block_fd = -1;
+    int err;
+
+    err = receive_block_fd(reader, &block_fd, &size, block);
+    if(1 != err) {
+        return err;
+    }
+    if(0 > block_fd || 0 == size) {
+        if(0 <= block_fd) {
+            close(block_fd);
+        }
+        return -EPROTO;
+    }
+
+#ifndef __MACH__
+    /* only map what the daemon can't change under our feet */
+    if(F_SEAL_WRITE != (fcntl(block_fd, F_GET_SEALS) & F_SEAL_WRITE)) {
+        close(block_fd);
+        return -EPROTO;
+    }
+#endif
+
+    unmap_block(reader);
+    reader->map = mmap(NULL, size, PROT_READ, MAP_SHARED, block_fd, 0);
+    close(block_fd);
+    if(MAP_FAILED == reader->map) {
+        reader->map = NULL;
+        return -errno;
+    }
+    reader->map_size = size;
+
+    slot = (const pm_shm_slot_t *)reader->map;
+    if(size < sizeof(pm_shm_slot_t) ||
+       size < sizeof(pm_shm_slot_t) +
+              PM_SHM_DATA_SIZE(slot->num_channels,
+                               slot->points_per_channel) ||
+       0 != decode_slot(slot,
+                        reader->channels,
+                        reader->num_channels,
+                        reader->channel_data,
+                        reader->digital_channel_data,
+                        view)) {
+        unmap_block(reader);
+        return -EPROTO;
+    }
+
+    view->generation = reader->description.generation;
+    view->seq = 0;
+    view->opaque_slot = slot;
+    reader->description.sampling_rate = slot->sampling_rate;
+
+    return 1;
+}
+
+int unix_reader_read(unix_reader_t *reader,
+                     size_t buffer_sizes,
+                     double *analog_data,
+                     digival_t *digital_data,
+                     unsigned int *samples_read,
+                     uint64_t *timestamp_nanos,
+                     pm_marker_t *markers,
+                     unsigned int *num_markers,
+                     bool block) {
+    pm_view_t view;
+    int err;
+
+    err = unix_reader_view(reader, &view, block);
+    if(1 != err) {
+        return err;
+    }
+
+    decode_view(&view, reader->num_channels, buffer_sizes, analog_data,
+                digital_data, markers, num_markers);
+    if(NULL != samples_read) {
+        *samples_read = view.samples_read;
+    }
+    if(NULL != timestamp_nanos) {
+        *timestamp_nanos = view.timestamp_nanos;
+    }
+    unmap_block(reader);
+
+    return view.samples_read * reader->num_channels * sizeof(double);
+}
+
+void unix_reader_close(unix_reader_t *reader) {
+    unmap_block(reader);
+    close(reader->sockfd);
+    free(reader->channels);
+    free(reader->channel_data);
+    free(reader->digital_channel_data);
+    free(reader);
+}
+/* vim: set fileencoding=utf8 : */
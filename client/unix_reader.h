@@ -0,0 +1,69 @@
+/*
+ *  Library to read data from pm-lab-tools/daemon
+ *
+ *  Copyright (C)2011/12, Jonathan Dimond <jonny@dimond.de>
+ *                      & Johannes Weiß <uni@tux4u.de>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef UNIX_READER_H
+#define UNIX_READER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "libpmlab.h"
+
+typedef struct unix_reader unix_reader_t;
+
+/*
+ * Connects to the unix domain socket of the daemon listening on port and
+ * requests the channels. Returns NULL if there is no such socket or the
+ * daemon refuses.
+ */
+unix_reader_t *unix_reader_connect(const char *port,
+                                   const uint32_t *channels,
+                                   unsigned int num_channels);
+
+/* the description of the block read last */
+const pm_description_t *unix_reader_describe(unix_reader_t *reader);
+
+/*
+ * Maps the next block the daemon passes and points view at it. The view
+ * stays valid until the next call. Returns 1 on success, 0 on EOF, -EAGAIN
+ * if block is false and there is no new block and another negative errno
+ * value on error.
+ */
+int unix_reader_view(unix_reader_t *reader, pm_view_t *view, bool block);
+
+/*
+ * Copies the next block just like decode_dataset. Returns the number of
+ * analog bytes copied or what unix_reader_view returned.
+ */
+int unix_reader_read(unix_reader_t *reader,
+                     size_t buffer_sizes,
+                     double *analog_data,
+                     digival_t *digital_data,
+                     unsigned int *samples_read,
+                     uint64_t *timestamp_nanos,
+                     pm_marker_t *markers,
+                     unsigned int *num_markers,
+                     bool block);
+
+void unix_reader_close(unix_reader_t *reader);
+
+#endif
+/* vim: set fileencoding=utf8 : */
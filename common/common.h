@@ -21,8 +21,56 @@
 #ifndef COMMON_H
 #define COMMON_H
 
+/*
+ * Handshake: protocol version 1 clients send the number of channels and the
+ * channel ids, the daemon answers WELCOME_MSG and the sampling rate. Later
+ * clients start with HELLO_MAGIC and their protocol version, then the
+ * channels (version 2 as before, version 3 as ranges, version 4 followed by
+ * a trigger, see selection.h), and the daemon answers WELCOME_MSG and a
+ * MeasuredData frame describing the stream. All numbers are uint32 in
+ * network byte order. Either way, a MeasuredData frame announces every
+ * reconfiguration. A client with a trigger only receives captures, each a
+ * MeasuredData frame with the shot_id and a DataSet with the samples.
+ */
+#define HELLO_MAGIC 0x504d4c54 /* "PMLT", more channels than ever allowed */
+#define PROTOCOL_VERSION 4
+
+/* length of a trigger specification at most, see daemon/trigger.h */
+#define MAX_TRIGGER_LEN 256
+/* length of a shot_id at most, terminating zero included */
+#define MAX_SHOT_ID_LEN 32
+
+/*
+ * Markers: a program under test marks where its phases begin by sending
+ * datagrams of MARKER_RECORD_SIZE bytes to UDP port MARKER_PORT of the
+ * daemon: MARKER_MAGIC, an id (both uint32, network byte order) and a label
+ * of MARKER_LABEL_LEN bytes, NUL padded. Clients receive them with the
+ * DataSet of the block read when they arrived, see daemon/markers.h.
+ */
+#define MARKER_PORT 12348
+#define MARKER_MAGIC 0x504d4d4b /* "PMMK" */
+#define MARKER_LABEL_LEN 24
+#define MARKER_RECORD_SIZE (2 * 4 + MARKER_LABEL_LEN)
+/* markers a block carries at most */
+#define MAX_BLOCK_MARKERS 32
+
+/* channels of a daemon at most */
+#define MAX_CHANNELS 256
+/*
+ * samples of all channels in a block at most: the more channels and the
+ * higher the rate, the shorter the blocks, so a buffer of MAX_BLOCK_SAMPLES
+ * holds every block of any selection of channels
+ */
+#define MAX_BLOCK_SAMPLES 240000
+/* samples are sent as IEEE 754 doubles, measured in volts */
+#define SAMPLE_ENCODING "float64"
+#define SAMPLE_UNIT "V"
+
 #define MAGIC_DATA_SET "THE MATRIX HAS YOU!!"
+/* starts a MeasuredData frame, as long as MAGIC_DATA_SET */
+#define MAGIC_MEASURED_DATA "FOLLOW THE RABBIT!!!"
 #define WELCOME_MSG "WELCOME HOME NEO"
+#define MAGIC_MEMFD_BLOCK "THERE IS NO SPOON!!"
 
 typedef int digival_t;
 
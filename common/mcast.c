@@ -0,0 +1,160 @@
+/*
+ *  Records analog data from a NI USB-6218 and send it to connected clients
+ *
+ *  Copyright (C)2011-2012, Johannes Weiß <weiss@tux4u.de>
+ *                        , Jonathan Dimond <jonny@dimond.de>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include <stdint.h>
+
+#include "mcast.h"
+
+/*
+ * BYTE ORDER
+ */
+static uint8_t *put_u32(uint8_t *p, uint32_t value) {
+    for(int i = 3; i >= 0; i--) {
+        *p++ = (value >> (8 * i)) & 0xff;
+    }
+    return p;
+}
+
+static uint8_t *put_u64(uint8_t *p, uint64_t value) {
+    for(int i = 7; i >= 0; i--) {
+        *p++ = (value >> (8 * i)) & 0xff;
+    }
+    return p;
+}
+
+static const uint8_t *get_u32(const uint8_t *p, uint32_t *value) {
+    *value = 0;
+    for(int i = 0; i < 4; i++) {
+        *value = (*value << 8) | *p++;
+    }
+    return p;
+}
+
+static const uint8_t *get_u64(const uint8_t *p, uint64_t *value) {
+    *value = 0;
+    for(int i = 0; i < 8; i++) {
+        *value = (*value << 8) | *p++;
+    }
+    return p;
+}
+
+static void put_samples(uint8_t *buf, const double *samples, size_t n) {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    memcpy(buf, samples, n * sizeof(double));
+#else
+    for(size_t i = 0; i < n; i++) {
+        uint64_t bits;
+        memcpy(&bits, &samples[i], sizeof(bits));
+        for(int j = 0; j < 8; j++) {
+            *buf++ = (bits >> (8 * j)) & 0xff;
+        }
+    }
+#endif
+}
+
+void mcast_get_samples(double *samples, const uint8_t *buf, size_t n) {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    memcpy(samples, buf, n * sizeof(double));
+#else
+    for(size_t i = 0; i < n; i++) {
+        uint64_t bits = 0;
+        for(int j = 7; j >= 0; j--) {
+            bits = (bits << 8) | buf[j];
+        }
+        memcpy(&samples[i], &bits, sizeof(bits));
+        buf += 8;
+    }
+#endif
+}
+
+/*
+ * FUNCTIONALITY
+ */
+uint32_t mcast_num_fragments(uint32_t points_per_channel) {
+    return (points_per_channel + MCAST_SAMPLES_PER_DATAGRAM - 1) /
+           MCAST_SAMPLES_PER_DATAGRAM;
+}
+
+size_t mcast_pack(uint8_t *buf,
+                  const mcast_header_t *header,
+                  const double *samples) {
+    uint8_t *p = buf;
+
+    p = put_u32(p, MCAST_MAGIC);
+    p = put_u64(p, header->seq);
+    p = put_u64(p, header->block);
+    p = put_u64(p, header->timestamp_nanos);
+    p = put_u32(p, header->sampling_rate);
+    p = put_u32(p, header->channel);
+    p = put_u32(p, header->points_per_channel);
+    p = put_u32(p, header->fragment);
+    p = put_u32(p, header->num_samples);
+    put_samples(p, samples, header->num_samples);
+
+    return MCAST_HEADER_SIZE + header->num_samples * sizeof(double);
+}
+
+const uint8_t *mcast_unpack(const uint8_t *buf,
+                            size_t len,
+                            mcast_header_t *header) {
+    const uint8_t *p = buf;
+    uint32_t magic;
+
+    if(len < MCAST_HEADER_SIZE) {
+        return NULL;
+    }
+
+    p = get_u32(p, &magic);
+    p = get_u64(p, &header->seq);
+    p = get_u64(p, &header->block);
+    p = get_u64(p, &header->timestamp_nanos);
+    p = get_u32(p, &header->sampling_rate);
+    p = get_u32(p, &header->channel);
+    p = get_u32(p, &header->points_per_channel);
+    p = get_u32(p, &header->fragment);
+    p = get_u32(p, &header->num_samples);
+
+    if(MCAST_MAGIC != magic ||
+       header->num_samples > MCAST_SAMPLES_PER_DATAGRAM ||
+       len != MCAST_HEADER_SIZE + header->num_samples * sizeof(double) ||
+       header->fragment >= mcast_num_fragments(header->points_per_channel) ||
+       (uint64_t)header->fragment * MCAST_SAMPLES_PER_DATAGRAM +
+           header->num_samples > header->points_per_channel) {
+        return NULL;
+    }
+
+    return p;
+}
+
+void mcast_pack_request(uint8_t *buf, const mcast_request_t *request) {
+    buf = put_u64(buf, request->block);
+    buf = put_u32(buf, request->channel);
+    buf = put_u32(buf, request->first_fragment);
+    put_u32(buf, request->num_fragments);
+}
+
+void mcast_unpack_request(const uint8_t *buf, mcast_request_t *request) {
+    buf = get_u64(buf, &request->block);
+    buf = get_u32(buf, &request->channel);
+    buf = get_u32(buf, &request->first_fragment);
+    get_u32(buf, &request->num_fragments);
+}
+/* vim: set fileencoding=utf8 : */
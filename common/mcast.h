@@ -0,0 +1,98 @@
+/*
+ *  Records analog data from a NI USB-6218 and send it to connected clients
+ *
+ *  Copyright (C)2011-2012, Johannes Weiß <weiss@tux4u.de>
+ *                        , Jonathan Dimond <jonny@dimond.de>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MCAST_H
+#define MCAST_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * Multicast publication: every channel of every block is sent once to
+ * GROUP:MCAST_DATA_PORT+channel as datagrams of MCAST_SAMPLES_PER_DATAGRAM
+ * samples, each starting with a header (MCAST_HEADER_SIZE bytes):
+ *
+ * uint32 magic, uint64 seq (counting the datagrams of the channel),
+ * uint64 block, uint64 timestamp_nanos, uint32 sampling_rate,
+ * uint32 channel, uint32 points_per_channel, uint32 fragment (samples start
+ * at fragment * MCAST_SAMPLES_PER_DATAGRAM), uint32 num_samples
+ *
+ * all in network byte order, followed by num_samples little-endian doubles.
+ *
+ * Lost datagrams can be requested from TCP port MCAST_RETRANS_PORT: a
+ * request is uint64 block, uint32 channel, uint32 first_fragment,
+ * uint32 num_fragments (network byte order, MCAST_ALL_FRAGMENTS for the
+ * whole block). The answer is every fragment still available as uint32
+ * length followed by the datagram, terminated by a length of 0.
+ */
+#define MCAST_MAGIC 0x504d4d43 /* "PMMC" */
+#define MCAST_RETRANS_PORT 12349
+#define MCAST_DATA_PORT 12350
+#define MCAST_SAMPLES_PER_DATAGRAM 160
+#define MCAST_HEADER_SIZE 48
+#define MCAST_MAX_DATAGRAM (MCAST_HEADER_SIZE + \
+                            MCAST_SAMPLES_PER_DATAGRAM * sizeof(double))
+#define MCAST_REQUEST_SIZE 20
+#define MCAST_ALL_FRAGMENTS 0xffffffff
+
+typedef struct {
+    uint64_t seq;
+    uint64_t block;
+    uint64_t timestamp_nanos;
+    uint32_t sampling_rate;
+    uint32_t channel;
+    uint32_t points_per_channel;
+    uint32_t fragment;
+    uint32_t num_samples;
+} mcast_header_t;
+
+typedef struct {
+    uint64_t block;
+    uint32_t channel;
+    uint32_t first_fragment;
+    uint32_t num_fragments;
+} mcast_request_t;
+
+/* number of datagrams a channel of a block is split into */
+uint32_t mcast_num_fragments(uint32_t points_per_channel);
+
+/*
+ * Writes the header and the samples to buf (which must hold
+ * MCAST_MAX_DATAGRAM bytes), returns the datagram's length.
+ */
+size_t mcast_pack(uint8_t *buf,
+                  const mcast_header_t *header,
+                  const double *samples);
+
+/*
+ * Parses a datagram, returns a pointer to its samples (to be read with
+ * mcast_get_samples) or NULL if it's not a valid datagram.
+ */
+const uint8_t *mcast_unpack(const uint8_t *buf,
+                            size_t len,
+                            mcast_header_t *header);
+
+void mcast_get_samples(double *samples, const uint8_t *buf, size_t n);
+
+void mcast_pack_request(uint8_t *buf, const mcast_request_t *request);
+void mcast_unpack_request(const uint8_t *buf, mcast_request_t *request);
+
+#endif
+/* vim: set fileencoding=utf8 : */
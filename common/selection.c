@@ -0,0 +1,80 @@
+/*
+ *  Records analog data from a NI USB-6218 and send it to connected clients
+ *
+ *  Copyright (C)2011-2012, Johannes Weiß <weiss@tux4u.de>
+ *                        , Jonathan Dimond <jonny@dimond.de>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include <arpa/inet.h>
+
+#include "common.h"
+#include "selection.h"
+
+static uint8_t *put_u32(uint8_t *p, uint32_t value) {
+    value = htonl(value);
+    memcpy(p, &value, sizeof(value));
+    return p + sizeof(value);
+}
+
+size_t selection_request(uint8_t *buf,
+                         const uint32_t *channels,
+                         unsigned int num_channels,
+                         const char *trigger) {
+    uint8_t *p = buf + 3 * sizeof(uint32_t);
+    uint32_t num_ranges = 0;
+    unsigned int count;
+    size_t trigger_len = NULL == trigger ? 0 : strlen(trigger);
+
+    for(unsigned int i = 0; i < num_channels; i += count) {
+        /* as many ascending consecutive channels as possible */
+        for(count = 1; i + count < num_channels &&
+                       channels[i + count] == channels[i] + count; count++) {
+        }
+        p = put_u32(p, channels[i]);
+        p = put_u32(p, count);
+        num_ranges++;
+    }
+
+    if(trigger_len > MAX_TRIGGER_LEN) {
+        trigger_len = MAX_TRIGGER_LEN;
+    }
+    p = put_u32(p, trigger_len);
+    memcpy(p, NULL == trigger ? "" : trigger, trigger_len);
+    p += trigger_len;
+
+    put_u32(put_u32(put_u32(buf, HELLO_MAGIC), PROTOCOL_VERSION), num_ranges);
+    return p - buf;
+}
+
+int selection_expand(const channel_range_t *ranges,
+                     unsigned int num_ranges,
+                     uint32_t *channels,
+                     unsigned int max) {
+    unsigned int n = 0;
+
+    for(unsigned int r = 0; r < num_ranges; r++) {
+        if(ranges[r].count > max - n) {
+            return -1;
+        }
+        for(uint32_t c = 0; c < ranges[r].count; c++) {
+            channels[n++] = ranges[r].first + c;
+        }
+    }
+
+    return n;
+}
+/* vim: set fileencoding=utf8 : */
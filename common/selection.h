@@ -0,0 +1,74 @@
+/*
+ *  Records analog data from a NI USB-6218 and send it to connected clients
+ *
+ *  Copyright (C)2011-2012, Johannes Weiß <weiss@tux4u.de>
+ *                        , Jonathan Dimond <jonny@dimond.de>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SELECTION_H
+#define SELECTION_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * The channels a protocol version 3 client requests: the number of ranges,
+ * then the first channel id and the number of channels of every range, all
+ * uint32 in network byte order. The channels are delivered in the order of
+ * the ranges, so "ai3 ai0" takes two ranges and all 256 channels one. No
+ * range at all asks for the description of every channel of the daemon
+ * instead of a stream. Since protocol version 4, the length of a trigger
+ * and its text (MAX_TRIGGER_LEN bytes at most, not terminated) follow, an
+ * empty one streams every block.
+ */
+typedef struct {
+    uint32_t first;
+    uint32_t count;
+} channel_range_t;
+
+/*
+ * HELLO_MAGIC, the protocol version, the number of ranges, the ranges and
+ * the trigger
+ */
+#define SELECTION_REQUEST_MAX_SIZE(num_channels) \
+    ((4 + 2 * (size_t)(num_channels)) * sizeof(uint32_t) + MAX_TRIGGER_LEN)
+
+/*
+ * Writes the handshake of a client reading channels (in this order) to buf,
+ * SELECTION_REQUEST_MAX_SIZE(num_channels) bytes at most. trigger is NULL
+ * to stream every block, longer ones are cut at MAX_TRIGGER_LEN.
+ *
+ * Returns:
+ * The length of the request
+ */
+size_t selection_request(uint8_t *buf,
+                         const uint32_t *channels,
+                         unsigned int num_channels,
+                         const char *trigger);
+
+/*
+ * Writes the channel ids of num_ranges ranges to channels.
+ *
+ * Returns:
+ * The number of channels or -1 if there are more than max
+ */
+int selection_expand(const channel_range_t *ranges,
+                     unsigned int num_ranges,
+                     uint32_t *channels,
+                     unsigned int max);
+
+#endif
+/* vim: set fileencoding=utf8 : */
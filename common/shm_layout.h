@@ -0,0 +1,126 @@
+/*
+ *  Records analog data from a NI USB-6218 and send it to connected clients
+ *
+ *  Copyright (C)2011-2012, Johannes Weiß <weiss@tux4u.de>
+ *                        , Jonathan Dimond <jonny@dimond.de>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SHM_LAYOUT_H
+#define SHM_LAYOUT_H
+
+#include <stdint.h>
+
+#include "common.h"
+
+/*
+ * Layout of the shared memory segment the daemon publishes its blocks in for
+ * clients on the same host. The segment is called PM_SHM_NAME_FORMAT with the
+ * TCP port of the daemon and starts with a pm_shm_header_t, followed by
+ * num_slots slots of slot_size bytes each, every slot starting with a
+ * pm_shm_slot_t.
+ *
+ * Block n (counting from 0) is written to slot n % num_slots. The writer
+ * makes the slot's seq odd, writes the data, makes seq even again and then
+ * sets write_count to n + 1. A reader copies or uses the data between two
+ * reads of seq and only trusts it if both reads returned the same even value
+ * (a seqlock), otherwise the slot has been overwritten. After every block
+ * (and once it's closed) the writer increments the futex word published and
+ * wakes all readers waiting on it.
+ *
+ * The sampling rate can change at runtime, every slot carries the rate its
+ * block was read with and the header the rate of the newest block.
+ *
+ * The header ends with the description of all channels, the MeasuredData
+ * message TCP clients receive (see common.h), guarded by a seqlock of its
+ * own. The daemon rewrites it before it publishes the first block read with
+ * a new configuration and every slot carries the generation of the
+ * description its block belongs to.
+ *
+ * A slot holds what a DataSet frame does: the markers of the block, the
+ * analog data of all channels and then their digital data, both one channel
+ * after the other (see PM_SHM_DIGITAL_DATA).
+ */
+#define PM_SHM_NAME_FORMAT "/pm-lab-tools-%s"
+#define PM_SHM_MAGIC 0x424c4d50 /* "PMLB" */
+#define PM_SHM_VERSION 4
+#define PM_SHM_DESCRIPTION_SIZE 16384
+
+typedef struct {
+    uint64_t seq;
+    uint64_t generation;
+    uint32_t len;            /* of the message */
+    uint32_t reserved;
+    uint8_t message[PM_SHM_DESCRIPTION_SIZE];
+} pm_shm_description_t;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t sampling_rate;
+    uint32_t num_channels;
+    uint32_t num_slots;
+    uint32_t max_points_per_channel;
+    uint64_t slot_size;
+    int64_t daemon_pid;
+    uint32_t closed;         /* set once the daemon stops publishing */
+    uint32_t published;      /* futex word, see above */
+    uint64_t write_count;    /* blocks published so far */
+    pm_shm_description_t description;
+} pm_shm_header_t;
+
+typedef struct {
+    uint32_t id;
+    uint32_t sample;         /* index of the sample in the block */
+    char label[MARKER_LABEL_LEN]; /* NUL padded */
+} pm_shm_marker_t;
+
+typedef struct {
+    uint64_t seq;
+    uint64_t block;
+    uint64_t timestamp_nanos;
+    uint32_t points_per_channel;
+    uint32_t num_channels;
+    uint32_t sampling_rate;
+    uint32_t num_markers;
+    uint64_t config_generation;
+    pm_shm_marker_t markers[MAX_BLOCK_MARKERS];
+    double analog_data[];    /* followed by the digital data */
+} pm_shm_slot_t;
+
+#define PM_SHM_DIGITAL_DATA(slot) \
+    ((const digival_t *)((slot)->analog_data + \
+                         (slot)->num_channels * (slot)->points_per_channel))
+#define PM_SHM_DATA_SIZE(num_channels, points_per_channel) \
+    ((sizeof(double) + sizeof(digival_t)) * \
+     (num_channels) * (points_per_channel))
+
+/*
+ * Clients on the same host that can't map the ring connect to the unix
+ * domain socket PM_UNIX_PATH_FORMAT (again with the TCP port) instead. The
+ * handshake is the same as over TCP, but every block then arrives as
+ * MAGIC_MEMFD_BLOCK followed by the uint32 size of a memfd (network byte
+ * order), the memfd itself being passed along as SCM_RIGHTS. It is sealed
+ * against writes and holds one pm_shm_slot_t (seq, block and
+ * config_generation are 0) with all channels of the block, so clients just
+ * mmap it. MeasuredData frames are sent in between as over TCP.
+ */
+#define PM_UNIX_PATH_FORMAT "/tmp/pm-lab-tools-%s.sock"
+
+#define PM_SHM_LOAD(x) __atomic_load_n(&(x), __ATOMIC_ACQUIRE)
+#define PM_SHM_STORE(x, v) __atomic_store_n(&(x), (v), __ATOMIC_RELEASE)
+
+#endif
+/* vim: set fileencoding=utf8 : */
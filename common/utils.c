@@ -22,6 +22,7 @@
 #include <errno.h>
 #include <assert.h>
 #include <stdio.h>
+#include <math.h>
 
 #include "utils.h"
 
@@ -72,4 +73,15 @@ ssize_t full_read(int fd, char *buf, size_t count) {
 
     return count;
 }
+
+void add_compensated(double *sum, double *compensation, double value) {
+    const double t = *sum + value;
+
+    if(fabs(*sum) >= fabs(value)) {
+        *compensation += (*sum - t) + value;
+    } else {
+        *compensation += (value - t) + *sum;
+    }
+    *sum = t;
+}
 /* vim: set fileencoding=utf8 : */
@@ -24,5 +24,9 @@
 ssize_t full_write(int fd, const char *buf, size_t count);
 ssize_t full_read(int fd, char *buf, size_t count);
 
+/* Neumaier: the low order bits lost in sum are collected in compensation,
+ * the result is sum + compensation */
+void add_compensated(double *sum, double *compensation, double value);
+
 #endif
 /* vim: set fileencoding=utf8 : */
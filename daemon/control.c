@@ -0,0 +1,364 @@
+/*
+ *  Records analog data from a NI USB-6218 and send it to connected clients
+ *
+ *  Copyright (C)2011-2012, Johannes Weiß <weiss@tux4u.de>
+ *                        , Jonathan Dimond <jonny@dimond.de>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdbool.h>
+#include <assert.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <utils.h>
+
+#include "daemon.h"
+#include "sync.h"
+#include "daq_config.h"
+#include "energy.h"
+#include "control.h"
+
+/* the energy of every channel is the longest reply */
+#define REPLY_LEN (ENERGY_REPLY_LEN > DAQ_REPLY_LEN ? ENERGY_REPLY_LEN : \
+                                                      DAQ_REPLY_LEN)
+
+/* shutdown_fd, the listener, energy_result_fd and daq_config_result_fd
+ * come before the clients */
+#define FIRST_CLIENT 4
+
+typedef struct {
+    char line[CONTROL_LINE_LEN];
+    size_t used;
+    uint32_t ending;    /* the session whose result is awaited, 0 if none */
+    bool configuring;   /* awaits the result of its config */
+} control_conn_t;
+
+typedef struct {
+    const char *name;
+    /* writes a one-line reply without the newline, or sets conn->ending
+     * or conn->configuring for a result to come to be the reply */
+    void (*handle)(char *args, char *reply, size_t size,
+                   control_conn_t *conn);
+} control_command_t;
+
+/*
+ * COMMANDS
+ */
+static void cmd_config(char *args, char *reply, size_t size,
+                       control_conn_t *conn) {
+    if('\0' == *args) {
+        snprintf(reply, size, "ERR usage: config [rate=HZ] [u_min=V] "
+                              "[u_max=V] [channels=DEV/AI0,...] "
+                              "[scale=S0,...] [offset=O0,...]");
+        return;
+    }
+    printf("control: config %s\n", args);
+    conn->configuring = daq_config_request(args, reply, size);
+}
+
+static void cmd_status(char *args, char *reply, size_t size,
+                       control_conn_t *conn) {
+    daq_config_t config;
+    char channels[DAQ_MAX_CHANNELS * DAQ_CHANNEL_NAME_LEN];
+    size_t used = 0;
+
+    daq_config_current(&config);
+    for(unsigned int i = 0; i < config.num_channels; i++) {
+        used += snprintf(channels + used, sizeof(channels) - used, "%s%s",
+                         0 == i ? "" : ",", config.channel_names[i]);
+    }
+    snprintf(reply, size, "OK generation %llu rate %u block %u u_min %g "
+                          "u_max %g channels %s",
+             (unsigned long long)config.generation, config.sampling_rate,
+             config.block_size, config.u_min, config.u_max, channels);
+}
+
+static void cmd_begin(char *args, char *reply, size_t size,
+                      control_conn_t *conn) {
+    energy_begin(args, reply, size);
+}
+
+static void cmd_end(char *args, char *reply, size_t size,
+                    control_conn_t *conn) {
+    conn->ending = energy_end(args, reply, size);
+}
+
+static void cmd_help(char *args, char *reply, size_t size,
+                     control_conn_t *conn);
+
+static const control_command_t COMMANDS[] = {
+    { "config", cmd_config },
+    { "status", cmd_status },
+    { "begin", cmd_begin },
+    { "end", cmd_end },
+    { "help", cmd_help },
+};
+#define NUM_COMMANDS (sizeof(COMMANDS) / sizeof(COMMANDS[0]))
+
+static void cmd_help(char *args, char *reply, size_t size,
+                     control_conn_t *conn) {
+    size_t used = snprintf(reply, size, "OK commands:");
+
+    for(size_t i = 0; i < NUM_COMMANDS && used < size; i++) {
+        used += snprintf(reply + used, size - used, " %s", COMMANDS[i].name);
+    }
+}
+
+static void dispatch(char *line, char *reply, size_t size,
+                     control_conn_t *conn) {
+    char *args;
+    size_t len;
+
+    /* telnet and friends send \r\n */
+    len = strlen(line);
+    if(len > 0 && '\r' == line[len - 1]) {
+        line[len - 1] = '\0';
+    }
+
+    line += strspn(line, " \t");
+    args = line + strcspn(line, " \t");
+    if('\0' != *args) {
+        *args++ = '\0';
+        args += strspn(args, " \t");
+    }
+
+    for(size_t i = 0; i < NUM_COMMANDS; i++) {
+        if(0 == strcasecmp(COMMANDS[i].name, line)) {
+            COMMANDS[i].handle(args, reply, size, conn);
+            return;
+        }
+    }
+    snprintf(reply, size, "ERR unknown command: %s", line);
+}
+
+/*
+ * CONNECTIONS
+ */
+
+/* its next lines wait for the result of an end or a config */
+static bool waiting(const control_conn_t *conn) {
+    return 0 != conn->ending || conn->configuring;
+}
+
+/* reply has room for the newline, returns false if the client is gone */
+static bool send_reply(int fd, char *reply) {
+    size_t len = strlen(reply);
+
+    reply[len++] = '\n';
+    return len == full_write(fd, reply, len);
+}
+
+/*
+ * Runs the complete lines received. The replies stay in order: after an
+ * "end" or a "config" the next line waits until its result is there.
+ * Returns false if the client is gone.
+ */
+static bool run_lines(int fd, control_conn_t *conn) {
+    char reply[REPLY_LEN + 1];
+    char *newline;
+    bool blank;
+
+    while(true) {
+        if(0 != conn->ending) {
+            if(!energy_result(conn->ending, reply, REPLY_LEN)) {
+                return true;
+            }
+            conn->ending = 0;
+            if(!send_reply(fd, reply)) {
+                return false;
+            }
+        } else if(conn->configuring) {
+            if(!daq_config_result(reply, REPLY_LEN)) {
+                return true;
+            }
+            conn->configuring = false;
+            if(!send_reply(fd, reply)) {
+                return false;
+            }
+        }
+
+        newline = strchr(conn->line, '\n');
+        if(NULL == newline) {
+            return true;
+        }
+        *newline = '\0';
+        blank = '\0' == conn->line[strspn(conn->line, " \t\r")];
+        if(!blank) {
+            dispatch(conn->line, reply, REPLY_LEN, conn);
+        }
+        conn->used -= newline + 1 - conn->line;
+        memmove(conn->line, newline + 1, conn->used + 1);
+
+        if(!blank && !waiting(conn) && !send_reply(fd, reply)) {
+            return false;
+        }
+    }
+}
+
+/* returns false if the client is gone */
+static bool serve_client(int fd, control_conn_t *conn) {
+    ssize_t res;
+
+    res = recv(fd, conn->line + conn->used,
+               sizeof(conn->line) - conn->used - 1, 0);
+    if(0 >= res) {
+        return 0 > res && EINTR == errno;
+    }
+    conn->used += res;
+    conn->line[conn->used] = '\0';
+
+    if(!run_lines(fd, conn)) {
+        return false;
+    }
+
+    if(!waiting(conn) && sizeof(conn->line) - 1 == conn->used) {
+        full_write(fd, "ERR line too long\n", 18);
+        return false;
+    }
+    return true;
+}
+
+static void drop_client(struct pollfd *poll_cfg,
+                        control_conn_t *conns,
+                        nfds_t *num_fds,
+                        nfds_t i) {
+    if(0 != conns[i].ending) {
+        energy_discard(conns[i].ending);
+    } else if(conns[i].configuring) {
+        daq_config_discard();
+    }
+    close(poll_cfg[i].fd);
+    (*num_fds)--;
+    poll_cfg[i] = poll_cfg[*num_fds];
+    conns[i] = conns[*num_fds];
+}
+
+void *control_thread_main(void *unused) {
+    struct sockaddr_in servaddr;
+    struct pollfd poll_cfg[FIRST_CLIENT + CONTROL_MAX_CLIENTS];
+    control_conn_t conns[FIRST_CLIENT + CONTROL_MAX_CLIENTS];
+    nfds_t num_fds = FIRST_CLIENT;
+    bool ok;
+    int err;
+    int conn;
+    int sock_opt = 1;
+    const int server_sock = socket(AF_INET, SOCK_STREAM, 0);
+    assert(0 <= server_sock);
+
+    err = setsockopt(server_sock,
+                     SOL_SOCKET,
+                     SO_REUSEADDR,
+                     &sock_opt,
+                     sizeof(sock_opt));
+    assert(0 == err);
+
+    /* reconfiguring the hardware is nothing for the whole network */
+    memset(&servaddr, 0, sizeof(servaddr));
+    servaddr.sin_family = AF_INET;
+    servaddr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    servaddr.sin_port = htons(CONTROL_PORT);
+
+    err = bind(server_sock, (struct sockaddr *) &servaddr, sizeof(servaddr));
+    if(0 != err) {
+        printf("WARNING: control port disabled, bind: %s\n",
+               strerror(errno));
+        close(server_sock);
+        return NULL;
+    }
+
+    err = listen(server_sock, CONTROL_MAX_CLIENTS);
+    assert(0 <= err);
+    printf("control commands on 127.0.0.1:%d\n", CONTROL_PORT);
+
+    poll_cfg[0].fd = shutdown_fd();
+    poll_cfg[0].events = POLLIN;
+    poll_cfg[1].fd = server_sock;
+    poll_cfg[1].events = POLLIN;
+    poll_cfg[2].fd = energy_result_fd();
+    poll_cfg[2].events = POLLIN;
+    poll_cfg[3].fd = daq_config_result_fd();
+    poll_cfg[3].events = POLLIN;
+
+    while(running) {
+        err = poll(poll_cfg, num_fds, -1);
+        if (-1 == err && EINTR == errno) {
+            continue;
+        }
+        assert(0 < err);
+
+        if(0 != (poll_cfg[2].revents & POLLIN)) {
+            energy_clear_result_fd();
+        }
+        if(0 != (poll_cfg[3].revents & POLLIN)) {
+            daq_config_clear_result_fd();
+        }
+
+        for(nfds_t i = num_fds - 1; running && i >= FIRST_CLIENT; i--) {
+            if(waiting(&conns[i])) {
+                /* not read while waiting, revents are hangups or errors */
+                ok = 0 == poll_cfg[i].revents &&
+                     run_lines(poll_cfg[i].fd, &conns[i]);
+            } else if(0 != poll_cfg[i].revents) {
+                ok = serve_client(poll_cfg[i].fd, &conns[i]);
+            } else {
+                continue;
+            }
+
+            if(!ok) {
+                drop_client(poll_cfg, conns, &num_fds, i);
+            } else {
+                poll_cfg[i].events = waiting(&conns[i]) ? 0 : POLLIN;
+            }
+        }
+
+        if(0 != (poll_cfg[1].revents & POLLIN)) {
+            conn = accept(server_sock, NULL, NULL);
+            if(0 > conn) {
+                continue;
+            } else if(num_fds == FIRST_CLIENT + CONTROL_MAX_CLIENTS) {
+                close(conn);
+                continue;
+            }
+            poll_cfg[num_fds].fd = conn;
+            poll_cfg[num_fds].events = POLLIN;
+            conns[num_fds].used = 0;
+            conns[num_fds].ending = 0;
+            conns[num_fds].configuring = false;
+            num_fds++;
+        }
+    }
+
+    for(nfds_t i = FIRST_CLIENT; i < num_fds; i++) {
+        close(poll_cfg[i].fd);
+    }
+    err = close(server_sock);
+    assert(0 == err);
+    printf("control socket closed\n");
+
+    return NULL;
+}
+/* vim: set fileencoding=utf8 : */
@@ -0,0 +1,50 @@
+/*
+ *  Records analog data from a NI USB-6218 and send it to connected clients
+ *
+ *  Copyright (C)2011-2012, Johannes Weiß <weiss@tux4u.de>
+ *                        , Jonathan Dimond <jonny@dimond.de>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CONTROL_H
+#define CONTROL_H
+
+/*
+ * Control port: a line based text protocol on the loopback interface
+ * (e.g. `echo status | nc localhost 12347'). Every line is a command and
+ * gets a one-line reply starting with "OK" or "ERR". Commands:
+ *
+ * config [rate=HZ] [u_min=V] [u_max=V] [channels=DEV/AI0,...]
+ *        [scale=S0,...] [offset=O0,...]
+ *        reconfigures the DAQ task between two blocks, see daq_config.h,
+ *        the connection's next commands wait for the reply
+ * status the current configuration
+ * begin [channels=N,FIRST-LAST,...] [shunt=VOLTS:MILLIOHMS]
+ *        opens an energy accounting session, see energy.h
+ * end ID closes session ID, replies its duration and the joules, mean and
+ *        peak watts of every channel once its last block is integrated,
+ *        the connection's next commands wait for it, other connections
+ *        are served meanwhile
+ * help   the available commands
+ */
+#define CONTROL_PORT 12347
+#define CONTROL_MAX_CLIENTS 8
+/* long enough for a scale and an offset of every channel */
+#define CONTROL_LINE_LEN 16384
+
+void *control_thread_main(void *unused);
+
+#endif
+/* vim: set fileencoding=utf8 : */
@@ -32,6 +32,7 @@
 #include <time.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/un.h>
 #include <inttypes.h>
 #include <netinet/tcp.h>
 #include <pthread.h>
@@ -46,27 +47,53 @@
 #include "daemon.h"
 #include "sync.h"
 #include "handler.h"
+#include "stats.h"
+#include "shm_ring.h"
+#include "fd_block.h"
+#include "mcast_pub.h"
+#include "uring_sender.h"
+#include "pipeline.h"
+#include "daq_config.h"
+#include "control.h"
+#include "markers.h"
+#include "energy.h"
+#include "shm_layout.h"
+#include "rt.h"
 #include <common/conf.h>
 
 #define DAQmx_Val_GroupByChannel 0
 #define SERVER_PORT 12345
 #define LISTEN_QUEUE_LEN 8
-#define BUFFER_SAMPLES_PER_CHANNEL 30000
+#define NI_MAX_SAMPLING_RATE 30000
 
 #ifndef WITH_NI
-#include "test_data.h"
+#include "generator.h"
+
+static generator_params_t generator_params;
 #endif
-static const digival_t TEST_DIGITAL_DATA[240000] = { 0 };
 
 volatile bool running = true;
+bool verbose = false;
+static const char *physical_channels = NULL;
+static bool use_shm = true;
+static bool use_unix = true;
+static const char *mcast_group = NULL;
+static bool use_uring = false;
+static rt_params_t rt_params;
 static void sig_hnd() {
-    printf("Ctrl+C caught, exiting...\n");
-    running = false;
+    static const char msg[] = "Ctrl+C caught, exiting...\n";
+    ssize_t res;
+
+    /* only async-signal-safe calls */
+    res = write(STDERR_FILENO, msg, sizeof(msg) - 1);
+    (void)res;
+    request_shutdown();
 }
 
 typedef struct {
     void *opaque_task_handle;
     void *opaque_error;
+    unsigned int block_size;
     bool failed;
 } data_acq_info_t;
 
@@ -91,6 +118,8 @@ static void finish_ni(data_acq_info_t *dai) {
 
     free(dai->opaque_task_handle);
     free(dai->opaque_error);
+#else
+    generator_destroy(dai->opaque_task_handle);
 #endif
     free(dai);
 }
@@ -102,22 +131,28 @@ static void finish_ni(data_acq_info_t *dai) {
             goto err; \
         } \
     }
-static data_acq_info_t *init_ni(void) {
+static data_acq_info_t *init_ni(const daq_config_t *config) {
     data_acq_info_t *dai = malloc(sizeof *dai);
+    assert(NULL != dai);
     dai->failed = false;
     dai->opaque_task_handle = NULL;
+    dai->block_size = config->block_size;
 #ifdef WITH_NI
+    char channels[DAQ_MAX_CHANNELS * DAQ_CHANNEL_NAME_LEN];
     TaskHandle *h = malloc(sizeof *h);
     assert(NULL != h);
 
     dai->opaque_task_handle = h;
     dai->opaque_error = malloc(sizeof(int32));
     assert(NULL != dai->opaque_error);
+    *((int32 *)dai->opaque_error) = 0;
 
+    daq_config_channel_list(config, channels, sizeof(channels));
     CHK(DAQmxBaseCreateTask("analog-inputs", h));
-    CHK(DAQmxBaseCreateAIVoltageChan(*h, NI_CHANNELS, NULL, DAQmx_Val_Diff,
-                                     U_MIN, U_MAX, DAQmx_Val_Volts, NULL));
-    CHK(DAQmxBaseCfgSampClkTiming(*h, CLK_SRC, SAMPLING_RATE,
+    CHK(DAQmxBaseCreateAIVoltageChan(*h, channels, NULL, DAQmx_Val_Diff,
+                                     config->u_min, config->u_max,
+                                     DAQmx_Val_Volts, NULL));
+    CHK(DAQmxBaseCfgSampClkTiming(*h, CLK_SRC, config->sampling_rate,
                                   DAQmx_Val_Rising, DAQmx_Val_ContSamps,
                                   0));
     CHK(DAQmxBaseStartTask(*h));
@@ -126,44 +161,11 @@ err:
     dai->failed = true;
     return dai;
 success:
-#endif
-    return dai;
-}
-
-#ifndef WITH_NI
-int read_dummy(void *handle, unsigned int sampling_rate,
-               time_t timeout, int format, double *buffer,
-               size_t data_size,
-               unsigned int *points_per_channel,
-               void *unused) {
-#ifndef __MACH__
-    static struct timespec t_next = { 0 };
-#endif
-
-    assert(NULL == handle);
-    assert(30000 == sampling_rate);
-    (void)timeout;
-    assert(DAQmx_Val_GroupByChannel == format);
-    assert(sizeof(TEST_ANALOG_DATA)/sizeof(double) <= data_size);
-    *points_per_channel = sizeof(TEST_ANALOG_DATA)/sizeof(double)/8;
-    (void)unused;
-
-#ifndef __MACH__
-    if(0 == t_next.tv_sec) {
-        clock_gettime(CLOCK_REALTIME, &t_next);
-    }
-#endif
-    memcpy(buffer, TEST_ANALOG_DATA, sizeof(TEST_ANALOG_DATA));
-#ifndef __MACH__
-    t_next.tv_sec += 1;
-    clock_nanosleep(CLOCK_REALTIME, TIMER_ABSTIME, &t_next, NULL);
 #else
-    sleep(1);
+    dai->opaque_task_handle = generator_create(&generator_params, config);
 #endif
-
-    return 0;
+    return dai;
 }
-#endif
 
 static int read_ni(data_acq_info_t *dai, const size_t data_size,
                    double *analog_data, unsigned int *points_pc_long) {
@@ -175,7 +177,7 @@ static int read_ni(data_acq_info_t *dai, const size_t data_size,
     TaskHandle *h = (TaskHandle *)dai->opaque_task_handle;
     *((int32 *)dai->opaque_error) =
         DAQmxBaseReadAnalogF64(*h,
-                               SAMPLING_RATE,
+                               dai->block_size,
                                TIMEOUT,
                                DAQmx_Val_GroupByChannel,
                                analog_data,
@@ -189,26 +191,104 @@ static int read_ni(data_acq_info_t *dai, const size_t data_size,
     *points_pc_long = points_pc;
     return 0;
 #else
-    read_dummy(dai->opaque_task_handle, SAMPLING_RATE, TIMEOUT,
-               DAQmx_Val_GroupByChannel, analog_data,
-               data_size, points_pc_long, NULL);
+    if(0 != generator_read(dai->opaque_task_handle, analog_data, data_size,
+                           points_pc_long)) {
+        dai->failed = true;
+        return EIO;
+    }
     return 0;
 #endif
 }
 
+/*
+ * Restarts the DAQ task with the configuration next between two blocks and
+ * returns the task to read from. If the DAQ task doesn't accept next, the
+ * current configuration stays.
+ */
+static data_acq_info_t *reconfigure(data_acq_info_t *dai,
+                                    daq_config_t *config,
+                                    const daq_config_t *next) {
+    finish_ni(dai);
+    dai = init_ni(next);
+    if(!dai->failed) {
+        *config = *next;
+        daq_config_applied(true);
+        printf("NI: reconfigured, generation %llu, rate %u, block %u\n",
+               (unsigned long long)config->generation,
+               config->sampling_rate, config->block_size);
+        return dai;
+    }
+
+    printf("NI: configuration rejected, restarting the previous one\n");
+    finish_ni(dai);
+    daq_config_applied(false);
+    return init_ni(config);
+}
+
 static void *ni_thread_main(void *opaque_info) {
     int err;
     input_data_t *info = (input_data_t *)opaque_info;
     unsigned int points_pc;
-    const unsigned int num_channels = 8;
-    const size_t data_size = BUFFER_SAMPLES_PER_CHANNEL * num_channels;
+    unsigned int num_channels, max_points;
+    const size_t data_size = MAX_BLOCK_SAMPLES;
     uint64_t timestamp = 0;
-    data_acq_info_t *h = init_ni();
-    double *analog_data = malloc(data_size * sizeof(*analog_data));
-    assert(NULL != analog_data);
-    digival_t *digital_data = malloc(data_size * sizeof(*digital_data));
-    assert(NULL != digital_data);
-    info->lock = (pthread_mutex_t)PTHREAD_MUTEX_INITIALIZER;
+    uint64_t read_start;
+    /* when the DAQ task (re)started and the samples per channel since */
+    uint64_t acquisition_start;
+    uint64_t acquired_points = 0;
+    block_markers_t markers;
+    block_sessions_t sessions;
+    daq_config_t config, next_config;
+    data_acq_info_t *h;
+    shm_ring_t *shm = NULL;
+    int block_fd, old_block_fd;
+    mcast_pub_t *mcast = NULL;
+    pthread_t mcast_retrans_thread;
+    rt_block_t *block;
+    double *analog_data;
+    digival_t *digital_data;
+
+    rt_enter(RT_ACQUISITION);
+    block = rt_block_get();
+    analog_data = block->analog_data;
+    /* no digital inputs read yet */
+    digital_data = block->digital_data;
+    memset(digital_data, 0, data_size * sizeof(*digital_data));
+    info->block_fd = -1;
+    info->frame = NULL;
+    info->shot_id = 0;
+    info->markers.count = 0;
+
+    daq_config_current(&config);
+    /* the number of channels stays, the blocks fit the buffers */
+    num_channels = config.num_channels;
+    max_points = data_size / num_channels;
+    h = init_ni(&config);
+    acquisition_start = stats_now_nanos();
+
+    if(use_shm) {
+        shm = shm_ring_create(SERVER_PORT,
+                              num_channels,
+                              config.sampling_rate,
+                              max_points);
+    }
+
+    pipeline_start();
+
+    if(use_uring) {
+        use_uring = uring_sender_start(num_channels, max_points);
+    }
+
+    if(NULL != mcast_group) {
+        mcast = mcast_pub_create(mcast_group, num_channels, max_points);
+    }
+    if(NULL != mcast) {
+        err = pthread_create(&mcast_retrans_thread,
+                             NULL,
+                             mcast_retrans_thread_main,
+                             mcast);
+        assert(0 == err);
+    }
 
     while(running) {
         wait_read_barrier();
@@ -216,18 +296,66 @@ static void *ni_thread_main(void *opaque_info) {
             break;
         }
 
+        if(daq_config_pending(&next_config)) {
+            if(daq_config_needs_restart(&config, &next_config)) {
+                h = reconfigure(h, &config, &next_config);
+                acquisition_start = stats_now_nanos();
+                acquired_points = 0;
+            } else {
+                /* only the calibration changed, the task keeps running */
+                config = next_config;
+                daq_config_applied(true);
+                printf("NI: recalibrated, generation %llu\n",
+                       (unsigned long long)config.generation);
+            }
+        }
+
+        read_start = stats_now_nanos();
         err = read_ni(h, data_size, analog_data, &points_pc);
         if (0 != err) {
-            running = false;
+            request_shutdown();
             break;
         }
-        memcpy(digital_data,
-               TEST_DIGITAL_DATA,
-               num_channels * points_pc * sizeof(digival_t));
+        stats_block_acquired(stats_now_nanos() - read_start);
+        assert(points_pc <= max_points);
+        markers_take(acquisition_start, acquired_points, points_pc,
+                     config.sampling_rate, &markers);
+        energy_cut(acquisition_start, acquired_points, points_pc,
+                   config.sampling_rate, &sessions);
+        acquired_points += points_pc;
+        rt_wakeup(acquisition_start + ((uint64_t)TIME_S) * acquired_points /
+                                      config.sampling_rate);
 
         timestamp += ((uint64_t)TIME_S) *
                      ((uint64_t)points_pc) /
-                     ((uint64_t)SAMPLING_RATE);
+                     ((uint64_t)config.sampling_rate);
+
+        if(NULL != shm) {
+            shm_ring_publish(shm, timestamp, &config, points_pc,
+                             num_channels, analog_data, digital_data,
+                             &markers);
+        }
+
+        if(NULL != mcast) {
+            mcast_pub_publish(mcast, timestamp, config.sampling_rate,
+                              points_pc, analog_data);
+        }
+
+        if(use_uring) {
+            uring_sender_publish(&config, timestamp, points_pc, num_channels,
+                                 analog_data, digital_data, &markers);
+        }
+
+        /* transformed and encoded for the send threads by the workers */
+        pipeline_publish(&config, timestamp, points_pc, num_channels,
+                         analog_data, digital_data, &markers, &sessions);
+
+        block_fd = -1;
+        if(use_unix && fd_block_wanted()) {
+            block_fd = fd_block_create(timestamp, config.sampling_rate,
+                                       points_pc, num_channels, analog_data,
+                                       digital_data, &markers);
+        }
 
         err = pthread_mutex_lock(&info->lock);
         assert(0 == err);
@@ -236,17 +364,50 @@ static void *ni_thread_main(void *opaque_info) {
         info->num_channels = num_channels;
         info->analog_data = analog_data;
         info->digital_data = digital_data;
+        old_block_fd = info->block_fd;
+        info->block_fd = block_fd;
+        info->config = config;
+        info->markers = markers;
         err = pthread_mutex_unlock(&info->lock);
         assert(0 == err);
 
-        printf("NI: read successful, ts = %"PRIu64"\n", timestamp);
+        /* the handlers hold their own descriptors of the older block */
+        if(0 <= old_block_fd) {
+            close(old_block_fd);
+        }
+
+        if(verbose) {
+            printf("NI: read successful, ts = %"PRIu64"\n", timestamp);
+        }
         reset_ready_handlers();
         notify_data_available();
     }
 
+    /* no more reconfigurations, the handlers finish with the last block */
+    daq_config_finish();
+    stop_acquisition();
+
+    if(NULL != shm) {
+        shm_ring_destroy(shm);
+    }
+    /* every handler got the last block, the workers finish its frames */
+    pipeline_stop();
+    /* sessions not ended by now won't get their last block */
+    energy_finish();
+    if(use_uring) {
+        uring_sender_stop();
+    }
+    if(NULL != mcast) {
+        err = pthread_join(mcast_retrans_thread, NULL);
+        assert(0 == err);
+        mcast_pub_destroy(mcast);
+    }
+    if(0 <= info->block_fd) {
+        close(info->block_fd);
+        info->block_fd = -1;
+    }
     finish_ni(h);
-    free(analog_data);
-    free(digital_data);
+    rt_block_put(block);
     return NULL;
 }
 
@@ -254,10 +415,7 @@ static void *dead_handler_thread_main() {
     int err;
     pthread_t *zombie;
 
-    while(running || have_alive_threads()) {
-        zombie = wait_dead_handler();
-        assert(NULL != zombie);
-
+    while(NULL != (zombie = wait_dead_handler())) {
         err = pthread_join(*zombie, NULL);
         assert(0 == err);
 
@@ -267,7 +425,9 @@ static void *dead_handler_thread_main() {
     return NULL;
 }
 
-static void launch_handler_thread(input_data_t *data_info, int conn_fd) {
+static void launch_handler_thread(input_data_t *data_info,
+                                  int conn_fd,
+                                  bool is_local) {
     pthread_t handler_thread;
     int err;
     handler_thread_info_t *handler_info =
@@ -275,6 +435,7 @@ static void launch_handler_thread(input_data_t *data_info, int conn_fd) {
     assert(NULL != handler_info);
 
     handler_info->fd = conn_fd;
+    handler_info->is_local = is_local;
     handler_info->data_info = data_info;
     printf("handling conn fd %d\n", handler_info->fd);
 
@@ -285,15 +446,52 @@ static void launch_handler_thread(input_data_t *data_info, int conn_fd) {
     assert(0 == err);
 }
 
+/*
+ * Listens on the unix domain socket for clients on the same host, returns
+ * -1 (and keeps the daemon running without it) on failure.
+ */
+static int open_unix_listener(struct sockaddr_un *addr) {
+    char port_str[16];
+    int err;
+    const int sock = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(0 > sock) {
+        printf("WARNING: unix socket disabled, socket: %s\n",
+               strerror(errno));
+        return -1;
+    }
+
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    snprintf(port_str, sizeof(port_str), "%u", SERVER_PORT);
+    snprintf(addr->sun_path, sizeof(addr->sun_path),
+             PM_UNIX_PATH_FORMAT, port_str);
+
+    /* a socket left behind by a crashed daemon */
+    unlink(addr->sun_path);
+
+    err = bind(sock, (struct sockaddr *)addr, sizeof(*addr));
+    if(0 == err) {
+        err = listen(sock, LISTEN_QUEUE_LEN);
+    }
+    if(0 != err) {
+        printf("WARNING: unix socket disabled, %s: %s\n",
+               addr->sun_path, strerror(errno));
+        close(sock);
+        return -1;
+    }
+
+    printf("passing blocks as memfds on %s\n", addr->sun_path);
+    return sock;
+}
+
 static void wait_for_connections(input_data_t *data_info) {
     struct sockaddr_in servaddr;
+    struct sockaddr_un unix_addr;
     int err;
     int conn;
-    struct pollfd poll_cfg;
+    struct pollfd poll_cfg[3];
+    nfds_t num_poll_fds = 2;
     int sock_opt;
-#ifndef __MACH__
-    struct timespec timeout = WAIT_TIMEOUT;
-#endif
     const int server_sock = socket(AF_INET, SOCK_STREAM, 0);
     assert(0 <= server_sock);
 
@@ -328,36 +526,137 @@ static void wait_for_connections(input_data_t *data_info) {
     err = listen(server_sock, LISTEN_QUEUE_LEN);
     assert(0 <= err);
 
-    poll_cfg.fd = server_sock;
-    poll_cfg.events = POLLIN;
+    /* stop accepting as soon as we are shutting down */
+    poll_cfg[0].fd = shutdown_fd();
+    poll_cfg[0].events = POLLIN;
+
+    poll_cfg[1].fd = server_sock;
+    poll_cfg[1].events = POLLIN;
+
+    poll_cfg[2].fd = use_unix ? open_unix_listener(&unix_addr) : -1;
+    poll_cfg[2].events = POLLIN;
+    if(0 <= poll_cfg[2].fd) {
+        num_poll_fds = 3;
+    }
 
     while(running) {
-#ifndef __MACH__
-        err = ppoll(&poll_cfg, 1, &timeout, NULL);
-#else
-        err = poll(&poll_cfg, 1, 1);
-#endif
-        if (0 == err || (-1 == err && EINTR == errno)) {
+        err = poll(poll_cfg, num_poll_fds, -1);
+        if (-1 == err && EINTR == errno) {
             continue;
         }
         assert(0 < err);
 
-        conn = accept(server_sock, NULL, NULL);
-        launch_handler_thread(data_info, conn);
+        for(nfds_t i = 1; running && i < num_poll_fds; i++) {
+            if(0 == (poll_cfg[i].revents & POLLIN)) {
+                continue;
+            }
+            conn = accept(poll_cfg[i].fd, NULL, NULL);
+            if(0 > conn) {
+                continue;
+            }
+            launch_handler_thread(data_info, conn, 2 == i);
+        }
     }
 
     err = close(server_sock);
     assert(0 == err);
+    if(3 == num_poll_fds) {
+        err = close(poll_cfg[2].fd);
+        assert(0 == err);
+        unlink(unix_addr.sun_path);
+    }
     printf("server socket closed\n");
 
     return;
 }
 
+static void usage(const char *argv0) {
+    fprintf(stderr, "Usage: %s [-v] [-S] [-U] [-m GROUP] [-u] "
+                    "[-c CHANNELS] [-R RT]"
+#ifndef WITH_NI
+                    " [-g SIGNAL]"
+#endif
+                    "\n\n", argv0);
+    fprintf(stderr, "\t-v\tlog every block read\n");
+    fprintf(stderr, "\t-S\tdon't publish blocks in shared memory for "
+                    "local clients\n");
+    fprintf(stderr, "\t-U\tdon't listen on the unix domain socket for "
+                    "local clients\n");
+    fprintf(stderr, "\t-m\talso publish all channels to the multicast "
+                    "GROUP\n");
+    fprintf(stderr, "\t-u\tsend to TCP clients using io_uring if "
+                    "available\n");
+    fprintf(stderr, "\t-c\tthe physical channels, comma separated, up "
+                    "to %d, e.g. Dev1/ai0:15\n", MAX_CHANNELS);
+    fprintf(stderr, "\t-R\treal-time mode, comma separated "
+                    "KEY=VALUE of prio, acq, encode, io\n"
+                    "\t\t(CPU or FIRST-LAST), lock, pool and "
+                    "huge (see daemon/rt.h), e.g.\n"
+                    "\t\tprio=80,acq=1,encode=2-3,io=0\n");
+#ifndef WITH_NI
+    fprintf(stderr, "\t-g\tthe generated signal, comma "
+                    "separated KEY=VALUE of dc, step, period,\n"
+                    "\t\tnoise, spikes (per second), spike "
+                    "and seed (see daemon/generator.h)\n");
+#endif
+}
+
 int main(int argc, char **argv) {
     input_data_t data_info;
     pthread_t acquire_data_thread, collect_dead_handlers_thread;
+    pthread_t stats_thread, control_thread, markers_thread;
 
     int err;
+    int opt;
+
+#ifndef WITH_NI
+    generator_default_params(&generator_params);
+#endif
+
+    rt_default_params(&rt_params);
+
+    while((opt = getopt(argc, argv, "vSUm:uc:R:g:")) != -1) {
+        switch(opt) {
+            case 'v':
+                verbose = true;
+                break;
+            case 'c':
+                physical_channels = optarg;
+                break;
+            case 'S':
+                use_shm = false;
+                break;
+            case 'U':
+                use_unix = false;
+                break;
+            case 'm':
+                mcast_group = optarg;
+                break;
+            case 'u':
+                use_uring = true;
+                break;
+            case 'R':
+                if(0 == rt_parse_params(optarg, &rt_params)) {
+                    break;
+                }
+                fprintf(stderr, "invalid real-time settings: %s\n\n",
+                        optarg);
+                usage(argv[0]);
+                exit(EXIT_FAILURE);
+#ifndef WITH_NI
+            case 'g':
+                if(0 == generator_parse_params(optarg, &generator_params)) {
+                    break;
+                }
+                fprintf(stderr, "invalid signal: %s\n\n", optarg);
+                usage(argv[0]);
+                exit(EXIT_FAILURE);
+#endif
+            default:
+                usage(argv[0]);
+                exit(EXIT_FAILURE);
+        }
+    }
 
     signal(SIGINT, (void (*)(int))sig_hnd);
     signal(SIGPIPE, SIG_IGN);
@@ -374,7 +673,30 @@ int main(int argc, char **argv) {
             "This is free software, and you are welcome to redistribute it"
             "\nunder certain conditions; type `show c' for details.\n\n");
 
+    /* first, the mutexes the acquisition thread takes depend on it */
+    rt_init(&rt_params);
     init_sync();
+#ifdef WITH_NI
+    err = daq_config_init(NI_MAX_SAMPLING_RATE, MAX_BLOCK_SAMPLES,
+                          physical_channels);
+#else
+    err = daq_config_init(GENERATOR_MAX_RATE, MAX_BLOCK_SAMPLES,
+                          physical_channels);
+#endif
+    if(0 != err) {
+        fprintf(stderr, "invalid channels: %s\n", physical_channels);
+        exit(EXIT_FAILURE);
+    }
+
+    rt_mutex_init(&data_info.lock);
+    markers_init();
+    energy_init();
+    pipeline_init();
+    uring_sender_init();
+
+    /* the threads started from here inherit it, the acquisition thread and
+     * the pipeline workers place themselves */
+    rt_enter(RT_IO);
 
     err = pthread_create(&acquire_data_thread,
                          NULL,
@@ -388,18 +710,47 @@ int main(int argc, char **argv) {
                          NULL);
     assert(0 == err);
 
+    err = pthread_create(&stats_thread,
+                         NULL,
+                         stats_thread_main,
+                         NULL);
+    assert(0 == err);
+
+    err = pthread_create(&control_thread,
+                         NULL,
+                         control_thread_main,
+                         NULL);
+    assert(0 == err);
+
+    err = pthread_create(&markers_thread,
+                         NULL,
+                         markers_thread_main,
+                         NULL);
+    assert(0 == err);
+
     wait_for_connections(&data_info);
 
+    /* no new clients, give the connected ones until the deadline to receive
+     * what is buffered for them, then stop the DAQ task */
+    begin_shutdown();
+
     err = pthread_join(acquire_data_thread, NULL);
     assert(0 == err);
 
-    err = pthread_cancel(collect_dead_handlers_thread);
+    err = pthread_join(collect_dead_handlers_thread, NULL);
     assert(0 == err);
 
-    err = pthread_join(collect_dead_handlers_thread, NULL);
+    err = pthread_join(stats_thread, NULL);
+    assert(0 == err);
+
+    err = pthread_join(control_thread, NULL);
+    assert(0 == err);
+
+    err = pthread_join(markers_thread, NULL);
     assert(0 == err);
 
     finish_sync();
+    rt_finish();
 
     return 0;
 }
@@ -23,8 +23,13 @@
 #include <stdbool.h>
 #include <stdint.h>
 #include "common.h"
+#include "daq_config.h"
+#include "markers.h"
 
 extern volatile bool running;
+extern bool verbose; /* log every block */
+
+struct pipeline_frame;
 
 typedef struct {
     pthread_mutex_t lock;
@@ -37,10 +42,27 @@ typedef struct {
 
     /* digital inputs */
     digival_t *digital_data;
+
+    /* sealed memfd holding the block for unix socket clients or -1 */
+    int block_fd;
+
+    /* the DAQ configuration the block was read with */
+    daq_config_t config;
+
+    /* the markers that arrived while the block was read */
+    block_markers_t markers;
+
+    /* in a client's send queue: the block encoded for its channels by the
+     * pipeline or NULL, then analog_data and digital_data are a copy */
+    struct pipeline_frame *frame;
+
+    /* in a client's send queue: the capture of its trigger or 0 */
+    uint64_t shot_id;
 } input_data_t;
 
 typedef struct {
     int fd;
+    bool is_local; /* connected to the unix domain socket */
     input_data_t *data_info; /* const */
 } handler_thread_info_t;
 
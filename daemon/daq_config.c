@@ -0,0 +1,486 @@
+/*
+ *  Records analog data from a NI USB-6218 and send it to connected clients
+ *
+ *  Copyright (C)2011-2012, Johannes Weiß <weiss@tux4u.de>
+ *                        , Jonathan Dimond <jonny@dimond.de>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#ifndef __MACH__
+#include <sys/eventfd.h>
+#endif
+
+#include "daq_config.h"
+#include "rt.h"
+#include <common/conf.h>
+
+static pthread_mutex_t __config_mutex = PTHREAD_MUTEX_INITIALIZER;
+/* readable once the pending request is answered */
+static int __result_fds[2] = { -1, -1 };
+
+/* all protected by __config_mutex */
+static daq_config_t __current;
+static daq_config_t __next;
+static bool __pending = false;   /* a request waits for its result */
+static bool __answered = false;  /* the acquisition thread took a decision */
+static bool __success = false;
+static bool __discarded = false; /* nobody waits for the result */
+static bool __finished = false;
+static unsigned int __max_sampling_rate;
+static unsigned int __max_block_samples;
+
+static void notify_result(void) {
+    const uint64_t one = 1;
+    ssize_t res;
+
+    /* a wakeup still unread does as well */
+    res = write(__result_fds[1], &one, sizeof(one));
+    (void)res;
+}
+
+/*
+ * PARSING
+ */
+static unsigned int block_size(unsigned int sampling_rate,
+                               unsigned int num_channels) {
+    const unsigned int max_points = __max_block_samples / num_channels;
+
+    return sampling_rate < max_points ? sampling_rate : max_points;
+}
+
+static char *trim(char *s) {
+    char *end;
+
+    while(' ' == *s || '\t' == *s) {
+        s++;
+    }
+    end = s + strlen(s);
+    while(end > s && (' ' == end[-1] || '\t' == end[-1])) {
+        *--end = '\0';
+    }
+    return s;
+}
+
+/*
+ * Splits "Dev1/ai0:15" into the prefix length and the numbers 0 and 15.
+ * Returns false if name isn't a range.
+ */
+static bool parse_range(const char *name,
+                        size_t *prefix_len,
+                        unsigned long *first,
+                        unsigned long *last) {
+    const char *colon = strchr(name, ':');
+    const char *digits = colon;
+    char *end;
+
+    if(NULL == colon) {
+        return false;
+    }
+    while(digits > name && '0' <= digits[-1] && '9' >= digits[-1]) {
+        digits--;
+    }
+    *prefix_len = digits - name;
+    *first = strtoul(digits, &end, 10);
+    if(end != colon || digits == colon) {
+        return false;
+    }
+    *last = strtoul(colon + 1, &end, 10);
+    return '\0' == *end && end != colon + 1;
+}
+
+/* returns false if list doesn't name between 1 and DAQ_MAX_CHANNELS */
+static bool parse_channels(const char *list, daq_config_t *config) {
+    char *copy = strdup(list);
+    char *saveptr = NULL;
+    char *name;
+    size_t prefix_len;
+    unsigned long first, last;
+    unsigned int n = 0;
+    bool ok = true;
+    assert(NULL != copy);
+
+    for(char *tok = strtok_r(copy, ",", &saveptr); ok && NULL != tok;
+        tok = strtok_r(NULL, ",", &saveptr)) {
+        name = trim(tok);
+        if(!parse_range(name, &prefix_len, &first, &last)) {
+            ok = n < DAQ_MAX_CHANNELS && '\0' != *name &&
+                 strlen(name) < DAQ_CHANNEL_NAME_LEN;
+            if(ok) {
+                strcpy(config->channel_names[n++], name);
+            }
+            continue;
+        }
+
+        ok = first <= last && last - first < DAQ_MAX_CHANNELS - n &&
+             prefix_len + 10 < DAQ_CHANNEL_NAME_LEN;
+        for(unsigned long i = first; ok && i <= last; i++) {
+            snprintf(config->channel_names[n++], DAQ_CHANNEL_NAME_LEN,
+                     "%.*s%lu", (int)prefix_len, name, i);
+        }
+    }
+    free(copy);
+
+    config->num_channels = n;
+    return ok && 0 < n;
+}
+
+static bool parse_double(const char *s, double *value) {
+    char *end;
+
+    errno = 0;
+    *value = strtod(s, &end);
+    return 0 == errno && end != s && '\0' == *end;
+}
+
+/* returns false if list doesn't hold exactly count numbers */
+static bool parse_doubles(const char *list,
+                          double *values,
+                          unsigned int count) {
+    char *copy = strdup(list);
+    char *saveptr = NULL;
+    unsigned int n = 0;
+    bool ok = true;
+    assert(NULL != copy);
+
+    for(char *tok = strtok_r(copy, ",", &saveptr); ok && NULL != tok;
+        tok = strtok_r(NULL, ",", &saveptr)) {
+        ok = n < count && parse_double(trim(tok), &values[n++]);
+    }
+    free(copy);
+
+    return ok && count == n;
+}
+
+/* returns false and describes the problem in reply if it's invalid */
+static bool parse_assignments(const char *assignments,
+                              daq_config_t *config,
+                              char *reply,
+                              size_t size) {
+    char *copy = strdup(assignments);
+    char *saveptr = NULL;
+    char *value, *end;
+    unsigned long rate;
+    const unsigned int num_channels = config->num_channels;
+    bool ok = true;
+    assert(NULL != copy);
+
+    for(char *tok = strtok_r(copy, " \t", &saveptr); ok && NULL != tok;
+        tok = strtok_r(NULL, " \t", &saveptr)) {
+        value = strchr(tok, '=');
+        if(NULL == value) {
+            snprintf(reply, size, "ERR expected KEY=VALUE: %s", tok);
+            ok = false;
+            break;
+        }
+        *value++ = '\0';
+
+        if(0 == strcasecmp("rate", tok)) {
+            errno = 0;
+            rate = strtoul(value, &end, 10);
+            ok = 0 == errno && end != value && '\0' == *end &&
+                 rate > 0 && rate <= __max_sampling_rate;
+            if(!ok) {
+                snprintf(reply, size, "ERR rate must be 1-%u",
+                         __max_sampling_rate);
+            }
+            config->sampling_rate = rate;
+            config->block_size = block_size(rate, num_channels);
+        } else if(0 == strcasecmp("u_min", tok)) {
+            ok = parse_double(value, &config->u_min);
+            if(!ok) {
+                snprintf(reply, size, "ERR bad u_min: %s", value);
+            }
+        } else if(0 == strcasecmp("u_max", tok)) {
+            ok = parse_double(value, &config->u_max);
+            if(!ok) {
+                snprintf(reply, size, "ERR bad u_max: %s", value);
+            }
+        } else if(0 == strcasecmp("scale", tok) ||
+                  0 == strcasecmp("offset", tok)) {
+            ok = parse_doubles(value, 0 == strcasecmp("scale", tok) ?
+                                      config->scale : config->offset,
+                               num_channels);
+            if(!ok) {
+                snprintf(reply, size, "ERR %s must list %u numbers",
+                         tok, num_channels);
+            }
+        } else if(0 == strcasecmp("channels", tok)) {
+            ok = parse_channels(value, config) &&
+                 num_channels == config->num_channels;
+            if(!ok) {
+                snprintf(reply, size, "ERR channels must name %u physical "
+                                      "channels", num_channels);
+            }
+            config->num_channels = num_channels;
+        } else {
+            snprintf(reply, size, "ERR unknown setting: %s", tok);
+            ok = false;
+        }
+    }
+    free(copy);
+
+    if(ok && !(config->u_min < config->u_max)) {
+        snprintf(reply, size, "ERR u_min must be less than u_max");
+        ok = false;
+    }
+
+    return ok;
+}
+
+/*
+ * FUNCTIONALITY
+ */
+int daq_config_init(unsigned int max_sampling_rate,
+                    unsigned int max_block_samples,
+                    const char *channels) {
+    bool ok;
+    int err;
+
+    rt_mutex_init(&__config_mutex);
+#ifndef __MACH__
+    __result_fds[0] = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    __result_fds[1] = __result_fds[0];
+    assert(0 <= __result_fds[0]);
+#else
+    err = pipe(__result_fds);
+    assert(0 == err);
+    for(int i = 0; i < 2; i++) {
+        err = fcntl(__result_fds[i], F_SETFL, O_NONBLOCK);
+        assert(0 == err);
+    }
+#endif
+
+    err = pthread_mutex_lock(&__config_mutex);
+    assert(0 == err);
+
+    __max_sampling_rate = max_sampling_rate;
+    __max_block_samples = max_block_samples;
+    memset(&__current, 0, sizeof(__current));
+    __current.sampling_rate = SAMPLING_RATE;
+    __current.u_min = U_MIN;
+    __current.u_max = U_MAX;
+    ok = parse_channels(NULL != channels ? channels : NI_CHANNELS,
+                        &__current) &&
+         __current.num_channels <= max_block_samples;
+    if(ok) {
+        __current.block_size = block_size(SAMPLING_RATE,
+                                          __current.num_channels);
+        for(unsigned int i = 0; i < __current.num_channels; i++) {
+            __current.scale[i] = 1.0;
+            __current.offset[i] = 0.0;
+        }
+    }
+    assert(__current.sampling_rate <= max_sampling_rate);
+
+    err = pthread_mutex_unlock(&__config_mutex);
+    assert(0 == err);
+
+    return ok ? 0 : -1;
+}
+
+void daq_config_current(daq_config_t *config) {
+    int err;
+
+    err = pthread_mutex_lock(&__config_mutex);
+    assert(0 == err);
+    *config = __current;
+    err = pthread_mutex_unlock(&__config_mutex);
+    assert(0 == err);
+}
+
+void daq_config_channel_list(const daq_config_t *config,
+                             char *buf,
+                             size_t size) {
+    size_t used = 0;
+
+    assert(size > 0);
+    buf[0] = '\0';
+    for(unsigned int i = 0; i < config->num_channels && used < size; i++) {
+        used += snprintf(buf + used, size - used, "%s%s",
+                         0 == i ? "" : ", ", config->channel_names[i]);
+    }
+}
+
+bool daq_config_request(const char *assignments, char *reply, size_t size) {
+    daq_config_t next;
+    bool ret = false;
+    int err;
+
+    err = pthread_mutex_lock(&__config_mutex);
+    assert(0 == err);
+
+    next = __current;
+    if(__finished) {
+        snprintf(reply, size, "ERR acquisition stopped");
+    } else if(__pending) {
+        snprintf(reply, size, "ERR another reconfiguration is in progress");
+    } else if(parse_assignments(assignments, &next, reply, size)) {
+        /* the acquisition thread picks it up before reading the next block
+         * and notifies daq_config_result_fd */
+        __next = next;
+        __pending = true;
+        __answered = false;
+        __discarded = false;
+        ret = true;
+    }
+
+    err = pthread_mutex_unlock(&__config_mutex);
+    assert(0 == err);
+
+    return ret;
+}
+
+int daq_config_result_fd(void) {
+    return __result_fds[0];
+}
+
+void daq_config_clear_result_fd(void) {
+    uint64_t buf[8];
+
+    while(0 < read(__result_fds[0], buf, sizeof(buf))) {
+        /* all of them */
+    }
+}
+
+bool daq_config_result(char *reply, size_t size) {
+    bool ret = true;
+    int err;
+
+    err = pthread_mutex_lock(&__config_mutex);
+    assert(0 == err);
+
+    assert(__pending && !__discarded);
+    if(__answered && __success) {
+        snprintf(reply, size, "OK generation %llu rate %u",
+                 (unsigned long long)__current.generation,
+                 __current.sampling_rate);
+    } else if(__answered) {
+        snprintf(reply, size, "ERR the DAQ task rejected the "
+                              "configuration, kept generation %llu",
+                 (unsigned long long)__current.generation);
+    } else if(__finished) {
+        snprintf(reply, size, "ERR acquisition stopped");
+    } else {
+        ret = false;
+    }
+    if(ret) {
+        __pending = false;
+    }
+
+    err = pthread_mutex_unlock(&__config_mutex);
+    assert(0 == err);
+
+    return ret;
+}
+
+void daq_config_discard(void) {
+    int err;
+
+    err = pthread_mutex_lock(&__config_mutex);
+    assert(0 == err);
+    assert(__pending);
+    /* still applied, the next request may come once it is */
+    __discarded = true;
+    if(__answered || __finished) {
+        __pending = false;
+    }
+    err = pthread_mutex_unlock(&__config_mutex);
+    assert(0 == err);
+}
+
+bool daq_config_needs_restart(const daq_config_t *config,
+                              const daq_config_t *next) {
+    if(config->sampling_rate != next->sampling_rate ||
+       config->block_size != next->block_size ||
+       config->u_min != next->u_min ||
+       config->u_max != next->u_max ||
+       config->num_channels != next->num_channels) {
+        return true;
+    }
+    for(unsigned int i = 0; i < config->num_channels; i++) {
+        if(0 != strcmp(config->channel_names[i], next->channel_names[i])) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool daq_config_pending(daq_config_t *next) {
+    bool ret;
+    int err;
+
+    err = pthread_mutex_lock(&__config_mutex);
+    assert(0 == err);
+    ret = __pending && !__answered;
+    if(ret) {
+        *next = __next;
+        next->generation = __current.generation + 1;
+    }
+    err = pthread_mutex_unlock(&__config_mutex);
+    assert(0 == err);
+
+    return ret;
+}
+
+void daq_config_applied(bool success) {
+    int err;
+
+    err = pthread_mutex_lock(&__config_mutex);
+    assert(0 == err);
+
+    assert(__pending && !__answered);
+    if(success) {
+        __current = __next;
+        __current.generation++;
+    }
+    __success = success;
+    __answered = true;
+    if(__discarded) {
+        __pending = false;
+    } else {
+        notify_result();
+    }
+
+    err = pthread_mutex_unlock(&__config_mutex);
+    assert(0 == err);
+}
+
+void daq_config_finish(void) {
+    int err;
+
+    err = pthread_mutex_lock(&__config_mutex);
+    assert(0 == err);
+    __finished = true;
+    if(__pending && __discarded) {
+        __pending = false;
+    } else if(__pending) {
+        /* it won't get applied anymore */
+        notify_result();
+    }
+    err = pthread_mutex_unlock(&__config_mutex);
+    assert(0 == err);
+}
+/* vim: set fileencoding=utf8 : */
@@ -0,0 +1,143 @@
+/*
+ *  Records analog data from a NI USB-6218 and send it to connected clients
+ *
+ *  Copyright (C)2011-2012, Johannes Weiß <weiss@tux4u.de>
+ *                        , Jonathan Dimond <jonny@dimond.de>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef DAQ_CONFIG_H
+#define DAQ_CONFIG_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "common.h"
+
+/*
+ * The configuration of the DAQ task. It starts with the values from
+ * common/conf.h and can be changed at runtime (see control.h): the control
+ * thread hands a new configuration to the acquisition thread, which restarts
+ * the DAQ task with it between two blocks, or just uses it if only the
+ * calibration changed. Every configuration applied gets a new generation,
+ * clients get told about the change in-band.
+ */
+
+#define DAQ_MAX_CHANNELS MAX_CHANNELS
+#define DAQ_CHANNEL_NAME_LEN 32
+/* long enough for the names of all channels */
+#define DAQ_REPLY_LEN (DAQ_MAX_CHANNELS * DAQ_CHANNEL_NAME_LEN + 256)
+
+typedef struct {
+    unsigned int sampling_rate;
+    /* samples per channel and block, a second of them at most */
+    unsigned int block_size;
+    double u_min;
+    double u_max;
+    /* fixed once the acquisition runs, clients address channels by index */
+    unsigned int num_channels;
+    char channel_names[DAQ_MAX_CHANNELS][DAQ_CHANNEL_NAME_LEN];
+    /* calibration for clients: physical value = scale * sample + offset */
+    double scale[DAQ_MAX_CHANNELS];
+    double offset[DAQ_MAX_CHANNELS];
+    uint64_t generation;
+} daq_config_t;
+
+/*
+ * Sets the configuration from common/conf.h. max_sampling_rate is the
+ * highest rate the DAQ backend takes, max_block_samples the number of
+ * samples of all channels the acquisition buffers hold: faster rates and
+ * more channels are read in several blocks per second. channels lists the
+ * physical channels (NI_CHANNELS if NULL), comma separated, where
+ * "Dev1/ai0:15" stands for Dev1/ai0 to Dev1/ai15.
+ *
+ * Returns:
+ * 0 or -1 if channels is invalid
+ */
+int daq_config_init(unsigned int max_sampling_rate,
+                    unsigned int max_block_samples,
+                    const char *channels);
+
+/*
+ * Copies the configuration currently applied.
+ */
+void daq_config_current(daq_config_t *config);
+
+/*
+ * Writes the physical channels comma separated (as NI-DAQmx Base wants
+ * them) to buf.
+ */
+void daq_config_channel_list(const daq_config_t *config,
+                             char *buf,
+                             size_t size);
+
+/*
+ * Changes the current configuration by the space separated KEY=VALUE
+ * assignments (rate, u_min, u_max and the comma separated lists channels,
+ * scale and offset with a value per channel, the number of channels stays)
+ * once the acquisition thread gets to it, without waiting for that.
+ *
+ * Returns:
+ * true if the request is pending, get the reply with daq_config_result,
+ * false and "ERR ..." in reply else
+ */
+bool daq_config_request(const char *assignments, char *reply, size_t size);
+
+/*
+ * Readable when the pending request may have been answered, clear it
+ * before checking with daq_config_result.
+ */
+int daq_config_result_fd(void);
+void daq_config_clear_result_fd(void);
+
+/*
+ * Returns false if the pending request isn't answered yet, else writes the
+ * reply for the requester ("OK ..." or "ERR ...") to reply.
+ */
+bool daq_config_result(char *reply, size_t size);
+
+/*
+ * Nobody waits for the pending request anymore, it is applied anyway.
+ */
+void daq_config_discard(void);
+
+/*
+ * Whether the DAQ task has to be restarted to go from config to next,
+ * false if they only differ in the calibration.
+ */
+bool daq_config_needs_restart(const daq_config_t *config,
+                              const daq_config_t *next);
+
+/*
+ * Called by the acquisition thread between two blocks. Returns true and the
+ * requested configuration if there is one, which has to be answered with
+ * daq_config_applied.
+ */
+bool daq_config_pending(daq_config_t *next);
+
+/*
+ * Tells the requester whether the configuration from daq_config_pending is
+ * in use now (it gets the next generation) or the old one is kept.
+ */
+void daq_config_applied(bool success);
+
+/*
+ * The acquisition stopped, fails current and future requests.
+ */
+void daq_config_finish(void);
+
+#endif
+/* vim: set fileencoding=utf8 : */
@@ -0,0 +1,531 @@
+/*
+ *  Records analog data from a NI USB-6218 and send it to connected clients
+ *
+ *  Copyright (C)2011-2012, Johannes Weiß <weiss@tux4u.de>
+ *                        , Jonathan Dimond <jonny@dimond.de>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdbool.h>
+#include <assert.h>
+#include <errno.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#ifndef __MACH__
+#include <sys/eventfd.h>
+#endif
+
+#include <utils.h>
+
+#include "energy.h"
+#include "markers.h"
+#include "stats.h"
+#include "rt.h"
+
+typedef struct {
+    double joules;
+    double compensation;    /* of joules, see add_compensated */
+    double peak;            /* watts */
+} channel_energy_t;
+
+typedef struct {
+    bool used;
+    uint32_t id;
+    uint64_t begin_nanos;
+    uint64_t end_nanos;     /* 0 while the session is open */
+    bool started;           /* a block got its first sample */
+    bool last_cut;          /* a block got its last sample */
+    unsigned int pending;   /* blocks cut but not integrated yet */
+    bool discarded;         /* nobody waits for the result */
+    double factor;          /* watts per calibrated unit */
+    double seconds;
+    unsigned int num_channels;
+    unsigned int channels[DAQ_MAX_CHANNELS];
+    channel_energy_t energy[DAQ_MAX_CHANNELS];
+} session_t;
+
+static pthread_mutex_t __energy_mutex = PTHREAD_MUTEX_INITIALIZER;
+/* readable once an ended session got integrated */
+static int __result_fds[2] = { -1, -1 };
+
+/* all protected by __energy_mutex, channels and factor are fixed while the
+ * session is used */
+static session_t __sessions[ENERGY_MAX_SESSIONS];
+static uint32_t __next_id = 1;
+static unsigned int __open = 0;
+static bool __finished = false;
+
+/*
+ * SESSIONS
+ */
+
+/* the block with the last sample is integrated */
+static bool integrated(const session_t *session) {
+    return session->last_cut && 0 == session->pending;
+}
+
+static session_t *find_ended(uint32_t id) {
+    for(unsigned int i = 0; i < ENERGY_MAX_SESSIONS; i++) {
+        if(__sessions[i].used && 0 != __sessions[i].end_nanos &&
+           id == __sessions[i].id) {
+            return &__sessions[i];
+        }
+    }
+    return NULL;
+}
+
+static void close_session(session_t *session) {
+    session->used = false;
+    STATS_SET(stats_energy.open, --__open);
+    STATS_ADD(stats_energy.closed, 1);
+}
+
+static void notify_result(void) {
+    const uint64_t one = 1;
+    ssize_t res;
+
+    /* a wakeup still unread does as well */
+    res = write(__result_fds[1], &one, sizeof(one));
+    (void)res;
+}
+
+/*
+ * PARSING
+ */
+
+/* "N" or "FIRST-LAST" separated by commas, returns false if a channel
+ * doesn't exist */
+static bool parse_channels(const char *list,
+                           unsigned int num_channels,
+                           session_t *session) {
+    char *copy = strdup(list);
+    char *saveptr = NULL;
+    char *end;
+    unsigned long first, last;
+    bool ok = true;
+    assert(NULL != copy);
+
+    session->num_channels = 0;
+    for(char *tok = strtok_r(copy, ",", &saveptr); ok && NULL != tok;
+        tok = strtok_r(NULL, ",", &saveptr)) {
+        errno = 0;
+        first = last = strtoul(tok, &end, 10);
+        if('-' == *end) {
+            last = strtoul(end + 1, &end, 10);
+        }
+        ok = 0 == errno && end != tok && '\0' == *end && first <= last &&
+             last < num_channels &&
+             last - first < DAQ_MAX_CHANNELS - session->num_channels;
+        for(unsigned long ch = first; ok && ch <= last; ch++) {
+            session->channels[session->num_channels++] = ch;
+        }
+    }
+    free(copy);
+
+    return ok && 0 < session->num_channels;
+}
+
+/* VOLTS:MILLIOHMS */
+static bool parse_shunt(const char *value, double *factor) {
+    double volts, milliohms;
+    char tail;
+
+    if(2 != sscanf(value, "%lf:%lf%c", &volts, &milliohms, &tail) ||
+       !(volts > 0) || !(milliohms > 0)) {
+        return false;
+    }
+    *factor = volts / (milliohms / 1000.0);
+    return true;
+}
+
+/* returns false and describes the problem in reply if it's invalid */
+static bool parse_assignments(const char *assignments,
+                              unsigned int num_channels,
+                              session_t *session,
+                              char *reply,
+                              size_t size) {
+    char *copy = strdup(assignments);
+    char *saveptr = NULL;
+    char *value;
+    bool ok = true;
+    assert(NULL != copy);
+
+    session->num_channels = num_channels;
+    for(unsigned int i = 0; i < num_channels; i++) {
+        session->channels[i] = i;
+    }
+    session->factor = 1;
+
+    for(char *tok = strtok_r(copy, " \t", &saveptr); ok && NULL != tok;
+        tok = strtok_r(NULL, " \t", &saveptr)) {
+        value = strchr(tok, '=');
+        if(NULL == value) {
+            snprintf(reply, size, "ERR expected KEY=VALUE: %s", tok);
+            ok = false;
+            break;
+        }
+        *value++ = '\0';
+
+        if(0 == strcasecmp("channels", tok)) {
+            ok = parse_channels(value, num_channels, session);
+            if(!ok) {
+                snprintf(reply, size, "ERR channels must be 0-%u",
+                         num_channels - 1);
+            }
+        } else if(0 == strcasecmp("shunt", tok)) {
+            ok = parse_shunt(value, &session->factor);
+            if(!ok) {
+                snprintf(reply, size, "ERR shunt must be VOLTS:MILLIOHMS");
+            }
+        } else {
+            snprintf(reply, size, "ERR unknown setting: %s", tok);
+            ok = false;
+        }
+    }
+    free(copy);
+
+    return ok;
+}
+
+/*
+ * FUNCTIONALITY
+ */
+void energy_init(void) {
+    rt_mutex_init(&__energy_mutex);
+#ifndef __MACH__
+    __result_fds[0] = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    __result_fds[1] = __result_fds[0];
+    assert(0 <= __result_fds[0]);
+#else
+    int err = pipe(__result_fds);
+    assert(0 == err);
+    for(int i = 0; i < 2; i++) {
+        err = fcntl(__result_fds[i], F_SETFL, O_NONBLOCK);
+        assert(0 == err);
+    }
+#endif
+}
+
+int energy_result_fd(void) {
+    return __result_fds[0];
+}
+
+void energy_clear_result_fd(void) {
+    uint64_t buf[8];
+
+    while(0 < read(__result_fds[0], buf, sizeof(buf))) {
+        /* all of them */
+    }
+}
+
+void energy_begin(const char *assignments, char *reply, size_t size) {
+    daq_config_t config;
+    session_t *session = NULL;
+    int err;
+
+    daq_config_current(&config);
+
+    err = pthread_mutex_lock(&__energy_mutex);
+    assert(0 == err);
+
+    for(unsigned int i = 0; i < ENERGY_MAX_SESSIONS; i++) {
+        if(!__sessions[i].used) {
+            session = &__sessions[i];
+            break;
+        }
+    }
+
+    if(__finished) {
+        snprintf(reply, size, "ERR acquisition stopped");
+    } else if(NULL == session) {
+        snprintf(reply, size, "ERR %u sessions open already",
+                 ENERGY_MAX_SESSIONS);
+    } else if(parse_assignments(assignments, config.num_channels, session,
+                                reply, size)) {
+        session->used = true;
+        session->id = __next_id++;
+        session->begin_nanos = stats_now_nanos();
+        session->end_nanos = 0;
+        session->started = false;
+        session->last_cut = false;
+        session->pending = 0;
+        session->discarded = false;
+        session->seconds = 0;
+        for(unsigned int i = 0; i < session->num_channels; i++) {
+            session->energy[i].joules = 0;
+            session->energy[i].compensation = 0;
+            session->energy[i].peak = -INFINITY;
+        }
+        STATS_SET(stats_energy.open, ++__open);
+        snprintf(reply, size, "OK session %u", session->id);
+    }
+
+    err = pthread_mutex_unlock(&__energy_mutex);
+    assert(0 == err);
+}
+
+uint32_t energy_end(const char *id, char *reply, size_t size) {
+    session_t *session = NULL;
+    unsigned long wanted;
+    uint32_t ret = 0;
+    char *end;
+    int err;
+
+    errno = 0;
+    wanted = strtoul(id, &end, 10);
+    if(0 != errno || end == id || '\0' != *end) {
+        snprintf(reply, size, "ERR usage: end ID");
+        return 0;
+    }
+
+    err = pthread_mutex_lock(&__energy_mutex);
+    assert(0 == err);
+
+    for(unsigned int i = 0; i < ENERGY_MAX_SESSIONS; i++) {
+        if(__sessions[i].used && 0 == __sessions[i].end_nanos &&
+           wanted == __sessions[i].id) {
+            session = &__sessions[i];
+            break;
+        }
+    }
+
+    if(NULL == session) {
+        snprintf(reply, size, "ERR no open session %lu", wanted);
+    } else {
+        /* the acquisition thread cuts the block of the last sample, a
+         * worker integrates it and notifies energy_result_fd */
+        session->end_nanos = stats_now_nanos();
+        ret = session->id;
+    }
+
+    err = pthread_mutex_unlock(&__energy_mutex);
+    assert(0 == err);
+
+    return ret;
+}
+
+bool energy_result(uint32_t id, char *reply, size_t size) {
+    session_t *session;
+    bool done;
+    size_t used;
+    double joules;
+    int err;
+
+    err = pthread_mutex_lock(&__energy_mutex);
+    assert(0 == err);
+
+    session = find_ended(id);
+    assert(NULL != session);
+    done = integrated(session) || __finished;
+    if(integrated(session)) {
+        used = snprintf(reply, size, "OK session %u seconds %.6f",
+                        session->id, session->seconds);
+        for(unsigned int i = 0;
+            i < session->num_channels && used < size; i++) {
+            joules = session->energy[i].joules +
+                     session->energy[i].compensation;
+            used += snprintf(reply + used, size - used,
+                             " channel %u joules %.9g mean %.9g "
+                             "peak %.9g",
+                             session->channels[i], joules,
+                             0 < session->seconds ?
+                                 joules / session->seconds : 0,
+                             0 < session->seconds ?
+                                 session->energy[i].peak : 0);
+        }
+    } else if(__finished) {
+        snprintf(reply, size, "ERR acquisition stopped");
+    }
+    if(done) {
+        close_session(session);
+    }
+
+    err = pthread_mutex_unlock(&__energy_mutex);
+    assert(0 == err);
+
+    return done;
+}
+
+void energy_discard(uint32_t id) {
+    session_t *session;
+    int err;
+
+    err = pthread_mutex_lock(&__energy_mutex);
+    assert(0 == err);
+
+    session = find_ended(id);
+    assert(NULL != session);
+    if(integrated(session) || __finished) {
+        close_session(session);
+    } else {
+        session->discarded = true;
+    }
+
+    err = pthread_mutex_unlock(&__energy_mutex);
+    assert(0 == err);
+}
+
+void energy_cut(uint64_t acquisition_start,
+                uint64_t first_point,
+                unsigned int points_per_channel,
+                uint32_t sampling_rate,
+                block_sessions_t *sessions) {
+    const uint64_t end_point = first_point + points_per_channel;
+    session_t *session;
+    uint64_t begin, last;
+    uint32_t from, to;
+    int err;
+
+    sessions->count = 0;
+
+    err = pthread_mutex_lock(&__energy_mutex);
+    assert(0 == err);
+
+    for(unsigned int i = 0; i < ENERGY_MAX_SESSIONS; i++) {
+        session = &__sessions[i];
+        if(!session->used || session->last_cut) {
+            continue;
+        }
+
+        from = 0;
+        if(!session->started) {
+            begin = markers_sample_at(acquisition_start,
+                                      session->begin_nanos, sampling_rate);
+            if(begin >= end_point) {
+                /* begins in a later block */
+                continue;
+            }
+            from = begin > first_point ? begin - first_point : 0;
+            session->started = true;
+        }
+
+        to = points_per_channel;
+        if(0 != session->end_nanos) {
+            last = markers_sample_at(acquisition_start,
+                                     session->end_nanos, sampling_rate);
+            if(last < end_point) {
+                to = last > first_point + from ? last - first_point : from;
+                session->last_cut = true;
+            }
+        }
+
+        sessions->cut[sessions->count].slot = i;
+        sessions->cut[sessions->count].from = from;
+        sessions->cut[sessions->count].to = to;
+        sessions->count++;
+        session->pending++;
+    }
+
+    err = pthread_mutex_unlock(&__energy_mutex);
+    assert(0 == err);
+}
+
+/* a cut of the block is integrated or skipped, call with __energy_mutex */
+static void cut_done(session_t *session) {
+    session->pending--;
+    if(integrated(session) && session->discarded) {
+        close_session(session);
+    } else if(integrated(session)) {
+        notify_result();
+    }
+}
+
+void energy_integrate(const daq_config_t *config,
+                      const double *analog_data,
+                      unsigned int points_per_channel,
+                      const block_sessions_t *sessions) {
+    channel_energy_t block[DAQ_MAX_CHANNELS];
+    session_t *session;
+    const double *samples;
+    double scale, offset, power, sum, compensation, peak;
+    unsigned int ch, from, to;
+    int err;
+
+    for(unsigned int c = 0; c < sessions->count; c++) {
+        /* channels and factor don't change while it waits for us */
+        session = &__sessions[sessions->cut[c].slot];
+        from = sessions->cut[c].from;
+        to = sessions->cut[c].to;
+
+        for(unsigned int i = 0; i < session->num_channels; i++) {
+            ch = session->channels[i];
+            samples = analog_data + ch * points_per_channel;
+            scale = session->factor * config->scale[ch];
+            offset = session->factor * config->offset[ch];
+            sum = compensation = 0;
+            peak = -INFINITY;
+            for(unsigned int j = from; j < to; j++) {
+                power = scale * samples[j] + offset;
+                add_compensated(&sum, &compensation, power);
+                peak = power > peak ? power : peak;
+            }
+            block[i].joules = (sum + compensation) / config->sampling_rate;
+            block[i].peak = peak;
+        }
+
+        err = pthread_mutex_lock(&__energy_mutex);
+        assert(0 == err);
+        for(unsigned int i = 0; i < session->num_channels; i++) {
+            add_compensated(&session->energy[i].joules,
+                            &session->energy[i].compensation,
+                            block[i].joules);
+            if(block[i].peak > session->energy[i].peak) {
+                session->energy[i].peak = block[i].peak;
+            }
+        }
+        session->seconds += (to - from) / (double)config->sampling_rate;
+        cut_done(session);
+        err = pthread_mutex_unlock(&__energy_mutex);
+        assert(0 == err);
+    }
+}
+
+void energy_skip(const block_sessions_t *sessions) {
+    int err;
+
+    err = pthread_mutex_lock(&__energy_mutex);
+    assert(0 == err);
+    for(unsigned int c = 0; c < sessions->count; c++) {
+        cut_done(&__sessions[sessions->cut[c].slot]);
+    }
+    err = pthread_mutex_unlock(&__energy_mutex);
+    assert(0 == err);
+}
+
+void energy_finish(void) {
+    int err;
+
+    err = pthread_mutex_lock(&__energy_mutex);
+    assert(0 == err);
+    __finished = true;
+    for(unsigned int i = 0; i < ENERGY_MAX_SESSIONS; i++) {
+        if(__sessions[i].used && __sessions[i].discarded) {
+            close_session(&__sessions[i]);
+        }
+    }
+    /* the ended ones won't get their last block */
+    notify_result();
+    err = pthread_mutex_unlock(&__energy_mutex);
+    assert(0 == err);
+}
+/* vim: set fileencoding=utf8 : */
@@ -0,0 +1,134 @@
+/*
+ *  Records analog data from a NI USB-6218 and send it to connected clients
+ *
+ *  Copyright (C)2011-2012, Johannes Weiß <weiss@tux4u.de>
+ *                        , Jonathan Dimond <jonny@dimond.de>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ENERGY_H
+#define ENERGY_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#include "daq_config.h"
+
+/*
+ * Energy accounting sessions: a client of the control port opens a session
+ * with "begin" and gets the energy of its channels with "end", without
+ * reading a single sample (see control.h).
+ *
+ * Like a marker, a session begins and ends at the sample read when the
+ * command arrived (markers_sample_at). The acquisition thread cuts every
+ * block at those samples (energy_cut) and the transform stage of the
+ * pipeline integrates the calibrated samples of the sessions in it
+ * (energy_integrate): power = factor * (scale * sample + offset), factor 1
+ * if the calibration yields watts already or VOLTS / OHMS of the shunt.
+ * Every block is summed with Neumaier's compensated summation and the
+ * joules of the blocks are summed the same way, so hour-long sessions at
+ * full rate don't lose the small contributions. "end" is answered once the
+ * block with the last sample is integrated, without holding up the control
+ * thread meanwhile (energy_result_fd).
+ *
+ * The duration counts the samples integrated, the time a reconfiguration
+ * takes and blocks the pipeline dropped (energy_skip) aren't part of a
+ * session.
+ */
+
+#define ENERGY_MAX_SESSIONS 16
+/* "OK session ID seconds S" and the channels, see energy_end */
+#define ENERGY_REPLY_LEN (DAQ_MAX_CHANNELS * 96 + 64)
+
+/* the samples of a block that belong to each open session */
+typedef struct {
+    unsigned int count;
+    struct {
+        unsigned int slot;
+        uint32_t from;      /* first sample of the session in the block */
+        uint32_t to;        /* behind its last one */
+    } cut[ENERGY_MAX_SESSIONS];
+} block_sessions_t;
+
+/* Call after rt_init, before any thread uses the sessions. */
+void energy_init(void);
+
+/*
+ * Opens a session by the space separated KEY=VALUE assignments: channels
+ * (comma separated N or FIRST-LAST, every channel if not given) and shunt
+ * (VOLTS:MILLIOHMS, the supply voltage and the shunt the channels measure).
+ * Writes "OK session ID" or "ERR ..." to reply.
+ */
+void energy_begin(const char *assignments, char *reply, size_t size);
+
+/*
+ * Ends session ID (a decimal number) at the sample read now. Returns the
+ * session to get with energy_result once it is integrated or 0 and "ERR
+ * ..." in reply.
+ */
+uint32_t energy_end(const char *id, char *reply, size_t size);
+
+/*
+ * Readable when ended sessions may have been integrated, clear it before
+ * checking them with energy_result.
+ */
+int energy_result_fd(void);
+void energy_clear_result_fd(void);
+
+/*
+ * Returns false if session id from energy_end isn't integrated yet, else
+ * closes it and writes "OK session ID seconds S" followed by "channel N
+ * joules J mean W peak W" for every channel or "ERR ..." to reply.
+ */
+bool energy_result(uint32_t id, char *reply, size_t size);
+
+/*
+ * Nobody waits for session id from energy_end anymore, it is closed once
+ * integrated.
+ */
+void energy_discard(uint32_t id);
+
+/*
+ * Called by the acquisition thread for the block of points_per_channel
+ * samples from first_point on (see markers_take). Sessions that began
+ * before the end of the block get a cut, ended ones their last.
+ */
+void energy_cut(uint64_t acquisition_start,
+                uint64_t first_point,
+                unsigned int points_per_channel,
+                uint32_t sampling_rate,
+                block_sessions_t *sessions);
+
+/*
+ * Integrates the cuts of a block, called once per block in any order.
+ */
+void energy_integrate(const daq_config_t *config,
+                      const double *analog_data,
+                      unsigned int points_per_channel,
+                      const block_sessions_t *sessions);
+
+/*
+ * The pipeline dropped the block, its cuts count as done without samples.
+ */
+void energy_skip(const block_sessions_t *sessions);
+
+/*
+ * The acquisition and the pipeline stopped, fails sessions still waiting.
+ */
+void energy_finish(void);
+
+#endif
+/* vim: set fileencoding=utf8 : */
@@ -0,0 +1,169 @@
+/*
+ *  Records analog data from a NI USB-6218 and send it to connected clients
+ *
+ *  Copyright (C)2011-2012, Johannes Weiß <weiss@tux4u.de>
+ *                        , Jonathan Dimond <jonny@dimond.de>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+
+#include <utils.h>
+
+#include "common.h"
+#include "shm_layout.h"
+#include "shm_ring.h"
+#include "fd_block.h"
+
+/* unix domain socket clients, atomic */
+static uint32_t __subscribers = 0;
+
+void fd_block_subscribe(void) {
+    __atomic_add_fetch(&__subscribers, 1, __ATOMIC_ACQ_REL);
+}
+
+void fd_block_unsubscribe(void) {
+    __atomic_sub_fetch(&__subscribers, 1, __ATOMIC_ACQ_REL);
+}
+
+bool fd_block_wanted(void) {
+    return 0 < __atomic_load_n(&__subscribers, __ATOMIC_ACQUIRE);
+}
+
+#ifndef __MACH__
+int fd_block_create(uint64_t timestamp_nanos,
+                    unsigned int sampling_rate,
+                    unsigned int points_per_channel,
+                    unsigned int num_channels,
+                    const double *analog_data,
+                    const digival_t *digital_data,
+                    const block_markers_t *markers) {
+    const size_t samples = num_channels * points_per_channel;
+    pm_shm_slot_t slot = { 0 };
+    ssize_t res;
+    int fd, err;
+
+    fd = memfd_create("pm-lab-tools-block", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if(0 > fd) {
+        return -1;
+    }
+
+    slot.timestamp_nanos = timestamp_nanos;
+    slot.points_per_channel = points_per_channel;
+    slot.num_channels = num_channels;
+    slot.sampling_rate = sampling_rate;
+    shm_slot_markers(&slot, markers);
+
+    res = full_write(fd, (const char *)&slot, sizeof(slot));
+    if(sizeof(slot) != res) {
+        goto err;
+    }
+    res = full_write(fd, (const char *)analog_data, sizeof(double) * samples);
+    if(sizeof(double) * samples != res) {
+        goto err;
+    }
+    res = full_write(fd, (const char *)digital_data,
+                     sizeof(digival_t) * samples);
+    if(sizeof(digival_t) * samples != res) {
+        goto err;
+    }
+
+    /* clients map it, it must never change */
+    err = fcntl(fd, F_ADD_SEALS,
+                F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL);
+    if(0 != err) {
+        goto err;
+    }
+
+    return fd;
+
+err:
+    close(fd);
+    return -1;
+}
+
+int fd_block_send(int sock, int block_fd) {
+    char msg[sizeof(MAGIC_MEMFD_BLOCK) + sizeof(uint32_t)];
+    char control[CMSG_SPACE(sizeof(int))];
+    struct iovec iov = { .iov_base = msg, .iov_len = sizeof(msg) };
+    struct msghdr hdr = { 0 };
+    struct cmsghdr *cmsg;
+    struct stat st;
+    uint32_t net_size;
+    ssize_t res;
+
+    if(0 != fstat(block_fd, &st)) {
+        return -1;
+    }
+    net_size = htonl((uint32_t)st.st_size);
+    memcpy(msg, MAGIC_MEMFD_BLOCK, sizeof(MAGIC_MEMFD_BLOCK));
+    memcpy(msg + sizeof(MAGIC_MEMFD_BLOCK), &net_size, sizeof(uint32_t));
+
+    memset(control, 0, sizeof(control));
+    hdr.msg_iov = &iov;
+    hdr.msg_iovlen = 1;
+    hdr.msg_control = control;
+    hdr.msg_controllen = sizeof(control);
+    cmsg = CMSG_FIRSTHDR(&hdr);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &block_fd, sizeof(int));
+
+    do {
+        res = sendmsg(sock, &hdr, MSG_NOSIGNAL);
+    } while(0 > res && EINTR == errno);
+    if(0 > res) {
+        return -1;
+    }
+
+    /* the descriptor went with the first byte, the rest is plain data */
+    if(sizeof(msg) != res &&
+       sizeof(msg) - res != full_write(sock, msg + res, sizeof(msg) - res)) {
+        return -1;
+    }
+
+    return sizeof(msg);
+}
+#else
+int fd_block_create(uint64_t timestamp_nanos,
+                    unsigned int sampling_rate,
+                    unsigned int points_per_channel,
+                    unsigned int num_channels,
+                    const double *analog_data,
+                    const digival_t *digital_data,
+                    const block_markers_t *markers) {
+    return -1;
+}
+
+int fd_block_send(int sock, int block_fd) {
+    errno = ENOTSUP;
+    return -1;
+}
+#endif
+/* vim: set fileencoding=utf8 : */
@@ -0,0 +1,59 @@
+/*
+ *  Records analog data from a NI USB-6218 and send it to connected clients
+ *
+ *  Copyright (C)2011-2012, Johannes Weiß <weiss@tux4u.de>
+ *                        , Jonathan Dimond <jonny@dimond.de>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef FD_BLOCK_H
+#define FD_BLOCK_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "markers.h"
+
+/* see common/shm_layout.h for what clients receive */
+
+/*
+ * Creates a sealed memfd holding one block, analog_data and digital_data
+ * hold one channel after the other. Returns the file descriptor or -1 (e.g.
+ * if memfds are not supported).
+ */
+int fd_block_create(uint64_t timestamp_nanos,
+                    unsigned int sampling_rate,
+                    unsigned int points_per_channel,
+                    unsigned int num_channels,
+                    const double *analog_data,
+                    const digival_t *digital_data,
+                    const block_markers_t *markers);
+
+/*
+ * Counts the unix domain socket clients, the acquisition thread only
+ * creates memfds while fd_block_wanted.
+ */
+void fd_block_subscribe(void);
+void fd_block_unsubscribe(void);
+bool fd_block_wanted(void);
+
+/*
+ * Passes block_fd to the client connected to the unix domain socket sock.
+ * Returns the number of bytes sent or -1 on error.
+ */
+int fd_block_send(int sock, int block_fd);
+
+#endif
+/* vim: set fileencoding=utf8 : */
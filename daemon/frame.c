@@ -0,0 +1,192 @@
+/*
+ *  Records analog data from a NI USB-6218 and send it to connected clients
+ *
+ *  Copyright (C)2011-2012, Johannes Weiß <weiss@tux4u.de>
+ *                        , Jonathan Dimond <jonny@dimond.de>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <alloca.h>
+#include <arpa/inet.h>
+
+#include "frame.h"
+
+#include "measured-data.pb-c.h"
+
+/* tag and length of a length delimited field at most */
+#define FIELD_OVERHEAD (1 + 5)
+/* tag and value of a varint field at most */
+#define VARINT_FIELD_SIZE (1 + 10)
+/* a Marker within a DataSet at most */
+#define MARKER_FIELD_SIZE \
+    (FIELD_OVERHEAD + 2 * VARINT_FIELD_SIZE + FIELD_OVERHEAD + MARKER_LABEL_LEN)
+
+static void encode_datapoints(unsigned int len,
+                              double *analog_data,
+                              digival_t *digital_data,
+                              DataPoints *msg_dps) {
+    data_points__init(msg_dps);
+
+    msg_dps->n_analog_data = len;
+    msg_dps->analog_data = analog_data;
+    msg_dps->n_digital_data = len;
+    assert(sizeof(digival_t) == sizeof(protobuf_c_boolean));
+    msg_dps->digital_data = (protobuf_c_boolean *)digital_data;
+}
+
+size_t frame_max_size(unsigned int num_channels,
+                      unsigned int points_per_channel) {
+    /* packed doubles take 8 bytes, packed bools 1 byte */
+    const size_t channel_size = FIELD_OVERHEAD +
+                                2 * FIELD_OVERHEAD +
+                                9 * (size_t)points_per_channel;
+
+    return sizeof(MAGIC_DATA_SET) + sizeof(uint32_t) +
+           VARINT_FIELD_SIZE + num_channels * channel_size +
+           MAX_BLOCK_MARKERS * MARKER_FIELD_SIZE;
+}
+
+size_t frame_encode(uint8_t *buf,
+                    unsigned int num_channels,
+                    const unsigned int *channel_ids,
+                    unsigned int points_per_channel,
+                    uint64_t timestamp_nanos,
+                    double *analog_data,
+                    digival_t *digital_data,
+                    const block_markers_t *markers) {
+    const unsigned int num_markers = NULL == markers ? 0 : markers->count;
+    DataSet msg_ds = DATA_SET__INIT;
+    DataPoints *msg_dps = alloca(sizeof(DataPoints) * num_channels);
+    DataPoints **msg_dpps = alloca(sizeof(DataPoints *) * num_channels);
+    Marker *msg_ms = alloca(sizeof(Marker) * num_markers + 1);
+    Marker **msg_mps = alloca(sizeof(Marker *) * num_markers + 1);
+    uint32_t msg_len, net_msg_len;
+    assert(NULL != msg_dps && NULL != msg_dpps);
+    assert(num_markers <= MAX_BLOCK_MARKERS);
+
+    msg_ds.timestamp_nanos = timestamp_nanos;
+
+    for (int i=0; i<num_channels; i++) {
+        const unsigned int offset = channel_ids[i] * points_per_channel;
+        encode_datapoints(points_per_channel,
+                          analog_data+offset,
+                          digital_data+offset,
+                          &msg_dps[i]);
+        msg_dpps[i] = &msg_dps[i];
+    }
+
+    msg_ds.n_channel_data = num_channels;
+    msg_ds.channel_data = msg_dpps;
+
+    for(unsigned int i = 0; i < num_markers; i++) {
+        marker__init(&msg_ms[i]);
+        msg_ms[i].id = markers->marker[i].id;
+        msg_ms[i].sample = markers->marker[i].sample;
+        msg_ms[i].label = (char *)markers->marker[i].label;
+        msg_mps[i] = &msg_ms[i];
+    }
+    msg_ds.n_markers = num_markers;
+    msg_ds.markers = msg_mps;
+
+    msg_len = data_set__pack(&msg_ds,
+                             buf + sizeof(MAGIC_DATA_SET) + sizeof(uint32_t));
+    assert(sizeof(MAGIC_DATA_SET) + sizeof(uint32_t) + msg_len <=
+           frame_max_size(num_channels, points_per_channel));
+
+    memcpy(buf, MAGIC_DATA_SET, sizeof(MAGIC_DATA_SET));
+    net_msg_len = htonl(msg_len);
+    memcpy(buf + sizeof(MAGIC_DATA_SET), &net_msg_len, sizeof(uint32_t));
+
+    return sizeof(MAGIC_DATA_SET) + sizeof(uint32_t) + msg_len;
+}
+
+size_t frame_config_max_size(unsigned int num_channels) {
+    /* tag and value of a fixed64 field */
+    const size_t double_size = 1 + sizeof(double);
+
+    /*
+     * shot_id, sampling_rate, channel_count, the names, version, encoding,
+     * block_size, unit, range, scale and offset, generation
+     */
+    return sizeof(MAGIC_MEASURED_DATA) + sizeof(uint32_t) +
+           FIELD_OVERHEAD + MAX_SHOT_ID_LEN + double_size + VARINT_FIELD_SIZE +
+           num_channels * (FIELD_OVERHEAD + DAQ_CHANNEL_NAME_LEN) +
+           VARINT_FIELD_SIZE + FIELD_OVERHEAD + sizeof(SAMPLE_ENCODING) +
+           VARINT_FIELD_SIZE + FIELD_OVERHEAD + sizeof(SAMPLE_UNIT) +
+           2 * double_size +
+           2 * (FIELD_OVERHEAD + num_channels * sizeof(double)) +
+           VARINT_FIELD_SIZE;
+}
+
+size_t frame_encode_config(uint8_t *buf,
+                           const daq_config_t *config,
+                           unsigned int num_channels,
+                           const unsigned int *channel_ids,
+                           const char *shot_id) {
+    MeasuredData msg_md = MEASURED_DATA__INIT;
+    char **names = alloca(sizeof(char *) * num_channels);
+    double *scale = alloca(sizeof(double) * num_channels);
+    double *offset = alloca(sizeof(double) * num_channels);
+    uint32_t msg_len, net_msg_len;
+    assert(NULL != names && NULL != scale && NULL != offset);
+    assert(sizeof(MAGIC_MEASURED_DATA) == sizeof(MAGIC_DATA_SET));
+    assert(strlen(shot_id) < MAX_SHOT_ID_LEN);
+
+    for(unsigned int i = 0; i < num_channels; i++) {
+        assert(channel_ids[i] < config->num_channels);
+        names[i] = (char *)config->channel_names[channel_ids[i]];
+        scale[i] = config->scale[channel_ids[i]];
+        offset[i] = config->offset[channel_ids[i]];
+    }
+
+    msg_md.shot_id = (char *)shot_id;
+    msg_md.sampling_rate = config->sampling_rate;
+    msg_md.channel_count = num_channels;
+    msg_md.n_channel_names = num_channels;
+    msg_md.channel_names = names;
+
+    msg_md.has_protocol_version = 1;
+    msg_md.protocol_version = PROTOCOL_VERSION;
+    msg_md.encoding = SAMPLE_ENCODING;
+    msg_md.has_block_size = 1;
+    msg_md.block_size = config->block_size;
+    msg_md.unit = SAMPLE_UNIT;
+    msg_md.has_range_min = 1;
+    msg_md.range_min = config->u_min;
+    msg_md.has_range_max = 1;
+    msg_md.range_max = config->u_max;
+    msg_md.n_scale = num_channels;
+    msg_md.scale = scale;
+    msg_md.n_offset = num_channels;
+    msg_md.offset = offset;
+    msg_md.has_generation = 1;
+    msg_md.generation = config->generation;
+
+    msg_len = measured_data__pack(&msg_md,
+                                  buf + sizeof(MAGIC_MEASURED_DATA) +
+                                  sizeof(uint32_t));
+    assert(sizeof(MAGIC_MEASURED_DATA) + sizeof(uint32_t) + msg_len <=
+           frame_config_max_size(num_channels));
+
+    memcpy(buf, MAGIC_MEASURED_DATA, sizeof(MAGIC_MEASURED_DATA));
+    net_msg_len = htonl(msg_len);
+    memcpy(buf + sizeof(MAGIC_MEASURED_DATA), &net_msg_len, sizeof(uint32_t));
+
+    return sizeof(MAGIC_MEASURED_DATA) + sizeof(uint32_t) + msg_len;
+}
+/* vim: set fileencoding=utf8 : */
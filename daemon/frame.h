@@ -0,0 +1,82 @@
+/*
+ *  Records analog data from a NI USB-6218 and send it to connected clients
+ *
+ *  Copyright (C)2011-2012, Johannes Weiß <weiss@tux4u.de>
+ *                        , Jonathan Dimond <jonny@dimond.de>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef FRAME_H
+#define FRAME_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "common.h"
+#include "daq_config.h"
+#include "markers.h"
+
+/*
+ * A frame is what clients read for every block: MAGIC_DATA_SET, the length
+ * of the DataSet message (uint32, network byte order) and the message.
+ */
+
+/*
+ * Upper bound of the size of a frame with num_channels channels of
+ * points_per_channel samples and up to MAX_BLOCK_MARKERS markers.
+ */
+size_t frame_max_size(unsigned int num_channels,
+                      unsigned int points_per_channel);
+
+/*
+ * Encodes the channels channel_ids of a block (analog_data and digital_data
+ * hold one channel after the other) and its markers (NULL for none) into
+ * buf, which must hold at least frame_max_size bytes. Returns the length of
+ * the frame.
+ */
+size_t frame_encode(uint8_t *buf,
+                    unsigned int num_channels,
+                    const unsigned int *channel_ids,
+                    unsigned int points_per_channel,
+                    uint64_t timestamp_nanos,
+                    double *analog_data,
+                    digival_t *digital_data,
+                    const block_markers_t *markers);
+
+/*
+ * A configuration frame describes the stream after the handshake and
+ * announces a new DAQ configuration between two data frames:
+ * MAGIC_MEASURED_DATA (as long as MAGIC_DATA_SET), the length of the
+ * MeasuredData message (uint32, network byte order) and the message with the
+ * protocol version, sampling rate, encoding, block size, input range and the
+ * physical names and calibration of the client's channels. Before a capture
+ * of a trigger, the frame carries its shot_id.
+ */
+size_t frame_config_max_size(unsigned int num_channels);
+
+/*
+ * Encodes config for a client reading channel_ids into buf, which must hold
+ * at least frame_config_max_size bytes. shot_id is "" for a stream or names
+ * the capture that follows (MAX_SHOT_ID_LEN at most). Returns the length of
+ * the frame.
+ */
+size_t frame_encode_config(uint8_t *buf,
+                           const daq_config_t *config,
+                           unsigned int num_channels,
+                           const unsigned int *channel_ids,
+                           const char *shot_id);
+
+#endif
+/* vim: set fileencoding=utf8 : */
@@ -0,0 +1,359 @@
+/*
+ *  Records analog data from a NI USB-6218 and send it to connected clients
+ *
+ *  Copyright (C)2011-2012, Johannes Weiß <weiss@tux4u.de>
+ *                        , Jonathan Dimond <jonny@dimond.de>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <assert.h>
+#include <errno.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#ifndef __MACH__
+#include <sys/timerfd.h>
+#endif
+
+#include "generator.h"
+#include "stats.h"
+#include "sync.h"
+
+/* the noise is taken from a table of normally distributed values */
+#define NOISE_TABLE_SIZE (1 << 16)
+/* time constant of the decay of a spike */
+#define SPIKE_DECAY_S 50e-6
+/* spikes are placed in windows of this length, spike_rate on average */
+#define SPIKE_WINDOW_S 0.01
+
+struct generator {
+    generator_params_t params;
+    unsigned int sampling_rate;
+    unsigned int block_size;
+    unsigned int num_channels;
+    double u_min;
+    double u_max;
+    uint64_t next_sample;  /* index of the first sample of the next block */
+    uint64_t start_nanos;
+    int timer_fd;          /* -1 without timerfd */
+    double *noise;
+};
+
+/*
+ * RANDOMNESS, a hash of the seed and the position, not a sequence
+ */
+static uint64_t mix(uint64_t x) {
+    /* splitmix64 */
+    x += 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+static uint64_t hash(uint64_t seed, uint64_t a, uint64_t b) {
+    return mix(seed ^ mix(a ^ mix(b)));
+}
+
+/* in [0, 1) */
+static double uniform(uint64_t h) {
+    return (h >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/*
+ * SIGNAL
+ */
+static void fill_noise_table(generator_t *gen) {
+    double u1, u2;
+
+    for(unsigned int i = 0; i < NOISE_TABLE_SIZE; i++) {
+        /* Box-Muller */
+        u1 = 1.0 - uniform(hash(gen->params.seed, 0, 2 * i));
+        u2 = uniform(hash(gen->params.seed, 0, 2 * i + 1));
+        gen->noise[i] = gen->params.noise *
+                        sqrt(-2.0 * log(u1)) * cos(2.0 * M_PI * u2);
+    }
+}
+
+/* the DC level plus a load step every other half period */
+static void add_levels(const generator_t *gen, unsigned int c,
+                       uint64_t first, unsigned int points, double *out) {
+    const double dc = gen->params.dc * (1.0 + 0.5 * c);
+    const double period = gen->params.step_period * (1.0 + 0.37 * c);
+    uint64_t half = (uint64_t)(period * gen->sampling_rate / 2);
+    uint64_t segment, len;
+    double level;
+
+    half = half < 1 ? 1 : half;
+    for(unsigned int i = 0; i < points; i += len) {
+        segment = (first + i) / half;
+        len = (segment + 1) * half - (first + i);
+        len = len < points - i ? len : points - i;
+
+        level = dc;
+        if(segment & 1) {
+            level += gen->params.step *
+                     (0.5 + 0.5 * uniform(hash(gen->params.seed,
+                                               c + 1, segment)));
+        }
+        for(uint64_t j = 0; j < len; j++) {
+            out[i + j] = level;
+        }
+    }
+}
+
+/* every NOISE_TABLE_SIZE samples start at another place in the table */
+static void add_noise(const generator_t *gen, unsigned int c,
+                      uint64_t first, unsigned int points, double *out) {
+    const double *noise = gen->noise;
+    uint64_t sample, chunk;
+    unsigned int offset, len;
+
+    for(unsigned int i = 0; i < points; i += len) {
+        sample = first + i;
+        chunk = sample / NOISE_TABLE_SIZE;
+        offset = (hash(gen->params.seed, c + 1000, chunk) + sample) %
+                 NOISE_TABLE_SIZE;
+        /* to the end of the table or of the chunk */
+        len = NOISE_TABLE_SIZE - offset;
+        if(len > (chunk + 1) * NOISE_TABLE_SIZE - sample) {
+            len = (chunk + 1) * NOISE_TABLE_SIZE - sample;
+        }
+        len = len < points - i ? len : points - i;
+        for(unsigned int j = 0; j < len; j++) {
+            out[i + j] += noise[offset + j];
+        }
+    }
+}
+
+/*
+ * The spikes of every window (SPIKE_WINDOW_S), including the earlier ones
+ * still decaying in the block.
+ */
+static void add_spikes(const generator_t *gen, unsigned int c,
+                       uint64_t first, unsigned int points, double *out) {
+    const uint64_t seed = gen->params.seed;
+    const double decay = SPIKE_DECAY_S * gen->sampling_rate;
+    const uint64_t spike_len = 1 + (uint64_t)(5 * decay);
+    uint64_t window = (uint64_t)(SPIKE_WINDOW_S * gen->sampling_rate);
+    const uint64_t end = first + points;
+    uint64_t w, last_window, pos, from, to;
+    double expected;
+    unsigned int num_spikes;
+    double height;
+
+    window = window < 1 ? 1 : window;
+    expected = gen->params.spike_rate * window / gen->sampling_rate;
+    w = first < spike_len ? 0 : (first - spike_len) / window;
+    last_window = (end - 1) / window;
+    for(; w <= last_window; w++) {
+        /* rounded randomly, so the rate holds for short windows as well */
+        num_spikes = (unsigned int)(expected +
+                                    uniform(hash(seed, c + 2000, w)));
+        for(uint64_t s = 0; s < num_spikes; s++) {
+            pos = w * window +
+                  hash(seed, c + 3000 + (s << 32), w) % window;
+            if(pos >= end || pos + spike_len <= first) {
+                continue;
+            }
+            height = gen->params.spike *
+                     (0.5 + 0.5 * uniform(hash(seed, c + 4000 + (s << 32),
+                                               w)));
+            from = pos < first ? first : pos;
+            to = pos + spike_len < end ? pos + spike_len : end;
+            for(uint64_t j = from; j < to; j++) {
+                out[j - first] += height * exp(-(double)(j - pos) /
+                                               (decay + 1e-9));
+            }
+        }
+    }
+}
+
+static void clip(const generator_t *gen, unsigned int points, double *out) {
+    const double lo = gen->u_min;
+    const double hi = gen->u_max;
+
+    for(unsigned int i = 0; i < points; i++) {
+        out[i] = out[i] < lo ? lo : out[i] > hi ? hi : out[i];
+    }
+}
+
+/*
+ * PACING
+ */
+static uint64_t deadline_nanos(const generator_t *gen, uint64_t sample) {
+    const uint64_t rate = gen->sampling_rate;
+
+    return gen->start_nanos + (sample / rate) * TIME_S +
+           (sample % rate) * TIME_S / rate;
+}
+
+static int wait_until(generator_t *gen, uint64_t deadline) {
+#ifndef __MACH__
+    struct itimerspec its;
+    uint64_t expirations;
+    ssize_t res;
+
+    memset(&its, 0, sizeof(its));
+    its.it_value.tv_sec = deadline / TIME_S;
+    its.it_value.tv_nsec = deadline % TIME_S;
+    if(0 != timerfd_settime(gen->timer_fd, TFD_TIMER_ABSTIME, &its, NULL)) {
+        return -1;
+    }
+
+    do {
+        /* returns at once if the deadline passed already */
+        res = read(gen->timer_fd, &expirations, sizeof(expirations));
+    } while(0 > res && EINTR == errno);
+
+    return sizeof(expirations) == res ? 0 : -1;
+#else
+    struct timespec ts;
+    uint64_t now = stats_now_nanos();
+
+    if(deadline > now) {
+        ts.tv_sec = (deadline - now) / TIME_S;
+        ts.tv_nsec = (deadline - now) % TIME_S;
+        while(0 != nanosleep(&ts, &ts) && EINTR == errno) {
+            /* the rest */
+        }
+    }
+    return 0;
+#endif
+}
+
+/*
+ * FUNCTIONALITY
+ */
+void generator_default_params(generator_params_t *params) {
+    /* about the voltages over the shunts of the lab's boards */
+    params->dc = 0.004;
+    params->step = 0.012;
+    params->step_period = 1.5;
+    params->noise = 0.0015;
+    params->spike_rate = 2;
+    params->spike = 0.03;
+    params->seed = 1;
+}
+
+int generator_parse_params(const char *spec, generator_params_t *params) {
+    char *copy = strdup(spec);
+    char *saveptr = NULL;
+    char *value, *end;
+    double number;
+    int ret = 0;
+    assert(NULL != copy);
+
+    for(char *tok = strtok_r(copy, ",", &saveptr); 0 == ret && NULL != tok;
+        tok = strtok_r(NULL, ",", &saveptr)) {
+        value = strchr(tok, '=');
+        if(NULL == value) {
+            ret = -1;
+            break;
+        }
+        *value++ = '\0';
+
+        errno = 0;
+        number = strtod(value, &end);
+        if(0 != errno || end == value || '\0' != *end || number < 0) {
+            ret = -1;
+        } else if(0 == strcasecmp("dc", tok)) {
+            params->dc = number;
+        } else if(0 == strcasecmp("step", tok)) {
+            params->step = number;
+        } else if(0 == strcasecmp("period", tok) && number > 0) {
+            params->step_period = number;
+        } else if(0 == strcasecmp("noise", tok)) {
+            params->noise = number;
+        } else if(0 == strcasecmp("spikes", tok)) {
+            params->spike_rate = number;
+        } else if(0 == strcasecmp("spike", tok)) {
+            params->spike = number;
+        } else if(0 == strcasecmp("seed", tok)) {
+            params->seed = (uint64_t)number;
+        } else {
+            ret = -1;
+        }
+    }
+    free(copy);
+
+    return ret;
+}
+
+generator_t *generator_create(const generator_params_t *params,
+                              const daq_config_t *config) {
+    generator_t *gen = calloc(1, sizeof(*gen));
+    assert(NULL != gen);
+    assert(0 < config->sampling_rate && 0 < config->block_size);
+
+    gen->params = *params;
+    gen->sampling_rate = config->sampling_rate;
+    gen->block_size = config->block_size;
+    gen->num_channels = config->num_channels;
+    gen->u_min = config->u_min;
+    gen->u_max = config->u_max;
+    gen->noise = malloc(NOISE_TABLE_SIZE * sizeof(double));
+    assert(NULL != gen->noise);
+    fill_noise_table(gen);
+
+#ifndef __MACH__
+    gen->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+    assert(0 <= gen->timer_fd);
+#else
+    gen->timer_fd = -1;
+#endif
+    /* stats_now_nanos uses the clock of the timerfd */
+    gen->start_nanos = stats_now_nanos();
+
+    return gen;
+}
+
+int generator_read(generator_t *gen,
+                   double *buffer,
+                   size_t data_size,
+                   unsigned int *points_per_channel) {
+    const unsigned int points = gen->block_size;
+    const uint64_t first = gen->next_sample;
+    double *out;
+
+    assert((size_t)gen->num_channels * points <= data_size);
+
+    for(unsigned int c = 0; c < gen->num_channels; c++) {
+        out = buffer + (size_t)c * points;
+        add_levels(gen, c, first, points, out);
+        add_noise(gen, c, first, points, out);
+        add_spikes(gen, c, first, points, out);
+        clip(gen, points, out);
+    }
+    gen->next_sample += points;
+    *points_per_channel = points;
+
+    /* a DAQ read returns once the last sample of the block was taken */
+    return wait_until(gen, deadline_nanos(gen, gen->next_sample));
+}
+
+void generator_destroy(generator_t *gen) {
+    if(0 <= gen->timer_fd) {
+        close(gen->timer_fd);
+    }
+    free(gen->noise);
+    free(gen);
+}
+/* vim: set fileencoding=utf8 : */
@@ -0,0 +1,87 @@
+/*
+ *  Records analog data from a NI USB-6218 and send it to connected clients
+ *
+ *  Copyright (C)2011-2012, Johannes Weiß <weiss@tux4u.de>
+ *                        , Jonathan Dimond <jonny@dimond.de>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef GENERATOR_H
+#define GENERATOR_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "daq_config.h"
+
+/*
+ * The DAQ backend of builds without NI-DAQmx Base (build.sh -n): every
+ * channel carries a power-like signal made of a DC level, load steps, noise
+ * and occasional spikes, clipped to the input range, at any sampling rate
+ * up to GENERATOR_MAX_RATE and for any number of channels. The signal only
+ * depends on the parameters, the channel and the index of the sample since
+ * the DAQ task started, not on how it is cut into blocks, so two runs send
+ * the same data.
+ *
+ * Blocks are due at absolute deadlines (a timerfd on Linux) computed from
+ * the number of samples generated, so the stream keeps the configured rate
+ * no matter how long generating took and doesn't drift.
+ */
+
+#define GENERATOR_MAX_RATE 10000000
+
+typedef struct {
+    double dc;           /* V, level of the first channel */
+    double step;         /* V, height of the load steps at most */
+    double step_period;  /* s, low and high once, first channel */
+    double noise;        /* V, standard deviation */
+    double spike_rate;   /* per second and channel */
+    double spike;        /* V, height of a spike */
+    uint64_t seed;
+} generator_params_t;
+
+typedef struct generator generator_t;
+
+void generator_default_params(generator_params_t *params);
+
+/*
+ * Changes params by the comma separated KEY=VALUE assignments in spec (dc,
+ * step, period, noise, spikes, spike and seed). Returns 0 or -1 if spec is
+ * invalid.
+ */
+int generator_parse_params(const char *spec, generator_params_t *params);
+
+/*
+ * Starts generating config->block_size samples per channel and block of
+ * config->num_channels channels at config->sampling_rate, the first block
+ * is due one block from now.
+ */
+generator_t *generator_create(const generator_params_t *params,
+                              const daq_config_t *config);
+
+/*
+ * Writes the next block to buffer (one channel after the other, data_size
+ * samples at most) and waits until it is due, like a DAQ read. Returns 0 or
+ * -1 if waiting failed.
+ */
+int generator_read(generator_t *gen,
+                   double *buffer,
+                   size_t data_size,
+                   unsigned int *points_per_channel);
+
+void generator_destroy(generator_t *gen);
+
+#endif
+/* vim: set fileencoding=utf8 : */
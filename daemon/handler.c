@@ -22,6 +22,7 @@
 #include <stdio.h>
 #include <unistd.h>
 #include <sys/types.h>
+#include <sys/socket.h>
 #include <time.h>
 #include <assert.h>
 #include <pthread.h>
@@ -30,17 +31,26 @@
 #include <stdlib.h>
 #include <arpa/inet.h>
 #include <strings.h>
+#include <inttypes.h>
 
 #include <utils.h>
+#include <selection.h>
 
 #include "daemon.h"
 #include "sync.h"
+#include "stats.h"
+#include "fd_block.h"
+#include "frame.h"
+#include "uring_sender.h"
+#include "zerocopy.h"
+#include "pipeline.h"
+#include "trigger.h"
 #include "common/conf.h"
 
-#include "measured-data.pb-c.h"
-
 #define BUF_SIZE 8
-#define MAX_CHANNELS 8
+
+/* the captures of all triggers are numbered, the first is 1 */
+static uint64_t __last_shot_id = 0;
 
 typedef struct {
     pthread_mutex_t lock;
@@ -49,6 +59,9 @@ typedef struct {
     const size_t max_elems;
     input_data_t *start;
     size_t count;
+    bool finished;    /* no more blocks, send what is left */
+    bool closing;     /* the handler gave up on the client */
+    bool sender_done; /* the sender thread sent what it could */
 } buffer_desc_t;
 
 typedef struct {
@@ -57,25 +70,18 @@ typedef struct {
     int conn_fd;
     unsigned int num_channels;
     unsigned int *channels;
+    stats_client_t *stats;
+    zc_socket_t *zc;
+    uint32_t protocol_version;
+    uint64_t config_generation; /* the DAQ configuration the client knows */
+    unsigned int sampling_rate; /* of that configuration */
 } sender_thread_info_t;
 
 /*
  * PROTOCOL BUFFER ENCODING AND SENDING
  */
-static void encode_datapoints(unsigned int len,
-                              double *analog_data,
-                              digival_t *digital_data,
-                              DataPoints *msg_dps) {
-    data_points__init(msg_dps);
-
-    msg_dps->n_analog_data = len;
-    msg_dps->analog_data = analog_data;
-    msg_dps->n_digital_data = len;
-    assert(sizeof(digival_t) == sizeof(protobuf_c_boolean));
-    msg_dps->digital_data = (protobuf_c_boolean *)digital_data;
-}
-
 static int write_dataset(int fd,
+                         zc_socket_t *zc,
                          unsigned int num_channels,  /* 3 */
                          unsigned int channel_ids[], /* 1, 4, 16 */
                          unsigned int len,           /* samples per channel */
@@ -83,74 +89,224 @@ static int write_dataset(int fd,
                          double *analog_data,        /* chan1val1, chan1val2,
                                                       * chan2val1, chan2val2,
                                                       * ... */
-                         digival_t *digital_data) {  /* just as analog_data */
-    int err, ret;
-    DataSet msg_ds = DATA_SET__INIT;
-    DataPoints **msg_dps = alloca(sizeof(DataPoints *) * num_channels);
-    assert(NULL != msg_dps);
+                         digival_t *digital_data,   /* just as analog_data */
+                         const block_markers_t *markers,
+                         stats_client_t *stats) {
+    int err;
+    size_t frame_len;
+    uint64_t encode_start = stats_now_nanos();
+    uint8_t *buf = malloc(frame_max_size(num_channels, len));
+    assert(NULL != buf);
 
-    for (int i=0; i<num_channels; i++) {
-        msg_dps[i] = alloca(sizeof(DataPoints));
-        assert(NULL != msg_dps[i]);
+    frame_len = frame_encode(buf,
+                             num_channels,
+                             channel_ids,
+                             len,
+                             timestamp,
+                             analog_data,
+                             digital_data,
+                             markers);
+    STATS_ADD(stats->encode_nanos, stats_now_nanos() - encode_start);
+
+    if(frame_len >= ZC_MIN_FRAME_SIZE && zc_enabled(zc)) {
+        /* frees buf once the kernel is done with it */
+        err = zc_send(zc, buf, frame_len, free, buf);
+    } else {
+        /* the whole frame in one go */
+        err = full_write(fd, (char *)buf, frame_len);
+        free(buf);
+    }
+    if (err >= 0) {
+        assert(frame_len == err);
+        STATS_ADD(stats->bytes_sent, err);
+        STATS_ADD(stats->frames_sent, 1);
     }
 
-    msg_ds.timestamp_nanos = timestamp;
+    return err;
+}
+
+/*
+ * Sends a frame the pipeline encoded for all clients reading the same
+ * channels and drops the reference to it.
+ */
+static int write_frame(int fd,
+                       zc_socket_t *zc,
+                       pipeline_frame_t *frame,
+                       stats_client_t *stats) {
+    int err;
+    size_t frame_len;
+
+    pipeline_frame_wait(frame);
+    frame_len = frame->len;
+    if(0 == frame_len) {
+        /* the pipeline dropped the block */
+        pipeline_frame_put(frame);
+        return 0;
+    }
 
-    for (int i=0; i<num_channels; i++) {
-        const unsigned int offset = channel_ids[i] * len;
-        encode_datapoints(len,
-                          analog_data+offset,
-                          digital_data+offset,
-                          msg_dps[i]);
+    if(frame_len >= ZC_MIN_FRAME_SIZE && zc_enabled(zc)) {
+        /* the reference is dropped once the kernel is done with it */
+        err = zc_send(zc, frame->data, frame_len, pipeline_frame_put, frame);
+    } else {
+        err = full_write(fd, (char *)frame->data, frame_len);
+        pipeline_frame_put(frame);
+    }
+    if (err >= 0) {
+        assert(frame_len == err);
+        STATS_ADD(stats->bytes_sent, err);
+        STATS_ADD(stats->frames_sent, 1);
     }
 
-    msg_ds.n_channel_data = num_channels;
-    msg_ds.channel_data = msg_dps;
+    return err;
+}
+
+static void release_element(input_data_t *in) {
+    free(in->analog_data);
+    free(in->digital_data);
+    if(0 <= in->block_fd) {
+        close(in->block_fd);
+    }
+    if(NULL != in->frame) {
+        pipeline_frame_put(in->frame);
+    }
+}
 
-    const uint32_t msg_len = data_set__get_packed_size(&msg_ds);
-    const uint32_t net_msg_len = htonl(msg_len);
-    void *buf = malloc(msg_len);
+/*
+ * Describes the stream to the client after the handshake, tells it about a
+ * new DAQ configuration before the first block read with it and announces
+ * every capture of its trigger (shot_id is "" otherwise).
+ */
+static int write_config(int fd,
+                        const daq_config_t *config,
+                        unsigned int num_channels,
+                        unsigned int channel_ids[],
+                        const char *shot_id,
+                        stats_client_t *stats) {
+    int err;
+    size_t frame_len;
+    uint8_t *buf = malloc(frame_config_max_size(num_channels));
     assert(NULL != buf);
-    bzero(buf, msg_len);
 
-    data_set__pack(&msg_ds, buf);
+    frame_len = frame_encode_config(buf, config, num_channels, channel_ids,
+                                    shot_id);
+    err = full_write(fd, (char *)buf, frame_len);
+    free(buf);
+    if (err >= 0) {
+        assert(frame_len == err);
+        STATS_ADD(stats->bytes_sent, err);
+    }
 
-    ret = 0;
-    err = full_write(fd, MAGIC_DATA_SET, sizeof(MAGIC_DATA_SET));
-    if (err < 0) {
-        goto finally;
-    } else {
-        assert(sizeof(MAGIC_DATA_SET) == err);
+    return err;
+}
+
+/*
+ * Answers the handshake: protocol version 1 clients learn the sampling rate
+ * only, later ones get the whole description of their channels.
+ */
+static int write_welcome(int fd,
+                         uint32_t protocol_version,
+                         const daq_config_t *config,
+                         unsigned int num_channels,
+                         unsigned int channel_ids[],
+                         stats_client_t *stats) {
+    uint32_t net_sampling_rate;
+    int err;
+
+    err = full_write(fd, WELCOME_MSG, sizeof(WELCOME_MSG));
+    if(sizeof(WELCOME_MSG) != err) {
+        return -1;
     }
-    ret += err;
 
-    err = full_write(fd, (char *)&net_msg_len, sizeof(uint32_t));
-    if (err < 0) {
-        goto finally;
-    } else {
-        assert(sizeof(uint32_t) == err);
+    if(1 < protocol_version) {
+        return write_config(fd, config, num_channels, channel_ids, "",
+                            stats);
     }
-    ret += err;
 
-    err = full_write(fd, buf, msg_len);
-    if (err < 0) {
-        goto finally;
-    } else {
-        assert(msg_len == err);
+    net_sampling_rate = htonl((uint32_t)config->sampling_rate);
+    err = full_write(fd, (char *)&net_sampling_rate, sizeof(uint32_t));
+    return sizeof(uint32_t) == err ? err : -1;
+}
+
+/*
+ * Reads the channels of the handshake, count channel ids (protocol version
+ * 1 and 2) or count ranges of them (see selection.h), into channels.
+ * Returns the number of channels or -1 if reading failed or there are more
+ * than max.
+ */
+static int read_channels(int fd,
+                         uint32_t protocol_version,
+                         uint32_t count,
+                         uint32_t *channels,
+                         unsigned int max) {
+    channel_range_t *ranges;
+    ssize_t size;
+
+    if(count > max) {
+        return -1;
     }
-    ret += err;
-    err = ret;
 
-finally:
-    free(buf);
-    return err;
+    if(3 > protocol_version) {
+        size = count * sizeof(uint32_t);
+        if(size != full_read(fd, (char *)channels, size)) {
+            return -1;
+        }
+        for(uint32_t i = 0; i < count; i++) {
+            channels[i] = ntohl(channels[i]);
+        }
+        return count;
+    }
+
+    /* every range holds a channel at least */
+    ranges = alloca(count * sizeof(*ranges) + 1);
+    size = count * sizeof(*ranges);
+    if(size != full_read(fd, (char *)ranges, size)) {
+        return -1;
+    }
+    for(uint32_t r = 0; r < count; r++) {
+        ranges[r].first = ntohl(ranges[r].first);
+        ranges[r].count = ntohl(ranges[r].count);
+        if(0 == ranges[r].count) {
+            return -1;
+        }
+    }
+    return selection_expand(ranges, count, channels, max);
+}
+
+/*
+ * Reads the trigger of the handshake (protocol version 4) into spec, which
+ * holds MAX_TRIGGER_LEN + 1 bytes. Returns 0 or -1 if reading failed or it
+ * is too long.
+ */
+static int read_trigger(int fd, uint32_t protocol_version, char *spec) {
+    uint32_t net_len, len;
+
+    spec[0] = '\0';
+    if(4 > protocol_version) {
+        return 0;
+    }
+
+    if(sizeof(net_len) != full_read(fd, (char *)&net_len, sizeof(net_len))) {
+        return -1;
+    }
+    len = ntohl(net_len);
+    if(len > MAX_TRIGGER_LEN || len != full_read(fd, spec, len)) {
+        return -1;
+    }
+    spec[len] = '\0';
+    return 0;
 }
 
 /*
  * BUFFER MANAGEMENT
  */
 static int copy_to_buffer(buffer_desc_t *buf,
-                          input_data_t *in) {
+                          input_data_t *in,
+                          unsigned int num_channels,
+                          const unsigned int *channels,
+                          pipeline_group_t *group,
+                          stats_client_t *stats,
+                          bool is_local) {
+    unsigned int points;
     int ret, err;
 
     err = pthread_mutex_lock(&buf->lock);
@@ -162,30 +318,66 @@ static int copy_to_buffer(buffer_desc_t *buf,
 
         if(buf->start+buf->count+1 < buf->buffer+buf->max_elems) {
             /* new element will fit in the buffer */
-            unsigned int samples = in->num_channels * in->points_per_channel;
             input_data_t *dest = buf->start + buf->count;
 
             err = pthread_mutex_lock(&in->lock);
             assert(0 == err);
             *dest = *in;
+            if(is_local && 0 <= in->block_fd) {
+                /* the block stays in the memfd, no copy needed */
+                dest->block_fd = dup(in->block_fd);
+            }
             err = pthread_mutex_unlock(&in->lock);
             assert(0 == err);
-
-            /* copy analog data */
-            dest->analog_data = malloc(samples * sizeof(double));
-            assert(NULL != dest->analog_data);
-            memcpy(dest->analog_data,
-                   in->analog_data,
-                   samples * sizeof(double));
-
-            /* copy digital data */
-            dest->digital_data = malloc(samples * sizeof(digival_t));
-            assert(NULL != dest->digital_data);
-            memcpy(dest->digital_data,
-                   in->digital_data,
-                   samples * sizeof(digival_t));
+            dest->frame = NULL;
+
+            if(is_local) {
+                dest->analog_data = NULL;
+                dest->digital_data = NULL;
+                if(0 > dest->block_fd) {
+                    /* no memfd for this block, skip it */
+                    ret = 0;
+                    break;
+                }
+                buf->count++;
+                STATS_SET(stats->queue_depth, buf->count);
+
+                ret = 0;
+                break; /* success */
+            }
+            dest->block_fd = -1;
+
+            dest->frame = pipeline_frame_get(group, dest->timestamp_nanos);
+            if(NULL != dest->frame) {
+                /* encoded once for every client reading these channels */
+                dest->analog_data = NULL;
+                dest->digital_data = NULL;
+                buf->count++;
+                STATS_SET(stats->queue_depth, buf->count);
+
+                ret = 0;
+                break; /* success */
+            }
+
+            /* subscribed after the block was published, encode a copy of
+             * the client's channels, one after the other */
+            points = dest->points_per_channel;
+            dest->analog_data = malloc(num_channels * points *
+                                       sizeof(double));
+            dest->digital_data = malloc(num_channels * points *
+                                        sizeof(digival_t));
+            assert(NULL != dest->analog_data && NULL != dest->digital_data);
+            for(unsigned int c = 0; c < num_channels; c++) {
+                memcpy(dest->analog_data + c * points,
+                       in->analog_data + channels[c] * points,
+                       points * sizeof(double));
+                memcpy(dest->digital_data + c * points,
+                       in->digital_data + channels[c] * points,
+                       points * sizeof(digival_t));
+            }
 
             buf->count++;
+            STATS_SET(stats->queue_depth, buf->count);
 
             ret = 0;
             break; /* success */
@@ -213,24 +405,122 @@ static int copy_to_buffer(buffer_desc_t *buf,
     return ret;
 }
 
+/* queues a capture of the client's trigger, takes its analog_data */
+static int queue_capture(buffer_desc_t *buf,
+                         const daq_config_t *config,
+                         unsigned int num_channels,
+                         trigger_capture_t *capture,
+                         stats_client_t *stats) {
+    const size_t samples = num_channels * capture->points_per_channel;
+    input_data_t *dest;
+    int ret = 0, err;
+
+    err = pthread_mutex_lock(&buf->lock);
+    assert(0 == err);
+
+    if(buf->start+buf->count+1 >= buf->buffer+buf->max_elems &&
+       buf->start != buf->buffer) {
+        buf->start = memmove(buf->buffer,
+                             buf->start,
+                             sizeof(input_data_t) * buf->count);
+    }
+
+    if(buf->start+buf->count+1 < buf->buffer+buf->max_elems) {
+        dest = buf->start + buf->count;
+        memset(dest, 0, sizeof(*dest));
+        dest->timestamp_nanos = capture->timestamp_nanos;
+        dest->points_per_channel = capture->points_per_channel;
+        dest->num_channels = num_channels;
+        dest->analog_data = capture->analog_data;
+        /* no digital inputs read yet */
+        dest->digital_data = calloc(samples, sizeof(digival_t));
+        assert(NULL != dest->digital_data);
+        dest->block_fd = -1;
+        dest->config = *config;
+        dest->shot_id = __atomic_add_fetch(&__last_shot_id, 1,
+                                           __ATOMIC_RELAXED);
+        buf->count++;
+        STATS_SET(stats->queue_depth, buf->count);
+        STATS_ADD(stats->captures, 1);
+    } else {
+        free(capture->analog_data);
+        ret = ENOBUFS;
+    }
+
+    err = pthread_cond_broadcast(&buf->cond);
+    assert(0 == err);
+
+    err = pthread_mutex_unlock(&buf->lock);
+    assert(0 == err);
+
+    return ret;
+}
+
+/*
+ * Feeds the latest block to the client's trigger and queues the captures
+ * it completes, the client gets no blocks. Captures that don't fit into the
+ * buffer any more are dropped, a burst of hits doesn't cost the client its
+ * connection.
+ */
+static int feed_trigger(buffer_desc_t *buf,
+                        input_data_t *in,
+                        trigger_t *trigger,
+                        unsigned int num_channels,
+                        stats_client_t *stats) {
+    trigger_capture_t captures[TRIGGER_MAX_CAPTURES];
+    unsigned int num_captures;
+    daq_config_t config;
+    uint64_t timestamp_nanos;
+    unsigned int points;
+    int err;
+
+    err = pthread_mutex_lock(&in->lock);
+    assert(0 == err);
+    config = in->config;
+    timestamp_nanos = in->timestamp_nanos;
+    points = in->points_per_channel;
+    err = pthread_mutex_unlock(&in->lock);
+    assert(0 == err);
+
+    /* the block stays until every handler is ready */
+    num_captures = trigger_feed(trigger, &config, timestamp_nanos, points,
+                                in->analog_data, captures);
+
+    for(unsigned int i = 0; i < num_captures; i++) {
+        if(ENOBUFS == queue_capture(buf, &config, num_channels, &captures[i],
+                                    stats)) {
+            STATS_ADD(stats->captures_dropped, 1);
+        }
+    }
+
+    return 0;
+}
+
 static int write_buf_element(int fd,
+                             zc_socket_t *zc,
                              buffer_desc_t *buf,
                              unsigned int channel_ids[],
-                             unsigned int channel_count) {
-    struct timespec abs_timeout;
+                             unsigned int channel_count,
+                             uint32_t protocol_version,
+                             uint64_t *config_generation,
+                             unsigned int *sampling_rate,
+                             stats_client_t *stats) {
     int err, ret;
     input_data_t in;
+    unsigned int *copied_ids;
+    char shot_id[MAX_SHOT_ID_LEN];
+    daq_config_t capture_config;
 
     err = pthread_mutex_lock(&buf->lock);
     assert(0 == err);
 
-    while(0 == buf->count && running) {
-        abs_wait_timeout(&abs_timeout);
-        err = pthread_cond_timedwait(&buf->cond, &buf->lock, &abs_timeout);
-        assert(0 == err || ETIMEDOUT == err);
+    while(0 == buf->count && !buf->finished && !buf->closing) {
+        err = pthread_cond_wait(&buf->cond, &buf->lock);
+        assert(0 == err);
     }
 
-    if(!running) {
+    if(buf->closing || 0 == buf->count) {
+        /* dropped, or finished and everything is sent */
         err = pthread_mutex_unlock(&buf->lock);
         assert(0 == err);
         return 0;
@@ -241,23 +531,116 @@ static int write_buf_element(int fd,
     in = *((input_data_t *)buf->start);
     buf->count--;
     buf->start++;
+    STATS_SET(stats->queue_depth, buf->count);
 
     err = pthread_mutex_unlock(&buf->lock);
     assert(0 == err);
 
+    if(0 != in.shot_id) {
+        /* a capture, described with its own length */
+        snprintf(shot_id, sizeof(shot_id), "%"PRIu64, in.shot_id);
+        capture_config = in.config;
+        capture_config.block_size = in.points_per_channel;
+        ret = write_config(fd, &capture_config, channel_count, channel_ids,
+                           shot_id, stats);
+        if(0 > ret) {
+            release_element(&in);
+            return ret;
+        }
+        *config_generation = in.config.generation;
+    } else if(in.config.generation != *config_generation &&
+              1 == protocol_version) {
+        /* only knows the rate of the handshake and DataSets */
+        if(in.config.sampling_rate != *sampling_rate) {
+            printf("[%lu] sampling rate changed, closing protocol "
+                   "version 1 client\n", (unsigned long int)pthread_self());
+            release_element(&in);
+            return 0;
+        }
+        *config_generation = in.config.generation;
+    } else if(in.config.generation != *config_generation) {
+        /* reconfigured, the client keeps streaming with the new rate */
+        ret = write_config(fd, &in.config, channel_count, channel_ids, "",
+                           stats);
+        if(0 > ret) {
+            release_element(&in);
+            return ret;
+        }
+        *config_generation = in.config.generation;
+        *sampling_rate = in.config.sampling_rate;
+    }
+
+    if(0 <= in.block_fd) {
+        ret = fd_block_send(fd, in.block_fd);
+        close(in.block_fd);
+        if(0 < ret) {
+            STATS_ADD(stats->bytes_sent, ret);
+            STATS_ADD(stats->frames_sent, 1);
+        }
+        return ret;
+    }
+
+    if(NULL != in.frame) {
+        return write_frame(fd, zc, in.frame, stats);
+    }
+
+    /* the copy holds the client's channels only */
+    copied_ids = alloca(channel_count * sizeof(unsigned int) + 1);
+    for(unsigned int i = 0; i < channel_count; i++) {
+        copied_ids[i] = i;
+    }
     ret = write_dataset(fd,
+                        zc,
                         channel_count,
-                        channel_ids,
+                        copied_ids,
                         in.points_per_channel,
                         in.timestamp_nanos,
                         in.analog_data,
-                        in.digital_data);
+                        in.digital_data,
+                        &in.markers,
+                        stats);
     free(in.analog_data);
     free(in.digital_data);
 
     return ret;
 }
 
+/*
+ * Stops the sender thread. When shutting down, it first gets until the
+ * shutdown deadline to send what is still buffered.
+ */
+static void stop_sender(buffer_desc_t *buf, bool drain) {
+    struct timespec deadline;
+    int err;
+
+    err = pthread_mutex_lock(&buf->lock);
+    assert(0 == err);
+
+    if(drain) {
+        buf->finished = true;
+        err = pthread_cond_broadcast(&buf->cond);
+        assert(0 == err);
+
+        shutdown_deadline(&deadline);
+        while(!buf->sender_done) {
+            err = pthread_cond_timedwait(&buf->cond, &buf->lock, &deadline);
+            assert(0 == err || ETIMEDOUT == err);
+            if(ETIMEDOUT == err) {
+                printf("[%lu] client too slow, giving up on %zu block(s)\n",
+                       (unsigned long int)pthread_self(), buf->count);
+                break;
+            }
+        }
+    }
+
+    buf->closing = true;
+    err = pthread_cond_broadcast(&buf->cond);
+    assert(0 == err);
+
+    err = pthread_mutex_unlock(&buf->lock);
+    assert(0 == err);
+}
+
 void free_buffer(buffer_desc_t *buf) {
     int err;
 
@@ -265,9 +648,7 @@ void free_buffer(buffer_desc_t *buf) {
     assert(0 == err);
 
     for(size_t i=0; i<buf->count; i++) {
-        input_data_t *in = buf->start + i;
-        free(in->analog_data);
-        free(in->digital_data);
+        release_element(buf->start + i);
     }
     free(buf->buffer);
     buf->buffer = NULL;
@@ -290,9 +671,14 @@ void *handler_sender_main(void *opaque_sender_info) {
 
     while(*sender_info->handler_running) {
         err = write_buf_element(sender_info->conn_fd,
+                                sender_info->zc,
                                 buffer_desc,
                                 sender_info->channels,
-                                sender_info->num_channels);
+                                sender_info->num_channels,
+                                sender_info->protocol_version,
+                                &sender_info->config_generation,
+                                &sender_info->sampling_rate,
+                                sender_info->stats);
         if (err > 0) {
             /* everything okay */
         } else if(err < 0) {
@@ -302,32 +688,84 @@ void *handler_sender_main(void *opaque_sender_info) {
             break;
         } else {
             assert(0 == err);
-            assert(!running);
+            break;
         }
     }
 
     *sender_info->handler_running = false;
+
+    err = pthread_mutex_lock(&buffer_desc->lock);
+    assert(0 == err);
+    buffer_desc->sender_done = true;
+    err = pthread_cond_broadcast(&buffer_desc->cond);
+    assert(0 == err);
+    err = pthread_mutex_unlock(&buffer_desc->lock);
+    assert(0 == err);
+
     return NULL;
 }
 
+/*
+ * Lets the io_uring sender thread do the writing, the handler only takes part
+ * in the read barrier until the client is gone.
+ */
+static void handle_uring_client(handler_thread_info_t *info,
+                                uint32_t protocol_version,
+                                unsigned int num_channels,
+                                unsigned int *channels,
+                                stats_client_t *stats) {
+    uring_client_t *client;
+    daq_config_t config;
+
+    printf("Handler thread accepted %d (io_uring)\n", info->fd);
+
+    daq_config_current(&config);
+    if(0 > write_welcome(info->fd, protocol_version, &config,
+                         num_channels, channels, stats)) {
+        return;
+    }
+
+    inc_available_handlers();
+    client = uring_sender_add(info->fd, protocol_version, num_channels,
+                              channels, &config, stats);
+
+    while(!uring_sender_closed(client)) {
+        if(!wait_data_available()) {
+            break;
+        }
+        set_ready();
+    }
+
+    uring_sender_remove(client);
+    dec_available_handlers();
+}
+
 void *handler_thread_main(void *opaque_info) {
     handler_thread_info_t *info = (handler_thread_info_t *)opaque_info;
     int err, i;
     uint32_t net_nc, num_channels;
-    uint32_t net_sampling_rate;
-    uint32_t *net_channels;
+    uint32_t net_version, protocol_version = 1;
     uint32_t *channels;
     pthread_t sender_thread = 0;
+    daq_config_t config;
     volatile bool handler_running = true;
     bool handler_registered_alive = false;
+    stats_client_t *stats = NULL;
+    pipeline_group_t *group = NULL;
+    bool fd_subscribed = false;
+    char trigger_spec[MAX_TRIGGER_LEN + 1];
+    trigger_t *trigger = NULL;
     buffer_desc_t buffer_desc = { .buffer =malloc(BUF_SIZE*sizeof(input_data_t))
                                 , .lock = PTHREAD_MUTEX_INITIALIZER
                                 , .cond = PTHREAD_COND_INITIALIZER
                                 , .count = 0
+                                , .finished = false
+                                , .closing = false
+                                , .sender_done = false
                                 , .max_elems = BUF_SIZE
                                 , .start = 0
                                 };
-    sender_thread_info_t sender_info;
+    sender_thread_info_t sender_info = { .zc = NULL };
     assert(NULL != buffer_desc.buffer);
     buffer_desc.start = buffer_desc.buffer;
 
@@ -341,32 +779,53 @@ void *handler_thread_main(void *opaque_info) {
         goto finally;
     }
 
-    num_channels = ntohl(net_nc);
-    if(num_channels > MAX_CHANNELS) {
-        /* not allowed: too many channels */
-        printf("[%lu] too many channels: %u\n",
-               (unsigned long int)pthread_self(),
-               num_channels);
-        goto finally;
+    if(HELLO_MAGIC == ntohl(net_nc)) {
+        /* a newer client, the channels follow its protocol version */
+        err = full_read(info->fd, (char *)&net_version, sizeof(uint32_t));
+        if(sizeof(net_version) == err) {
+            err = full_read(info->fd, (char*)&net_nc, sizeof(uint32_t));
+        }
+        if(sizeof(net_nc) != err) {
+            printf("[%lu] error while reading: %s\n",
+                   (unsigned long int)pthread_self(),
+                   strerror(errno));
+            goto finally;
+        }
+        protocol_version = ntohl(net_version);
+        if(protocol_version < 2) {
+            printf("[%lu] bad protocol version: %u\n",
+                   (unsigned long int)pthread_self(),
+                   protocol_version);
+            goto finally;
+        } else if(protocol_version > PROTOCOL_VERSION) {
+            /* speak ours, the client will know it */
+            protocol_version = PROTOCOL_VERSION;
+        }
     }
 
-    net_channels = alloca(sizeof(uint32_t)*num_channels);
-    channels = alloca(sizeof(uint32_t)*num_channels);
+    /* the configuration in the handshake, later changes come in-band (the
+     * first block may not have been read yet) */
+    daq_config_current(&config);
+
+    /* no more than the daemon has, so every block fits a client's buffer */
+    channels = alloca(sizeof(uint32_t) * config.num_channels);
+    err = read_channels(info->fd, protocol_version, ntohl(net_nc), channels,
+                        config.num_channels);
+    if(0 > err) {
+        /* error while reading or too many channels */
+        printf("[%lu] bad channel selection\n",
+               (unsigned long int)pthread_self());
+        goto finally;
+    }
+    num_channels = err;
 
-    err = full_read(info->fd,
-                    (char *)net_channels,
-                    sizeof(uint32_t)*num_channels);
-    if(sizeof(uint32_t)*num_channels != err) {
-        /* error while reading */
-        printf("[%lu] error while reading: %s\n",
-               (unsigned long int)pthread_self(),
-               strerror(errno));
+    if(0 != read_trigger(info->fd, protocol_version, trigger_spec)) {
+        printf("[%lu] bad trigger\n", (unsigned long int)pthread_self());
         goto finally;
     }
 
     for(i = 0; i < num_channels; i++) {
-        channels[i] = ntohl(net_channels[i]);
-        if(channels[i] >= info->data_info->num_channels) {
+        if(channels[i] >= config.num_channels) {
             /* not allowed: wrong channel number */
             printf("[%lu] wrong channel number: %u\n",
                    (unsigned long int)pthread_self(),
@@ -375,11 +834,55 @@ void *handler_thread_main(void *opaque_info) {
         }
     }
 
+    stats = stats_register_client(info->fd);
+
+    if(2 < protocol_version && 0 == num_channels) {
+        /* no stream, just the description of every channel */
+        for(i = 0; i < config.num_channels; i++) {
+            channels[i] = i;
+        }
+        write_welcome(info->fd, protocol_version, &config,
+                      config.num_channels, channels, stats);
+        goto finally;
+    }
+
+    if('\0' != trigger_spec[0]) {
+        /* captures are sent like copies of blocks, never local */
+        trigger = info->is_local ? NULL :
+                  trigger_create(trigger_spec, &config, num_channels,
+                                 channels);
+        if(NULL == trigger) {
+            printf("[%lu] bad trigger: %s\n",
+                   (unsigned long int)pthread_self(), trigger_spec);
+            goto finally;
+        }
+    }
+
+    if(NULL == trigger && !info->is_local && uring_sender_active()) {
+        handle_uring_client(info, protocol_version, num_channels, channels,
+                            stats);
+        goto finally;
+    }
+
     sender_info.buffer_desc = &buffer_desc;
     sender_info.handler_running = &handler_running;
     sender_info.conn_fd = info->fd;
     sender_info.num_channels = num_channels;
     sender_info.channels = channels;
+    sender_info.stats = stats;
+    sender_info.zc = zc_open(info->fd, stats);
+    if(!info->is_local && NULL == trigger) {
+        /* the pipeline encodes the blocks for our channels from now on */
+        group = pipeline_subscribe(num_channels, channels);
+    } else if(info->is_local) {
+        /* the blocks are put in memfds from now on */
+        fd_block_subscribe();
+        fd_subscribed = true;
+    }
+
+    sender_info.protocol_version = protocol_version;
+    sender_info.config_generation = config.generation;
+    sender_info.sampling_rate = config.sampling_rate;
 
     err = pthread_create(&sender_thread,
                          NULL,
@@ -391,32 +894,48 @@ void *handler_thread_main(void *opaque_info) {
     handler_registered_alive = true;
     printf("Handler thread accepted %d\n", info->fd);
 
-    err = full_write(info->fd, WELCOME_MSG, sizeof(WELCOME_MSG));
-    assert(sizeof(WELCOME_MSG) == err);
-
-    net_sampling_rate = htonl((uint32_t)SAMPLING_RATE);
-    err = full_write(info->fd, (char *)&net_sampling_rate, sizeof(uint32_t));
-    assert(sizeof(uint32_t) == err);
+    if(0 > write_welcome(info->fd, protocol_version, &config,
+                         num_channels, channels, stats)) {
+        printf("[%lu] error while writing: %s\n",
+               (unsigned long int)pthread_self(),
+               strerror(errno));
+        goto finally;
+    }
 
-    while(running && handler_running) {
-        wait_data_available();
-        if(!running) {
+    while(handler_running) {
+        if(!wait_data_available()) {
+            /* shutting down, everything is in the buffer */
             break;
         }
 
         input_data_t *data_info = info->data_info;
-        err = copy_to_buffer(&buffer_desc, data_info);
+        if(NULL != trigger) {
+            err = feed_trigger(&buffer_desc, data_info, trigger, num_channels,
+                               stats);
+        } else {
+            err = copy_to_buffer(&buffer_desc,
+                                 data_info,
+                                 num_channels,
+                                 channels,
+                                 group,
+                                 stats,
+                                 info->is_local);
+        }
         if(ENOBUFS == err) {
             /* out of buffer space */
+            STATS_ADD(stats->drops, 1);
             break;
         }
         assert(0 == err);
-        printf("Buffer %p has %zu/%zu element(s) start at %p (offset = %zu)\n",
-               (void *)buffer_desc.buffer,
-               buffer_desc.count,
-               buffer_desc.max_elems,
-               (void *)buffer_desc.start,
-               (buffer_desc.start-buffer_desc.buffer));
+        if(verbose) {
+            printf("Buffer %p has %zu/%zu element(s) start at %p "
+                   "(offset = %zu)\n",
+                   (void *)buffer_desc.buffer,
+                   buffer_desc.count,
+                   buffer_desc.max_elems,
+                   (void *)buffer_desc.start,
+                   (buffer_desc.start-buffer_desc.buffer));
+        }
 
         set_ready();
     }
@@ -425,10 +944,13 @@ finally:
     if(handler_registered_alive) {
         dec_available_handlers();
     }
+    if(0 != sender_thread) {
+        stop_sender(&buffer_desc, !running);
+    }
     handler_running = false;
 
-    err = close(info->fd);
-    assert(0 == err);
+    /* wakes up the sender thread, but keeps the descriptor for zc_close */
+    shutdown(info->fd, SHUT_RDWR);
 
     if(0 != sender_thread) {
         err = pthread_join(sender_thread, NULL);
@@ -437,7 +959,26 @@ finally:
         }
     }
 
+    if(NULL != sender_info.zc) {
+        zc_close(sender_info.zc);
+    }
+
+    err = close(info->fd);
+    assert(0 == err);
+
     free_buffer(&buffer_desc);
+    if(NULL != group) {
+        pipeline_unsubscribe(group);
+    }
+    if(fd_subscribed) {
+        fd_block_unsubscribe();
+    }
+    if(NULL != trigger) {
+        trigger_destroy(trigger);
+    }
+    if(NULL != stats) {
+        stats_unregister_client(stats);
+    }
     free(opaque_info);
 
     return NULL;
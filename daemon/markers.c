@@ -0,0 +1,219 @@
+/*
+ *  Records analog data from a NI USB-6218 and send it to connected clients
+ *
+ *  Copyright (C)2011-2012, Johannes Weiß <weiss@tux4u.de>
+ *                        , Jonathan Dimond <jonny@dimond.de>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <assert.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "daemon.h"
+#include "sync.h"
+#include "stats.h"
+#include "markers.h"
+#include "rt.h"
+
+typedef struct {
+    uint64_t arrival_nanos;
+    uint32_t id;
+    char label[MARKER_LABEL_LEN + 1];
+} queued_marker_t;
+
+static pthread_mutex_t __queue_lock = PTHREAD_MUTEX_INITIALIZER;
+/* a ring in arrival order */
+static queued_marker_t __queue[MARKERS_QUEUE_SIZE];
+static unsigned int __queue_start = 0;
+static unsigned int __queue_count = 0;
+
+/*
+ * HELPERS
+ */
+static bool parse_record(const uint8_t *record,
+                         ssize_t len,
+                         queued_marker_t *marker) {
+    uint32_t net_magic, net_id;
+
+    if(MARKER_RECORD_SIZE != len) {
+        return false;
+    }
+    memcpy(&net_magic, record, sizeof(uint32_t));
+    memcpy(&net_id, record + sizeof(uint32_t), sizeof(uint32_t));
+    if(MARKER_MAGIC != ntohl(net_magic)) {
+        return false;
+    }
+
+    marker->id = ntohl(net_id);
+    memcpy(marker->label, record + 2 * sizeof(uint32_t), MARKER_LABEL_LEN);
+    marker->label[MARKER_LABEL_LEN] = '\0';
+    return true;
+}
+
+static void enqueue(const queued_marker_t *marker) {
+    int err = pthread_mutex_lock(&__queue_lock);
+    assert(0 == err);
+
+    if(MARKERS_QUEUE_SIZE == __queue_count) {
+        STATS_ADD(stats_markers.dropped, 1);
+    } else {
+        __queue[(__queue_start + __queue_count) % MARKERS_QUEUE_SIZE] =
+            *marker;
+        __queue_count++;
+    }
+
+    err = pthread_mutex_unlock(&__queue_lock);
+    assert(0 == err);
+}
+
+/*
+ * FUNCTIONALITY
+ */
+uint64_t markers_sample_at(uint64_t acquisition_start,
+                           uint64_t nanos,
+                           uint32_t sampling_rate) {
+    const uint64_t since = nanos - acquisition_start;
+
+    /* without overflowing for long runs */
+    if(nanos < acquisition_start) {
+        return 0;
+    }
+    return since / TIME_S * sampling_rate +
+           since % TIME_S * sampling_rate / TIME_S;
+}
+
+void markers_take(uint64_t acquisition_start,
+                  uint64_t first_point,
+                  unsigned int points_per_channel,
+                  uint32_t sampling_rate,
+                  block_markers_t *markers) {
+    queued_marker_t *queued;
+    uint64_t sample;
+    int err;
+
+    markers->count = 0;
+
+    err = pthread_mutex_lock(&__queue_lock);
+    assert(0 == err);
+
+    while(0 < __queue_count) {
+        queued = &__queue[__queue_start];
+        sample = markers_sample_at(acquisition_start, queued->arrival_nanos,
+                           sampling_rate);
+        if(sample >= first_point + points_per_channel) {
+            /* arrived during a later block, so did the rest */
+            break;
+        }
+
+        if(MAX_BLOCK_MARKERS == markers->count) {
+            STATS_ADD(stats_markers.dropped, 1);
+        } else {
+            markers->marker[markers->count].id = queued->id;
+            markers->marker[markers->count].sample =
+                sample > first_point ? sample - first_point : 0;
+            memcpy(markers->marker[markers->count].label, queued->label,
+                   sizeof(queued->label));
+            markers->count++;
+        }
+        __queue_start = (__queue_start + 1) % MARKERS_QUEUE_SIZE;
+        __queue_count--;
+    }
+
+    err = pthread_mutex_unlock(&__queue_lock);
+    assert(0 == err);
+
+    STATS_ADD(stats_markers.delivered, markers->count);
+}
+
+void markers_init(void) {
+    rt_mutex_init(&__queue_lock);
+}
+
+void *markers_thread_main(void *unused) {
+    struct sockaddr_in servaddr;
+    /* shutdown_fd and the socket */
+    struct pollfd poll_cfg[2];
+    /* one byte more to tell records that are too long */
+    uint8_t record[MARKER_RECORD_SIZE + 1];
+    queued_marker_t marker;
+    ssize_t len;
+    int err;
+    const int sock = socket(AF_INET, SOCK_DGRAM, 0);
+    assert(0 <= sock);
+
+    /* the program under test usually runs on another host */
+    memset(&servaddr, 0, sizeof(servaddr));
+    servaddr.sin_family = AF_INET;
+    servaddr.sin_addr.s_addr = htonl(INADDR_ANY);
+    servaddr.sin_port = htons(MARKER_PORT);
+
+    err = bind(sock, (struct sockaddr *) &servaddr, sizeof(servaddr));
+    if(0 != err) {
+        printf("WARNING: marker port disabled, bind: %s\n", strerror(errno));
+        close(sock);
+        return NULL;
+    }
+    printf("markers on UDP port %d\n", MARKER_PORT);
+
+    poll_cfg[0].fd = shutdown_fd();
+    poll_cfg[0].events = POLLIN;
+    poll_cfg[1].fd = sock;
+    poll_cfg[1].events = POLLIN;
+
+    while(running) {
+        err = poll(poll_cfg, 2, -1);
+        if(-1 == err && EINTR == errno) {
+            continue;
+        }
+        assert(0 < err);
+
+        if(0 == (poll_cfg[1].revents & POLLIN)) {
+            continue;
+        }
+        len = recv(sock, record, sizeof(record), MSG_DONTWAIT);
+        /* stamped right away, the thread does nothing else */
+        marker.arrival_nanos = stats_now_nanos();
+        if(0 > len) {
+            continue;
+        }
+
+        STATS_ADD(stats_markers.received, 1);
+        if(parse_record(record, len, &marker)) {
+            enqueue(&marker);
+        } else {
+            STATS_ADD(stats_markers.dropped, 1);
+        }
+    }
+
+    err = close(sock);
+    assert(0 == err);
+    printf("marker socket closed\n");
+
+    return NULL;
+}
+/* vim: set fileencoding=utf8 : */
@@ -0,0 +1,82 @@
+/*
+ *  Records analog data from a NI USB-6218 and send it to connected clients
+ *
+ *  Copyright (C)2011-2012, Johannes Weiß <weiss@tux4u.de>
+ *                        , Jonathan Dimond <jonny@dimond.de>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MARKERS_H
+#define MARKERS_H
+
+#include <stdint.h>
+
+#include "common.h"
+
+/*
+ * Markers (see common.h for the record) let the program under test cut the
+ * stream into phases. The marker thread receives them on UDP port
+ * MARKER_PORT, notes when each arrived and queues it. When the acquisition
+ * thread has read a block, it takes the markers that arrived while the
+ * block was acquired and places each at the sample read at the time it
+ * arrived, counted from the start of the DAQ task. The block's DataSet
+ * frames and shared memory slots carry them, so a marker's time is the one
+ * of its sample, on the same clock as the samples.
+ *
+ * A marker that arrived before the task (re)started goes to the first
+ * sample of the next block. Markers that don't fit into the queue
+ * (MARKERS_QUEUE_SIZE) or their block (MAX_BLOCK_MARKERS) are dropped.
+ */
+
+#define MARKERS_QUEUE_SIZE 256
+
+typedef struct {
+    uint32_t id;
+    uint32_t sample;    /* index of the sample in the block */
+    char label[MARKER_LABEL_LEN + 1];
+} marker_t;
+
+typedef struct {
+    unsigned int count;
+    marker_t marker[MAX_BLOCK_MARKERS];
+} block_markers_t;
+
+/* Call after rt_init, before any thread uses the markers. */
+void markers_init(void);
+
+void *markers_thread_main(void *unused);
+
+/*
+ * The sample (per channel, counted from the start of the DAQ task at
+ * acquisition_start) read at nanos, 0 if that was before the start.
+ */
+uint64_t markers_sample_at(uint64_t acquisition_start,
+                           uint64_t nanos,
+                           uint32_t sampling_rate);
+
+/*
+ * Takes the queued markers that arrived before the end of the block of
+ * points_per_channel samples from first_point on (samples per channel
+ * since the DAQ task started at acquisition_start, see stats_now_nanos).
+ * Later ones stay queued.
+ */
+void markers_take(uint64_t acquisition_start,
+                  uint64_t first_point,
+                  unsigned int points_per_channel,
+                  uint32_t sampling_rate,
+                  block_markers_t *markers);
+
+#endif
+/* vim: set fileencoding=utf8 : */
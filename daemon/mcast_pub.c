@@ -0,0 +1,355 @@
+/*
+ *  Records analog data from a NI USB-6218 and send it to connected clients
+ *
+ *  Copyright (C)2011-2012, Johannes Weiß <weiss@tux4u.de>
+ *                        , Jonathan Dimond <jonny@dimond.de>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <assert.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <utils.h>
+
+#include "daemon.h"
+#include "sync.h"
+#include "mcast.h"
+#include "mcast_pub.h"
+#include "rt.h"
+
+typedef struct {
+    uint64_t block;
+    uint64_t timestamp_nanos;
+    unsigned int sampling_rate;
+    unsigned int points_per_channel;
+    double *analog_data;
+} history_entry_t;
+
+struct mcast_pub {
+    int sock;
+    struct sockaddr_in group;
+    unsigned int num_channels;
+    unsigned int max_points_per_channel;
+    uint64_t *seq;      /* next datagram of every channel */
+    uint64_t next_block;
+
+    pthread_mutex_t lock; /* protects history */
+    history_entry_t history[MCAST_HISTORY_BLOCKS];
+
+    /* a retransmission, only used by the retransmission thread */
+    uint8_t *reply;
+};
+
+mcast_pub_t *mcast_pub_create(const char *group,
+                              unsigned int num_channels,
+                              unsigned int max_points_per_channel) {
+    unsigned char ttl = MCAST_TTL;
+    int err;
+    mcast_pub_t *pub = calloc(1, sizeof(*pub));
+    assert(NULL != pub);
+
+    pub->group.sin_family = AF_INET;
+    if(1 != inet_pton(AF_INET, group, &pub->group.sin_addr) ||
+       !IN_MULTICAST(ntohl(pub->group.sin_addr.s_addr))) {
+        printf("WARNING: multicast disabled, %s is no IPv4 multicast "
+               "group\n", group);
+        free(pub);
+        return NULL;
+    }
+
+    pub->sock = socket(AF_INET, SOCK_DGRAM, 0);
+    assert(0 <= pub->sock);
+    err = setsockopt(pub->sock, IPPROTO_IP, IP_MULTICAST_TTL,
+                     &ttl, sizeof(ttl));
+    assert(0 == err);
+
+    pub->num_channels = num_channels;
+    pub->max_points_per_channel = max_points_per_channel;
+    pub->seq = calloc(num_channels, sizeof(uint64_t));
+    assert(NULL != pub->seq);
+
+    rt_mutex_init(&pub->lock);
+    for(int i = 0; i < MCAST_HISTORY_BLOCKS; i++) {
+        pub->history[i].block = UINT64_MAX;
+        pub->history[i].analog_data = malloc(num_channels *
+                                             max_points_per_channel *
+                                             sizeof(double));
+        assert(NULL != pub->history[i].analog_data);
+    }
+    /* every fragment of a channel and the terminating 0, length prefixed */
+    pub->reply = malloc((mcast_num_fragments(max_points_per_channel) + 1) *
+                        (sizeof(uint32_t) + MCAST_MAX_DATAGRAM));
+    assert(NULL != pub->reply);
+
+    printf("publishing blocks to multicast group %s, ports %u-%u\n",
+           group, MCAST_DATA_PORT, MCAST_DATA_PORT + num_channels - 1);
+
+    return pub;
+}
+
+static void fill_header(mcast_pub_t *pub,
+                        const history_entry_t *entry,
+                        unsigned int channel,
+                        uint32_t fragment,
+                        mcast_header_t *header) {
+    const uint32_t first = fragment * MCAST_SAMPLES_PER_DATAGRAM;
+
+    header->block = entry->block;
+    header->timestamp_nanos = entry->timestamp_nanos;
+    header->sampling_rate = entry->sampling_rate;
+    header->channel = channel;
+    header->points_per_channel = entry->points_per_channel;
+    header->fragment = fragment;
+    header->num_samples = entry->points_per_channel - first;
+    if(header->num_samples > MCAST_SAMPLES_PER_DATAGRAM) {
+        header->num_samples = MCAST_SAMPLES_PER_DATAGRAM;
+    }
+}
+
+void mcast_pub_publish(mcast_pub_t *pub,
+                       uint64_t timestamp_nanos,
+                       unsigned int sampling_rate,
+                       unsigned int points_per_channel,
+                       const double *analog_data) {
+    uint8_t datagram[MCAST_MAX_DATAGRAM];
+    const uint32_t num_fragments = mcast_num_fragments(points_per_channel);
+    history_entry_t *entry;
+    mcast_header_t header;
+    size_t len;
+    int err;
+
+    assert(points_per_channel <= pub->max_points_per_channel);
+
+    /* keep it for retransmissions first, requests may come quickly */
+    entry = &pub->history[pub->next_block % MCAST_HISTORY_BLOCKS];
+    err = pthread_mutex_lock(&pub->lock);
+    assert(0 == err);
+    entry->block = pub->next_block;
+    entry->timestamp_nanos = timestamp_nanos;
+    entry->sampling_rate = sampling_rate;
+    entry->points_per_channel = points_per_channel;
+    memcpy(entry->analog_data,
+           analog_data,
+           pub->num_channels * points_per_channel * sizeof(double));
+    err = pthread_mutex_unlock(&pub->lock);
+    assert(0 == err);
+
+    /* only this thread writes the history, no lock needed for reading */
+    for(unsigned int c = 0; c < pub->num_channels; c++) {
+        struct sockaddr_in dest = pub->group;
+        const double *channel_data = entry->analog_data +
+                                     c * points_per_channel;
+
+        dest.sin_port = htons(MCAST_DATA_PORT + c);
+        for(uint32_t f = 0; f < num_fragments; f++) {
+            fill_header(pub, entry, c, f, &header);
+            header.seq = pub->seq[c]++;
+            len = mcast_pack(datagram,
+                             &header,
+                             channel_data + f * MCAST_SAMPLES_PER_DATAGRAM);
+
+            /* lost datagrams get retransmitted, don't care about errors */
+            sendto(pub->sock, datagram, len, 0,
+                   (struct sockaddr *)&dest, sizeof(dest));
+        }
+    }
+
+    pub->next_block++;
+}
+
+/*
+ * RETRANSMISSION
+ */
+
+static void set_timeouts(int conn) {
+    struct timeval timeout = { 0, MCAST_RETRANS_TIMEOUT_MS * 1000 };
+
+    setsockopt(conn, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(conn, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+}
+
+/* returns false if the client is gone or too slow */
+static bool serve_request(mcast_pub_t *pub, int conn) {
+    uint8_t request_buf[MCAST_REQUEST_SIZE];
+    mcast_request_t request;
+    mcast_header_t header;
+    history_entry_t *entry;
+    uint32_t num_fragments, net_len;
+    size_t len = 0, datagram_len;
+    ssize_t res;
+    int err;
+
+    res = full_read(conn, (char *)request_buf, sizeof(request_buf));
+    if(sizeof(request_buf) != res) {
+        return false;
+    }
+    mcast_unpack_request(request_buf, &request);
+
+    /* the reply is packed with the lock held and sent without, the
+     * acquisition thread must never wait for a client */
+    err = pthread_mutex_lock(&pub->lock);
+    assert(0 == err);
+
+    entry = &pub->history[request.block % MCAST_HISTORY_BLOCKS];
+    if(entry->block == request.block && request.channel < pub->num_channels) {
+        const double *channel_data = entry->analog_data +
+                                     request.channel *
+                                     entry->points_per_channel;
+
+        num_fragments = mcast_num_fragments(entry->points_per_channel);
+        if(MCAST_ALL_FRAGMENTS == request.num_fragments) {
+            request.first_fragment = 0;
+            request.num_fragments = num_fragments;
+        }
+
+        for(uint32_t f = request.first_fragment;
+            f < num_fragments &&
+            f - request.first_fragment < request.num_fragments;
+            f++) {
+            fill_header(pub, entry, request.channel, f, &header);
+            header.seq = 0;
+            datagram_len = mcast_pack(pub->reply + len + sizeof(uint32_t),
+                                      &header,
+                                      channel_data +
+                                      f * MCAST_SAMPLES_PER_DATAGRAM);
+            net_len = htonl(datagram_len);
+            memcpy(pub->reply + len, &net_len, sizeof(uint32_t));
+            len += sizeof(uint32_t) + datagram_len;
+        }
+    }
+
+    err = pthread_mutex_unlock(&pub->lock);
+    assert(0 == err);
+
+    net_len = 0;
+    memcpy(pub->reply + len, &net_len, sizeof(uint32_t));
+    len += sizeof(uint32_t);
+    return len == full_write(conn, (char *)pub->reply, len);
+}
+
+void *mcast_retrans_thread_main(void *opaque_pub) {
+    mcast_pub_t *pub = (mcast_pub_t *)opaque_pub;
+    struct sockaddr_in servaddr;
+    /* shutdown_fd, the listener and the clients */
+    struct pollfd poll_cfg[2 + MCAST_MAX_RETRANS_CLIENTS];
+    nfds_t num_fds = 2;
+    int err;
+    int conn;
+    int sock_opt = 1;
+    const int server_sock = socket(AF_INET, SOCK_STREAM, 0);
+    assert(0 <= server_sock);
+
+    /* started by the acquisition thread */
+    rt_enter(RT_IO);
+
+    err = setsockopt(server_sock,
+                     SOL_SOCKET,
+                     SO_REUSEADDR,
+                     &sock_opt,
+                     sizeof(sock_opt));
+    assert(0 == err);
+
+    memset(&servaddr, 0, sizeof(servaddr));
+    servaddr.sin_family = AF_INET;
+    servaddr.sin_addr.s_addr = htonl(INADDR_ANY);
+    servaddr.sin_port = htons(MCAST_RETRANS_PORT);
+
+    err = bind(server_sock, (struct sockaddr *) &servaddr, sizeof(servaddr));
+    if(0 != err) {
+        printf("WARNING: multicast retransmission disabled, bind: %s\n",
+               strerror(errno));
+        close(server_sock);
+        return NULL;
+    }
+
+    err = listen(server_sock, MCAST_MAX_RETRANS_CLIENTS);
+    assert(0 <= err);
+
+    poll_cfg[0].fd = shutdown_fd();
+    poll_cfg[0].events = POLLIN;
+    poll_cfg[1].fd = server_sock;
+    poll_cfg[1].events = POLLIN;
+
+    while(running) {
+        err = poll(poll_cfg, num_fds, -1);
+        if (-1 == err && EINTR == errno) {
+            continue;
+        }
+        assert(0 < err);
+
+        for(nfds_t i = num_fds - 1; i > 1; i--) {
+            if(0 == poll_cfg[i].revents) {
+                continue;
+            }
+            if(!serve_request(pub, poll_cfg[i].fd)) {
+                close(poll_cfg[i].fd);
+                poll_cfg[i] = poll_cfg[--num_fds];
+            }
+        }
+
+        if(0 != (poll_cfg[1].revents & POLLIN)) {
+            conn = accept(server_sock, NULL, NULL);
+            if(0 > conn) {
+                continue;
+            } else if(num_fds == 2 + MCAST_MAX_RETRANS_CLIENTS) {
+                close(conn);
+                continue;
+            }
+            set_timeouts(conn);
+            poll_cfg[num_fds].fd = conn;
+            poll_cfg[num_fds].events = POLLIN;
+            num_fds++;
+        }
+    }
+
+    for(nfds_t i = 2; i < num_fds; i++) {
+        close(poll_cfg[i].fd);
+    }
+    err = close(server_sock);
+    assert(0 == err);
+    printf("multicast retransmission socket closed\n");
+
+    return NULL;
+}
+
+void mcast_pub_destroy(mcast_pub_t *pub) {
+    int err;
+
+    for(int i = 0; i < MCAST_HISTORY_BLOCKS; i++) {
+        free(pub->history[i].analog_data);
+    }
+    err = pthread_mutex_destroy(&pub->lock);
+    assert(0 == err);
+    free(pub->reply);
+    free(pub->seq);
+    close(pub->sock);
+    free(pub);
+}
+/* vim: set fileencoding=utf8 : */
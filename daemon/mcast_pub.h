@@ -0,0 +1,64 @@
+/*
+ *  Records analog data from a NI USB-6218 and send it to connected clients
+ *
+ *  Copyright (C)2011-2012, Johannes Weiß <weiss@tux4u.de>
+ *                        , Jonathan Dimond <jonny@dimond.de>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MCAST_PUB_H
+#define MCAST_PUB_H
+
+#include <stdint.h>
+
+/* see common/mcast.h for the datagrams and the retransmission protocol */
+
+/* blocks kept for retransmission */
+#define MCAST_HISTORY_BLOCKS 8
+#define MCAST_MAX_RETRANS_CLIENTS 64
+/* peers not sending a whole request or taking the reply in time are
+ * dropped, they would delay the others */
+#define MCAST_RETRANS_TIMEOUT_MS 100
+#define MCAST_TTL 1
+
+typedef struct mcast_pub mcast_pub_t;
+
+/*
+ * Prepares publishing blocks to the multicast group (an IPv4 address).
+ * Returns NULL (and keeps the daemon running without it) on failure.
+ */
+mcast_pub_t *mcast_pub_create(const char *group,
+                              unsigned int num_channels,
+                              unsigned int max_points_per_channel);
+
+/*
+ * Sends one block, analog_data holds one channel after the other, and keeps
+ * it for retransmission. Must only be called from one thread.
+ */
+void mcast_pub_publish(mcast_pub_t *pub,
+                       uint64_t timestamp_nanos,
+                       unsigned int sampling_rate,
+                       unsigned int points_per_channel,
+                       const double *analog_data);
+
+/*
+ * Serves retransmission requests until !running.
+ */
+void *mcast_retrans_thread_main(void *pub);
+
+void mcast_pub_destroy(mcast_pub_t *pub);
+
+#endif
+/* vim: set fileencoding=utf8 : */
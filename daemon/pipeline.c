@@ -0,0 +1,682 @@
+/*
+ *  Records analog data from a NI USB-6218 and send it to connected clients
+ *
+ *  Copyright (C)2011-2012, Johannes Weiß <weiss@tux4u.de>
+ *                        , Jonathan Dimond <jonny@dimond.de>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "daemon.h"
+#include "frame.h"
+#include "pipeline.h"
+#include "stats.h"
+#include "rt.h"
+
+/* recycled block and frame descriptors, some are allocated at start so
+ * publishing doesn't allocate */
+#define PIPELINE_SPARE_DESCRIPTORS 16
+
+/* a copy of a published block, recycled by the last of its tasks */
+typedef struct pipeline_block {
+    uint64_t timestamp_nanos;
+    unsigned int points_per_channel;
+    unsigned int num_channels;
+    rt_block_t *data;
+    double *analog_data;
+    digival_t *digital_data;
+    daq_config_t config;
+    block_markers_t markers;
+    block_sessions_t sessions;
+    uint32_t refs;
+    struct pipeline_block *next_free;
+} pipeline_block_t;
+
+typedef enum {
+    TASK_TRANSFORM,
+    TASK_ENCODE
+} task_kind_t;
+
+typedef struct {
+    task_kind_t kind;
+    pipeline_block_t *block;
+    pipeline_frame_t *frame; /* TASK_ENCODE only */
+} pipeline_task_t;
+
+/* the owner takes the oldest task from the front, thieves the newest from
+ * the back */
+typedef struct {
+    pthread_mutex_t lock;
+    pipeline_task_t tasks[PIPELINE_QUEUE_SIZE];
+    unsigned int front;
+    unsigned int count;
+    unsigned int index;
+    pthread_t thread;
+} worker_t;
+
+struct pipeline_group {
+    unsigned int num_channels;
+    unsigned int *channel_ids;
+    unsigned int refs;        /* subscribed clients */
+    pipeline_frame_t *frame;  /* of the latest block */
+    struct pipeline_group *next;
+};
+
+static worker_t __workers[PIPELINE_MAX_WORKERS];
+static unsigned int __num_workers = 0;
+/* round robin, acquisition thread only */
+static unsigned int __next_worker = 0;
+
+/* idle workers sleep until tasks get queued, __queued is atomic */
+static pthread_mutex_t __pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t __pool_cond = PTHREAD_COND_INITIALIZER;
+static uint32_t __queued = 0;
+static bool __stopping = false;
+
+static pthread_mutex_t __groups_lock = PTHREAD_MUTEX_INITIALIZER;
+static pipeline_group_t *__groups = NULL;
+
+/* senders waiting for their frames */
+static pthread_mutex_t __frames_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t __frames_cond = PTHREAD_COND_INITIALIZER;
+
+static pthread_mutex_t __free_lock = PTHREAD_MUTEX_INITIALIZER;
+static pipeline_block_t *__free_blocks = NULL;
+static pipeline_frame_t *__free_frames = NULL;
+
+/* the frames of the block being published, acquisition thread only */
+static pipeline_frame_t **__publish_frames = NULL;
+static unsigned int __publish_frames_size = 0;
+
+/*
+ * BLOCKS AND FRAMES
+ */
+static pipeline_block_t *alloc_block(void) {
+    pipeline_block_t *block = calloc(1, sizeof(*block));
+    assert(NULL != block);
+    return block;
+}
+
+static pipeline_frame_t *alloc_frame(void) {
+    pipeline_frame_t *frame = calloc(1, sizeof(*frame));
+    assert(NULL != frame);
+    frame->channel_ids = malloc(MAX_CHANNELS * sizeof(unsigned int));
+    assert(NULL != frame->channel_ids);
+    return frame;
+}
+
+static pipeline_block_t *get_block(void) {
+    pipeline_block_t *block;
+    int err;
+
+    err = pthread_mutex_lock(&__free_lock);
+    assert(0 == err);
+    block = __free_blocks;
+    if(NULL != block) {
+        __free_blocks = block->next_free;
+    }
+    err = pthread_mutex_unlock(&__free_lock);
+    assert(0 == err);
+
+    return NULL != block ? block : alloc_block();
+}
+
+static void put_block(pipeline_block_t *block) {
+    int err;
+
+    if(0 == __atomic_sub_fetch(&block->refs, 1, __ATOMIC_ACQ_REL)) {
+        rt_block_put(block->data);
+
+        err = pthread_mutex_lock(&__free_lock);
+        assert(0 == err);
+        block->next_free = __free_blocks;
+        __free_blocks = block;
+        err = pthread_mutex_unlock(&__free_lock);
+        assert(0 == err);
+    }
+}
+
+static pipeline_frame_t *new_frame(const pipeline_group_t *group,
+                                   uint64_t timestamp_nanos) {
+    pipeline_frame_t *frame;
+    int err;
+
+    err = pthread_mutex_lock(&__free_lock);
+    assert(0 == err);
+    frame = __free_frames;
+    if(NULL != frame) {
+        __free_frames = frame->next_free;
+    }
+    err = pthread_mutex_unlock(&__free_lock);
+    assert(0 == err);
+
+    if(NULL == frame) {
+        frame = alloc_frame();
+    }
+
+    /* data and size stay for the next encoding */
+    frame->len = 0;
+    frame->done = false;
+    frame->timestamp_nanos = timestamp_nanos;
+    frame->num_channels = group->num_channels;
+    memcpy(frame->channel_ids, group->channel_ids,
+           group->num_channels * sizeof(unsigned int));
+    /* the group's and the encode task's */
+    frame->refs = 2;
+
+    return frame;
+}
+
+void pipeline_frame_put(void *opaque_frame) {
+    pipeline_frame_t *frame = (pipeline_frame_t *)opaque_frame;
+
+    int err;
+
+    if(0 == __atomic_sub_fetch(&frame->refs, 1, __ATOMIC_ACQ_REL)) {
+        err = pthread_mutex_lock(&__free_lock);
+        assert(0 == err);
+        frame->next_free = __free_frames;
+        __free_frames = frame;
+        err = pthread_mutex_unlock(&__free_lock);
+        assert(0 == err);
+    }
+}
+
+void pipeline_frame_wait(pipeline_frame_t *frame) {
+    int err;
+
+    err = pthread_mutex_lock(&__frames_lock);
+    assert(0 == err);
+    while(!frame->done) {
+        err = pthread_cond_wait(&__frames_cond, &__frames_lock);
+        assert(0 == err);
+    }
+    err = pthread_mutex_unlock(&__frames_lock);
+    assert(0 == err);
+}
+
+/*
+ * STAGES
+ */
+static void transform_block(const pipeline_block_t *block) {
+    const unsigned int points = block->points_per_channel;
+    const double *samples;
+    double value, min, max, sum;
+
+    energy_integrate(&block->config, block->analog_data, points,
+                     &block->sessions);
+
+    if(0 == points) {
+        return;
+    }
+
+    for(unsigned int ch = 0; ch < block->num_channels; ch++) {
+        samples = block->analog_data + ch * points;
+        min = max = sum = block->config.scale[ch] * samples[0] +
+                          block->config.offset[ch];
+        for(unsigned int i = 1; i < points; i++) {
+            value = block->config.scale[ch] * samples[i] +
+                    block->config.offset[ch];
+            min = value < min ? value : min;
+            max = value > max ? value : max;
+            sum += value;
+        }
+        stats_channel_summary(ch, block->config.channel_names[ch],
+                              min, max, sum / points);
+    }
+}
+
+static void frame_done(pipeline_frame_t *frame) {
+    int err;
+
+    err = pthread_mutex_lock(&__frames_lock);
+    assert(0 == err);
+    frame->done = true;
+    err = pthread_cond_broadcast(&__frames_cond);
+    assert(0 == err);
+    err = pthread_mutex_unlock(&__frames_lock);
+    assert(0 == err);
+}
+
+static void encode_block(const pipeline_block_t *block,
+                         pipeline_frame_t *frame) {
+    const size_t size = frame_max_size(frame->num_channels,
+                                       block->points_per_channel);
+
+    /* nobody reads a frame before it's done */
+    if(size > frame->size) {
+        free(frame->data);
+        frame->data = malloc(size);
+        assert(NULL != frame->data);
+        frame->size = size;
+    }
+
+    frame->len = frame_encode(frame->data,
+                              frame->num_channels,
+                              frame->channel_ids,
+                              block->points_per_channel,
+                              block->timestamp_nanos,
+                              block->analog_data,
+                              block->digital_data,
+                              &block->markers);
+    STATS_ADD(stats_pipeline.encoded_bytes, frame->len);
+
+    frame_done(frame);
+}
+
+static void run_task(const pipeline_task_t *task) {
+    uint64_t start = stats_now_nanos();
+
+    switch(task->kind) {
+        case TASK_TRANSFORM:
+            transform_block(task->block);
+            STATS_ADD(stats_pipeline.transform_nanos,
+                      stats_now_nanos() - start);
+            break;
+        case TASK_ENCODE:
+            encode_block(task->block, task->frame);
+            STATS_ADD(stats_pipeline.encode_nanos, stats_now_nanos() - start);
+            pipeline_frame_put(task->frame);
+            break;
+    }
+    STATS_ADD(stats_pipeline.tasks, 1);
+    put_block(task->block);
+}
+
+/* settles what waits for the task as if it ran, without doing the work */
+static void drop_task(const pipeline_task_t *task) {
+    switch(task->kind) {
+        case TASK_TRANSFORM:
+            energy_skip(&task->block->sessions);
+            break;
+        case TASK_ENCODE:
+            /* empty, the senders skip it */
+            frame_done(task->frame);
+            pipeline_frame_put(task->frame);
+            break;
+    }
+    STATS_ADD(stats_pipeline.dropped_tasks, 1);
+    put_block(task->block);
+}
+
+/*
+ * WORK STEALING
+ */
+static bool push_task(worker_t *w, const pipeline_task_t *task) {
+    bool pushed = false;
+    int err;
+
+    err = pthread_mutex_lock(&w->lock);
+    assert(0 == err);
+    if(w->count < PIPELINE_QUEUE_SIZE) {
+        w->tasks[(w->front + w->count) % PIPELINE_QUEUE_SIZE] = *task;
+        w->count++;
+        pushed = true;
+    }
+    err = pthread_mutex_unlock(&w->lock);
+    assert(0 == err);
+
+    return pushed;
+}
+
+static bool take_task(worker_t *w, pipeline_task_t *task, bool steal) {
+    bool taken = false;
+    int err;
+
+    err = pthread_mutex_lock(&w->lock);
+    assert(0 == err);
+    if(0 < w->count) {
+        w->count--;
+        if(steal) {
+            *task = w->tasks[(w->front + w->count) % PIPELINE_QUEUE_SIZE];
+        } else {
+            *task = w->tasks[w->front];
+            w->front = (w->front + 1) % PIPELINE_QUEUE_SIZE;
+        }
+        taken = true;
+    }
+    err = pthread_mutex_unlock(&w->lock);
+    assert(0 == err);
+
+    if(taken) {
+        STATS_SET(stats_pipeline.queued,
+                  __atomic_sub_fetch(&__queued, 1, __ATOMIC_ACQ_REL));
+    }
+    return taken;
+}
+
+static bool find_task(worker_t *self, pipeline_task_t *task) {
+    if(take_task(self, task, false)) {
+        return true;
+    }
+
+    /* own deque is empty, help the others from the other end */
+    for(unsigned int i = 1; i < __num_workers; i++) {
+        if(take_task(&__workers[(self->index + i) % __num_workers],
+                     task, true)) {
+            STATS_ADD(stats_pipeline.steals, 1);
+            return true;
+        }
+    }
+    return false;
+}
+
+static void *worker_main(void *opaque_worker) {
+    worker_t *self = (worker_t *)opaque_worker;
+    pipeline_task_t task;
+    bool stop;
+    int err;
+
+    rt_enter(RT_ENCODE);
+
+    while(true) {
+        if(find_task(self, &task)) {
+            run_task(&task);
+            continue;
+        }
+
+        err = pthread_mutex_lock(&__pool_lock);
+        assert(0 == err);
+        while(0 == __atomic_load_n(&__queued, __ATOMIC_ACQUIRE) &&
+              !__stopping) {
+            err = pthread_cond_wait(&__pool_cond, &__pool_lock);
+            assert(0 == err);
+        }
+        /* what is queued still gets done */
+        stop = __stopping && 0 == __atomic_load_n(&__queued, __ATOMIC_ACQUIRE);
+        err = pthread_mutex_unlock(&__pool_lock);
+        assert(0 == err);
+
+        if(stop) {
+            break;
+        }
+    }
+
+    return NULL;
+}
+
+static void queue_task(const pipeline_task_t *task) {
+    unsigned int w;
+    int err;
+
+    /* counted first, so a worker never sees more tasks than __queued */
+    STATS_SET(stats_pipeline.queued,
+              __atomic_add_fetch(&__queued, 1, __ATOMIC_ACQ_REL));
+
+    for(unsigned int i = 0; i < __num_workers; i++) {
+        w = (__next_worker + i) % __num_workers;
+        if(push_task(&__workers[w], task)) {
+            __next_worker = (w + 1) % __num_workers;
+
+            err = pthread_mutex_lock(&__pool_lock);
+            assert(0 == err);
+            err = pthread_cond_signal(&__pool_cond);
+            assert(0 == err);
+            err = pthread_mutex_unlock(&__pool_lock);
+            assert(0 == err);
+            return;
+        }
+    }
+
+    /* every deque is full, the acquisition doesn't wait for the pool */
+    STATS_SET(stats_pipeline.queued,
+              __atomic_sub_fetch(&__queued, 1, __ATOMIC_ACQ_REL));
+    drop_task(task);
+}
+
+/*
+ * FUNCTIONALITY
+ */
+void pipeline_init(void) {
+    pipeline_block_t *block;
+    pipeline_frame_t *frame;
+
+    rt_mutex_init(&__pool_lock);
+    rt_mutex_init(&__groups_lock);
+    rt_mutex_init(&__frames_lock);
+    rt_mutex_init(&__free_lock);
+
+    for(unsigned int i = 0; i < PIPELINE_SPARE_DESCRIPTORS; i++) {
+        block = alloc_block();
+        block->next_free = __free_blocks;
+        __free_blocks = block;
+
+        frame = alloc_frame();
+        frame->next_free = __free_frames;
+        __free_frames = frame;
+    }
+}
+
+void pipeline_start(void) {
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    int err;
+
+    /* one worker per CPU they are pinned to */
+    if(0 < rt_cpus(RT_ENCODE)) {
+        cores = rt_cpus(RT_ENCODE);
+    }
+
+    __num_workers = cores < 1 ? 1 : cores > PIPELINE_MAX_WORKERS ?
+                                    PIPELINE_MAX_WORKERS : (unsigned int)cores;
+    __stopping = false;
+
+    for(unsigned int i = 0; i < __num_workers; i++) {
+        rt_mutex_init(&__workers[i].lock);
+        __workers[i].front = 0;
+        __workers[i].count = 0;
+        __workers[i].index = i;
+        err = pthread_create(&__workers[i].thread,
+                             NULL,
+                             worker_main,
+                             &__workers[i]);
+        assert(0 == err);
+    }
+    STATS_SET(stats_pipeline.workers, __num_workers);
+
+    printf("Pipeline started with %u worker(s)\n", __num_workers);
+}
+
+void pipeline_stop(void) {
+    int err;
+
+    err = pthread_mutex_lock(&__pool_lock);
+    assert(0 == err);
+    __stopping = true;
+    err = pthread_cond_broadcast(&__pool_cond);
+    assert(0 == err);
+    err = pthread_mutex_unlock(&__pool_lock);
+    assert(0 == err);
+
+    for(unsigned int i = 0; i < __num_workers; i++) {
+        err = pthread_join(__workers[i].thread, NULL);
+        assert(0 == err);
+    }
+    __num_workers = 0;
+}
+
+pipeline_group_t *pipeline_subscribe(unsigned int num_channels,
+                                     const unsigned int *channel_ids) {
+    const size_t ids_size = num_channels * sizeof(unsigned int);
+    pipeline_group_t *group;
+    unsigned int num_groups = 0;
+    int err;
+
+    err = pthread_mutex_lock(&__groups_lock);
+    assert(0 == err);
+
+    for(group = __groups; NULL != group; group = group->next) {
+        if(num_channels == group->num_channels &&
+           0 == memcmp(channel_ids, group->channel_ids, ids_size)) {
+            break;
+        }
+    }
+
+    if(NULL == group) {
+        group = calloc(1, sizeof(*group));
+        assert(NULL != group);
+        group->num_channels = num_channels;
+        group->channel_ids = malloc(ids_size);
+        assert(NULL != group->channel_ids);
+        memcpy(group->channel_ids, channel_ids, ids_size);
+        group->next = __groups;
+        __groups = group;
+    }
+    group->refs++;
+
+    for(pipeline_group_t *g = __groups; NULL != g; g = g->next) {
+        num_groups++;
+    }
+    STATS_SET(stats_pipeline.groups, num_groups);
+
+    err = pthread_mutex_unlock(&__groups_lock);
+    assert(0 == err);
+
+    return group;
+}
+
+void pipeline_unsubscribe(pipeline_group_t *group) {
+    pipeline_group_t **cur;
+    unsigned int num_groups = 0;
+    bool last;
+    int err;
+
+    err = pthread_mutex_lock(&__groups_lock);
+    assert(0 == err);
+
+    assert(group->refs > 0);
+    last = 0 == --group->refs;
+    if(last) {
+        for(cur = &__groups; NULL != *cur; cur = &(*cur)->next) {
+            if(*cur == group) {
+                *cur = group->next;
+                break;
+            }
+        }
+    }
+
+    for(pipeline_group_t *g = __groups; NULL != g; g = g->next) {
+        num_groups++;
+    }
+    STATS_SET(stats_pipeline.groups, num_groups);
+
+    err = pthread_mutex_unlock(&__groups_lock);
+    assert(0 == err);
+
+    if(last) {
+        if(NULL != group->frame) {
+            pipeline_frame_put(group->frame);
+        }
+        free(group->channel_ids);
+        free(group);
+    }
+}
+
+void pipeline_publish(const daq_config_t *config,
+                      uint64_t timestamp_nanos,
+                      unsigned int points_per_channel,
+                      unsigned int num_channels,
+                      const double *analog_data,
+                      const digival_t *digital_data,
+                      const block_markers_t *markers,
+                      const block_sessions_t *sessions) {
+    const size_t samples = num_channels * points_per_channel;
+    pipeline_task_t task = { .kind = TASK_TRANSFORM };
+    pipeline_frame_t *old_frame;
+    pipeline_group_t *group;
+    unsigned int num_frames = 0;
+    int err;
+    pipeline_block_t *block = get_block();
+
+    block->timestamp_nanos = timestamp_nanos;
+    block->points_per_channel = points_per_channel;
+    block->num_channels = num_channels;
+    block->config = *config;
+    block->markers = *markers;
+    block->sessions = *sessions;
+    assert(samples <= MAX_BLOCK_SAMPLES);
+    block->data = rt_block_get();
+    block->analog_data = block->data->analog_data;
+    memcpy(block->analog_data, analog_data, samples * sizeof(double));
+    block->digital_data = block->data->digital_data;
+    memcpy(block->digital_data, digital_data, samples * sizeof(digival_t));
+
+    err = pthread_mutex_lock(&__groups_lock);
+    assert(0 == err);
+
+    for(group = __groups; NULL != group; group = group->next) {
+        num_frames++;
+    }
+    if(num_frames > __publish_frames_size) {
+        /* only when groups were added */
+        free(__publish_frames);
+        __publish_frames = malloc(num_frames * sizeof(*__publish_frames));
+        assert(NULL != __publish_frames);
+        __publish_frames_size = num_frames;
+    }
+
+    num_frames = 0;
+    for(group = __groups; NULL != group; group = group->next) {
+        old_frame = group->frame;
+        group->frame = new_frame(group, timestamp_nanos);
+        __publish_frames[num_frames++] = group->frame;
+        if(NULL != old_frame) {
+            /* the senders hold their own references */
+            pipeline_frame_put(old_frame);
+        }
+    }
+    /* the transform task and one encode task per group */
+    block->refs = 1 + num_frames;
+
+    err = pthread_mutex_unlock(&__groups_lock);
+    assert(0 == err);
+
+    STATS_ADD(stats_pipeline.blocks, 1);
+
+    task.block = block;
+    queue_task(&task);
+
+    task.kind = TASK_ENCODE;
+    for(unsigned int i = 0; i < num_frames; i++) {
+        task.frame = __publish_frames[i];
+        queue_task(&task);
+    }
+}
+
+pipeline_frame_t *pipeline_frame_get(pipeline_group_t *group,
+                                     uint64_t timestamp_nanos) {
+    pipeline_frame_t *frame = NULL;
+    int err;
+
+    err = pthread_mutex_lock(&__groups_lock);
+    assert(0 == err);
+    if(NULL != group->frame &&
+       timestamp_nanos == group->frame->timestamp_nanos) {
+        frame = group->frame;
+        __atomic_add_fetch(&frame->refs, 1, __ATOMIC_ACQ_REL);
+    }
+    err = pthread_mutex_unlock(&__groups_lock);
+    assert(0 == err);
+
+    return frame;
+}
+/* vim: set fileencoding=utf8 : */
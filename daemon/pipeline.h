@@ -0,0 +1,118 @@
+/*
+ *  Records analog data from a NI USB-6218 and send it to connected clients
+ *
+ *  Copyright (C)2011-2012, Johannes Weiß <weiss@tux4u.de>
+ *                        , Jonathan Dimond <jonny@dimond.de>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#include "common.h"
+#include "daq_config.h"
+#include "markers.h"
+#include "energy.h"
+
+/*
+ * The stages a block passes after the acquisition thread read it:
+ *
+ *  - transform: summarises every channel (calibrated minimum, maximum and
+ *    mean, exported as metrics) and integrates the energy sessions,
+ *  - encode: turns the block into one frame per subscription group, i.e.
+ *    per channel selection of the TCP clients with a send thread,
+ *  - I/O: the send thread of every client writes the frame of its group.
+ *
+ * The transform and encode tasks of a block run on a small pool of worker
+ * threads (one per core, at most PIPELINE_MAX_WORKERS). Every worker has a
+ * bounded deque, idle workers steal from the others. The acquisition thread
+ * only queues the tasks and goes on reading, a sender waits for the frame of
+ * its block with pipeline_frame_wait. If every deque is full, the task is
+ * dropped and counted, the acquisition never waits for the pool: the block
+ * isn't summarised and its energy cuts are skipped (energy_skip), or the
+ * frame of the group stays empty and its clients miss the block.
+ */
+
+#define PIPELINE_MAX_WORKERS 4
+/* tasks queued per worker at most */
+#define PIPELINE_QUEUE_SIZE 32
+
+/* A block encoded for the channels of a subscription group. */
+typedef struct pipeline_frame {
+    uint8_t *data;
+    size_t len;
+    uint64_t timestamp_nanos;
+    unsigned int num_channels;
+    unsigned int *channel_ids;
+    bool done;     /* data and len are valid */
+    uint32_t refs;
+    size_t size;   /* of data, kept when the frame is recycled */
+    struct pipeline_frame *next_free;
+} pipeline_frame_t;
+
+typedef struct pipeline_group pipeline_group_t;
+
+/* Call after rt_init, before any thread subscribes. */
+void pipeline_init(void);
+
+void pipeline_start(void);
+
+/*
+ * Runs the tasks still queued and stops the workers. Call after the
+ * handlers got the last block.
+ */
+void pipeline_stop(void);
+
+/*
+ * Joins (or creates) the group of the clients reading channel_ids. Blocks
+ * published from then on get encoded for it.
+ */
+pipeline_group_t *pipeline_subscribe(unsigned int num_channels,
+                                     const unsigned int *channel_ids);
+void pipeline_unsubscribe(pipeline_group_t *group);
+
+/*
+ * Hands a block, its markers and its cuts of the energy sessions to the
+ * pipeline. Called by the acquisition thread before it notifies the
+ * handlers, the block is copied.
+ */
+void pipeline_publish(const daq_config_t *config,
+                      uint64_t timestamp_nanos,
+                      unsigned int points_per_channel,
+                      unsigned int num_channels,
+                      const double *analog_data,
+                      const digival_t *digital_data,
+                      const block_markers_t *markers,
+                      const block_sessions_t *sessions);
+
+/*
+ * Returns a reference to the frame of the group for the block with
+ * timestamp_nanos or NULL if the group joined after it was published.
+ */
+pipeline_frame_t *pipeline_frame_get(pipeline_group_t *group,
+                                     uint64_t timestamp_nanos);
+
+/* Waits until the frame is encoded. */
+void pipeline_frame_wait(pipeline_frame_t *frame);
+
+/* Drops a reference, takes void * to be a zc_send release function. */
+void pipeline_frame_put(void *frame);
+
+#endif
+/* vim: set fileencoding=utf8 : */
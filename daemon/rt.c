@@ -0,0 +1,360 @@
+/*
+ *  Records analog data from a NI USB-6218 and send it to connected clients
+ *
+ *  Copyright (C)2011-2012, Johannes Weiß <weiss@tux4u.de>
+ *                        , Jonathan Dimond <jonny@dimond.de>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <assert.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+#include "rt.h"
+#include "stats.h"
+
+/* size of a huge page on x86 and arm64 */
+#define HUGE_PAGE_SIZE (2 * 1024 * 1024)
+
+static const char *__role_names[RT_NUM_ROLES] = {
+    "acquisition", "encode", "I/O"
+};
+
+static rt_params_t __params = {
+    .first_cpu = { -1, -1, -1 },
+    .last_cpu = { -1, -1, -1 }
+};
+
+/* the pool: __pool_size bytes of slots, the free ones on a stack */
+static pthread_mutex_t __pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static uint8_t *__pool = NULL;
+static size_t __pool_size = 0;
+static size_t __slot_size = 0;
+static rt_block_t **__free_blocks = NULL;
+static unsigned int __num_free = 0;
+
+void rt_default_params(rt_params_t *params) {
+    memset(params, 0, sizeof(*params));
+    for(unsigned int r = 0; r < RT_NUM_ROLES; r++) {
+        params->first_cpu[r] = -1;
+        params->last_cpu[r] = -1;
+    }
+}
+
+/* CPU or FIRST-LAST */
+static int parse_cpus(const char *value, int *first, int *last) {
+    long cpus = sysconf(_SC_NPROCESSORS_CONF);
+    char *end;
+
+    errno = 0;
+    *first = *last = strtol(value, &end, 10);
+    if('-' == *end) {
+        *last = strtol(end + 1, &end, 10);
+    }
+    if(0 != errno || end == value || '\0' != *end ||
+       0 > *first || *first > *last || *last >= cpus) {
+        return -1;
+    }
+    return 0;
+}
+
+int rt_parse_params(const char *spec, rt_params_t *params) {
+    char *copy = strdup(spec);
+    char *saveptr = NULL;
+    char *value, *end;
+    long number;
+    int ret = 0;
+    assert(NULL != copy);
+
+    params->priority = RT_DEFAULT_PRIORITY;
+    params->lock_memory = true;
+    params->pool_blocks = RT_DEFAULT_POOL_BLOCKS;
+
+    for(char *tok = strtok_r(copy, ",", &saveptr); 0 == ret && NULL != tok;
+        tok = strtok_r(NULL, ",", &saveptr)) {
+        value = strchr(tok, '=');
+        if(NULL == value) {
+            ret = -1;
+            break;
+        }
+        *value++ = '\0';
+
+        if(0 == strcasecmp("acq", tok)) {
+            ret = parse_cpus(value, &params->first_cpu[RT_ACQUISITION],
+                             &params->last_cpu[RT_ACQUISITION]);
+            continue;
+        } else if(0 == strcasecmp("encode", tok)) {
+            ret = parse_cpus(value, &params->first_cpu[RT_ENCODE],
+                             &params->last_cpu[RT_ENCODE]);
+            continue;
+        } else if(0 == strcasecmp("io", tok)) {
+            ret = parse_cpus(value, &params->first_cpu[RT_IO],
+                             &params->last_cpu[RT_IO]);
+            continue;
+        }
+
+        errno = 0;
+        number = strtol(value, &end, 10);
+        if(0 != errno || end == value || '\0' != *end || number < 0) {
+            ret = -1;
+        } else if(0 == strcasecmp("prio", tok) && number <= 99) {
+            params->priority = number;
+        } else if(0 == strcasecmp("lock", tok) && number <= 1) {
+            params->lock_memory = 1 == number;
+        } else if(0 == strcasecmp("pool", tok) && number <= 1024) {
+            params->pool_blocks = number;
+        } else if(0 == strcasecmp("huge", tok) && number <= 1) {
+            params->huge_pages = 1 == number;
+        } else {
+            ret = -1;
+        }
+    }
+    free(copy);
+
+    return ret;
+}
+
+/*
+ * MEMORY
+ */
+static void lock_memory(void) {
+    int err;
+
+#ifdef MCL_ONFAULT
+    /* pages get locked once used, the stacks of the client threads aren't
+     * faulted in completely, what has to be resident is pre-faulted */
+    err = mlockall(MCL_CURRENT | MCL_FUTURE | MCL_ONFAULT);
+    if(0 != err && EINVAL == errno)
+#endif
+    err = mlockall(MCL_CURRENT | MCL_FUTURE);
+
+    if(0 != err) {
+        printf("WARNING: memory not locked, mlockall: %s\n", strerror(errno));
+        return;
+    }
+    STATS_SET(stats_rt.memory_locked, 1);
+}
+
+static void create_pool(unsigned int num_blocks, bool huge_pages) {
+    const size_t page_size = huge_pages ? HUGE_PAGE_SIZE :
+                                          (size_t)sysconf(_SC_PAGESIZE);
+    void *pool = MAP_FAILED;
+
+    __slot_size = (sizeof(rt_block_t) + page_size - 1) / page_size *
+                  page_size;
+    __pool_size = num_blocks * __slot_size;
+
+#ifdef MAP_HUGETLB
+    if(huge_pages) {
+        pool = mmap(NULL, __pool_size, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if(MAP_FAILED == pool) {
+            printf("WARNING: no huge pages for the block pool, mmap: %s\n",
+                   strerror(errno));
+        } else {
+            STATS_SET(stats_rt.pool_huge_pages, 1);
+        }
+    }
+#endif
+    if(MAP_FAILED == pool) {
+        pool = mmap(NULL, __pool_size, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        assert(MAP_FAILED != pool);
+#ifdef MADV_HUGEPAGE
+        if(huge_pages) {
+            /* transparent huge pages at least */
+            madvise(pool, __pool_size, MADV_HUGEPAGE);
+        }
+#endif
+    }
+    __pool = pool;
+
+    /* fault in every page now rather than when reading the first blocks */
+    memset(__pool, 0, __pool_size);
+
+    __free_blocks = malloc(num_blocks * sizeof(*__free_blocks));
+    assert(NULL != __free_blocks);
+    for(unsigned int i = 0; i < num_blocks; i++) {
+        __free_blocks[i] = (rt_block_t *)(__pool + i * __slot_size);
+    }
+    __num_free = num_blocks;
+    STATS_SET(stats_rt.pool_blocks, num_blocks);
+    STATS_SET(stats_rt.pool_free, num_blocks);
+}
+
+void rt_init(const rt_params_t *params) {
+    __params = *params;
+    rt_mutex_init(&__pool_lock);
+
+    if(params->lock_memory) {
+        lock_memory();
+    }
+    if(0 < params->pool_blocks) {
+        create_pool(params->pool_blocks, params->huge_pages);
+    }
+
+    if(0 < params->priority || params->lock_memory ||
+       0 < params->pool_blocks) {
+        printf("RT: priority %d, memory %slocked, pool of %u block(s)%s\n",
+               params->priority,
+               STATS_GET(stats_rt.memory_locked) ? "" : "not ",
+               params->pool_blocks,
+               STATS_GET(stats_rt.pool_huge_pages) ? " in huge pages" : "");
+    }
+}
+
+void rt_mutex_init(pthread_mutex_t *mutex) {
+    pthread_mutexattr_t attr;
+    int err;
+
+    err = pthread_mutexattr_init(&attr);
+    assert(0 == err);
+    if(0 < __params.priority) {
+        err = pthread_mutexattr_setprotocol(&attr, PTHREAD_PRIO_INHERIT);
+        assert(0 == err);
+    }
+    err = pthread_mutex_init(mutex, &attr);
+    assert(0 == err);
+    err = pthread_mutexattr_destroy(&attr);
+    assert(0 == err);
+}
+
+void rt_finish(void) {
+    int err;
+
+    if(NULL != __pool) {
+        assert(__num_free == __params.pool_blocks);
+        err = munmap(__pool, __pool_size);
+        assert(0 == err);
+        free(__free_blocks);
+        __pool = NULL;
+        __free_blocks = NULL;
+        __num_free = 0;
+    }
+}
+
+rt_block_t *rt_block_get(void) {
+    rt_block_t *block = NULL;
+    int err;
+
+    if(NULL != __pool) {
+        err = pthread_mutex_lock(&__pool_lock);
+        assert(0 == err);
+        if(0 < __num_free) {
+            block = __free_blocks[--__num_free];
+        }
+        STATS_SET(stats_rt.pool_free, __num_free);
+        err = pthread_mutex_unlock(&__pool_lock);
+        assert(0 == err);
+
+        if(NULL == block) {
+            STATS_ADD(stats_rt.pool_misses, 1);
+        }
+    }
+
+    if(NULL == block) {
+        block = calloc(1, sizeof(*block));
+        assert(NULL != block);
+    }
+    return block;
+}
+
+void rt_block_put(rt_block_t *block) {
+    int err;
+
+    if((uint8_t *)block < __pool || (uint8_t *)block >= __pool + __pool_size) {
+        free(block);
+        return;
+    }
+
+    err = pthread_mutex_lock(&__pool_lock);
+    assert(0 == err);
+    __free_blocks[__num_free++] = block;
+    STATS_SET(stats_rt.pool_free, __num_free);
+    err = pthread_mutex_unlock(&__pool_lock);
+    assert(0 == err);
+}
+
+/*
+ * THREADS
+ */
+void rt_enter(rt_role_t role) {
+    struct sched_param param = { .sched_priority = 0 };
+    int policy = SCHED_OTHER;
+    int err;
+
+#ifndef __MACH__
+    cpu_set_t cpus;
+
+    if(0 <= __params.first_cpu[role]) {
+        CPU_ZERO(&cpus);
+        for(int c = __params.first_cpu[role]; c <= __params.last_cpu[role];
+            c++) {
+            CPU_SET(c, &cpus);
+        }
+        err = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+        if(0 != err) {
+            printf("WARNING: %s thread not pinned: %s\n", __role_names[role],
+                   strerror(err));
+        }
+    }
+#endif
+
+    if(0 == __params.priority) {
+        return;
+    }
+    if(RT_ACQUISITION == role) {
+        policy = SCHED_FIFO;
+        param.sched_priority = __params.priority;
+    }
+    err = pthread_setschedparam(pthread_self(), policy, &param);
+    if(0 != err) {
+        printf("WARNING: %s thread keeps its scheduling policy: %s\n",
+               __role_names[role], strerror(err));
+    } else if(RT_ACQUISITION == role) {
+        STATS_SET(stats_rt.acquisition_priority, __params.priority);
+    }
+}
+
+unsigned int rt_cpus(rt_role_t role) {
+    if(0 > __params.first_cpu[role]) {
+        return 0;
+    }
+    return __params.last_cpu[role] - __params.first_cpu[role] + 1;
+}
+
+void rt_wakeup(uint64_t due_nanos) {
+    const uint64_t now = stats_now_nanos();
+
+    stats_wakeup(now > due_nanos ? now - due_nanos : 0);
+#ifndef __MACH__
+    struct rusage usage;
+    if(0 == getrusage(RUSAGE_THREAD, &usage)) {
+        STATS_SET(stats_rt.involuntary_switches, usage.ru_nivcsw);
+    }
+#endif
+}
+/* vim: set fileencoding=utf8 : */
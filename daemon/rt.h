@@ -0,0 +1,130 @@
+/*
+ *  Records analog data from a NI USB-6218 and send it to connected clients
+ *
+ *  Copyright (C)2011-2012, Johannes Weiß <weiss@tux4u.de>
+ *                        , Jonathan Dimond <jonny@dimond.de>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef RT_H
+#define RT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "common.h"
+
+/*
+ * The real-time runtime (daemon -R): keeps the acquisition thread from
+ * waiting for the CPU or for page faults while the DAQ fills its FIFO.
+ *
+ *  - The acquisition thread runs with SCHED_FIFO, every other thread with
+ *    the normal policy, so no client thread can delay a read.
+ *  - The acquisition thread, the pipeline workers (encode) and everything
+ *    else (I/O: accepting, sending, metrics, control) can be pinned to CPUs
+ *    of their own, e.g. isolated ones (isolcpus) for the acquisition.
+ *  - mlockall keeps the daemon's memory from being swapped out.
+ *  - Blocks (the acquisition buffer and the pipeline's copies) come from a
+ *    pool allocated and pre-faulted at start, in huge pages if asked for,
+ *    so reading a block never faults in fresh memory.
+ *  - The mutexes the acquisition thread takes inherit its priority, so a
+ *    thread of normal priority holding one can't keep it waiting behind
+ *    others (priority inversion).
+ *
+ * How late the acquisition thread gets its blocks (the wakeup latency) and
+ * how often it was preempted is exported as metrics, see rt_wakeup.
+ */
+
+/* SCHED_FIFO priority of the acquisition thread with -R */
+#define RT_DEFAULT_PRIORITY 50
+/* blocks in the pool with -R */
+#define RT_DEFAULT_POOL_BLOCKS 8
+
+typedef enum {
+    RT_ACQUISITION,
+    RT_ENCODE,
+    RT_IO,
+    RT_NUM_ROLES
+} rt_role_t;
+
+typedef struct {
+    int priority;                 /* SCHED_FIFO, 0 for normal scheduling */
+    int first_cpu[RT_NUM_ROLES];  /* -1 for any CPU */
+    int last_cpu[RT_NUM_ROLES];
+    bool lock_memory;
+    unsigned int pool_blocks;
+    bool huge_pages;              /* for the pool */
+} rt_params_t;
+
+/* a block of all channels as read from the DAQ */
+typedef struct {
+    double analog_data[MAX_BLOCK_SAMPLES];
+    digival_t digital_data[MAX_BLOCK_SAMPLES];
+} rt_block_t;
+
+/* Normal scheduling, any CPU, no locking and no pool. */
+void rt_default_params(rt_params_t *params);
+
+/*
+ * Changes params to the real-time mode, then by the comma separated
+ * KEY=VALUE assignments in spec: prio (1-99), acq, encode and io (a CPU or
+ * a range FIRST-LAST), lock (0 or 1), pool (blocks) and huge (0 or 1).
+ * Returns 0 or -1 if spec is invalid.
+ */
+int rt_parse_params(const char *spec, rt_params_t *params);
+
+/*
+ * Locks the memory and allocates the pool. Call once before starting any
+ * thread. Whatever the system refuses (e.g. without CAP_IPC_LOCK or huge
+ * pages reserved) is reported and left out.
+ */
+void rt_init(const rt_params_t *params);
+
+/*
+ * Initialises mutex, with priority inheritance in the real-time mode. Call
+ * after rt_init and before any thread uses it, for every mutex the
+ * acquisition thread may wait for.
+ */
+void rt_mutex_init(pthread_mutex_t *mutex);
+
+/* Frees the pool. */
+void rt_finish(void);
+
+/*
+ * Places the calling thread: pins it to the CPUs of role and sets its
+ * scheduling policy. Threads inherit both from the thread creating them,
+ * so every thread started by a thread of another role calls it first.
+ */
+void rt_enter(rt_role_t role);
+
+/* The number of CPUs role is pinned to or 0 if it runs on any. */
+unsigned int rt_cpus(rt_role_t role);
+
+/*
+ * Called by the acquisition thread when a read returned, due_nanos
+ * (stats_now_nanos) is when the last sample of the block was acquired.
+ */
+void rt_wakeup(uint64_t due_nanos);
+
+/*
+ * Takes a block from the pool or allocates one if the pool is empty. Only
+ * freshly allocated blocks are zeroed.
+ */
+rt_block_t *rt_block_get(void);
+void rt_block_put(rt_block_t *block);
+
+#endif
+/* vim: set fileencoding=utf8 : */
@@ -0,0 +1,238 @@
+/*
+ *  Records analog data from a NI USB-6218 and send it to connected clients
+ *
+ *  Copyright (C)2011-2012, Johannes Weiß <weiss@tux4u.de>
+ *                        , Jonathan Dimond <jonny@dimond.de>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <assert.h>
+#include <errno.h>
+#include <limits.h>
+#include <alloca.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#ifndef __MACH__
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#endif
+
+#include "shm_layout.h"
+#include "frame.h"
+#include "shm_ring.h"
+
+#define SHM_NAME_LEN 64
+
+struct shm_ring {
+    char name[SHM_NAME_LEN];
+    void *base;
+    size_t size;
+    pm_shm_header_t *header;
+    uint64_t next_block;
+    bool described;
+    uint64_t config_generation; /* of the description */
+};
+
+static pm_shm_slot_t *ring_slot(shm_ring_t *ring, uint64_t block) {
+    const pm_shm_header_t *h = ring->header;
+    return (pm_shm_slot_t *)((char *)ring->base + sizeof(pm_shm_header_t) +
+                             (block % h->num_slots) * h->slot_size);
+}
+
+shm_ring_t *shm_ring_create(unsigned int port,
+                            unsigned int num_channels,
+                            unsigned int sampling_rate,
+                            unsigned int max_points_per_channel) {
+    char port_str[16];
+    const size_t slot_size = sizeof(pm_shm_slot_t) +
+                             PM_SHM_DATA_SIZE(num_channels,
+                                              max_points_per_channel);
+    int fd, err;
+    shm_ring_t *ring = calloc(1, sizeof(*ring));
+    assert(NULL != ring);
+
+    snprintf(port_str, sizeof(port_str), "%u", port);
+    snprintf(ring->name, sizeof(ring->name), PM_SHM_NAME_FORMAT, port_str);
+    ring->size = sizeof(pm_shm_header_t) + SHM_RING_SLOTS * slot_size;
+
+    /* a segment left behind by a crashed daemon */
+    shm_unlink(ring->name);
+
+    fd = shm_open(ring->name, O_CREAT | O_EXCL | O_RDWR, 0644);
+    if(0 > fd) {
+        printf("WARNING: shared memory disabled, shm_open: %s\n",
+               strerror(errno));
+        free(ring);
+        return NULL;
+    }
+
+    err = ftruncate(fd, ring->size);
+    if(0 != err) {
+        printf("WARNING: shared memory disabled, ftruncate: %s\n",
+               strerror(errno));
+        close(fd);
+        shm_unlink(ring->name);
+        free(ring);
+        return NULL;
+    }
+
+    ring->base = mmap(NULL, ring->size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                      fd, 0);
+    close(fd);
+    if(MAP_FAILED == ring->base) {
+        printf("WARNING: shared memory disabled, mmap: %s\n",
+               strerror(errno));
+        shm_unlink(ring->name);
+        free(ring);
+        return NULL;
+    }
+
+    ring->header = (pm_shm_header_t *)ring->base;
+    ring->header->version = PM_SHM_VERSION;
+    ring->header->sampling_rate = sampling_rate;
+    ring->header->num_channels = num_channels;
+    ring->header->num_slots = SHM_RING_SLOTS;
+    ring->header->max_points_per_channel = max_points_per_channel;
+    ring->header->slot_size = slot_size;
+    ring->header->daemon_pid = getpid();
+    ring->header->closed = 0;
+    ring->header->published = 0;
+    ring->header->write_count = 0;
+    /* readers check the magic last */
+    PM_SHM_STORE(ring->header->magic, PM_SHM_MAGIC);
+
+    printf("publishing blocks in shared memory %s (%zu bytes)\n",
+           ring->name, ring->size);
+
+    return ring;
+}
+
+/* readers wait on published instead of polling write_count */
+static void wake_readers(shm_ring_t *ring) {
+    __atomic_add_fetch(&ring->header->published, 1, __ATOMIC_RELEASE);
+#ifndef __MACH__
+    syscall(SYS_futex, &ring->header->published, FUTEX_WAKE, INT_MAX,
+            NULL, NULL, 0);
+#endif
+}
+
+void shm_slot_markers(pm_shm_slot_t *slot, const block_markers_t *markers) {
+    slot->num_markers = markers->count;
+    for(unsigned int i = 0; i < markers->count; i++) {
+        slot->markers[i].id = markers->marker[i].id;
+        slot->markers[i].sample = markers->marker[i].sample;
+        /* NUL padded like the record it arrived in */
+        memcpy(slot->markers[i].label, markers->marker[i].label,
+               MARKER_LABEL_LEN);
+    }
+}
+
+/* writes the MeasuredData message describing all channels to the header */
+static void describe(shm_ring_t *ring, const daq_config_t *config) {
+    pm_shm_description_t *d = &ring->header->description;
+    const unsigned int num_channels = ring->header->num_channels;
+    unsigned int *channel_ids = alloca(sizeof(unsigned int) * num_channels);
+    uint8_t *frame = malloc(frame_config_max_size(num_channels));
+    const size_t header_size = sizeof(MAGIC_MEASURED_DATA) + sizeof(uint32_t);
+    size_t len;
+    assert(NULL != channel_ids && NULL != frame);
+
+    for(unsigned int i = 0; i < num_channels; i++) {
+        channel_ids[i] = i;
+    }
+    len = frame_encode_config(frame, config, num_channels, channel_ids, "") -
+          header_size;
+    assert(len <= PM_SHM_DESCRIPTION_SIZE);
+
+    /* odd: being written */
+    __atomic_store_n(&d->seq, d->seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    d->generation = config->generation;
+    d->len = len;
+    memcpy(d->message, frame + header_size, len);
+
+    /* even: stable */
+    PM_SHM_STORE(d->seq, d->seq + 1);
+
+    free(frame);
+    ring->described = true;
+    ring->config_generation = config->generation;
+}
+
+void shm_ring_publish(shm_ring_t *ring,
+                      uint64_t timestamp_nanos,
+                      const daq_config_t *config,
+                      unsigned int points_per_channel,
+                      unsigned int num_channels,
+                      const double *analog_data,
+                      const digival_t *digital_data,
+                      const block_markers_t *markers) {
+    pm_shm_slot_t *slot = ring_slot(ring, ring->next_block);
+    const size_t samples = num_channels * points_per_channel;
+
+    assert(points_per_channel <= ring->header->max_points_per_channel);
+    assert(num_channels <= ring->header->num_channels);
+
+    if(!ring->described || config->generation != ring->config_generation) {
+        /* readers find it before the first block read with config */
+        describe(ring, config);
+    }
+
+    /* odd: being written */
+    __atomic_store_n(&slot->seq, slot->seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    slot->block = ring->next_block;
+    slot->timestamp_nanos = timestamp_nanos;
+    slot->points_per_channel = points_per_channel;
+    slot->num_channels = num_channels;
+    slot->sampling_rate = config->sampling_rate;
+    slot->config_generation = config->generation;
+    shm_slot_markers(slot, markers);
+    memcpy(slot->analog_data, analog_data, sizeof(double) * samples);
+    memcpy(slot->analog_data + samples, digital_data,
+           sizeof(digival_t) * samples);
+
+    /* even: stable */
+    PM_SHM_STORE(slot->seq, slot->seq + 1);
+
+    ring->next_block++;
+    PM_SHM_STORE(ring->header->sampling_rate, config->sampling_rate);
+    PM_SHM_STORE(ring->header->write_count, ring->next_block);
+    wake_readers(ring);
+}
+
+void shm_ring_destroy(shm_ring_t *ring) {
+    int err;
+
+    PM_SHM_STORE(ring->header->closed, 1);
+    wake_readers(ring);
+
+    err = munmap(ring->base, ring->size);
+    assert(0 == err);
+    shm_unlink(ring->name);
+    free(ring);
+}
+/* vim: set fileencoding=utf8 : */
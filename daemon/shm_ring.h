@@ -0,0 +1,66 @@
+/*
+ *  Records analog data from a NI USB-6218 and send it to connected clients
+ *
+ *  Copyright (C)2011-2012, Johannes Weiß <weiss@tux4u.de>
+ *                        , Jonathan Dimond <jonny@dimond.de>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SHM_RING_H
+#define SHM_RING_H
+
+#include <stdint.h>
+
+#include "daq_config.h"
+#include "markers.h"
+#include "shm_layout.h"
+
+/* see common/shm_layout.h for the layout clients see */
+#define SHM_RING_SLOTS 8
+
+typedef struct shm_ring shm_ring_t;
+
+/*
+ * Creates the shared memory segment for the daemon listening on port.
+ * Returns NULL (and keeps the daemon running without it) on failure.
+ */
+shm_ring_t *shm_ring_create(unsigned int port,
+                            unsigned int num_channels,
+                            unsigned int sampling_rate,
+                            unsigned int max_points_per_channel);
+
+/*
+ * Publishes one block read with config, analog_data and digital_data hold
+ * one channel after the other. Must only be called from one thread.
+ */
+void shm_ring_publish(shm_ring_t *ring,
+                      uint64_t timestamp_nanos,
+                      const daq_config_t *config,
+                      unsigned int points_per_channel,
+                      unsigned int num_channels,
+                      const double *analog_data,
+                      const digival_t *digital_data,
+                      const block_markers_t *markers);
+
+/* Copies the markers of a block to slot, also for memfd blocks. */
+void shm_slot_markers(pm_shm_slot_t *slot, const block_markers_t *markers);
+
+/*
+ * Tells readers no more blocks will come and removes the segment.
+ */
+void shm_ring_destroy(shm_ring_t *ring);
+
+#endif
+/* vim: set fileencoding=utf8 : */
@@ -0,0 +1,598 @@
+/*
+ *  Records analog data from a NI USB-6218 and send it to connected clients
+ *
+ *  Copyright (C)2011-2012, Johannes Weiß <weiss@tux4u.de>
+ *                        , Jonathan Dimond <jonny@dimond.de>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <assert.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <inttypes.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+
+#include <utils.h>
+
+#include "daemon.h"
+#include "daq_config.h"
+#include "sync.h"
+#include "stats.h"
+
+#define STATS_LISTEN_QUEUE_LEN 4
+#define STATS_REQUEST_SIZE 1024
+/* a scraper not taking the metrics in time is dropped, it would keep the
+ * thread from shutting down */
+#define STATS_TIMEOUT_MS 1000
+
+static pthread_mutex_t __stats_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* clients currently connected, protected by __stats_mutex */
+static stats_client_t *__clients = NULL;
+
+/* sums of all clients that already disconnected, protected by __stats_mutex */
+static stats_client_t __retired = { .name = "retired" };
+
+/* written by the acquisition thread only */
+static uint64_t __blocks_acquired = 0;
+static uint64_t __daq_read_nanos = 0;
+
+stats_pipeline_t stats_pipeline;
+stats_rt_t stats_rt;
+stats_markers_t stats_markers;
+stats_energy_t stats_energy;
+stats_uring_t stats_uring;
+
+typedef struct {
+    bool valid;
+    char name[DAQ_CHANNEL_NAME_LEN];
+    double min;
+    double max;
+    double mean;
+} channel_summary_t;
+
+/* written by the transform stage */
+static pthread_mutex_t __summary_mutex = PTHREAD_MUTEX_INITIALIZER;
+static channel_summary_t __summaries[DAQ_MAX_CHANNELS];
+
+typedef struct {
+    char *data;
+    size_t len;
+    size_t size;
+} text_buf_t;
+
+uint64_t stats_now_nanos(void) {
+#ifndef __MACH__
+    struct timespec ts;
+    int err = clock_gettime(CLOCK_MONOTONIC, &ts);
+    assert(0 == err);
+    return ((uint64_t)ts.tv_sec) * TIME_S + (uint64_t)ts.tv_nsec;
+#else
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return ((uint64_t)tv.tv_sec) * TIME_S + ((uint64_t)tv.tv_usec) * 1000;
+#endif
+}
+
+stats_client_t *stats_register_client(int fd) {
+    struct sockaddr_storage addr;
+    socklen_t addr_len = sizeof(addr);
+    char host[INET6_ADDRSTRLEN] = "unknown";
+    unsigned int port = 0;
+    int err;
+    stats_client_t *client = calloc(1, sizeof(*client));
+    assert(NULL != client);
+
+    if(0 == getpeername(fd, (struct sockaddr *)&addr, &addr_len)) {
+        if(AF_INET == addr.ss_family) {
+            struct sockaddr_in *in = (struct sockaddr_in *)&addr;
+            inet_ntop(AF_INET, &in->sin_addr, host, sizeof(host));
+            port = ntohs(in->sin_port);
+        } else if(AF_INET6 == addr.ss_family) {
+            struct sockaddr_in6 *in6 = (struct sockaddr_in6 *)&addr;
+            inet_ntop(AF_INET6, &in6->sin6_addr, host, sizeof(host));
+            port = ntohs(in6->sin6_port);
+        } else if(AF_UNIX == addr.ss_family) {
+            strcpy(host, "local");
+        }
+    }
+    snprintf(client->name, sizeof(client->name), "%s:%u/fd%d", host, port, fd);
+
+    err = pthread_mutex_lock(&__stats_mutex);
+    assert(0 == err);
+    client->next = __clients;
+    __clients = client;
+    err = pthread_mutex_unlock(&__stats_mutex);
+    assert(0 == err);
+
+    return client;
+}
+
+void stats_unregister_client(stats_client_t *client) {
+    stats_client_t **cur;
+    int err;
+
+    err = pthread_mutex_lock(&__stats_mutex);
+    assert(0 == err);
+
+    for(cur = &__clients; NULL != *cur; cur = &(*cur)->next) {
+        if(*cur == client) {
+            *cur = client->next;
+            break;
+        }
+    }
+
+    __retired.bytes_sent += STATS_GET(client->bytes_sent);
+    __retired.frames_sent += STATS_GET(client->frames_sent);
+    __retired.encode_nanos += STATS_GET(client->encode_nanos);
+    __retired.drops += STATS_GET(client->drops);
+    __retired.zerocopy_frames += STATS_GET(client->zerocopy_frames);
+    __retired.zerocopy_copied += STATS_GET(client->zerocopy_copied);
+    __retired.captures += STATS_GET(client->captures);
+    __retired.captures_dropped += STATS_GET(client->captures_dropped);
+
+    err = pthread_mutex_unlock(&__stats_mutex);
+    assert(0 == err);
+
+    free(client);
+}
+
+void stats_block_acquired(uint64_t daq_read_nanos) {
+    STATS_ADD(__blocks_acquired, 1);
+    STATS_ADD(__daq_read_nanos, daq_read_nanos);
+}
+
+void stats_wakeup(uint64_t latency_nanos) {
+    unsigned int bucket = 0;
+
+    while(bucket < STATS_LATENCY_BUCKETS &&
+          latency_nanos > (1000ULL << bucket)) {
+        bucket++;
+    }
+    /* the slower ones only count in +Inf */
+    if(bucket < STATS_LATENCY_BUCKETS) {
+        STATS_ADD(stats_rt.wakeup_buckets[bucket], 1);
+    }
+    STATS_ADD(stats_rt.wakeups, 1);
+    STATS_ADD(stats_rt.wakeup_nanos, latency_nanos);
+    if(latency_nanos > STATS_GET(stats_rt.wakeup_max_nanos)) {
+        STATS_SET(stats_rt.wakeup_max_nanos, latency_nanos);
+    }
+}
+
+void stats_channel_summary(unsigned int channel,
+                           const char *name,
+                           double min,
+                           double max,
+                           double mean) {
+    channel_summary_t *summary;
+    int err;
+
+    if(channel >= DAQ_MAX_CHANNELS) {
+        return;
+    }
+    summary = &__summaries[channel];
+
+    err = pthread_mutex_lock(&__summary_mutex);
+    assert(0 == err);
+    summary->valid = true;
+    snprintf(summary->name, sizeof(summary->name), "%s", name);
+    summary->min = min;
+    summary->max = max;
+    summary->mean = mean;
+    err = pthread_mutex_unlock(&__summary_mutex);
+    assert(0 == err);
+}
+
+/*
+ * METRICS FORMATTING (Prometheus text format 0.0.4)
+ */
+static void buf_printf(text_buf_t *buf, const char *fmt, ...) {
+    va_list ap;
+    int len;
+
+    while(true) {
+        va_start(ap, fmt);
+        len = vsnprintf(buf->data + buf->len, buf->size - buf->len, fmt, ap);
+        va_end(ap);
+        assert(0 <= len);
+
+        if(buf->len + len < buf->size) {
+            buf->len += len;
+            return;
+        }
+
+        buf->size = 2 * (buf->size + len);
+        buf->data = realloc(buf->data, buf->size);
+        assert(NULL != buf->data);
+    }
+}
+
+static void metric_header(text_buf_t *buf,
+                          const char *name,
+                          const char *type,
+                          const char *help) {
+    buf_printf(buf, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+static void format_pipeline_metrics(text_buf_t *buf) {
+    static const char *kinds[] = { "min", "max", "mean" };
+    char name[64];
+    double value;
+    int err;
+
+    metric_header(buf, "pmlab_pipeline_workers", "gauge",
+                  "Worker threads transforming and encoding blocks.");
+    buf_printf(buf, "pmlab_pipeline_workers %"PRIu64"\n",
+               STATS_GET(stats_pipeline.workers));
+    metric_header(buf, "pmlab_pipeline_groups", "gauge",
+                  "Channel selections every block is encoded for.");
+    buf_printf(buf, "pmlab_pipeline_groups %"PRIu64"\n",
+               STATS_GET(stats_pipeline.groups));
+    metric_header(buf, "pmlab_pipeline_queued_tasks", "gauge",
+                  "Tasks waiting for a pipeline worker.");
+    buf_printf(buf, "pmlab_pipeline_queued_tasks %"PRIu64"\n",
+               STATS_GET(stats_pipeline.queued));
+    metric_header(buf, "pmlab_pipeline_blocks_total", "counter",
+                  "Blocks handed to the pipeline.");
+    buf_printf(buf, "pmlab_pipeline_blocks_total %"PRIu64"\n",
+               STATS_GET(stats_pipeline.blocks));
+    metric_header(buf, "pmlab_pipeline_tasks_total", "counter",
+                  "Transform and encode tasks run.");
+    buf_printf(buf, "pmlab_pipeline_tasks_total %"PRIu64"\n",
+               STATS_GET(stats_pipeline.tasks));
+    metric_header(buf, "pmlab_pipeline_steals_total", "counter",
+                  "Tasks a worker took from the queue of another one.");
+    buf_printf(buf, "pmlab_pipeline_steals_total %"PRIu64"\n",
+               STATS_GET(stats_pipeline.steals));
+    metric_header(buf, "pmlab_pipeline_dropped_tasks_total", "counter",
+                  "Tasks dropped, the queues were full.");
+    buf_printf(buf, "pmlab_pipeline_dropped_tasks_total %"PRIu64"\n",
+               STATS_GET(stats_pipeline.dropped_tasks));
+    metric_header(buf, "pmlab_pipeline_transform_seconds_total", "counter",
+                  "Time spent summarising blocks.");
+    buf_printf(buf, "pmlab_pipeline_transform_seconds_total %.9f\n",
+               STATS_GET(stats_pipeline.transform_nanos) / (double)TIME_S);
+    metric_header(buf, "pmlab_pipeline_encode_seconds_total", "counter",
+                  "Time spent encoding blocks for the channel selections.");
+    buf_printf(buf, "pmlab_pipeline_encode_seconds_total %.9f\n",
+               STATS_GET(stats_pipeline.encode_nanos) / (double)TIME_S);
+    metric_header(buf, "pmlab_pipeline_encoded_bytes_total", "counter",
+                  "Bytes of the frames encoded once for all clients.");
+    buf_printf(buf, "pmlab_pipeline_encoded_bytes_total %"PRIu64"\n",
+               STATS_GET(stats_pipeline.encoded_bytes));
+
+    err = pthread_mutex_lock(&__summary_mutex);
+    assert(0 == err);
+    for(unsigned int k = 0; k < 3; k++) {
+        snprintf(name, sizeof(name), "pmlab_channel_%s", kinds[k]);
+        metric_header(buf, name, "gauge",
+                      "Calibrated summary of the latest block per channel.");
+        for(unsigned int ch = 0; ch < DAQ_MAX_CHANNELS; ch++) {
+            if(!__summaries[ch].valid) {
+                continue;
+            }
+            value = 0 == k ? __summaries[ch].min :
+                    1 == k ? __summaries[ch].max : __summaries[ch].mean;
+            buf_printf(buf, "%s{channel=\"%u\",name=\"%s\"} %.9g\n",
+                       name, ch, __summaries[ch].name, value);
+        }
+    }
+    err = pthread_mutex_unlock(&__summary_mutex);
+    assert(0 == err);
+}
+
+static void format_rt_metrics(text_buf_t *buf) {
+    uint64_t cumulative = 0;
+
+    metric_header(buf, "pmlab_rt_memory_locked", "gauge",
+                  "1 if the daemon's memory is locked (mlockall).");
+    buf_printf(buf, "pmlab_rt_memory_locked %"PRIu64"\n",
+               STATS_GET(stats_rt.memory_locked));
+    metric_header(buf, "pmlab_rt_acquisition_priority", "gauge",
+                  "SCHED_FIFO priority of the acquisition thread or 0.");
+    buf_printf(buf, "pmlab_rt_acquisition_priority %"PRIu64"\n",
+               STATS_GET(stats_rt.acquisition_priority));
+    metric_header(buf, "pmlab_block_pool_blocks", "gauge",
+                  "Pre-faulted blocks in the pool.");
+    buf_printf(buf, "pmlab_block_pool_blocks %"PRIu64"\n",
+               STATS_GET(stats_rt.pool_blocks));
+    metric_header(buf, "pmlab_block_pool_free", "gauge",
+                  "Blocks of the pool not in use.");
+    buf_printf(buf, "pmlab_block_pool_free %"PRIu64"\n",
+               STATS_GET(stats_rt.pool_free));
+    metric_header(buf, "pmlab_block_pool_huge_pages", "gauge",
+                  "1 if the pool is backed by huge pages.");
+    buf_printf(buf, "pmlab_block_pool_huge_pages %"PRIu64"\n",
+               STATS_GET(stats_rt.pool_huge_pages));
+    metric_header(buf, "pmlab_block_pool_misses_total", "counter",
+                  "Blocks allocated because the pool was empty.");
+    buf_printf(buf, "pmlab_block_pool_misses_total %"PRIu64"\n",
+               STATS_GET(stats_rt.pool_misses));
+    metric_header(buf, "pmlab_acquisition_involuntary_switches_total",
+                  "counter", "Times the acquisition thread was preempted.");
+    buf_printf(buf, "pmlab_acquisition_involuntary_switches_total "
+               "%"PRIu64"\n", STATS_GET(stats_rt.involuntary_switches));
+
+    metric_header(buf, "pmlab_acquisition_wakeup_latency_seconds",
+                  "histogram", "Time from the last sample of a block being "
+                  "acquired until the acquisition thread got it.");
+    for(unsigned int b = 0; b < STATS_LATENCY_BUCKETS; b++) {
+        cumulative += STATS_GET(stats_rt.wakeup_buckets[b]);
+        buf_printf(buf, "pmlab_acquisition_wakeup_latency_seconds_bucket"
+                   "{le=\"%.6f\"} %"PRIu64"\n",
+                   (1000ULL << b) / (double)TIME_S, cumulative);
+    }
+    buf_printf(buf, "pmlab_acquisition_wakeup_latency_seconds_bucket"
+               "{le=\"+Inf\"} %"PRIu64"\n", STATS_GET(stats_rt.wakeups));
+    buf_printf(buf, "pmlab_acquisition_wakeup_latency_seconds_sum %.9f\n",
+               STATS_GET(stats_rt.wakeup_nanos) / (double)TIME_S);
+    buf_printf(buf, "pmlab_acquisition_wakeup_latency_seconds_count "
+               "%"PRIu64"\n", STATS_GET(stats_rt.wakeups));
+    metric_header(buf, "pmlab_acquisition_wakeup_latency_max_seconds",
+                  "gauge", "Longest wakeup latency of the acquisition thread.");
+    buf_printf(buf, "pmlab_acquisition_wakeup_latency_max_seconds %.9f\n",
+               STATS_GET(stats_rt.wakeup_max_nanos) / (double)TIME_S);
+}
+
+static void format_marker_metrics(text_buf_t *buf) {
+    metric_header(buf, "pmlab_markers_received_total", "counter",
+                  "Markers received on the marker port.");
+    buf_printf(buf, "pmlab_markers_received_total %"PRIu64"\n",
+               STATS_GET(stats_markers.received));
+    metric_header(buf, "pmlab_markers_delivered_total", "counter",
+                  "Markers sent along with a block.");
+    buf_printf(buf, "pmlab_markers_delivered_total %"PRIu64"\n",
+               STATS_GET(stats_markers.delivered));
+    metric_header(buf, "pmlab_markers_dropped_total", "counter",
+                  "Markers malformed or without room in the queue or block.");
+    buf_printf(buf, "pmlab_markers_dropped_total %"PRIu64"\n",
+               STATS_GET(stats_markers.dropped));
+}
+
+static void format_energy_metrics(text_buf_t *buf) {
+    metric_header(buf, "pmlab_energy_sessions_open", "gauge",
+                  "Energy accounting sessions open.");
+    buf_printf(buf, "pmlab_energy_sessions_open %"PRIu64"\n",
+               STATS_GET(stats_energy.open));
+    metric_header(buf, "pmlab_energy_sessions_total", "counter",
+                  "Energy accounting sessions closed.");
+    buf_printf(buf, "pmlab_energy_sessions_total %"PRIu64"\n",
+               STATS_GET(stats_energy.closed));
+}
+
+static void format_uring_metrics(text_buf_t *buf) {
+    metric_header(buf, "pmlab_uring_dropped_blocks_total", "counter",
+                  "Blocks not handed to the io_uring sender, it was behind.");
+    buf_printf(buf, "pmlab_uring_dropped_blocks_total %"PRIu64"\n",
+               STATS_GET(stats_uring.dropped_blocks));
+}
+
+static void format_metrics(text_buf_t *buf) {
+    stats_client_t *c;
+    stats_client_t total;
+    unsigned int num_clients = 0;
+    int err;
+
+    metric_header(buf, "pmlab_blocks_acquired_total", "counter",
+                  "Blocks read from the data acquisition device.");
+    buf_printf(buf, "pmlab_blocks_acquired_total %"PRIu64"\n",
+               STATS_GET(__blocks_acquired));
+    metric_header(buf, "pmlab_daq_read_seconds_total", "counter",
+                  "Time spent waiting for and reading from the device.");
+    buf_printf(buf, "pmlab_daq_read_seconds_total %.9f\n",
+               STATS_GET(__daq_read_nanos) / (double)TIME_S);
+
+    format_pipeline_metrics(buf);
+    format_rt_metrics(buf);
+    format_marker_metrics(buf);
+    format_energy_metrics(buf);
+    format_uring_metrics(buf);
+
+    err = pthread_mutex_lock(&__stats_mutex);
+    assert(0 == err);
+
+    total = __retired;
+    for(c = __clients; NULL != c; c = c->next) {
+        total.bytes_sent += STATS_GET(c->bytes_sent);
+        total.frames_sent += STATS_GET(c->frames_sent);
+        total.encode_nanos += STATS_GET(c->encode_nanos);
+        total.drops += STATS_GET(c->drops);
+        total.zerocopy_frames += STATS_GET(c->zerocopy_frames);
+        total.zerocopy_copied += STATS_GET(c->zerocopy_copied);
+        total.captures += STATS_GET(c->captures);
+        total.captures_dropped += STATS_GET(c->captures_dropped);
+        num_clients++;
+    }
+
+    metric_header(buf, "pmlab_clients", "gauge", "Connected clients.");
+    buf_printf(buf, "pmlab_clients %u\n", num_clients);
+    metric_header(buf, "pmlab_drops_total", "counter",
+                  "Clients dropped because their send queue overflowed.");
+    buf_printf(buf, "pmlab_drops_total %"PRIu64"\n", total.drops);
+    metric_header(buf, "pmlab_bytes_sent_total", "counter",
+                  "Bytes sent to all clients.");
+    buf_printf(buf, "pmlab_bytes_sent_total %"PRIu64"\n", total.bytes_sent);
+    metric_header(buf, "pmlab_frames_sent_total", "counter",
+                  "Data set frames sent to all clients.");
+    buf_printf(buf, "pmlab_frames_sent_total %"PRIu64"\n", total.frames_sent);
+    metric_header(buf, "pmlab_encode_seconds_total", "counter",
+                  "Time spent encoding data sets for all clients.");
+    buf_printf(buf, "pmlab_encode_seconds_total %.9f\n",
+               total.encode_nanos / (double)TIME_S);
+    metric_header(buf, "pmlab_zerocopy_frames_total", "counter",
+                  "Frames sent without copying them into the kernel.");
+    buf_printf(buf, "pmlab_zerocopy_frames_total %"PRIu64"\n",
+               total.zerocopy_frames);
+    metric_header(buf, "pmlab_zerocopy_copied_total", "counter",
+                  "Clients the kernel copied zerocopy frames for anyway.");
+    buf_printf(buf, "pmlab_zerocopy_copied_total %"PRIu64"\n",
+               total.zerocopy_copied);
+    metric_header(buf, "pmlab_captures_total", "counter",
+                  "Captures the triggers of clients sent.");
+    buf_printf(buf, "pmlab_captures_total %"PRIu64"\n", total.captures);
+    metric_header(buf, "pmlab_captures_dropped_total", "counter",
+                  "Captures that didn't fit into the send queue.");
+    buf_printf(buf, "pmlab_captures_dropped_total %"PRIu64"\n",
+               total.captures_dropped);
+
+    metric_header(buf, "pmlab_client_bytes_sent_total", "counter",
+                  "Bytes sent per client.");
+    for(c = __clients; NULL != c; c = c->next) {
+        buf_printf(buf, "pmlab_client_bytes_sent_total{client=\"%s\"} "
+                   "%"PRIu64"\n", c->name, STATS_GET(c->bytes_sent));
+    }
+    metric_header(buf, "pmlab_client_frames_sent_total", "counter",
+                  "Data set frames sent per client.");
+    for(c = __clients; NULL != c; c = c->next) {
+        buf_printf(buf, "pmlab_client_frames_sent_total{client=\"%s\"} "
+                   "%"PRIu64"\n", c->name, STATS_GET(c->frames_sent));
+    }
+    metric_header(buf, "pmlab_client_encode_seconds_total", "counter",
+                  "Time spent encoding data sets per client.");
+    for(c = __clients; NULL != c; c = c->next) {
+        buf_printf(buf, "pmlab_client_encode_seconds_total{client=\"%s\"} "
+                   "%.9f\n", c->name,
+                   STATS_GET(c->encode_nanos) / (double)TIME_S);
+    }
+    metric_header(buf, "pmlab_client_queue_depth", "gauge",
+                  "Blocks waiting in the send queue per client.");
+    for(c = __clients; NULL != c; c = c->next) {
+        buf_printf(buf, "pmlab_client_queue_depth{client=\"%s\"} "
+                   "%"PRIu64"\n", c->name, STATS_GET(c->queue_depth));
+    }
+
+    err = pthread_mutex_unlock(&__stats_mutex);
+    assert(0 == err);
+}
+
+/*
+ * HTTP LISTENER
+ */
+static void set_timeouts(int conn) {
+    struct timeval timeout = { STATS_TIMEOUT_MS / 1000,
+                               (STATS_TIMEOUT_MS % 1000) * 1000 };
+
+    setsockopt(conn, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(conn, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+}
+
+static void serve_metrics(int conn) {
+    char request[STATS_REQUEST_SIZE];
+    struct pollfd poll_cfg = { .fd = conn, .events = POLLIN };
+    text_buf_t body = { .data = NULL, .len = 0, .size = 0 };
+    char header[128];
+    int header_len;
+    ssize_t err;
+
+    set_timeouts(conn);
+    /* we don't care about the request itself, every path returns metrics */
+    if(0 < poll(&poll_cfg, 1, STATS_TIMEOUT_MS)) {
+        err = read(conn, request, sizeof(request));
+        (void)err;
+    }
+
+    format_metrics(&body);
+
+    header_len = snprintf(header, sizeof(header),
+                          "HTTP/1.0 200 OK\r\n"
+                          "Content-Type: text/plain; version=0.0.4\r\n"
+                          "Content-Length: %zu\r\n"
+                          "Connection: close\r\n\r\n",
+                          body.len);
+    assert(0 < header_len && header_len < sizeof(header));
+
+    err = full_write(conn, header, header_len);
+    if(header_len == err) {
+        full_write(conn, body.data, body.len);
+    }
+
+    free(body.data);
+}
+
+void *stats_thread_main(void *unused) {
+    struct sockaddr_in servaddr;
+    struct pollfd poll_cfg[2];
+    int err;
+    int conn;
+    int sock_opt = 1;
+    const int server_sock = socket(AF_INET, SOCK_STREAM, 0);
+    assert(0 <= server_sock);
+
+    err = setsockopt(server_sock,
+                     SOL_SOCKET,
+                     SO_REUSEADDR,
+                     &sock_opt,
+                     sizeof(sock_opt));
+    assert(0 == err);
+
+    memset(&servaddr, 0, sizeof(servaddr));
+    servaddr.sin_family = AF_INET;
+    servaddr.sin_addr.s_addr = htonl(INADDR_ANY);
+    servaddr.sin_port = htons(STATS_PORT);
+
+    err = bind(server_sock, (struct sockaddr *) &servaddr, sizeof(servaddr));
+    if(0 != err) {
+        /* metrics are optional, keep acquiring data without them */
+        printf("WARNING: metrics disabled, bind: %s\n", strerror(errno));
+        close(server_sock);
+        return NULL;
+    }
+
+    err = listen(server_sock, STATS_LISTEN_QUEUE_LEN);
+    assert(0 <= err);
+
+    poll_cfg[0].fd = shutdown_fd();
+    poll_cfg[0].events = POLLIN;
+    poll_cfg[1].fd = server_sock;
+    poll_cfg[1].events = POLLIN;
+
+    while(running) {
+        err = poll(poll_cfg, 2, -1);
+        if (-1 == err && EINTR == errno) {
+            continue;
+        }
+        assert(0 < err);
+        if(0 == (poll_cfg[1].revents & POLLIN)) {
+            continue;
+        }
+
+        conn = accept(server_sock, NULL, NULL);
+        if(0 > conn) {
+            continue;
+        }
+        serve_metrics(conn);
+        close(conn);
+    }
+
+    err = close(server_sock);
+    assert(0 == err);
+    printf("metrics socket closed\n");
+
+    return NULL;
+}
+/* vim: set fileencoding=utf8 : */
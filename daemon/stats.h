@@ -0,0 +1,133 @@
+/*
+ *  Records analog data from a NI USB-6218 and send it to connected clients
+ *
+ *  Copyright (C)2011-2012, Johannes Weiß <weiss@tux4u.de>
+ *                        , Jonathan Dimond <jonny@dimond.de>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdint.h>
+
+#define STATS_PORT 12346
+
+/* Counters are only ever written by the thread owning them and read by the
+ * metrics thread, so relaxed atomics are sufficient and no data path lock
+ * has to be taken while scraping. */
+#define STATS_ADD(counter, value) \
+    __atomic_add_fetch(&(counter), (value), __ATOMIC_RELAXED)
+#define STATS_SET(counter, value) \
+    __atomic_store_n(&(counter), (value), __ATOMIC_RELAXED)
+#define STATS_GET(counter) \
+    __atomic_load_n(&(counter), __ATOMIC_RELAXED)
+
+typedef struct stats_client {
+    char name[64];
+    uint64_t bytes_sent;
+    uint64_t frames_sent;
+    uint64_t encode_nanos;
+    uint64_t queue_depth;
+    uint64_t drops;
+    uint64_t zerocopy_frames;
+    uint64_t zerocopy_copied;
+    uint64_t captures;          /* of the client's trigger */
+    uint64_t captures_dropped;  /* didn't fit into the send queue */
+    struct stats_client *next;
+} stats_client_t;
+
+/* the stages of pipeline.h, written by its workers and the acquisition
+ * thread */
+typedef struct {
+    uint64_t workers;
+    uint64_t groups;          /* channel selections encoded for */
+    uint64_t queued;          /* tasks waiting for a worker */
+    uint64_t blocks;
+    uint64_t tasks;
+    uint64_t steals;
+    uint64_t dropped_tasks;   /* the queues were full */
+    uint64_t transform_nanos;
+    uint64_t encode_nanos;
+    uint64_t encoded_bytes;
+} stats_pipeline_t;
+
+extern stats_pipeline_t stats_pipeline;
+
+/* wakeup latency buckets, the first up to 1us, each twice the previous */
+#define STATS_LATENCY_BUCKETS 20
+
+/* the real-time runtime (rt.h) and the wakeups of the acquisition thread */
+typedef struct {
+    uint64_t memory_locked;
+    uint64_t acquisition_priority;  /* SCHED_FIFO or 0 */
+    uint64_t pool_blocks;
+    uint64_t pool_free;
+    uint64_t pool_huge_pages;
+    uint64_t pool_misses;           /* blocks allocated, the pool was empty */
+    uint64_t involuntary_switches;  /* of the acquisition thread */
+    uint64_t wakeups;
+    uint64_t wakeup_nanos;
+    uint64_t wakeup_max_nanos;
+    uint64_t wakeup_buckets[STATS_LATENCY_BUCKETS];
+} stats_rt_t;
+
+extern stats_rt_t stats_rt;
+
+/* the markers of markers.h, written by the marker and acquisition threads */
+typedef struct {
+    uint64_t received;
+    uint64_t delivered;
+    uint64_t dropped;   /* malformed, queue or block full */
+} stats_markers_t;
+
+extern stats_markers_t stats_markers;
+
+/* the sessions of energy.h, written by the control thread */
+typedef struct {
+    uint64_t open;
+    uint64_t closed;
+} stats_energy_t;
+
+extern stats_energy_t stats_energy;
+
+/* the io_uring sender of uring_sender.h, written by the acquisition thread */
+typedef struct {
+    uint64_t dropped_blocks;    /* the sender thread was behind */
+} stats_uring_t;
+
+extern stats_uring_t stats_uring;
+
+uint64_t stats_now_nanos(void);
+
+stats_client_t *stats_register_client(int fd);
+void stats_unregister_client(stats_client_t *client);
+
+void stats_block_acquired(uint64_t daq_read_nanos);
+
+/* how late the acquisition thread got a block, see rt_wakeup */
+void stats_wakeup(uint64_t latency_nanos);
+
+/* calibrated summary of a channel of the latest block */
+void stats_channel_summary(unsigned int channel,
+                           const char *name,
+                           double min,
+                           double max,
+                           double mean);
+
+void *stats_thread_main(void *unused);
+
+#endif
+/* vim: set fileencoding=utf8 : */
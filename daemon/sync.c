@@ -30,18 +30,24 @@
 #include <sys/time.h>
 #include <inttypes.h>
 #include <stdlib.h>
+#ifndef __MACH__
+#include <sys/eventfd.h>
+#endif
 
 #include <pbl.h>
 
 #include "common.h"
 #include "daemon.h"
 #include "sync.h"
+#include "rt.h"
 
 #define START_TIMING(t) (t) = time(NULL)
 #define STOP_TIMING(t) (t) = (time(NULL) - (t))
-#define PRINT_TIMING(t,n) printf("[%lu] "n": %lds\n", \
-                                 (unsigned long int)pthread_self(), \
-                                 (long int)(t))
+#define PRINT_TIMING(t,n) if(verbose) { \
+                              printf("[%lu] "n": %lds\n", \
+                                     (unsigned long int)pthread_self(), \
+                                     (long int)(t)); \
+                          }
 
 static pthread_mutex_t __mutex = PTHREAD_MUTEX_INITIALIZER;
 
@@ -58,6 +64,11 @@ static PblSet *__alive_handler_set = NULL; /* all handlers that are alive */
 static PblSet *__dead_handler_set = NULL; /* all handlers that are dead
                                              (pthread_joinable) */
 
+/* readable as soon as the daemon shuts down, [0] to poll, [1] to write */
+static int __shutdown_fds[2] = { -1, -1 };
+static struct timespec __shutdown_deadline;
+static bool __acquisition_stopped = false;
+
 /* __done_handler_set + __pending_handler_set = __active_handler_set
  * __active_handler_set € __alive_handler_set
  */
@@ -93,6 +104,8 @@ static int pthread_compare(const void *prev, const void *next) {
 }
 
 void init_sync(void) {
+    rt_mutex_init(&__mutex);
+
     __pending_handler_set = pblSetNewHashSet();
     __done_handler_set = pblSetNewHashSet();
     __active_handler_set = pblSetNewHashSet();
@@ -110,6 +123,15 @@ void init_sync(void) {
     pblSetSetHashValueFunction(__active_handler_set, pthread_hash);
     pblSetSetHashValueFunction(__alive_handler_set, pthread_hash);
     pblSetSetHashValueFunction(__dead_handler_set, pthread_hash);
+
+#ifndef __MACH__
+    __shutdown_fds[0] = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    __shutdown_fds[1] = __shutdown_fds[0];
+    assert(0 <= __shutdown_fds[0]);
+#else
+    int err = pipe(__shutdown_fds);
+    assert(0 == err);
+#endif
 }
 
 void finish_sync(void) {
@@ -118,6 +140,11 @@ void finish_sync(void) {
     pblSetFree(__active_handler_set);
     pblSetFree(__alive_handler_set);
     pblSetFree(__dead_handler_set);
+
+    close(__shutdown_fds[0]);
+    if(__shutdown_fds[1] != __shutdown_fds[0]) {
+        close(__shutdown_fds[1]);
+    }
 }
 
 static void debug_set(PblSet *set) {
@@ -155,34 +182,66 @@ static void debug_sets(const char *debug_str) {
     fflush(stdout);
 }
 
-void abs_wait_timeout(struct timespec *abs_timeout) {
+/*
+ * SHUTDOWN
+ */
+int shutdown_fd(void) {
+    return __shutdown_fds[0];
+}
+
+void request_shutdown(void) {
+    const uint64_t one = 1;
+    ssize_t res;
+
+    /* only async-signal-safe calls, used by the signal handler */
+    running = false;
+    res = write(__shutdown_fds[1], &one, sizeof(one));
+    (void)res;
+}
+
+void begin_shutdown(void) {
+    int err;
+
+    err = pthread_mutex_lock(&__mutex);
+    assert(0 == err);
+
 #ifndef __MACH__
-    struct timespec wait_timeout = WAIT_TIMEOUT;
-    int err = clock_gettime(CLOCK_REALTIME, abs_timeout);
-    assert(0 == err);
-    if(abs_timeout->tv_nsec + wait_timeout.tv_nsec >= 1L*TIME_S) {
-        /* take care tv_nsec does not get greater or equal one second */
-        abs_timeout->tv_sec += wait_timeout.tv_sec + 1;
-        abs_timeout->tv_nsec += (wait_timeout.tv_nsec - (1L*TIME_S));
-        assert(abs_timeout->tv_nsec + wait_timeout.tv_nsec < (1L*TIME_S));
-    } else {
-        abs_timeout->tv_sec += wait_timeout.tv_sec;
-        abs_timeout->tv_nsec += wait_timeout.tv_nsec;
-    }
+    err = clock_gettime(CLOCK_REALTIME, &__shutdown_deadline);
+    assert(0 == err);
 #else
     struct timeval tv;
-    struct timespec ts;
     gettimeofday(&tv, NULL);
-    ts.tv_sec = tv.tv_sec + 1;
-    ts.tv_nsec = 0;
-    *abs_timeout = ts;
+    __shutdown_deadline.tv_sec = tv.tv_sec;
+    __shutdown_deadline.tv_nsec = 1000L * tv.tv_usec;
 #endif
+    __shutdown_deadline.tv_sec += SHUTDOWN_TIMEOUT_S;
+
+    /* everybody waiting re-checks running */
+    err = pthread_cond_broadcast(&__cond_read);
+    assert(0 == err);
+    err = pthread_cond_broadcast(&__cond_dead_handler);
+    assert(0 == err);
+
+    err = pthread_mutex_unlock(&__mutex);
+    assert(0 == err);
+}
+
+void shutdown_deadline(struct timespec *abs_deadline) {
+    int err;
+
+    err = pthread_mutex_lock(&__mutex);
+    assert(0 == err);
+    *abs_deadline = __shutdown_deadline;
+    err = pthread_mutex_unlock(&__mutex);
+    assert(0 == err);
 }
 
+/*
+ * BARRIER
+ */
 void wait_read_barrier(void) {
     int err;
     time_t timer;
-    struct timespec abs_timeout;
 
     START_TIMING(timer);
     err = pthread_mutex_lock(&__mutex);
@@ -190,17 +249,16 @@ void wait_read_barrier(void) {
 
     while(running &&
           pblSetEquals(__done_handler_set, __active_handler_set) == 0) {
-        abs_wait_timeout(&abs_timeout);
-        err = pthread_cond_timedwait(&__cond_read, &__mutex, &abs_timeout);
-        assert(0 == err || ETIMEDOUT == err);
-
-        if(ETIMEDOUT == err) {
-            debug_sets("wait_read_barrier (TIMEOUT!)");
-        }
+        err = pthread_cond_wait(&__cond_read, &__mutex);
+        assert(0 == err);
     }
 
-    assert(0 == pblSetSize(__pending_handler_set));
-    assert(pblSetEquals(__done_handler_set, __active_handler_set) > 0);
+    if(!running) {
+        debug_sets("wait_read_barrier (shutting down)");
+    } else {
+        assert(0 == pblSetSize(__pending_handler_set));
+        assert(pblSetEquals(__done_handler_set, __active_handler_set) > 0);
+    }
 
     err = pthread_mutex_unlock(&__mutex);
     assert(0 == err);
@@ -242,34 +300,51 @@ void set_ready(void) {
     notify_read_barrier();
 }
 
-void wait_data_available(void) {
+bool wait_data_available(void) {
     int err;
-    struct timespec abs_timeout;
+    bool ret;
     time_t timer;
     pthread_t self = pthread_self();
 
     START_TIMING(timer);
     err = pthread_mutex_lock(&__mutex);
     assert(0 == err);
-    while(running &&
+    while(!__acquisition_stopped &&
           0 == pblSetContains(__pending_handler_set, &self)) {
-        /* waiting here as long daemon is running AND
+        /* waiting here as long as data is acquired AND
          * pending does not contain our handler */
-        abs_wait_timeout(&abs_timeout);
-        err = pthread_cond_timedwait(&__cond_data, &__mutex, &abs_timeout);
-        assert(0 == err || ETIMEDOUT == err);
-
-        if(ETIMEDOUT == err) {
-            debug_sets("wait_data_available (TIMEOUT!)");
-        }
+        err = pthread_cond_wait(&__cond_data, &__mutex);
+        assert(0 == err);
     }
-    assert(!running || 0 != pblSetContains(__pending_handler_set, &self));
+    /* the last block read before the shutdown is still handed out */
+    ret = 0 != pblSetContains(__pending_handler_set, &self);
 
     err = pthread_mutex_unlock(&__mutex);
     assert(0 == err);
 
     STOP_TIMING(timer);
     PRINT_TIMING(timer, "wait_data_available");
+    return ret;
+}
+
+void stop_acquisition(void) {
+    int err;
+
+    err = pthread_mutex_lock(&__mutex);
+    assert(0 == err);
+
+    __acquisition_stopped = true;
+    err = pthread_cond_broadcast(&__cond_data);
+    assert(0 == err);
+
+    /* the handlers either copy the last block or leave */
+    while(0 < pblSetSize(__pending_handler_set)) {
+        err = pthread_cond_wait(&__cond_read, &__mutex);
+        assert(0 == err);
+    }
+
+    err = pthread_mutex_unlock(&__mutex);
+    assert(0 == err);
 }
 
 void notify_data_available(void) {
@@ -375,11 +450,19 @@ pthread_t *wait_dead_handler(void) {
     err = pthread_mutex_lock(&__mutex);
     assert(0 == err);
 
-    while(0 == pblSetSize(__dead_handler_set)) {
+    while(0 == pblSetSize(__dead_handler_set) &&
+          (running || 0 < pblSetSize(__alive_handler_set))) {
         err = pthread_cond_wait(&__cond_dead_handler, &__mutex);
         assert(0 == err);
     }
 
+    if(0 == pblSetSize(__dead_handler_set)) {
+        /* shut down and every handler joined */
+        err = pthread_mutex_unlock(&__mutex);
+        assert(0 == err);
+        return NULL;
+    }
+
     dead_thread = (pthread_t *)pblSetGet(__dead_handler_set, 0);
     assert(NULL != dead_thread);
 
@@ -391,20 +474,4 @@ pthread_t *wait_dead_handler(void) {
 
     return dead_thread;
 }
-
-bool have_alive_threads(void) {
-    bool ret;
-    int err;
-
-    err = pthread_mutex_lock(&__mutex);
-    assert(0 == err);
-
-    ret = pblSetSize(__alive_handler_set);
-
-    err = pthread_mutex_unlock(&__mutex);
-    assert(0 == err);
-
-    assert(ret >= 0);
-    return ret > 0;
-}
 /* vim: set fileencoding=utf8 : */
@@ -23,21 +23,38 @@
 
 #include <time.h>
 #include <pthread.h>
+#include <stdbool.h>
 
 #define TIME_MS ((unsigned long int)1000000L)
 #define TIME_S ((unsigned long int)(1000L*(TIME_MS)))
 
-#define WAIT_TIMEOUT ((struct timespec){1, 500L*TIME_MS})
-
-void abs_wait_timeout(struct timespec *abs_timeout);
+/* time clients get to receive what is buffered for them on shutdown */
+#define SHUTDOWN_TIMEOUT_S 2
 
 void init_sync(void);
 void finish_sync(void);
 
+/*
+ * Shutting down: request_shutdown (async-signal-safe) clears running and
+ * makes shutdown_fd readable, so threads sleeping in poll wake up. The main
+ * thread then calls begin_shutdown, which wakes the acquisition thread and
+ * starts the SHUTDOWN_TIMEOUT_S deadline for draining the client queues
+ * (shutdown_deadline, CLOCK_REALTIME). Once the acquisition thread has
+ * handed out its last block, it calls stop_acquisition, which returns when
+ * every handler has copied it (so the block may be freed) and makes the
+ * handlers finish.
+ */
+int shutdown_fd(void);
+void request_shutdown(void);
+void begin_shutdown(void);
+void shutdown_deadline(struct timespec *abs_deadline);
+
 void wait_read_barrier(void);
 void notify_read_barrier(void);
 
-void wait_data_available(void);
+/* returns false once the acquisition stopped and no block is left */
+bool wait_data_available(void);
+void stop_acquisition(void);
 void notify_data_available(void);
 void set_ready(void);
 
@@ -46,7 +63,7 @@ void dec_available_handlers(void);
 
 void reset_ready_handlers(void);
 
-bool have_alive_threads(void);
+/* returns NULL once shut down and no handler is left to join */
 pthread_t *wait_dead_handler(void);
 
 #endif
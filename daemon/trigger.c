@@ -0,0 +1,464 @@
+/*
+ *  Records analog data from a NI USB-6218 and send it to connected clients
+ *
+ *  Copyright (C)2011-2012, Johannes Weiß <weiss@tux4u.de>
+ *                        , Jonathan Dimond <jonny@dimond.de>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <strings.h>
+#include <assert.h>
+#include <errno.h>
+#include <math.h>
+
+#include "sync.h"
+#include "trigger.h"
+
+/* samples scanned per step before looking for the hit itself */
+#define SCAN_CHUNK 64
+
+typedef enum {
+    TRIGGER_LEVEL,
+    TRIGGER_EDGE,
+    TRIGGER_SLOPE,
+    TRIGGER_ENERGY
+} trigger_kind_t;
+
+static const char *__kind_names[] = { "level", "edge", "slope", "energy" };
+
+struct trigger {
+    /* as specified */
+    trigger_kind_t kind;
+    unsigned int channel;      /* of the daemon */
+    double threshold;
+    double dir;                /* 1 up, -1 down */
+    double window_s;
+    double pre_s;
+    double post_s;
+    double holdoff_s;
+    unsigned int num_channels;
+    unsigned int *channels;
+
+    /* for the configuration of generation, in samples per channel */
+    bool started;
+    uint64_t generation;
+    unsigned int sampling_rate;
+    uint64_t pre;
+    uint64_t post;
+    uint64_t holdoff;
+    uint64_t window;
+    /* num_channels rings of capacity samples, the last pre + post samples
+     * survive a block */
+    double *history;
+    uint64_t capacity;
+    uint64_t written;          /* samples since the configuration started */
+    uint64_t armed_from;       /* the first sample a hit may be at */
+    uint64_t pending[TRIGGER_MAX_CAPTURES];  /* hits, capture incomplete */
+    unsigned int num_pending;
+    double last;               /* the previous sample of the channel */
+    double *window_ring;       /* energy: the last window samples */
+};
+
+/*
+ * PARSING
+ */
+static int parse_seconds(const char *value, double *seconds) {
+    char *end;
+
+    errno = 0;
+    *seconds = strtod(value, &end);
+    return 0 == errno && end != value && '\0' == *end &&
+           0 <= *seconds && *seconds < 3600 ? 0 : -1;
+}
+
+static int parse_spec(trigger_t *t, char *spec) {
+    char *saveptr = NULL;
+    char *tok = strtok_r(spec, ",", &saveptr);
+    char *value, *end;
+    unsigned int k;
+    long ch;
+
+    for(k = 0; NULL != tok && k <= TRIGGER_ENERGY; k++) {
+        if(0 == strcasecmp(__kind_names[k], tok)) {
+            break;
+        }
+    }
+    if(NULL == tok || k > TRIGGER_ENERGY) {
+        return -1;
+    }
+    t->kind = (trigger_kind_t)k;
+
+    while(NULL != (tok = strtok_r(NULL, ",", &saveptr))) {
+        value = strchr(tok, '=');
+        if(NULL == value) {
+            return -1;
+        }
+        *value++ = '\0';
+
+        if(0 == strcasecmp("ch", tok)) {
+            errno = 0;
+            ch = strtol(value, &end, 10);
+            if(0 != errno || end == value || '\0' != *end || 0 > ch) {
+                return -1;
+            }
+            t->channel = ch;
+        } else if(0 == strcasecmp("thr", tok)) {
+            errno = 0;
+            t->threshold = strtod(value, &end);
+            if(0 != errno || end == value || '\0' != *end ||
+               !isfinite(t->threshold)) {
+                return -1;
+            }
+        } else if(0 == strcasecmp("dir", tok)) {
+            if(0 == strcasecmp("up", value)) {
+                t->dir = 1;
+            } else if(0 == strcasecmp("down", value)) {
+                t->dir = -1;
+            } else {
+                return -1;
+            }
+        } else if(0 == strcasecmp("window", tok)) {
+            if(0 != parse_seconds(value, &t->window_s) || 0 == t->window_s) {
+                return -1;
+            }
+        } else if(0 == strcasecmp("pre", tok)) {
+            if(0 != parse_seconds(value, &t->pre_s)) {
+                return -1;
+            }
+        } else if(0 == strcasecmp("post", tok)) {
+            if(0 != parse_seconds(value, &t->post_s)) {
+                return -1;
+            }
+        } else if(0 == strcasecmp("holdoff", tok)) {
+            if(0 != parse_seconds(value, &t->holdoff_s)) {
+                return -1;
+            }
+        } else {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * HISTORY
+ */
+static uint64_t to_samples(double seconds, unsigned int sampling_rate) {
+    return (uint64_t)llround(seconds * sampling_rate);
+}
+
+/* starts over for the configuration of the block */
+static void reset(trigger_t *t, const daq_config_t *config) {
+    const uint64_t max_capture = MAX_BLOCK_SAMPLES / t->num_channels;
+
+    t->started = true;
+    t->generation = config->generation;
+    t->sampling_rate = config->sampling_rate;
+    t->pre = to_samples(t->pre_s, t->sampling_rate);
+    t->post = to_samples(t->post_s, t->sampling_rate);
+    t->holdoff = to_samples(t->holdoff_s, t->sampling_rate);
+    t->window = to_samples(t->window_s, t->sampling_rate);
+    if(0 == t->post) {
+        /* the capture holds the hit at least */
+        t->post = 1;
+    }
+    if(0 == t->window) {
+        t->window = 1;
+    }
+    if(t->pre + t->post > max_capture) {
+        t->pre = t->pre * max_capture / (t->pre + t->post);
+        t->post = max_capture - t->pre;
+        printf("Trigger: captures shortened to %llu+%llu samples\n",
+               (unsigned long long)t->pre, (unsigned long long)t->post);
+    }
+
+    /* a block of the most points any block of the daemon has on top */
+    t->capacity = t->pre + t->post + MAX_BLOCK_SAMPLES / config->num_channels;
+    free(t->history);
+    t->history = malloc(t->num_channels * t->capacity * sizeof(double));
+    assert(NULL != t->history);
+    free(t->window_ring);
+    t->window_ring = NULL;
+    if(TRIGGER_ENERGY == t->kind) {
+        t->window_ring = calloc(t->window, sizeof(double));
+        assert(NULL != t->window_ring);
+    }
+
+    t->written = 0;
+    /* every capture gets its pre samples */
+    t->armed_from = t->pre;
+    t->num_pending = 0;
+    t->last = 0;
+}
+
+/* appends the client's channels of a block to the history */
+static void remember(trigger_t *t,
+                     unsigned int points_per_channel,
+                     const double *analog_data) {
+    const uint64_t pos = t->written % t->capacity;
+    const uint64_t first = points_per_channel < t->capacity - pos ?
+                           points_per_channel : t->capacity - pos;
+    double *ring;
+    const double *src;
+
+    for(unsigned int c = 0; c < t->num_channels; c++) {
+        ring = t->history + c * t->capacity;
+        src = analog_data + t->channels[c] * points_per_channel;
+        memcpy(ring + pos, src, first * sizeof(double));
+        memcpy(ring, src + first,
+               (points_per_channel - first) * sizeof(double));
+    }
+    t->written += points_per_channel;
+}
+
+/* copies the samples [start, start + len) of the history */
+static double *recall(const trigger_t *t, uint64_t start, uint64_t len) {
+    const uint64_t pos = start % t->capacity;
+    const uint64_t first = len < t->capacity - pos ? len : t->capacity - pos;
+    double *samples = malloc(t->num_channels * len * sizeof(double));
+    const double *ring;
+    assert(NULL != samples);
+    assert(start + t->capacity >= t->written && start + len <= t->written);
+
+    for(unsigned int c = 0; c < t->num_channels; c++) {
+        ring = t->history + c * t->capacity;
+        memcpy(samples + c * len, ring + pos, first * sizeof(double));
+        memcpy(samples + c * len + first, ring,
+               (len - first) * sizeof(double));
+    }
+    return samples;
+}
+
+/*
+ * SCANNING
+ */
+static bool hit(const trigger_t *t, double threshold, double prev,
+                double cur) {
+    switch(t->kind) {
+        case TRIGGER_LEVEL:
+            return t->dir * cur > threshold;
+        case TRIGGER_EDGE:
+            return t->dir * cur > threshold && t->dir * prev <= threshold;
+        case TRIGGER_SLOPE:
+            return t->dir * (cur - prev) > threshold;
+        default:
+            assert(false);
+            return false;
+    }
+}
+
+/*
+ * Returns the first sample of x[from, n) a level, edge or slope trigger
+ * hits at or n. The chunks are scanned without branches, so the compiler
+ * vectorizes the loops, only a chunk with a hit is searched sample by
+ * sample.
+ */
+static unsigned int scan(const trigger_t *t,
+                         const double *x,
+                         unsigned int from,
+                         unsigned int n) {
+    const double s = t->dir;
+    /* in the direction of the trigger, slopes per sample */
+    const double threshold = TRIGGER_SLOPE == t->kind ?
+                             t->threshold / t->sampling_rate :
+                             t->dir * t->threshold;
+    unsigned int end;
+    int any;
+
+    if(0 == from && from < n) {
+        if(hit(t, threshold, t->last, x[0])) {
+            return 0;
+        }
+        from = 1;
+    }
+
+    for(unsigned int start = from; start < n; start = end) {
+        end = n - start > SCAN_CHUNK ? start + SCAN_CHUNK : n;
+        any = 0;
+        switch(t->kind) {
+            case TRIGGER_LEVEL:
+                for(unsigned int j = start; j < end; j++) {
+                    any |= s * x[j] > threshold;
+                }
+                break;
+            case TRIGGER_EDGE:
+                for(unsigned int j = start; j < end; j++) {
+                    any |= (s * x[j] > threshold) &
+                           (s * x[j - 1] <= threshold);
+                }
+                break;
+            case TRIGGER_SLOPE:
+                for(unsigned int j = start; j < end; j++) {
+                    any |= s * (x[j] - x[j - 1]) > threshold;
+                }
+                break;
+            default:
+                assert(false);
+        }
+        if(!any) {
+            continue;
+        }
+        for(unsigned int j = start; j < end; j++) {
+            if(hit(t, threshold, x[j - 1], x[j])) {
+                return j;
+            }
+        }
+    }
+    return n;
+}
+
+/*
+ * Energy triggers see every sample to keep the sum over the window, hits
+ * count from armed_from on and are added to the pending ones.
+ */
+static void scan_energy(trigger_t *t,
+                        const double *x,
+                        uint64_t base,
+                        unsigned int n) {
+    /* the integral in samples rather than Vs */
+    const double threshold = t->dir * t->threshold * t->sampling_rate;
+    uint64_t pos = base % t->window;
+    double sum = 0;
+
+    /* summed up again for every block, no error accumulates */
+    for(uint64_t i = 0; i < t->window; i++) {
+        sum += t->window_ring[i];
+    }
+
+    for(unsigned int j = 0; j < n; j++) {
+        sum += x[j] - t->window_ring[pos];
+        t->window_ring[pos] = x[j];
+        pos = pos + 1 == t->window ? 0 : pos + 1;
+
+        if(base + j >= t->armed_from && base + j + 1 >= t->window &&
+           t->dir * sum > threshold &&
+           t->num_pending < TRIGGER_MAX_CAPTURES) {
+            t->pending[t->num_pending++] = base + j;
+            t->armed_from = base + j + t->post + t->holdoff;
+        }
+    }
+}
+
+/*
+ * FUNCTIONALITY
+ */
+trigger_t *trigger_create(const char *spec,
+                          const daq_config_t *config,
+                          unsigned int num_channels,
+                          const unsigned int *channels) {
+    char *copy = strdup(spec);
+    trigger_t *t = calloc(1, sizeof(*t));
+    assert(NULL != copy && NULL != t);
+
+    t->channel = 0 < num_channels ? channels[0] : 0;
+    t->dir = 1;
+    t->window_s = 0.001;
+    t->pre_s = 0.01;
+    t->post_s = 0.01;
+    t->num_channels = num_channels;
+
+    if(0 == num_channels || 0 != parse_spec(t, copy) ||
+       t->channel >= config->num_channels) {
+        free(copy);
+        free(t);
+        return NULL;
+    }
+    free(copy);
+
+    t->channels = malloc(num_channels * sizeof(unsigned int));
+    assert(NULL != t->channels);
+    memcpy(t->channels, channels, num_channels * sizeof(unsigned int));
+
+    printf("Trigger: %s on channel %u, thr %g, %s, pre %gs, post %gs\n",
+           __kind_names[t->kind], t->channel, t->threshold,
+           0 < t->dir ? "up" : "down", t->pre_s, t->post_s);
+    return t;
+}
+
+unsigned int trigger_feed(trigger_t *t,
+                          const daq_config_t *config,
+                          uint64_t timestamp_nanos,
+                          unsigned int points_per_channel,
+                          const double *analog_data,
+                          trigger_capture_t *captures) {
+    const double *x = analog_data + t->channel * points_per_channel;
+    const uint64_t base = t->written;
+    unsigned int num_captures = 0;
+    uint64_t start, len;
+    unsigned int j;
+
+    if(!t->started || config->generation != t->generation) {
+        reset(t, config);
+    }
+    if(0 == points_per_channel) {
+        return 0;
+    }
+
+    remember(t, points_per_channel, analog_data);
+
+    if(TRIGGER_ENERGY == t->kind) {
+        scan_energy(t, x, base, points_per_channel);
+    } else {
+        j = t->armed_from > base ? t->armed_from - base : 0;
+        while(j < points_per_channel &&
+              t->num_pending < TRIGGER_MAX_CAPTURES) {
+            j = scan(t, x, j, points_per_channel);
+            if(j == points_per_channel) {
+                break;
+            }
+            t->pending[t->num_pending++] = base + j;
+            t->armed_from = base + j + t->post + t->holdoff;
+            if(t->armed_from >= base + points_per_channel) {
+                break;
+            }
+            j = t->armed_from - base;
+        }
+    }
+    t->last = x[points_per_channel - 1];
+
+    /* captures are complete once their post samples are in the history */
+    while(0 < t->num_pending && t->pending[0] + t->post <= t->written) {
+        start = t->pending[0] - t->pre;
+        len = t->pre + t->post;
+        captures[num_captures].analog_data = recall(t, start, len);
+        captures[num_captures].points_per_channel = len;
+        captures[num_captures].timestamp_nanos =
+            start >= base ?
+            timestamp_nanos + (start - base) * TIME_S / t->sampling_rate :
+            timestamp_nanos - (base - start) * TIME_S / t->sampling_rate;
+        num_captures++;
+
+        t->num_pending--;
+        memmove(t->pending, t->pending + 1,
+                t->num_pending * sizeof(uint64_t));
+    }
+
+    return num_captures;
+}
+
+void trigger_destroy(trigger_t *t) {
+    free(t->channels);
+    free(t->history);
+    free(t->window_ring);
+    free(t);
+}
+/* vim: set fileencoding=utf8 : */
@@ -0,0 +1,93 @@
+/*
+ *  Records analog data from a NI USB-6218 and send it to connected clients
+ *
+ *  Copyright (C)2011-2012, Johannes Weiß <weiss@tux4u.de>
+ *                        , Jonathan Dimond <jonny@dimond.de>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TRIGGER_H
+#define TRIGGER_H
+
+#include <stdint.h>
+
+#include "common.h"
+#include "daq_config.h"
+
+/*
+ * Triggers of clients only interested in the signal around an event. The
+ * handler of such a client feeds every block to its trigger, which keeps a
+ * history of the client's channels and scans a trigger channel (any of the
+ * daemon's channels) for hits. A hit results in a capture of the client's
+ * channels from pre seconds before to post seconds after it, sent instead
+ * of the blocks.
+ *
+ * A trigger is specified as KIND,KEY=VALUE,... where KIND is one of
+ *
+ *   level   the sample is above (dir=up) or below (dir=down) thr V
+ *   edge    the signal crosses thr V upwards (dir=up) or downwards
+ *   slope   the signal rises (dir=up) or falls faster than thr V/s
+ *   energy  the integral over the last window seconds is above (dir=up) or
+ *           below thr Vs
+ *
+ * and the KEYs are ch (N of the daemon's channel aiN to watch, which the
+ * client need not read, default its first channel), thr, dir, window
+ * (default 0.001), pre and post (default 0.01 each) and holdoff (seconds
+ * after a capture before the trigger is armed again, default 0).
+ * Thresholds apply to the samples as sent, before the calibration. A
+ * capture holds MAX_BLOCK_SAMPLES samples of all channels at most like a
+ * block, longer pre and post times are shortened. Captures don't overlap, a
+ * trigger is armed again after the end of its capture.
+ */
+
+/* captures a block can complete at most */
+#define TRIGGER_MAX_CAPTURES 16
+
+typedef struct trigger trigger_t;
+
+/* a capture of a client's channels, one channel after the other */
+typedef struct {
+    uint64_t timestamp_nanos;    /* of the first sample */
+    unsigned int points_per_channel;
+    double *analog_data;
+} trigger_capture_t;
+
+/*
+ * Parses spec for a client reading channels of the daemon configured with
+ * config. Returns NULL if spec is invalid.
+ */
+trigger_t *trigger_create(const char *spec,
+                          const daq_config_t *config,
+                          unsigned int num_channels,
+                          const unsigned int *channels);
+
+/*
+ * Feeds a block of all channels (analog_data holds one channel after the
+ * other, timestamp_nanos is the one of the block). A block of a new
+ * configuration starts over with an empty history. Writes the captures
+ * completed by the block to captures (TRIGGER_MAX_CAPTURES at most, the
+ * analog_data to be freed by the caller) and returns how many.
+ */
+unsigned int trigger_feed(trigger_t *trigger,
+                          const daq_config_t *config,
+                          uint64_t timestamp_nanos,
+                          unsigned int points_per_channel,
+                          const double *analog_data,
+                          trigger_capture_t *captures);
+
+void trigger_destroy(trigger_t *trigger);
+
+#endif
+/* vim: set fileencoding=utf8 : */
@@ -0,0 +1,217 @@
+/*
+ *  Records analog data from a NI USB-6218 and send it to connected clients
+ *
+ *  Copyright (C)2011-2012, Johannes Weiß <weiss@tux4u.de>
+ *                        , Jonathan Dimond <jonny@dimond.de>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "uring.h"
+
+#if !defined(__MACH__) && defined(__NR_io_uring_setup)
+static int sys_io_uring_setup(unsigned int entries,
+                              struct io_uring_params *p) {
+    return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_io_uring_enter(int fd,
+                              unsigned int to_submit,
+                              unsigned int min_complete,
+                              unsigned int flags) {
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete,
+                        flags, NULL, 0);
+}
+
+static int sys_io_uring_register(int fd,
+                                 unsigned int opcode,
+                                 const void *arg,
+                                 unsigned int nr_args) {
+    return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+int uring_init(uring_t *ring, unsigned int entries) {
+    struct io_uring_params p;
+    char *sq, *cq;
+
+    memset(ring, 0, sizeof(*ring));
+    memset(&p, 0, sizeof(p));
+
+    ring->fd = sys_io_uring_setup(entries, &p);
+    if(0 > ring->fd) {
+        return -1;
+    }
+
+    ring->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+    ring->cq_ring_size = p.cq_off.cqes +
+                         p.cq_entries * sizeof(struct io_uring_cqe);
+    ring->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+
+    ring->sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_POPULATE, ring->fd,
+                         IORING_OFF_SQ_RING);
+    if(MAP_FAILED == ring->sq_ring) {
+        goto err;
+    }
+    ring->cq_ring = mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_POPULATE, ring->fd,
+                         IORING_OFF_CQ_RING);
+    if(MAP_FAILED == ring->cq_ring) {
+        goto err;
+    }
+    ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if(MAP_FAILED == ring->sqes) {
+        goto err;
+    }
+
+    sq = (char *)ring->sq_ring;
+    cq = (char *)ring->cq_ring;
+    ring->sq_entries = p.sq_entries;
+    ring->sq_head = (unsigned int *)(sq + p.sq_off.head);
+    ring->sq_tail = (unsigned int *)(sq + p.sq_off.tail);
+    ring->sq_mask = (unsigned int *)(sq + p.sq_off.ring_mask);
+    ring->sq_array = (unsigned int *)(sq + p.sq_off.array);
+    ring->sq_local_tail = *ring->sq_tail;
+    ring->cq_head = (unsigned int *)(cq + p.cq_off.head);
+    ring->cq_tail = (unsigned int *)(cq + p.cq_off.tail);
+    ring->cq_mask = (unsigned int *)(cq + p.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+
+    return 0;
+
+err:
+    uring_exit(ring);
+    return -1;
+}
+
+struct io_uring_sqe *uring_get_sqe(uring_t *ring) {
+    const unsigned int head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+    struct io_uring_sqe *sqe;
+    unsigned int idx;
+
+    if(ring->sq_local_tail - head >= ring->sq_entries) {
+        return NULL;
+    }
+
+    idx = ring->sq_local_tail & *ring->sq_mask;
+    sqe = &ring->sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    ring->sq_array[idx] = idx;
+    ring->sq_local_tail++;
+
+    return sqe;
+}
+
+int uring_submit(uring_t *ring, unsigned int wait_nr) {
+    const unsigned int to_submit = ring->sq_local_tail - *ring->sq_tail;
+    int res;
+
+    __atomic_store_n(ring->sq_tail, ring->sq_local_tail, __ATOMIC_RELEASE);
+
+    do {
+        res = sys_io_uring_enter(ring->fd,
+                                 to_submit,
+                                 wait_nr,
+                                 0 < wait_nr ? IORING_ENTER_GETEVENTS : 0);
+    } while(0 > res && EINTR == errno);
+
+    return 0 > res ? -errno : res;
+}
+
+bool uring_next_cqe(uring_t *ring,
+                    uint64_t *user_data,
+                    int32_t *res,
+                    uint32_t *flags) {
+    const unsigned int head = *ring->cq_head;
+    const struct io_uring_cqe *cqe;
+
+    if(head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+        return false;
+    }
+
+    cqe = &ring->cqes[head & *ring->cq_mask];
+    *user_data = cqe->user_data;
+    *res = cqe->res;
+    *flags = cqe->flags;
+    __atomic_store_n(ring->cq_head, head + 1, __ATOMIC_RELEASE);
+
+    return true;
+}
+
+int uring_register_buffers(uring_t *ring,
+                           const struct iovec *iovecs,
+                           unsigned int nr) {
+    int res = sys_io_uring_register(ring->fd, IORING_REGISTER_BUFFERS,
+                                    iovecs, nr);
+    return 0 > res ? -errno : 0;
+}
+
+void uring_exit(uring_t *ring) {
+    if(NULL != ring->sqes && MAP_FAILED != (void *)ring->sqes) {
+        munmap(ring->sqes, ring->sqes_size);
+    }
+    if(NULL != ring->cq_ring && MAP_FAILED != ring->cq_ring) {
+        munmap(ring->cq_ring, ring->cq_ring_size);
+    }
+    if(NULL != ring->sq_ring && MAP_FAILED != ring->sq_ring) {
+        munmap(ring->sq_ring, ring->sq_ring_size);
+    }
+    if(0 <= ring->fd) {
+        close(ring->fd);
+    }
+    memset(ring, 0, sizeof(*ring));
+    ring->fd = -1;
+}
+#else
+int uring_init(uring_t *ring, unsigned int entries) {
+    memset(ring, 0, sizeof(*ring));
+    ring->fd = -1;
+    return -1;
+}
+
+struct io_uring_sqe *uring_get_sqe(uring_t *ring) {
+    return NULL;
+}
+
+int uring_submit(uring_t *ring, unsigned int wait_nr) {
+    return -ENOSYS;
+}
+
+bool uring_next_cqe(uring_t *ring,
+                    uint64_t *user_data,
+                    int32_t *res,
+                    uint32_t *flags) {
+    return false;
+}
+
+int uring_register_buffers(uring_t *ring,
+                           const struct iovec *iovecs,
+                           unsigned int nr) {
+    return -ENOSYS;
+}
+
+void uring_exit(uring_t *ring) {
+}
+#endif
+/* vim: set fileencoding=utf8 : */
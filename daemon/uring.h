@@ -0,0 +1,98 @@
+/*
+ *  Records analog data from a NI USB-6218 and send it to connected clients
+ *
+ *  Copyright (C)2011-2012, Johannes Weiß <weiss@tux4u.de>
+ *                        , Jonathan Dimond <jonny@dimond.de>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef URING_H
+#define URING_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/uio.h>
+
+/*
+ * Minimal io_uring wrapper on top of the raw system calls (no liburing
+ * needed). Only available on Linux, uring_init fails everywhere else.
+ */
+
+#ifndef __MACH__
+#include <linux/io_uring.h>
+#else
+struct io_uring_sqe;
+struct io_uring_cqe;
+#endif
+
+typedef struct {
+    int fd;
+    unsigned int sq_entries;
+    unsigned int *sq_head;
+    unsigned int *sq_tail;
+    unsigned int *sq_mask;
+    unsigned int *sq_array;
+    struct io_uring_sqe *sqes;
+    unsigned int sq_local_tail; /* queued, not yet published to the kernel */
+    unsigned int *cq_head;
+    unsigned int *cq_tail;
+    unsigned int *cq_mask;
+    struct io_uring_cqe *cqes;
+
+    void *sq_ring;
+    size_t sq_ring_size;
+    void *cq_ring;
+    size_t cq_ring_size;
+    size_t sqes_size;
+} uring_t;
+
+/*
+ * Sets up a ring with room for entries submissions.
+ * Returns 0 on success, -1 if io_uring is not available.
+ */
+int uring_init(uring_t *ring, unsigned int entries);
+
+/*
+ * Returns a cleared submission queue entry or NULL if the queue is full
+ * (call uring_submit first).
+ */
+struct io_uring_sqe *uring_get_sqe(uring_t *ring);
+
+/*
+ * Submits everything queued and waits for wait_nr completions with a single
+ * system call. Returns the number of entries submitted or -errno.
+ */
+int uring_submit(uring_t *ring, unsigned int wait_nr);
+
+/*
+ * Copies the next completion out of the ring. Returns false if there is
+ * none.
+ */
+bool uring_next_cqe(uring_t *ring,
+                    uint64_t *user_data,
+                    int32_t *res,
+                    uint32_t *flags);
+
+/*
+ * Registers buffers for IORING_OP_WRITE_FIXED, returns 0 or -errno.
+ */
+int uring_register_buffers(uring_t *ring,
+                           const struct iovec *iovecs,
+                           unsigned int nr);
+
+void uring_exit(uring_t *ring);
+
+#endif
+/* vim: set fileencoding=utf8 : */
@@ -0,0 +1,786 @@
+/*
+ *  Records analog data from a NI USB-6218 and send it to connected clients
+ *
+ *  Copyright (C)2011-2012, Johannes Weiß <weiss@tux4u.de>
+ *                        , Jonathan Dimond <jonny@dimond.de>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#ifndef __MACH__
+#include <sys/eventfd.h>
+#endif
+
+#include "daemon.h"
+#include "sync.h"
+#include "frame.h"
+#include "uring.h"
+#include "uring_sender.h"
+#include "zerocopy.h"
+#include "rt.h"
+
+/* user_data of the eventfd read, the sends carry their client */
+#define URING_EVENT_TAG 0
+/* set in user_data of zerocopy sends, they carry a zc_send_t */
+#define URING_ZC_TAG 1
+
+#if !defined(__MACH__) && defined(IORING_SEND_ZC_REPORT_USAGE)
+#define HAVE_SEND_ZC
+#endif
+
+typedef struct {
+    uint8_t *data;
+    size_t len;
+    int refs;
+    bool registered; /* one of the slots */
+    bool in_use;
+} frame_t;
+
+struct uring_client {
+    int fd;
+    unsigned int num_channels;
+    unsigned int *channels;
+    stats_client_t *stats;
+    uint32_t protocol_version;
+    uint64_t config_generation; /* the DAQ configuration it knows */
+    unsigned int sampling_rate; /* of that configuration */
+
+    frame_t *queue[URING_CLIENT_QUEUE];
+    size_t queue_start;
+    size_t queue_count;
+    size_t sent;     /* bytes of the first frame sent */
+    bool in_flight;  /* a send is submitted */
+    unsigned int notifs; /* zerocopy sends the kernel still reads from */
+    bool dead;
+    bool closing;    /* dead once the queue is sent */
+    bool removed;    /* freed by the last notification */
+    struct uring_client *next;
+};
+
+/* a zerocopy send holds a reference on its frame until the kernel is done */
+typedef struct {
+    uring_client_t *client;
+    frame_t *frame;
+} zc_send_t;
+
+/* a block handed over by the acquisition thread */
+typedef struct {
+    daq_config_t config;
+    uint64_t timestamp_nanos;
+    unsigned int points_per_channel;
+    unsigned int num_channels;
+    double *analog_data;
+    digival_t *digital_data;
+    block_markers_t markers;
+} staged_block_t;
+
+/* frames of one block, one per distinct channel set */
+typedef struct {
+    const uring_client_t *client;
+    frame_t *frame;
+} group_t;
+
+static pthread_mutex_t __uring_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t __uring_cond = PTHREAD_COND_INITIALIZER;
+static bool __active = false;
+static bool __stopping = false;
+static pthread_t __sender_thread;
+static uring_t __ring;
+static int __event_fd = -1;
+static uint64_t __event_value;
+static unsigned int __in_flight = 0;
+static unsigned int __notifs = 0;
+static uring_client_t *__clients = NULL;
+
+/* the blocks waiting to be sent, a ring without lock: only the
+ * acquisition thread advances __blocks_head, only the sender thread
+ * __blocks_tail */
+static staged_block_t __blocks[URING_BLOCK_SLOTS];
+static unsigned int __blocks_head = 0;
+static unsigned int __blocks_tail = 0;
+
+static frame_t __slots[URING_FRAME_SLOTS];
+static uint8_t *__arena;
+static size_t __slot_size;
+static bool __registered = false;
+#ifdef HAVE_SEND_ZC
+static bool __zerocopy = true;
+#else
+static bool __zerocopy = false;
+#endif
+
+/*
+ * FRAMES
+ */
+static frame_t *alloc_frame(size_t size) {
+    frame_t *frame;
+
+    for(int i = 0; size <= __slot_size && i < URING_FRAME_SLOTS; i++) {
+        if(!__slots[i].in_use) {
+            __slots[i].in_use = true;
+            __slots[i].refs = 0;
+            return &__slots[i];
+        }
+    }
+
+    /* all slots busy with slow clients, use ordinary memory */
+    frame = calloc(1, sizeof(*frame));
+    assert(NULL != frame);
+    frame->data = malloc(size);
+    assert(NULL != frame->data);
+    return frame;
+}
+
+/* configuration frames are small and rare, they don't take a slot */
+static frame_t *config_frame(const uring_client_t *client,
+                             const daq_config_t *config) {
+    frame_t *frame = calloc(1, sizeof(*frame));
+    assert(NULL != frame);
+
+    frame->data = malloc(frame_config_max_size(client->num_channels));
+    assert(NULL != frame->data);
+    frame->len = frame_encode_config(frame->data,
+                                     config,
+                                     client->num_channels,
+                                     client->channels,
+                                     "");
+    return frame;
+}
+
+static void unref_frame(frame_t *frame) {
+    assert(frame->refs > 0);
+    if(0 < --frame->refs) {
+        return;
+    }
+    if(frame->in_use) {
+        frame->in_use = false;
+    } else {
+        free(frame->data);
+        free(frame);
+    }
+}
+
+/*
+ * SENDING (__uring_mutex held)
+ */
+static struct io_uring_sqe *get_sqe(void) {
+    struct io_uring_sqe *sqe = uring_get_sqe(&__ring);
+    int err;
+
+    if(NULL == sqe) {
+        /* queue full, hand what we have to the kernel */
+        err = uring_submit(&__ring, 0);
+        assert(0 <= err);
+        sqe = uring_get_sqe(&__ring);
+    }
+    assert(NULL != sqe);
+    return sqe;
+}
+
+static void arm_event_read(void) {
+    struct io_uring_sqe *sqe = get_sqe();
+
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = __event_fd;
+    sqe->addr = (uint64_t)(uintptr_t)&__event_value;
+    sqe->len = sizeof(__event_value);
+    sqe->user_data = URING_EVENT_TAG;
+}
+
+static void submit_send(uring_client_t *client) {
+    frame_t *frame = client->queue[client->queue_start];
+    struct io_uring_sqe *sqe = get_sqe();
+    zc_send_t *zc;
+
+    sqe->fd = client->fd;
+    sqe->addr = (uint64_t)(uintptr_t)(frame->data + client->sent);
+    sqe->len = frame->len - client->sent;
+    sqe->user_data = (uint64_t)(uintptr_t)client;
+    if(__zerocopy && sqe->len >= ZC_MIN_FRAME_SIZE) {
+#ifdef HAVE_SEND_ZC
+        zc = malloc(sizeof(*zc));
+        assert(NULL != zc);
+        zc->client = client;
+        zc->frame = frame;
+        frame->refs++;
+
+        sqe->opcode = IORING_OP_SEND_ZC;
+        sqe->msg_flags = MSG_NOSIGNAL;
+        sqe->ioprio = IORING_SEND_ZC_REPORT_USAGE;
+        if(frame->registered) {
+            sqe->ioprio |= IORING_RECVSEND_FIXED_BUF;
+            sqe->buf_index = 0;
+        }
+        sqe->user_data = (uint64_t)(uintptr_t)zc | URING_ZC_TAG;
+#else
+        (void)zc;
+        assert(false);
+#endif
+    } else if(frame->registered) {
+        sqe->opcode = IORING_OP_WRITE_FIXED;
+        sqe->buf_index = 0;
+        sqe->off = (uint64_t)-1;
+    } else {
+        sqe->opcode = IORING_OP_SEND;
+        sqe->msg_flags = MSG_NOSIGNAL;
+    }
+
+    client->in_flight = true;
+    __in_flight++;
+}
+
+static void drop_queue(uring_client_t *client) {
+    while(client->queue_count > 0) {
+        unref_frame(client->queue[client->queue_start]);
+        client->queue_start = (client->queue_start + 1) % URING_CLIENT_QUEUE;
+        client->queue_count--;
+    }
+    client->sent = 0;
+    STATS_SET(client->stats->queue_depth, 0);
+}
+
+static void kill_client(uring_client_t *client) {
+    client->dead = true;
+    if(client->in_flight) {
+        /* makes the outstanding send complete */
+        shutdown(client->fd, SHUT_RDWR);
+    } else {
+        drop_queue(client);
+    }
+}
+
+/* takes no more frames, the queued ones are still sent */
+static void close_client(uring_client_t *client) {
+    client->closing = true;
+    if(0 == client->queue_count) {
+        client->dead = true;
+    }
+}
+
+static void complete_send(uring_client_t *client, int32_t res) {
+    frame_t *frame = client->queue[client->queue_start];
+
+    client->in_flight = false;
+    __in_flight--;
+
+    if(0 >= res) {
+        client->dead = true;
+    } else if(!client->dead) {
+        STATS_ADD(client->stats->bytes_sent, res);
+        client->sent += res;
+        if(client->sent == frame->len) {
+            STATS_ADD(client->stats->frames_sent, 1);
+            unref_frame(frame);
+            client->queue_start = (client->queue_start + 1) %
+                                  URING_CLIENT_QUEUE;
+            client->queue_count--;
+            client->sent = 0;
+            STATS_SET(client->stats->queue_depth, client->queue_count);
+            if(client->closing && 0 == client->queue_count) {
+                client->dead = true;
+            }
+        }
+    }
+
+    if(client->dead) {
+        drop_queue(client);
+    } else if(client->queue_count > 0) {
+        submit_send(client);
+    }
+}
+
+static void complete_zerocopy(zc_send_t *zc, int32_t res, uint32_t flags) {
+    uring_client_t *client = zc->client;
+
+#ifdef HAVE_SEND_ZC
+    if(flags & IORING_CQE_F_NOTIF) {
+        /* the kernel is done with the frame */
+        if(__zerocopy && (res & IORING_NOTIF_USAGE_ZC_COPIED)) {
+            /* e.g. loopback, pinning the pages only costs extra */
+            __zerocopy = false;
+            if(!client->removed) {
+                STATS_ADD(client->stats->zerocopy_copied, 1);
+            }
+            printf("io_uring: kernel copies zerocopy sends, disabled\n");
+        }
+        client->notifs--;
+        __notifs--;
+        unref_frame(zc->frame);
+        free(zc);
+        if(client->removed && 0 == client->notifs) {
+            free(client->channels);
+            free(client);
+        }
+        return;
+    }
+
+    if(flags & IORING_CQE_F_MORE) {
+        /* a notification follows */
+        client->notifs++;
+        __notifs++;
+    }
+#endif
+
+    if(-EINVAL == res || -EOPNOTSUPP == res) {
+        /* kernel without IORING_OP_SEND_ZC, nothing has been sent */
+        __zerocopy = false;
+        printf("io_uring: zerocopy sends not supported\n");
+        client->in_flight = false;
+        __in_flight--;
+        if(!client->dead) {
+            submit_send(client);
+        } else {
+            drop_queue(client);
+        }
+    } else {
+        if(0 < res) {
+            STATS_ADD(client->stats->zerocopy_frames, 1);
+        }
+        complete_send(client, res);
+    }
+
+    if(!(flags & IORING_CQE_F_MORE)) {
+        unref_frame(zc->frame);
+        free(zc);
+    }
+}
+
+/* clients that still have frames to send */
+static bool have_queued_frames(void) {
+    for(uring_client_t *c = __clients; NULL != c; c = c->next) {
+        if(!c->dead && c->queue_count > 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * Waits until the client's frames are sent or the shutdown deadline passed.
+ */
+static void drain_client(uring_client_t *client) {
+    struct timespec deadline;
+    int err;
+
+    shutdown_deadline(&deadline);
+    while(!client->dead && client->queue_count > 0) {
+        err = pthread_cond_timedwait(&__uring_cond, &__uring_mutex,
+                                     &deadline);
+        assert(0 == err || ETIMEDOUT == err);
+        if(ETIMEDOUT == err) {
+            break;
+        }
+    }
+}
+
+static bool same_channels(const uring_client_t *a, const uring_client_t *b) {
+    return a->num_channels == b->num_channels &&
+           0 == memcmp(a->channels, b->channels,
+                       a->num_channels * sizeof(unsigned int));
+}
+
+static void queue_frame(uring_client_t *client, frame_t *frame) {
+    frame->refs++;
+    client->queue[(client->queue_start + client->queue_count) %
+                  URING_CLIENT_QUEUE] = frame;
+    client->queue_count++;
+    STATS_SET(client->stats->queue_depth, client->queue_count);
+}
+
+static void send_block(const staged_block_t *block) {
+    group_t groups[URING_ENTRIES];
+    unsigned int num_groups = 0;
+    uring_client_t *client;
+    frame_t *frame;
+    uint64_t encode_start;
+    bool reconfigured;
+
+    for(client = __clients; NULL != client; client = client->next) {
+        if(client->dead || client->closing) {
+            continue;
+        }
+        reconfigured = client->config_generation != block->config.generation;
+        if(reconfigured && 1 == client->protocol_version) {
+            /* only knows the rate of the handshake and DataSets */
+            if(block->config.sampling_rate != client->sampling_rate) {
+                printf("io_uring: sampling rate changed, closing protocol "
+                       "version 1 client %d\n", client->fd);
+                close_client(client);
+                continue;
+            }
+            client->config_generation = block->config.generation;
+            reconfigured = false;
+        }
+        if(URING_CLIENT_QUEUE - client->queue_count < 1 + reconfigured) {
+            /* out of buffer space, just like the handler threads */
+            STATS_ADD(client->stats->drops, 1);
+            kill_client(client);
+            continue;
+        }
+
+        frame = NULL;
+        for(unsigned int g = 0; g < num_groups; g++) {
+            if(same_channels(groups[g].client, client)) {
+                frame = groups[g].frame;
+                break;
+            }
+        }
+        if(NULL == frame) {
+            encode_start = stats_now_nanos();
+            frame = alloc_frame(frame_max_size(client->num_channels,
+                                               block->points_per_channel));
+            frame->len = frame_encode(frame->data,
+                                      client->num_channels,
+                                      client->channels,
+                                      block->points_per_channel,
+                                      block->timestamp_nanos,
+                                      block->analog_data,
+                                      block->digital_data,
+                                      &block->markers);
+            STATS_ADD(client->stats->encode_nanos,
+                      stats_now_nanos() - encode_start);
+            if(num_groups < URING_ENTRIES) {
+                groups[num_groups].client = client;
+                groups[num_groups].frame = frame;
+                num_groups++;
+            }
+        }
+
+        if(reconfigured) {
+            /* the client keeps streaming with the new configuration */
+            queue_frame(client, config_frame(client, &block->config));
+            client->config_generation = block->config.generation;
+            client->sampling_rate = block->config.sampling_rate;
+        }
+        queue_frame(client, frame);
+
+        if(!client->in_flight) {
+            submit_send(client);
+        }
+    }
+}
+
+/* encodes the blocks handed over, the frames don't refer to them */
+static void send_blocks(void) {
+    while(__blocks_tail != __atomic_load_n(&__blocks_head,
+                                           __ATOMIC_ACQUIRE)) {
+        send_block(&__blocks[__blocks_tail % URING_BLOCK_SLOTS]);
+        __atomic_store_n(&__blocks_tail, __blocks_tail + 1,
+                         __ATOMIC_RELEASE);
+    }
+}
+
+/*
+ * THREAD
+ */
+static void *uring_thread_main(void *unused) {
+    bool stop_seen = false;
+    uint64_t user_data;
+    int32_t res;
+    uint32_t flags;
+    int err;
+
+    /* started by the acquisition thread */
+    rt_enter(RT_IO);
+
+    err = pthread_mutex_lock(&__uring_mutex);
+    assert(0 == err);
+    arm_event_read();
+
+    while(!stop_seen || __in_flight > 0) {
+        err = pthread_mutex_unlock(&__uring_mutex);
+        assert(0 == err);
+
+        /* submits all queued sends and sleeps until something completes */
+        err = uring_submit(&__ring, 1);
+        assert(0 <= err);
+
+        err = pthread_mutex_lock(&__uring_mutex);
+        assert(0 == err);
+
+        while(uring_next_cqe(&__ring, &user_data, &res, &flags)) {
+            if(user_data & URING_ZC_TAG) {
+                complete_zerocopy((zc_send_t *)(uintptr_t)(user_data &
+                                                           ~URING_ZC_TAG),
+                                  res, flags);
+            } else if(URING_EVENT_TAG != user_data) {
+                complete_send((uring_client_t *)(uintptr_t)user_data, res);
+            } else if(__stopping) {
+                stop_seen = true;
+            } else {
+                send_blocks();
+                arm_event_read();
+            }
+        }
+
+        err = pthread_cond_broadcast(&__uring_cond);
+        assert(0 == err);
+    }
+
+    __active = false;
+    if(0 < __notifs) {
+        /* sockets of stuck receivers still hold on to their frames, the
+         * kernel keeps the pages */
+        printf("io_uring: %u zerocopy send(s) still referenced\n", __notifs);
+    }
+    err = pthread_mutex_unlock(&__uring_mutex);
+    assert(0 == err);
+
+    printf("io_uring sender stopped\n");
+    return NULL;
+}
+
+static void wake_thread(void) {
+    const uint64_t one = 1;
+    ssize_t res;
+
+    res = write(__event_fd, &one, sizeof(one));
+    assert(sizeof(one) == res);
+}
+
+/*
+ * FUNCTIONALITY
+ */
+void uring_sender_init(void) {
+    rt_mutex_init(&__uring_mutex);
+}
+
+bool uring_sender_start(unsigned int num_channels,
+                        unsigned int max_points_per_channel) {
+    struct iovec arena_iov;
+    int err;
+
+#ifndef __MACH__
+    if(0 != uring_init(&__ring, URING_ENTRIES)) {
+        printf("WARNING: io_uring not available (%s), using send "
+               "threads\n", strerror(errno));
+        return false;
+    }
+
+    __event_fd = eventfd(0, EFD_CLOEXEC);
+    assert(0 <= __event_fd);
+#else
+    printf("WARNING: io_uring not available, using send threads\n");
+    return false;
+#endif
+
+    for(int i = 0; i < URING_BLOCK_SLOTS; i++) {
+        __blocks[i].analog_data = malloc(num_channels *
+                                         max_points_per_channel *
+                                         sizeof(double));
+        __blocks[i].digital_data = malloc(num_channels *
+                                          max_points_per_channel *
+                                          sizeof(digival_t));
+        assert(NULL != __blocks[i].analog_data &&
+               NULL != __blocks[i].digital_data);
+    }
+
+    __slot_size = frame_max_size(num_channels, max_points_per_channel);
+    __arena = malloc(URING_FRAME_SLOTS * __slot_size);
+    assert(NULL != __arena);
+    arena_iov.iov_base = __arena;
+    arena_iov.iov_len = URING_FRAME_SLOTS * __slot_size;
+    __registered = 0 == uring_register_buffers(&__ring, &arena_iov, 1);
+
+    for(int i = 0; i < URING_FRAME_SLOTS; i++) {
+        __slots[i].data = __arena + i * __slot_size;
+        __slots[i].registered = __registered;
+    }
+
+    printf("io_uring sender started (%s buffers)\n",
+           __registered ? "registered" : "ordinary");
+
+    __active = true;
+    err = pthread_create(&__sender_thread, NULL, uring_thread_main, NULL);
+    assert(0 == err);
+
+    return true;
+}
+
+bool uring_sender_active(void) {
+    bool ret;
+    int err;
+
+    err = pthread_mutex_lock(&__uring_mutex);
+    assert(0 == err);
+    ret = __active && !__stopping;
+    err = pthread_mutex_unlock(&__uring_mutex);
+    assert(0 == err);
+
+    return ret;
+}
+
+void uring_sender_publish(const daq_config_t *config,
+                          uint64_t timestamp_nanos,
+                          unsigned int points_per_channel,
+                          unsigned int num_channels,
+                          const double *analog_data,
+                          const digival_t *digital_data,
+                          const block_markers_t *markers) {
+    const size_t samples = num_channels * points_per_channel;
+    const unsigned int head = __blocks_head;
+    staged_block_t *block;
+
+    if(URING_BLOCK_SLOTS == head - __atomic_load_n(&__blocks_tail,
+                                                   __ATOMIC_ACQUIRE)) {
+        /* the sender is behind, its clients miss the block */
+        STATS_ADD(stats_uring.dropped_blocks, 1);
+        return;
+    }
+
+    block = &__blocks[head % URING_BLOCK_SLOTS];
+    block->config = *config;
+    block->timestamp_nanos = timestamp_nanos;
+    block->points_per_channel = points_per_channel;
+    block->num_channels = num_channels;
+    memcpy(block->analog_data, analog_data, samples * sizeof(double));
+    memcpy(block->digital_data, digital_data, samples * sizeof(digival_t));
+    block->markers = *markers;
+    __atomic_store_n(&__blocks_head, head + 1, __ATOMIC_RELEASE);
+
+    wake_thread();
+}
+
+void uring_sender_stop(void) {
+    struct timespec deadline;
+    uring_client_t *client;
+    int err;
+
+    err = pthread_mutex_lock(&__uring_mutex);
+    assert(0 == err);
+    __stopping = true;
+
+    /* the clients get until the shutdown deadline to receive their frames */
+    shutdown_deadline(&deadline);
+    while(have_queued_frames()) {
+        err = pthread_cond_timedwait(&__uring_cond, &__uring_mutex,
+                                     &deadline);
+        assert(0 == err || ETIMEDOUT == err);
+        if(ETIMEDOUT == err) {
+            break;
+        }
+    }
+
+    for(client = __clients; NULL != client; client = client->next) {
+        kill_client(client);
+    }
+    err = pthread_mutex_unlock(&__uring_mutex);
+    assert(0 == err);
+
+    wake_thread();
+    err = pthread_join(__sender_thread, NULL);
+    assert(0 == err);
+
+    uring_exit(&__ring);
+    close(__event_fd);
+    __event_fd = -1;
+}
+
+uring_client_t *uring_sender_add(int fd,
+                                 uint32_t protocol_version,
+                                 unsigned int num_channels,
+                                 const unsigned int *channels,
+                                 const daq_config_t *config,
+                                 stats_client_t *stats) {
+    uring_client_t *client = calloc(1, sizeof(*client));
+    int err;
+    assert(NULL != client);
+
+    client->fd = fd;
+    client->num_channels = num_channels;
+    client->channels = malloc(num_channels * sizeof(unsigned int));
+    assert(NULL != client->channels);
+    memcpy(client->channels, channels, num_channels * sizeof(unsigned int));
+    client->stats = stats;
+    client->protocol_version = protocol_version;
+    client->config_generation = config->generation;
+    client->sampling_rate = config->sampling_rate;
+
+    err = pthread_mutex_lock(&__uring_mutex);
+    assert(0 == err);
+    client->dead = __stopping;
+    client->next = __clients;
+    __clients = client;
+    err = pthread_mutex_unlock(&__uring_mutex);
+    assert(0 == err);
+
+    return client;
+}
+
+bool uring_sender_closed(uring_client_t *client) {
+    bool ret;
+    int err;
+
+    err = pthread_mutex_lock(&__uring_mutex);
+    assert(0 == err);
+    ret = client->dead;
+    err = pthread_mutex_unlock(&__uring_mutex);
+    assert(0 == err);
+
+    return ret;
+}
+
+void uring_sender_remove(uring_client_t *client) {
+    uring_client_t **cur;
+    bool free_now;
+    int err;
+
+    err = pthread_mutex_lock(&__uring_mutex);
+    assert(0 == err);
+
+    if(!running) {
+        drain_client(client);
+    }
+    if(!client->dead) {
+        kill_client(client);
+    }
+    while(client->in_flight) {
+        err = pthread_cond_wait(&__uring_cond, &__uring_mutex);
+        assert(0 == err);
+    }
+    drop_queue(client);
+
+    for(cur = &__clients; NULL != *cur; cur = &(*cur)->next) {
+        if(client == *cur) {
+            *cur = client->next;
+            break;
+        }
+    }
+
+    /* a stuck receiver keeps the kernel from releasing zerocopy frames
+     * until the socket is closed, so don't wait for that */
+    client->removed = client->notifs > 0;
+    free_now = !client->removed;
+
+    err = pthread_mutex_unlock(&__uring_mutex);
+    assert(0 == err);
+
+    if(free_now) {
+        free(client->channels);
+        free(client);
+    }
+}
+/* vim: set fileencoding=utf8 : */
@@ -0,0 +1,104 @@
+/*
+ *  Records analog data from a NI USB-6218 and send it to connected clients
+ *
+ *  Copyright (C)2011-2012, Johannes Weiß <weiss@tux4u.de>
+ *                        , Jonathan Dimond <jonny@dimond.de>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef URING_SENDER_H
+#define URING_SENDER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "common.h"
+#include "daq_config.h"
+#include "markers.h"
+#include "stats.h"
+
+/*
+ * Sends the frames of all TCP clients from a single thread using io_uring:
+ * every block is encoded once per distinct channel set and the sends to all
+ * clients are submitted with one system call. Frames live in a buffer
+ * registered with the kernel if possible.
+ */
+
+#define URING_ENTRIES 1024
+#define URING_FRAME_SLOTS 16
+/* frames queued for a client at most, slower clients get dropped */
+#define URING_CLIENT_QUEUE 8
+/* blocks handed over and not encoded yet at most, the acquisition thread
+ * drops the block if all are taken */
+#define URING_BLOCK_SLOTS 4
+
+typedef struct uring_client uring_client_t;
+
+/* Call after rt_init, before any thread uses the sender. */
+void uring_sender_init(void);
+
+/*
+ * Starts the sender thread. Returns false if io_uring is not available, the
+ * handlers keep sending themselves then.
+ */
+bool uring_sender_start(unsigned int num_channels,
+                        unsigned int max_points_per_channel);
+
+bool uring_sender_active(void);
+
+/*
+ * Hands a block read with config and its markers to the sender thread (the
+ * data is copied). Never waits for the sender thread, if it's still behind
+ * with URING_BLOCK_SLOTS blocks the block is dropped and counted.
+ */
+void uring_sender_publish(const daq_config_t *config,
+                          uint64_t timestamp_nanos,
+                          unsigned int points_per_channel,
+                          unsigned int num_channels,
+                          const double *analog_data,
+                          const digival_t *digital_data,
+                          const block_markers_t *markers);
+
+/*
+ * Stops the sender thread once the outstanding sends are finished.
+ */
+void uring_sender_stop(void);
+
+/*
+ * Adds a client whose handshake is done, its frames are sent from now on.
+ * config is the DAQ configuration the handshake told it about. Protocol
+ * version 1 clients don't understand configuration frames, they are closed
+ * once the sampling rate changes.
+ */
+uring_client_t *uring_sender_add(int fd,
+                                 uint32_t protocol_version,
+                                 unsigned int num_channels,
+                                 const unsigned int *channels,
+                                 const daq_config_t *config,
+                                 stats_client_t *stats);
+
+/*
+ * Returns true if sending to the client failed or it was too slow.
+ */
+bool uring_sender_closed(uring_client_t *client);
+
+/*
+ * Removes the client, waits for outstanding sends. Afterwards, its file
+ * descriptor may be closed.
+ */
+void uring_sender_remove(uring_client_t *client);
+
+#endif
+/* vim: set fileencoding=utf8 : */
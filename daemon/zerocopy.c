@@ -0,0 +1,328 @@
+/*
+ *  Records analog data from a NI USB-6218 and send it to connected clients
+ *
+ *  Copyright (C)2011-2012, Johannes Weiß <weiss@tux4u.de>
+ *                        , Jonathan Dimond <jonny@dimond.de>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#include <utils.h>
+
+#include "daemon.h"
+#include "zerocopy.h"
+
+#if !defined(__MACH__) && defined(MSG_ZEROCOPY) && defined(SO_ZEROCOPY)
+#define HAVE_ZEROCOPY
+#include <linux/errqueue.h>
+#endif
+
+/*
+ * A frame stays referenced by every send that hasn't completed yet and is
+ * freed by the last completion.
+ */
+typedef struct zc_frame {
+    uint8_t *data;
+    zc_release_t release;
+    void *opaque;
+    uint32_t first_id;
+    uint32_t num_ids;    /* zerocopy sends of this frame */
+    uint32_t refs;
+    struct zc_frame *next;
+} zc_frame_t;
+
+struct zc_socket {
+    int fd;
+    bool enabled;
+    uint32_t next_id;    /* the kernel counts the zerocopy sends per socket */
+    unsigned int num_pending;
+    zc_frame_t *pending; /* oldest first */
+    zc_frame_t **pending_tail;
+    stats_client_t *stats;
+};
+
+static void unref_frame(zc_frame_t *frame) {
+    assert(frame->refs > 0);
+    if(0 == --frame->refs) {
+        frame->release(frame->opaque);
+        free(frame);
+    }
+}
+
+#ifdef HAVE_ZEROCOPY
+/*
+ * COMPLETIONS
+ */
+static bool id_in_range(uint32_t id, uint32_t lo, uint32_t hi) {
+    /* ids wrap around */
+    return (uint32_t)(id - lo) <= (uint32_t)(hi - lo);
+}
+
+static void complete_range(zc_socket_t *zc, uint32_t lo, uint32_t hi,
+                           bool copied) {
+    zc_frame_t **cur = &zc->pending;
+    zc_frame_t *frame;
+
+    while(NULL != (frame = *cur)) {
+        for(uint32_t i = 0; i < frame->num_ids; i++) {
+            if(id_in_range(frame->first_id + i, lo, hi)) {
+                frame->refs--;
+            }
+        }
+
+        if(1 == frame->refs) {
+            /* only the pending list is left */
+            *cur = frame->next;
+            if(NULL == *cur) {
+                zc->pending_tail = cur;
+            }
+            zc->num_pending--;
+            unref_frame(frame);
+        } else {
+            cur = &frame->next;
+        }
+    }
+
+    if(copied && zc->enabled) {
+        /* e.g. loopback, pinning the pages only costs extra */
+        STATS_ADD(zc->stats->zerocopy_copied, 1);
+        zc->enabled = false;
+        printf("Client fd %d: kernel copies zerocopy sends, disabled\n",
+               zc->fd);
+    }
+}
+
+/*
+ * Reads all completions from the error queue without waiting. Returns the
+ * number of messages read or -1 if the socket failed.
+ */
+static int reap_completions(zc_socket_t *zc) {
+    char control[128];
+    struct msghdr msg;
+    struct cmsghdr *cmsg;
+    struct sock_extended_err *serr;
+    int reaped = 0;
+    int err;
+
+    while(true) {
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+
+        err = recvmsg(zc->fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT);
+        if(0 > err) {
+            if(EAGAIN == errno || EWOULDBLOCK == errno || EINTR == errno) {
+                return reaped;
+            }
+            return -1;
+        }
+        reaped++;
+
+        for(cmsg = CMSG_FIRSTHDR(&msg);
+            NULL != cmsg;
+            cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+            if(!(SOL_IP == cmsg->cmsg_level && IP_RECVERR == cmsg->cmsg_type)
+               && !(SOL_IPV6 == cmsg->cmsg_level &&
+                    IPV6_RECVERR == cmsg->cmsg_type)) {
+                continue;
+            }
+            serr = (struct sock_extended_err *)CMSG_DATA(cmsg);
+            if(SO_EE_ORIGIN_ZEROCOPY != serr->ee_origin ||
+               0 != serr->ee_errno) {
+                continue;
+            }
+            complete_range(zc,
+                           serr->ee_info,
+                           serr->ee_data,
+                           0 != (serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED));
+        }
+    }
+}
+
+/*
+ * Sleeps until completions arrive or timeout_ms passed and reads them.
+ * Returns -1 if the socket failed.
+ */
+static int wait_completions(zc_socket_t *zc, int timeout_ms) {
+    /* POLLERR is reported as soon as the error queue isn't empty */
+    struct pollfd poll_cfg = { .fd = zc->fd, .events = 0 };
+    int err;
+
+    err = poll(&poll_cfg, 1, timeout_ms);
+    if(0 > err) {
+        return EINTR == errno ? 0 : -1;
+    } else if(0 == err) {
+        return 0;
+    }
+
+    /* a pending socket error or a hangup would wake us up right away
+     * again, only completions make waiting worthwhile */
+    return 0 < reap_completions(zc) ? 0 : -1;
+}
+
+/*
+ * SENDING
+ */
+static int send_zerocopy(zc_socket_t *zc, zc_frame_t *frame, size_t len) {
+    size_t sent = 0;
+    ssize_t res;
+    int flags;
+
+    frame->first_id = zc->next_id;
+    while(sent < len) {
+        flags = zc->enabled ? MSG_ZEROCOPY : 0;
+        res = send(zc->fd, frame->data + sent, len - sent,
+                   flags | MSG_NOSIGNAL);
+        if(0 > res && ENOBUFS == errno && 0 != flags) {
+            /* out of locked memory for pinned pages, copy this one */
+            res = send(zc->fd, frame->data + sent, len - sent, MSG_NOSIGNAL);
+            flags = 0;
+        }
+        if(0 > res) {
+            if(EINTR == errno) {
+                continue;
+            }
+            return -1;
+        }
+        if(0 != flags) {
+            /* the kernel now holds on to the frame until it completes */
+            zc->next_id++;
+            frame->num_ids++;
+            frame->refs++;
+        }
+        sent += res;
+    }
+
+    return (int)len;
+}
+#endif
+
+/*
+ * FUNCTIONALITY
+ */
+zc_socket_t *zc_open(int fd, stats_client_t *stats) {
+    zc_socket_t *zc = calloc(1, sizeof(*zc));
+    assert(NULL != zc);
+
+    zc->fd = fd;
+    zc->pending_tail = &zc->pending;
+    zc->stats = stats;
+#ifdef HAVE_ZEROCOPY
+    const int one = 1;
+    zc->enabled = 0 == setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY,
+                                  &one, sizeof(one));
+#endif
+
+    return zc;
+}
+
+bool zc_enabled(const zc_socket_t *zc) {
+    return zc->enabled;
+}
+
+int zc_send(zc_socket_t *zc,
+            uint8_t *data,
+            size_t len,
+            zc_release_t release,
+            void *opaque) {
+    zc_frame_t *frame;
+    int ret;
+
+#ifdef HAVE_ZEROCOPY
+    if(0 > reap_completions(zc)) {
+        release(opaque);
+        return -1;
+    }
+    /* don't pin more than ZC_MAX_PENDING frames */
+    while(running && zc->num_pending >= ZC_MAX_PENDING) {
+        if(0 > wait_completions(zc, 100)) {
+            release(opaque);
+            return -1;
+        }
+    }
+#endif
+
+    if(!zc->enabled) {
+        ret = full_write(zc->fd, (char *)data, len);
+        release(opaque);
+        return ret;
+    }
+
+    frame = calloc(1, sizeof(*frame));
+    assert(NULL != frame);
+    frame->data = data;
+    frame->release = release;
+    frame->opaque = opaque;
+    frame->refs = 1;
+
+#ifdef HAVE_ZEROCOPY
+    ret = send_zerocopy(zc, frame, len);
+#else
+    ret = -1;
+    assert(false);
+#endif
+
+    if(0 == frame->num_ids) {
+        unref_frame(frame);
+    } else {
+        STATS_ADD(zc->stats->zerocopy_frames, 1);
+        *zc->pending_tail = frame;
+        zc->pending_tail = &frame->next;
+        zc->num_pending++;
+    }
+
+    return ret;
+}
+
+void zc_close(zc_socket_t *zc) {
+    zc_frame_t *frame, *next;
+
+#ifdef HAVE_ZEROCOPY
+    const uint64_t deadline = stats_now_nanos() +
+                              (uint64_t)ZC_CLOSE_TIMEOUT_MS * 1000000;
+    uint64_t now;
+
+    while(zc->num_pending > 0 && (now = stats_now_nanos()) < deadline) {
+        if(0 > wait_completions(zc, (deadline - now + 999999) / 1000000)) {
+            break;
+        }
+    }
+#endif
+
+    /* the kernel may still send from the frames left, releasing them would
+     * put whatever reuses the memory on the wire */
+    if(zc->num_pending > 0) {
+        printf("WARNING: Client fd %d: %u zerocopy frame(s) never "
+               "completed, leaking them\n", zc->fd, zc->num_pending);
+    }
+    for(frame = zc->pending; NULL != frame; frame = next) {
+        next = frame->next;
+        free(frame);
+    }
+    free(zc);
+}
+/* vim: set fileencoding=utf8 : */
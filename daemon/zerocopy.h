@@ -0,0 +1,75 @@
+/*
+ *  Records analog data from a NI USB-6218 and send it to connected clients
+ *
+ *  Copyright (C)2011-2012, Johannes Weiß <weiss@tux4u.de>
+ *                        , Jonathan Dimond <jonny@dimond.de>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ZEROCOPY_H
+#define ZEROCOPY_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#include "stats.h"
+
+/*
+ * Sends large frames with MSG_ZEROCOPY: the kernel sends from the frame
+ * itself instead of copying it, so a frame is only freed once the completion
+ * covering its last send arrived on the socket's error queue.
+ */
+
+/* smaller frames are cheaper to copy than to pin */
+#define ZC_MIN_FRAME_SIZE (64 * 1024)
+/* frames waiting for their completion at most */
+#define ZC_MAX_PENDING 8
+/* time zc_close waits for outstanding completions */
+#define ZC_CLOSE_TIMEOUT_MS 1000
+
+typedef struct zc_socket zc_socket_t;
+
+/* gives a frame back once the kernel is done with it, e.g. free */
+typedef void (*zc_release_t)(void *opaque);
+
+/*
+ * Enables SO_ZEROCOPY on fd. Never fails, the frames are copied as usual
+ * if the kernel doesn't support it.
+ */
+zc_socket_t *zc_open(int fd, stats_client_t *stats);
+
+bool zc_enabled(const zc_socket_t *zc);
+
+/*
+ * Sends the whole frame and takes ownership of it: release(opaque) is called
+ * when it isn't needed anymore, which may be before zc_send returns. Returns
+ * len or -1 (errno set).
+ */
+int zc_send(zc_socket_t *zc,
+            uint8_t *frame,
+            size_t len,
+            zc_release_t release,
+            void *opaque);
+
+/*
+ * Waits up to ZC_CLOSE_TIMEOUT_MS for the outstanding completions and frees
+ * everything but the frames still not completed, those are leaked. Call
+ * before closing the socket.
+ */
+void zc_close(zc_socket_t *zc);
+
+#endif
+/* vim: set fileencoding=utf8 : */